@@ -1,4 +1,5 @@
 #include "atcommander.h"
+#include "datamode.h"
 
 #include "WProgram.h"
 #include <stdarg.h>
@@ -7,6 +8,10 @@ extern const AtCommanderPlatform AT_PLATFORM_RN42;
 
 bool configured = false;
 AtCommanderConfig config;
+uint8_t transmit_storage[128];
+
+const char* message = "Sending data over the RN-42 at 115200 baud!\r\n";
+int sent = 0;
 
 void write(void* device, uint8_t byte) {
     ((HardwareSerial*)device)->write(byte);
@@ -41,6 +46,8 @@ void setup() {
     config.read_function = read;
     config.delay_function = delay;
     config.log_function = debug;
+    at_commander_data_init(&config, NULL, 0, transmit_storage,
+            sizeof(transmit_storage));
 }
 
 void loop() {
@@ -52,7 +59,11 @@ void loop() {
             delay(5000);
         }
     } else {
-        Serial1.println("Sending data over the RN-42 at 115200 baud!");
+        sent += at_commander_data_write(&config, (const uint8_t*)&message[sent],
+                strlen(message) - sent);
+        if(sent == (int)strlen(message)) {
+            sent = 0;
+        }
     }
 
 }
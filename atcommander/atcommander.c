@@ -1,22 +1,81 @@
 #include "atcommander.h"
+#include "atcommander_private.h"
 
 #include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
-// TODO hard coded max of 128 - I've never seen one anywhere near this
-// long so we're probably OK.
-#define AT_COMMANDER_MAX_REQUEST_LENGTH 128
 #define AT_COMMANDER_DEFAULT_RESPONSE_DELAY_MS 100
 #define AT_COMMANDER_RETRY_DELAY_MS 50
-#define AT_COMMANDER_MAX_RESPONSE_LENGTH 8
+#define AT_COMMANDER_MAX_RESPONSE_LENGTH 32
+#define AT_COMMANDER_MAX_VERSION_LENGTH 32
+// Bytes of a multi-line response to throw away before the next command
+#define AT_COMMANDER_MAX_DISCARD 256
 #define AT_COMMANDER_MAX_RETRIES 3
+#define AT_COMMANDER_CANCEL_POLL_MS 5
 
-#define at_commander_debug(config, ...) \
-    if(config->log_function != NULL) { \
-        config->log_function(__VA_ARGS__); \
-        config->log_function("\r\n"); \
-    }
+// Sniff mode (SW) adds up to the sniff interval to every transfer, so it's
+// only enabled for the balanced profile. SQ,16 makes the RN-42 send smaller
+// packets sooner, at the cost of throughput.
+static const AtCommand RN42_BALANCED_PROFILE[] = {
+    { "SQ,0\r", "AOK" },
+    { "SW,0050\r", "AOK" },
+    { NULL, NULL },
+};
+
+static const AtCommand RN42_LOW_LATENCY_PROFILE[] = {
+    { "SQ,16\r", "AOK" },
+    { "SW,0000\r", "AOK" },
+    { NULL, NULL },
+};
+
+static const AtCommand RN42_BULK_THROUGHPUT_PROFILE[] = {
+    { "SQ,0\r", "AOK" },
+    { "SW,0000\r", "AOK" },
+    { NULL, NULL },
+};
+
+// RO is the packetization timeout in character times - 0 sends every byte as
+// soon as it arrives, a long one fills packets. D6 enables RTS flow control so
+// the XBee's buffer can't overflow the host when it's filling packets.
+static const AtCommand XBEE_BALANCED_PROFILE[] = {
+    { "ATRO 3\r", "OK" },
+    { "ATD6 0\r", "OK" },
+    { NULL, NULL },
+};
+
+static const AtCommand XBEE_LOW_LATENCY_PROFILE[] = {
+    { "ATRO 0\r", "OK" },
+    { "ATD6 0\r", "OK" },
+    { NULL, NULL },
+};
+
+static const AtCommand XBEE_BULK_THROUGHPUT_PROFILE[] = {
+    { "ATRO 20\r", "OK" },
+    { "ATD6 1\r", "OK" },
+    { NULL, NULL },
+};
+
+static const int RN42_BAUD_RATES[] = {230400, 115200, 9600, 19200, 38400,
+    57600, 460800, 921600};
+
+// The XBee ships at 9600, and can't run any faster than 115200
+static const int XBEE_BAUD_RATES[] = {9600, 115200, 57600, 38400, 19200,
+    4800, 2400, 1200};
+
+// "?" is the RN-42's answer to a command it doesn't recognize
+static const char* const RN42_ERROR_RESPONSES[] = {"ERR", "?", NULL};
+
+static const char* const XBEE_ERROR_RESPONSES[] = {"ERROR", NULL};
+
+// Every XBee firmware has API mode, but early 802.15.4 releases don't reliably
+// take chained commands, so they're only used from 10A0 on (ZigBee and
+// DigiMesh firmware numbers are all higher).
+static const AtCommanderCapabilityRule XBEE_CAPABILITY_RULES[] = {
+    { 0, 0, AT_CAPABILITY_API_MODE },
+    { 0x10A0, 0, AT_CAPABILITY_CHAINED_COMMANDS },
+};
 
 const AtCommanderPlatform AT_PLATFORM_RN42 = {
     AT_COMMANDER_DEFAULT_RESPONSE_DELAY_MS,
@@ -31,20 +90,69 @@ const AtCommanderPlatform AT_PLATFORM_RN42 = {
     { "S-,%s\r", "AOK" },
     { "GN\r", NULL, "ERR" },
     { "GB\r", NULL, "ERR" },
+    { "C,%s\r", "TRYING" },
+    { "K,\r", "KILL" },
+    { "SO,%s\r", "AOK" },
+    "%CONNECT",
+    "%DISCONNECT",
+    5,
+    { RN42_BALANCED_PROFILE, RN42_LOW_LATENCY_PROFILE,
+        RN42_BULK_THROUGHPUT_PROFILE },
+    false,
+    0,
+    RN42_BAUD_RATES,
+    sizeof(RN42_BAUD_RATES) / sizeof(int),
+    RN42_ERROR_RESPONSES,
+    { "V\r", NULL, "ERR" },
+    { NULL, NULL },
+    false,
+    NULL,
+    0,
 };
 
 const AtCommanderPlatform AT_PLATFORM_XBEE = {
     3000,
     xbee_baud_rate_mapper,
     { "+++", "OK" },
-    { NULL, NULL },
+    { "ATCN\r", "OK" },
     { "ATBD %d\r\n", "OK" },
+    { NULL, NULL },
     { "ATWR\r\n", "OK" },
     { NULL, NULL },
     { NULL, NULL },
     { NULL, NULL },
     { NULL, NULL },
     { NULL, NULL },
+    { NULL, NULL },
+    { NULL, NULL },
+    { NULL, NULL },
+    NULL,
+    NULL,
+    5,
+    { XBEE_BALANCED_PROFILE, XBEE_LOW_LATENCY_PROFILE,
+        XBEE_BULK_THROUGHPUT_PROFILE },
+    false,
+    0,
+    XBEE_BAUD_RATES,
+    sizeof(XBEE_BAUD_RATES) / sizeof(int),
+    XBEE_ERROR_RESPONSES,
+    { "ATVR\r", NULL, "ERROR" },
+    { "ATHV\r", NULL, "ERROR" },
+    true,
+    XBEE_CAPABILITY_RULES,
+    sizeof(XBEE_CAPABILITY_RULES) / sizeof(AtCommanderCapabilityRule),
+};
+
+const AtCommanderRetryPolicy AT_RETRY_POLICY_DEFAULT = {
+    3,
+    100,
+    1000,
+    25,
+    true,
+    true,
+    false,
+    0,
+    0,
 };
 
 /** Private: Send an array of bytes to the AT device.
@@ -61,17 +169,163 @@ void at_commander_write(AtCommanderConfig* config, const char* bytes, int size)
 
 /** Private: If a delay function is available, delay the given time, otherwise
  * just continue.
+ *
+ * The delay is cut short at the deadline, and if there's a cancel flag, it's
+ * checked every AT_COMMANDER_CANCEL_POLL_MS.
  */
 void at_commander_delay_ms(AtCommanderConfig* config, unsigned long ms) {
-    if(config->delay_function != NULL) {
-        config->delay_function(ms);
+    unsigned long remaining;
+    if(config->delay_function == NULL || ms == 0
+            || at_commander_interrupted(config) != AT_COMMANDER_RESULT_OK) {
+        return;
+    }
+
+    if(config->has_deadline) {
+        remaining = config->deadline - at_commander_millis(config);
+        if(remaining < ms) {
+            ms = remaining;
+        }
+    }
+
+    at_commander_trace(config, AT_TRACE_WAIT, true, NULL, ms);
+    remaining = ms;
+    while(remaining > 0) {
+        unsigned long slice = remaining;
+        if(config->cancel_flag != NULL
+                && slice > AT_COMMANDER_CANCEL_POLL_MS) {
+            slice = AT_COMMANDER_CANCEL_POLL_MS;
+        }
+        config->delay_function(slice);
+        remaining -= slice;
+        if(config->cancel_flag != NULL && *config->cancel_flag) {
+            break;
+        }
+    }
+    at_commander_trace(config, AT_TRACE_WAIT, false, NULL, ms);
+}
+
+void at_commander_set_budget(AtCommanderConfig* config,
+        unsigned long budget_ms) {
+    config->has_deadline = budget_ms > 0;
+    config->deadline = at_commander_millis(config) + budget_ms;
+}
+
+AtCommanderResult at_commander_interrupted(AtCommanderConfig* config) {
+    if(config->cancel_flag != NULL && *config->cancel_flag) {
+        return AT_COMMANDER_RESULT_CANCELLED;
+    }
+
+    if(config->has_deadline && (long)(at_commander_millis(config)
+                - config->deadline) >= 0) {
+        return AT_COMMANDER_RESULT_BUDGET_EXHAUSTED;
+    }
+    return AT_COMMANDER_RESULT_OK;
+}
+
+/** Private: Return the current time in milliseconds from the host clock, or 0
+ * if no millis function is available.
+ */
+unsigned long at_commander_millis(AtCommanderConfig* config) {
+    if(config->millis_function != NULL) {
+        return config->millis_function();
+    }
+    return 0;
+}
+
+/** Private: If a trace function is available, report the beginning or end of
+ * a span of work to it.
+ */
+void at_commander_trace(AtCommanderConfig* config, AtCommanderTraceSpan span,
+        bool begin, const char* detail, int value) {
+    if(config->trace_function != NULL) {
+        config->trace_function(config->device, span, begin, detail, value);
+    }
+}
+
+static int read_retries(AtCommanderConfig* config) {
+    if(config->retry_policy != NULL && config->retry_policy->read_retries > 0) {
+        return config->retry_policy->read_retries;
+    }
+    return AT_COMMANDER_MAX_RETRIES;
+}
+
+static int read_retry_delay_ms(AtCommanderConfig* config) {
+    if(config->retry_policy != NULL
+            && config->retry_policy->read_retry_delay_ms > 0) {
+        return config->retry_policy->read_retry_delay_ms;
+    }
+    return AT_COMMANDER_RETRY_DELAY_MS;
+}
+
+/** Private: Return the next pseudo-random number for backoff jitter - it only
+ * needs to differ between devices, so a xorshift seeded from the clock and the
+ * config's address does.
+ */
+static uint32_t next_jitter(AtCommanderConfig* config) {
+    uint32_t state = config->retry_jitter_state;
+    if(state == 0) {
+        state = (uint32_t)at_commander_millis(config)
+                ^ (uint32_t)(uintptr_t)config ^ 0x9e3779b9;
+        if(state == 0) {
+            state = 1;
+        }
+    }
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    config->retry_jitter_state = state;
+    return state;
+}
+
+static bool should_retry_result(const AtCommanderRetryPolicy* policy,
+        AtCommanderResult result) {
+    switch(result) {
+        case AT_COMMANDER_RESULT_TIMEOUT:
+            return policy->retry_timeout;
+        case AT_COMMANDER_RESULT_GARBLED:
+            return policy->retry_garbled;
+        case AT_COMMANDER_RESULT_ERROR:
+            return policy->retry_error;
+        default:
+            return false;
+    }
+}
+
+bool at_commander_retry(AtCommanderConfig* config, AtCommanderResult result,
+        int attempts) {
+    const AtCommanderRetryPolicy* policy = config->retry_policy;
+    unsigned long backoff;
+    int i;
+    if(policy == NULL || attempts >= policy->max_attempts
+            || !should_retry_result(policy, result)
+            || at_commander_interrupted(config) != AT_COMMANDER_RESULT_OK) {
+        return false;
+    }
+
+    backoff = policy->initial_backoff_ms;
+    for(i = 1; i < attempts && backoff < (unsigned long)policy->max_backoff_ms;
+            i++) {
+        backoff *= 2;
+    }
+    if(backoff > (unsigned long)policy->max_backoff_ms) {
+        backoff = policy->max_backoff_ms;
     }
+    if(policy->jitter_percent > 0) {
+        backoff += next_jitter(config)
+                % (backoff * policy->jitter_percent / 100 + 1);
+    }
+
+    at_commander_debug(config, "Retrying after %lu ms (attempt %d of %d)",
+            backoff, attempts + 1, policy->max_attempts);
+    at_commander_delay_ms(config, backoff);
+    return at_commander_interrupted(config) == AT_COMMANDER_RESULT_OK;
 }
 
 /** Private: Read multiple bytes from Serial into the buffer.
  *
  * Continues to try and read each byte from Serial until a maximum number of
- * retries.
+ * retries - or in bounded mode, until AT_COMMANDER_BOUNDED_RESPONSE_BYTES
+ * have been taken, as line endings don't fill the buffer.
  *
  * Returns the number of bytes actually read - may be less than size.
  */
@@ -79,11 +333,21 @@ int at_commander_read(AtCommanderConfig* config, char* buffer, int size,
         int max_retries) {
     int bytes_read = 0;
     int retries = 0;
+    int taken = 0;
     bool sawCarraigeReturn = false;
-    while(bytes_read < size && (max_retries == 0 || retries < max_retries)) {
+    while(bytes_read < size && (max_retries == 0 || retries < max_retries)
+            && (!config->bounded
+                || taken < AT_COMMANDER_BOUNDED_RESPONSE_BYTES)) {
         int byte = config->read_function(config->device);
+        if(byte != -1) {
+            taken++;
+        }
+
         if(byte == -1) {
-            at_commander_delay_ms(config, AT_COMMANDER_RETRY_DELAY_MS);
+            if(at_commander_interrupted(config) != AT_COMMANDER_RESULT_OK) {
+                break;
+            }
+            at_commander_delay_ms(config, read_retry_delay_ms(config));
             retries++;
         } else if(byte != '\r' && byte != '\n') {
             buffer[bytes_read++] = byte;
@@ -130,51 +394,121 @@ bool check_response(AtCommanderConfig* config, const char* response,
 }
 
 /** Private: Send an AT "get" query, read a response, and verify it doesn't match
- * any known errors.
+ * any known errors, retrying as the config's retry policy allows.
  *
- * Returns true if the response isn't a known error state.
+ * Returns the length of the response, or -1 if it was a known error state.
  */
 int get_request(AtCommanderConfig* config, AtCommand* command,
         char* response_buffer, int response_buffer_length) {
-    at_commander_write(config, command->request_format,
-            strlen(command->request_format));
-    at_commander_delay_ms(config, config->platform.response_delay_ms);
+    AtCommanderResult result;
+    int bytes_read;
+    int attempts = 0;
+    do {
+        attempts++;
+        if(config->platform.final_result_codes) {
+            result = final_result_request(config, command->request_format,
+                    NULL, response_buffer, response_buffer_length, 0);
+            bytes_read = result == AT_COMMANDER_RESULT_OK ?
+                    (int)strlen(response_buffer) : -1;
+        } else {
+            at_commander_trace(config, AT_TRACE_COMMAND, true,
+                    command->request_format, 0);
+            at_commander_write(config, command->request_format,
+                    strlen(command->request_format));
+            at_commander_delay_ms(config, config->platform.response_delay_ms);
 
-    int bytes_read = at_commander_read(config, response_buffer,
-            response_buffer_length - 1, AT_COMMANDER_MAX_RETRIES);
-    response_buffer[bytes_read] = '\0';
+            bytes_read = at_commander_read(config, response_buffer,
+                    response_buffer_length - 1, read_retries(config));
+            response_buffer[bytes_read] = '\0';
+            at_commander_trace(config, AT_TRACE_COMMAND, false,
+                    command->request_format, 0);
 
-    if(strncmp(response_buffer, command->error_response, strlen(command->error_response))) {
-        return bytes_read;
+            if(command->error_response != NULL
+                    && !strncmp(response_buffer, command->error_response,
+                        strlen(command->error_response))) {
+                result = AT_COMMANDER_RESULT_ERROR;
+                bytes_read = -1;
+            } else {
+                result = bytes_read > 0 ? AT_COMMANDER_RESULT_OK :
+                        AT_COMMANDER_RESULT_TIMEOUT;
+            }
+        }
+    } while(result != AT_COMMANDER_RESULT_OK
+            && at_commander_retry(config, result, attempts));
+    return bytes_read;
+}
+
+/** Private: Returns true if the response starts with one of the platform's
+ * error responses.
+ */
+static bool is_error_response(AtCommanderConfig* config, const char* response,
+        int response_length) {
+    const char* const* errors = config->platform.error_responses;
+    int i;
+    for(i = 0; errors != NULL && errors[i] != NULL; i++) {
+        int length = strlen(errors[i]);
+        if(response_length >= length && !strncmp(response, errors[i], length)) {
+            return true;
+        }
     }
-    return -1;
+    return false;
 }
 
+AtCommanderResult command_request(AtCommanderConfig* config,
+        const char* command, const char* expected_response) {
+    if(config->platform.final_result_codes) {
+        return final_result_request(config, command, expected_response, NULL,
+                0, 0);
+    }
 
-/** Private: Send an AT command, read a response, and verify it matches the
- * expected value.
- *
- * Returns true if the response matches the expected.
- */
-bool set_request(AtCommanderConfig* config, const char* command, const char* expected_response) {
+    at_commander_trace(config, AT_TRACE_COMMAND, true, command, 0);
     at_commander_write(config, command, strlen(command));
     at_commander_delay_ms(config, config->platform.response_delay_ms);
 
     char response[AT_COMMANDER_MAX_RESPONSE_LENGTH];
     int bytes_read = at_commander_read(config, response, strlen(expected_response),
-            AT_COMMANDER_MAX_RETRIES);
+            read_retries(config));
+    at_commander_trace(config, AT_TRACE_COMMAND, false, command, 0);
+
+    if(check_response(config, response, bytes_read, expected_response,
+            strlen(expected_response))) {
+        return AT_COMMANDER_RESULT_OK;
+    }
 
-    return check_response(config, response, bytes_read, expected_response,
-            strlen(expected_response));
+    if(bytes_read == 0) {
+        return AT_COMMANDER_RESULT_TIMEOUT;
+    }
+    return is_error_response(config, response, bytes_read) ?
+            AT_COMMANDER_RESULT_ERROR : AT_COMMANDER_RESULT_GARBLED;
+}
+
+/** Private: Send an AT command, read a response, and verify it matches the
+ * expected value, retrying as the config's retry policy allows.
+ *
+ * Returns true if the response matches the expected.
+ */
+bool set_request(AtCommanderConfig* config, const char* command, const char* expected_response) {
+    AtCommanderResult result;
+    int attempts = 0;
+    do {
+        result = command_request(config, command, expected_response);
+        attempts++;
+    } while(result != AT_COMMANDER_RESULT_OK
+            && at_commander_retry(config, result, attempts));
+    return result == AT_COMMANDER_RESULT_OK;
 }
 
 bool at_commander_store_settings(AtCommanderConfig* config) {
     if(config->platform.store_settings_command.request_format != NULL
             && config->platform.store_settings_command.expected_response
                 != NULL) {
-        if(set_request(config,
+        bool stored;
+        at_commander_trace(config, AT_TRACE_STORE, true, NULL, 0);
+        stored = set_request(config,
                 config->platform.store_settings_command.request_format,
-                config->platform.store_settings_command.expected_response)) {
+                config->platform.store_settings_command.expected_response);
+        at_commander_trace(config, AT_TRACE_STORE, false, NULL, 0);
+        if(stored) {
             at_commander_debug(config, "Stored settings into flash memory");
             return true;
         }
@@ -185,7 +519,102 @@ bool at_commander_store_settings(AtCommanderConfig* config) {
     return false;
 }
 
+/** Private: Join commands and the store command into one chained request,
+ * e.g. "ATRO 3,D6 0,WR\r", and their expected responses into the one expected
+ * back - line endings aren't compared, so "OK\rOK\rOK\r" matches "OKOKOK".
+ *
+ * Returns false if the device can't chain commands or they don't fit in one
+ * request, in which case they need to be sent one by one.
+ */
+static bool chain_commands(AtCommanderConfig* config,
+        const AtCommand* commands, int count, char* request,
+        char* expected) {
+    const AtCommand* store = &config->platform.store_settings_command;
+    int request_length = 2;
+    int expected_length = 0;
+    int i;
+    if(!at_commander_has_capability(config, AT_CAPABILITY_CHAINED_COMMANDS)
+            || store->request_format == NULL) {
+        return false;
+    }
+
+    strcpy(request, "AT");
+    for(i = 0; i <= count; i++) {
+        const AtCommand* command = i < count ? &commands[i] : store;
+        const char* body = command->request_format;
+        int length, response_length;
+        if(strncmp(body, "AT", 2) || command->expected_response == NULL) {
+            return false;
+        }
+        body += 2;
+        length = strcspn(body, "\r\n");
+        response_length = strlen(command->expected_response);
+        if(request_length + length + 2 >= AT_COMMANDER_MAX_REQUEST_LENGTH
+                || expected_length + response_length
+                    >= AT_COMMANDER_MAX_RESPONSE_LENGTH) {
+            return false;
+        }
+
+        if(i > 0) {
+            request[request_length++] = ',';
+        }
+        memcpy(&request[request_length], body, length);
+        request_length += length;
+        memcpy(&expected[expected_length], command->expected_response,
+                response_length);
+        expected_length += response_length;
+    }
+    request[request_length++] = '\r';
+    request[request_length] = '\0';
+    expected[expected_length] = '\0';
+    return true;
+}
+
+/** Private: Send commands and store them, in one request if the device can
+ * chain them, otherwise one by one.
+ *
+ * Returns true if every command succeeded and, on platforms with a store
+ * command, the settings were stored.
+ */
+static bool set_and_store(AtCommanderConfig* config,
+        const AtCommand* commands, int count) {
+    char request[AT_COMMANDER_MAX_REQUEST_LENGTH];
+    char expected[AT_COMMANDER_MAX_RESPONSE_LENGTH];
+    int i;
+
+    if(chain_commands(config, commands, count, request, expected)) {
+        bool stored;
+        at_commander_trace(config, AT_TRACE_STORE, true, NULL, 0);
+        stored = set_request(config, request, expected);
+        at_commander_trace(config, AT_TRACE_STORE, false, NULL, 0);
+        if(!stored) {
+            at_commander_debug(config, "Chained settings failed, not stored");
+        }
+        return stored;
+    }
+
+    for(i = 0; i < count; i++) {
+        if(!set_request(config, commands[i].request_format,
+                    commands[i].expected_response)) {
+            at_commander_debug(config, "Setting %d of %d failed, not storing",
+                    i + 1, count);
+            return false;
+        }
+    }
+
+    // Some platforms store every setting as it's made, e.g. the RN-42
+    if(config->platform.store_settings_command.request_format == NULL) {
+        return true;
+    }
+    return at_commander_store_settings(config);
+}
+
 bool at_commander_set(AtCommanderConfig* config, AtCommand* command, ...) {
+    if(command->request_format == NULL) {
+        at_commander_debug(config, "Platform has no command for this setting");
+        return false;
+    }
+
     if(at_commander_enter_command_mode(config)) {
         va_list args;
         va_start(args, command);
@@ -195,12 +624,8 @@ bool at_commander_set(AtCommanderConfig* config, AtCommand* command, ...) {
 
         va_end(args);
 
-        if(set_request(config, request, command->expected_response)) {
-            at_commander_store_settings(config);
-            return true;
-        } else {
-            return false;
-        }
+        AtCommand formatted = { request, command->expected_response, NULL };
+        return set_and_store(config, &formatted, 1);
     } else {
         at_commander_debug(config,
                 "Unable to enter command mode, can't make set request");
@@ -208,6 +633,38 @@ bool at_commander_set(AtCommanderConfig* config, AtCommand* command, ...) {
     }
 }
 
+bool at_commander_apply_settings(AtCommanderConfig* config,
+        const AtCommand* commands, int count) {
+    if(!at_commander_enter_command_mode(config)) {
+        at_commander_debug(config,
+                "Unable to enter command mode, can't apply settings");
+        return false;
+    }
+    return set_and_store(config, commands, count);
+}
+
+bool at_commander_set_link_profile(AtCommanderConfig* config,
+        AtCommanderLinkProfile profile) {
+    const AtCommand* commands;
+    int count = 0;
+    if(profile < 0 || profile >= AT_LINK_PROFILE_COUNT
+            || config->platform.link_profiles[profile] == NULL) {
+        at_commander_debug(config, "Link profile %d not supported", profile);
+        return false;
+    }
+
+    commands = config->platform.link_profiles[profile];
+    while(commands[count].request_format != NULL) {
+        count++;
+    }
+
+    if(at_commander_apply_settings(config, commands, count)) {
+        at_commander_debug(config, "Applied link profile %d", profile);
+        return true;
+    }
+    return false;
+}
+
 int at_commander_get(AtCommanderConfig* config, AtCommand* command,
         char* response_buffer, int response_buffer_length) {
     if(response_buffer == NULL || response_buffer_length <= 0) {
@@ -215,6 +672,11 @@ int at_commander_get(AtCommanderConfig* config, AtCommand* command,
         return -1;
     }
 
+    if(command->request_format == NULL) {
+        at_commander_debug(config, "Platform has no command for this query");
+        return -1;
+    }
+
     int bytes_read = -1;
     if(at_commander_enter_command_mode(config)) {
         bytes_read = get_request(config, command, response_buffer,
@@ -226,6 +688,88 @@ int at_commander_get(AtCommanderConfig* config, AtCommand* command,
     return bytes_read;
 }
 
+/** Private: Read the version number at the start of a response, skipping
+ * any text before it, e.g. "Ver 6.15 04/26/2013" is 615 and "10EF" is 0x10EF.
+ */
+static unsigned long parse_version(const char* response, bool hex) {
+    const char* digits = hex ? "0123456789ABCDEFabcdef" : "0123456789";
+    unsigned long version;
+    char* end;
+
+    response += strcspn(response, digits);
+    version = strtoul(response, &end, hex ? 16 : 10);
+    if(!hex && *end == '.') {
+        version = version * 100 + strtoul(end + 1, NULL, 10);
+    }
+    return version;
+}
+
+/** Private: Throw away the rest of a multi-line response.
+ */
+static void discard_input(AtCommanderConfig* config) {
+    int i;
+    for(i = 0; i < AT_COMMANDER_MAX_DISCARD
+            && config->read_function(config->device) != -1; i++) {
+        continue;
+    }
+}
+
+bool at_commander_probe_capabilities(AtCommanderConfig* config) {
+    AtCommanderPlatform* platform = &config->platform;
+    char response[AT_COMMANDER_MAX_VERSION_LENGTH];
+    unsigned int capabilities = 0;
+    int i;
+
+    if(config->capabilities_probed) {
+        return true;
+    }
+    if(platform->get_firmware_version_command.request_format == NULL) {
+        at_commander_debug(config, "Platform can't report its version");
+        return false;
+    }
+
+    if(at_commander_get(config, &platform->get_firmware_version_command,
+                response, sizeof(response)) <= 0) {
+        at_commander_debug(config, "Unable to read firmware version");
+        return false;
+    }
+    config->firmware_version = parse_version(response,
+            platform->hex_versions);
+    discard_input(config);
+
+    config->hardware_version = 0;
+    if(platform->get_hardware_version_command.request_format != NULL) {
+        if(get_request(config, &platform->get_hardware_version_command,
+                    response, sizeof(response)) <= 0) {
+            at_commander_debug(config, "Unable to read hardware version");
+            return false;
+        }
+        config->hardware_version = parse_version(response,
+                platform->hex_versions);
+        discard_input(config);
+    }
+
+    for(i = 0; i < platform->capability_rule_count; i++) {
+        const AtCommanderCapabilityRule* rule = &platform->capability_rules[i];
+        if(config->firmware_version >= rule->min_firmware_version
+                && config->hardware_version >= rule->min_hardware_version) {
+            capabilities |= rule->capabilities;
+        }
+    }
+    config->capabilities = capabilities;
+    config->capabilities_probed = true;
+    at_commander_debug(config, "Firmware version %lx, hardware version %lx, "
+            "capabilities 0x%x", config->firmware_version,
+            config->hardware_version, capabilities);
+    return true;
+}
+
+bool at_commander_has_capability(AtCommanderConfig* config,
+        AtCommanderCapability capability) {
+    return config->capabilities_probed
+            && (config->capabilities & capability) != 0;
+}
+
 /** Private: Change the baud rate of the UART interface and update the config
  * accordingly.
  *
@@ -244,18 +788,212 @@ bool initialize_baud(AtCommanderConfig* config, int baud) {
     return false;
 }
 
+static bool baud_in_list(const int* rates, int count, int baud) {
+    int i;
+    for(i = 0; i < count; i++) {
+        if(rates[i] == baud) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/** Private: Returns true if the host declared support for the baud rate, or
+ * didn't declare its supported rates at all.
+ */
+static bool host_supports_baud(AtCommanderConfig* config, int baud) {
+    return config->supported_baud_rates == NULL
+            || baud_in_list(config->supported_baud_rates,
+                    config->supported_baud_rate_count, baud);
+}
+
+int at_commander_candidate_baud_rates(AtCommanderConfig* config, int* rates,
+        int max_rates) {
+    int count = 0;
+    int i;
+    for(i = 0; i < config->platform.baud_rate_count; i++) {
+        int baud = config->platform.baud_rates[i];
+        if(host_supports_baud(config, baud)) {
+            if(rates != NULL && count < max_rates) {
+                rates[count] = baud;
+            }
+            count++;
+        }
+    }
+    return count;
+}
+
+/** Private: The time to transfer bytes at a baud rate, rounded up - with a
+ * start and stop bit, each byte is 10 bits.
+ */
+static unsigned long transfer_ms(int bytes, int baud) {
+    if(baud <= 0) {
+        return 0;
+    }
+    return ((unsigned long)bytes * 10 * 1000 + baud - 1) / baud;
+}
+
+/** Private: The slowest baud rate the device may be talking at - the current
+ * one once in command mode, otherwise any of the candidates.
+ */
+static int slowest_baud(AtCommanderConfig* config) {
+    int slowest = 0;
+    int i;
+    if(config->connected) {
+        return config->baud;
+    }
+
+    for(i = 0; i < config->platform.baud_rate_count; i++) {
+        int baud = config->platform.baud_rates[i];
+        if(host_supports_baud(config, baud) && (slowest == 0
+                    || baud < slowest)) {
+            slowest = baud;
+        }
+    }
+    return slowest;
+}
+
+/** Private: The longest one attempt at a request can take in bounded mode -
+ * the longest request, a full response and every wait for it.
+ */
+static unsigned long request_wcet_ms(AtCommanderConfig* config, int baud) {
+    unsigned long wcet = transfer_ms(AT_COMMANDER_MAX_REQUEST_LENGTH
+            + AT_COMMANDER_BOUNDED_RESPONSE_BYTES, baud);
+    if(config->platform.final_result_codes) {
+        return wcet + final_result_wait_wcet_ms(config, 0);
+    }
+    return wcet + config->platform.response_delay_ms
+            + (unsigned long)read_retries(config) * read_retry_delay_ms(config);
+}
+
+/** Private: The longest a request can take with every attempt and backoff
+ * the retry policy allows, jitter included.
+ */
+static unsigned long retried_wcet_ms(AtCommanderConfig* config, int baud) {
+    const AtCommanderRetryPolicy* policy = config->retry_policy;
+    unsigned long request = request_wcet_ms(config, baud);
+    unsigned long wcet = request;
+    unsigned long backoff;
+    int attempts;
+    if(policy == NULL) {
+        return wcet;
+    }
+
+    backoff = policy->initial_backoff_ms;
+    for(attempts = 1; attempts < policy->max_attempts; attempts++) {
+        unsigned long delay = backoff < (unsigned long)policy->max_backoff_ms ?
+                backoff : (unsigned long)policy->max_backoff_ms;
+        wcet += delay + delay * policy->jitter_percent / 100 + request;
+        if(backoff < (unsigned long)policy->max_backoff_ms) {
+            backoff *= 2;
+        }
+    }
+    return wcet;
+}
+
+static unsigned long enter_command_mode_wcet_ms(AtCommanderConfig* config) {
+    unsigned long wcet;
+    int i;
+    if(config->connected) {
+        return 0;
+    }
+
+    // Stashing whatever data had already arrived, then one attempt per rate
+    wcet = transfer_ms(config->data_rx_queue.size, slowest_baud(config));
+    for(i = 0; i < config->platform.baud_rate_count; i++) {
+        int baud = config->platform.baud_rates[i];
+        if(host_supports_baud(config, baud)) {
+            wcet += request_wcet_ms(config, baud);
+        }
+    }
+    return wcet;
+}
+
+unsigned long at_commander_wcet_ms(AtCommanderConfig* config,
+        AtCommanderOperation operation, int count) {
+    const AtCommanderPlatform* platform = &config->platform;
+    int baud = slowest_baud(config);
+    unsigned long wcet;
+    int requests;
+
+    switch(operation) {
+        case AT_OPERATION_ENTER_COMMAND_MODE:
+            return enter_command_mode_wcet_ms(config);
+        case AT_OPERATION_EXIT_COMMAND_MODE:
+            if(platform->exit_command_mode_command.request_format == NULL) {
+                return 0;
+            }
+            // Then flushing the data queued while in command mode
+            return request_wcet_ms(config, baud)
+                    + transfer_ms(config->data_tx_queue.size, baud);
+        case AT_OPERATION_SET:
+            // One by one is always slower than chained
+            requests = count;
+            if(platform->store_settings_command.request_format != NULL) {
+                requests++;
+            }
+            return enter_command_mode_wcet_ms(config)
+                    + requests * retried_wcet_ms(config, baud);
+        case AT_OPERATION_GET:
+            return enter_command_mode_wcet_ms(config)
+                    + retried_wcet_ms(config, baud);
+        case AT_OPERATION_REBOOT:
+            if(platform->reboot_command.request_format == NULL) {
+                return 0;
+            }
+            return enter_command_mode_wcet_ms(config)
+                    + request_wcet_ms(config, baud);
+        case AT_OPERATION_PROBE_CAPABILITIES:
+            if(platform->get_firmware_version_command.request_format == NULL) {
+                return 0;
+            }
+            wcet = enter_command_mode_wcet_ms(config)
+                    + retried_wcet_ms(config, baud)
+                    + transfer_ms(AT_COMMANDER_MAX_DISCARD, baud);
+            if(platform->get_hardware_version_command.request_format
+                    != NULL) {
+                wcet += retried_wcet_ms(config, baud)
+                        + transfer_ms(AT_COMMANDER_MAX_DISCARD, baud);
+            }
+            return wcet;
+        case AT_OPERATION_COMMAND:
+            if(!platform->final_result_codes) {
+                return 0;
+            }
+            return enter_command_mode_wcet_ms(config)
+                    + retried_wcet_ms(config, baud);
+    }
+    return 0;
+}
+
 bool at_commander_enter_command_mode(AtCommanderConfig* config) {
     int baud_index;
     if(!config->connected) {
-        for(baud_index = 0; baud_index < sizeof(VALID_BAUD_RATES) /
-                sizeof(int); baud_index++) {
-            initialize_baud(config, VALID_BAUD_RATES[baud_index]);
+        config->exit_state = AT_EXIT_IDLE;
+        at_commander_data_stash(config);
+        for(baud_index = 0; baud_index < config->platform.baud_rate_count;
+                baud_index++) {
+            int baud = config->platform.baud_rates[baud_index];
+            if(at_commander_interrupted(config) != AT_COMMANDER_RESULT_OK) {
+                at_commander_debug(config, "Stopped looking for baud rate");
+                break;
+            }
+
+            if(!host_supports_baud(config, baud)) {
+                continue;
+            }
+
+            at_commander_trace(config, AT_TRACE_BAUD_SWEEP, true, NULL, baud);
+            initialize_baud(config, baud);
             at_commander_debug(config, "Attempting to enter command mode");
 
-            if(set_request(config,
+            // A timeout is expected at the wrong baud rate, so don't retry
+            config->connected = command_request(config,
                     config->platform.enter_command_mode_command.request_format,
-                    config->platform.enter_command_mode_command.expected_response)) {
-                config->connected = true;
+                    config->platform.enter_command_mode_command.expected_response)
+                    == AT_COMMANDER_RESULT_OK;
+            at_commander_trace(config, AT_TRACE_BAUD_SWEEP, false, NULL, baud);
+            if(config->connected) {
                 break;
             }
         }
@@ -273,11 +1011,18 @@ bool at_commander_enter_command_mode(AtCommanderConfig* config) {
 
 bool at_commander_exit_command_mode(AtCommanderConfig* config) {
     if(config->connected) {
-        if(set_request(config,
+        if(config->platform.exit_command_mode_command.request_format == NULL) {
+            at_commander_debug(config, "Platform has no exit command");
+            return false;
+        }
+
+        if(command_request(config,
                 config->platform.exit_command_mode_command.request_format,
-                config->platform.exit_command_mode_command.expected_response)) {
+                config->platform.exit_command_mode_command.expected_response)
+                == AT_COMMANDER_RESULT_OK) {
             at_commander_debug(config, "Switched back to data mode");
             config->connected = false;
+            at_commander_data_flush(config);
             return true;
         } else {
             at_commander_debug(config, "Unable to exit command mode");
@@ -290,16 +1035,26 @@ bool at_commander_exit_command_mode(AtCommanderConfig* config) {
 }
 
 bool at_commander_reboot(AtCommanderConfig* config) {
+    if(config->platform.reboot_command.request_format == NULL) {
+        at_commander_debug(config, "Platform has no reboot command");
+        return false;
+    }
+
     if(at_commander_enter_command_mode(config)) {
-        if(set_request(config,
+        bool rebooted;
+        at_commander_trace(config, AT_TRACE_REBOOT, true, NULL, 0);
+        rebooted = command_request(config,
                 config->platform.reboot_command.request_format,
-                config->platform.reboot_command.expected_response)) {
+                config->platform.reboot_command.expected_response)
+                == AT_COMMANDER_RESULT_OK;
+        at_commander_trace(config, AT_TRACE_REBOOT, false, NULL, 0);
+        if(rebooted) {
             at_commander_debug(config, "Rebooted");
             config->connected = false;
         } else {
             at_commander_debug(config, "Unable to reboot");
         }
-        return true;
+        return rebooted;
     } else {
         at_commander_debug(config, "Unable to enter command mode, can't reboot");
         return false;
@@ -308,17 +1063,27 @@ bool at_commander_reboot(AtCommanderConfig* config) {
 
 bool at_commander_set_configuration_timer(AtCommanderConfig* config,
         int timeout_s) {
+    if(config->platform.set_configuration_timer_command.request_format
+            == NULL) {
+        at_commander_debug(config, "Platform has no configuration timer");
+        return false;
+    }
+
     if(at_commander_enter_command_mode(config)) {
-        char command[6];
-        sprintf(command,
+        char command[AT_COMMANDER_MAX_REQUEST_LENGTH];
+        snprintf(command, sizeof(command),
                 config->platform.set_configuration_timer_command.request_format,
                 timeout_s);
         if(set_request(config, command,
                 config->platform.set_configuration_timer_command.expected_response)) {
             at_commander_debug(config, "Changed configuration timer to %d",
                     timeout_s);
-            at_commander_store_settings(config);
-            return true;
+            // Some platforms store every setting as it's made, e.g. the RN-42
+            if(config->platform.store_settings_command.request_format
+                    == NULL) {
+                return true;
+            }
+            return at_commander_store_settings(config);
         } else {
             at_commander_debug(config, "Unable to change configuration timer");
             return false;
@@ -332,8 +1097,22 @@ bool at_commander_set_configuration_timer(AtCommanderConfig* config,
 
 bool at_commander_set_baud(AtCommanderConfig* config, int baud) {
     int (*baud_rate_mapper)(int) = config->platform.baud_rate_mapper;
+    int value = baud_rate_mapper(baud);
+    if(value == -1 || !baud_in_list(config->platform.baud_rates,
+                config->platform.baud_rate_count, baud)) {
+        at_commander_debug(config, "Baud rate %d isn't supported by device",
+                baud);
+        return false;
+    }
+
+    if(!host_supports_baud(config, baud)) {
+        at_commander_debug(config, "Baud rate %d isn't supported by host",
+                baud);
+        return false;
+    }
+
     if(at_commander_set(config, &config->platform.set_baud_rate_command,
-                baud_rate_mapper(baud))) {
+                value)) {
         at_commander_debug(config, "Changed device baud rate to %d", baud);
         config->device_baud = baud;
         return true;
@@ -372,13 +1151,13 @@ int at_commander_get_name(AtCommanderConfig* config, char* buffer,
 }
 
 int rn42_baud_rate_mapper(int baud) {
-    int value;
+    int value = -1;
     switch(baud) {
         case 1200:
             value = 12;
             break;
-        case 2300:
-            value = 23;
+        case 2400:
+            value = 24;
             break;
         case 4800:
             value = 48;
@@ -412,12 +1191,12 @@ int rn42_baud_rate_mapper(int baud) {
 }
 
 int xbee_baud_rate_mapper(int baud) {
-    int value;
+    int value = -1;
     switch(baud) {
         case 1200:
             value = 0;
             break;
-        case 2300:
+        case 2400:
             value = 1;
             break;
         case 4800:
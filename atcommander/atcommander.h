@@ -5,24 +5,56 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <stdarg.h>
+#include <signal.h>
 
 #define AT_PLATFORM_RN41 AT_PLATFORM_RN42
 
+// In bounded mode, the most bytes taken from the device while waiting for one
+// response, noise and line endings included
+#define AT_COMMANDER_BOUNDED_RESPONSE_BYTES 128
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-static const int VALID_BAUD_RATES[] = {230400, 115200, 9600, 19200, 38400,
-    57600, 460800};
-
 typedef struct {
     const char* request_format;
     const char* expected_response;
     const char* error_response;
 } AtCommand;
 
+/** Public: Named sets of link parameters, trading latency against throughput.
+ */
+typedef enum {
+    AT_LINK_PROFILE_BALANCED,
+    AT_LINK_PROFILE_LOW_LATENCY,
+    AT_LINK_PROFILE_BULK_THROUGHPUT,
+    AT_LINK_PROFILE_COUNT
+} AtCommanderLinkProfile;
+
+/** Public: Optional firmware features that operations use to take a faster
+ * path when the device has them, see at_commander_probe_capabilities.
+ */
+typedef enum {
+    // Several commands on one line, separated by commas (XBee), answered with
+    // one response each - one response delay instead of one per command
+    AT_CAPABILITY_CHAINED_COMMANDS = 1 << 0,
+    // Framed API mode (ATAP), see xbee_api.h
+    AT_CAPABILITY_API_MODE = 1 << 1
+} AtCommanderCapability;
+
+/** Public: The capabilities of a range of firmware and hardware versions -
+ * a device has those of every rule whose minimum versions it meets.
+ */
+typedef struct {
+    unsigned long min_firmware_version;
+    unsigned long min_hardware_version;
+    unsigned int capabilities;
+} AtCommanderCapabilityRule;
+
 typedef struct {
     int response_delay_ms;
+    // Returns the device's value for a baud rate, or -1 if it's unsupported
     int (*baud_rate_mapper)(int baud);
     AtCommand enter_command_mode_command;
     AtCommand exit_command_mode_command;
@@ -34,25 +66,261 @@ typedef struct {
     AtCommand set_serialized_name_command;
     AtCommand get_name_command;
     AtCommand get_device_id_command;
+    AtCommand connect_command;
+    AtCommand disconnect_command;
+    AtCommand set_status_string_command;
+    const char* connect_event;
+    const char* disconnect_event;
+    // Time the device needs after the exit command before it passes data
+    int mode_switch_delay_ms;
+    // The commands for each AtCommanderLinkProfile, each list terminated by
+    // a command with a NULL request format
+    const AtCommand* link_profiles[AT_LINK_PROFILE_COUNT];
+    // If true, responses are lines ending in a final result code like "OK" or
+    // "ERROR" (Hayes-style), and are read until one arrives instead of after a
+    // fixed delay.
+    bool final_result_codes;
+    // How long to wait for a final result code by default
+    int response_timeout_ms;
+    // The baud rates the device supports, in the order to try them when
+    // looking for its current rate - most likely first
+    const int* baud_rates;
+    int baud_rate_count;
+    // Responses that mean the device understood a request and refused it,
+    // matched as prefixes and terminated by NULL. Not needed with final result
+    // codes, as the standard error results are always recognized.
+    const char* const* error_responses;
+    // Queries for the firmware and hardware versions - the response's first
+    // number is the version, e.g. "Ver 6.15" or "10EF"
+    AtCommand get_firmware_version_command;
+    AtCommand get_hardware_version_command;
+    // If true, versions are in hex, otherwise they're "major.minor" and
+    // compared as major * 100 + minor
+    bool hex_versions;
+    const AtCommanderCapabilityRule* capability_rules;
+    int capability_rule_count;
 } AtCommanderPlatform;
 
+typedef enum {
+    AT_COMMANDER_RESULT_OK,
+    AT_COMMANDER_RESULT_ERROR,
+    AT_COMMANDER_RESULT_TIMEOUT,
+    // Stopped early by the config's cancel flag
+    AT_COMMANDER_RESULT_CANCELLED,
+    // Stopped early at the config's deadline
+    AT_COMMANDER_RESULT_BUDGET_EXHAUSTED,
+    // A response that was neither the expected one nor a known error, e.g.
+    // from line noise
+    AT_COMMANDER_RESULT_GARBLED
+} AtCommanderResult;
+
+/** Public: How commands that fail are retried.
+ *
+ * The delay before each retry starts at initial_backoff_ms and doubles up to
+ * max_backoff_ms, plus a random jitter of up to jitter_percent of it so many
+ * devices sharing a link don't retry in lockstep. Each class of failure can be
+ * retried or not - an error means the device understood and refused the
+ * request, so asking again rarely helps.
+ *
+ * Commands that change the device's mode (entering and leaving command mode,
+ * rebooting, connecting) are never repeated, as a lost response doesn't mean
+ * the command wasn't carried out.
+ */
+typedef struct {
+    // Attempts for each command including the first, 0 or 1 for no retries
+    int max_attempts;
+    int initial_backoff_ms;
+    int max_backoff_ms;
+    int jitter_percent;
+    bool retry_timeout;
+    bool retry_garbled;
+    bool retry_error;
+    // Empty polls allowed while reading a response, and the delay between
+    // them, for devices without final result codes - 0 for the defaults
+    int read_retries;
+    int read_retry_delay_ms;
+} AtCommanderRetryPolicy;
+
+// Three attempts, retrying timeouts and garbled responses but not errors
+extern const AtCommanderRetryPolicy AT_RETRY_POLICY_DEFAULT;
+
+/** Public: A byte FIFO over caller-provided storage, so the library never needs
+ * to allocate.
+ */
+typedef struct {
+    uint8_t* buffer;
+    int size;
+    int head;
+    int count;
+} AtCommanderRingBuffer;
+
+typedef enum {
+    AT_EXIT_IDLE,
+    AT_EXIT_AWAITING_RESPONSE,
+    AT_EXIT_CONFIRMED
+} AtCommanderExitState;
+
+/** Public: Counters for data mode traffic, see datamode.h.
+ */
+typedef struct {
+    unsigned long bytes_sent;
+    unsigned long bytes_received;
+    unsigned long backpressure_events;
+    unsigned long started_at;
+} AtCommanderDataStats;
+
+/** Public: Running totals of the errors a UART has seen on its receive line,
+ * as reported by a config's line_errors_function.
+ */
+typedef struct {
+    // A missing stop bit - usually a baud rate mismatch or a noisy line
+    unsigned long framing;
+    unsigned long parity;
+    // A byte arrived before the last one was read, and was lost
+    unsigned long overrun;
+} AtCommanderLineErrors;
+
+/** Public: The spans of work reported to a config's trace function, so a host
+ * can build a timeline of where each device's time went.
+ */
+typedef enum {
+    // Trying one baud rate (the value) while entering command mode
+    AT_TRACE_BAUD_SWEEP,
+    // A request (the detail) and its response, or a payload of value bytes
+    // sent at a prompt if the detail is NULL
+    AT_TRACE_COMMAND,
+    // Storing settings in non-volatile memory
+    AT_TRACE_STORE,
+    AT_TRACE_REBOOT,
+    // Waiting for the device for the value in ms, e.g. polling for a response
+    AT_TRACE_WAIT,
+} AtCommanderTraceSpan;
+
+/** Public: The operations at_commander_wcet_ms can bound.
+ */
+typedef enum {
+    // Entering command mode from data mode, sweeping every candidate baud rate
+    AT_OPERATION_ENTER_COMMAND_MODE,
+    AT_OPERATION_EXIT_COMMAND_MODE,
+    // at_commander_apply_settings with count commands - or, with a count of 1,
+    // at_commander_set and the setters built on it
+    AT_OPERATION_SET,
+    // at_commander_get and the getters built on it
+    AT_OPERATION_GET,
+    AT_OPERATION_REBOOT,
+    AT_OPERATION_PROBE_CAPABILITIES,
+    // at_commander_command with the platform's default timeout
+    AT_OPERATION_COMMAND,
+} AtCommanderOperation;
+
 extern const AtCommanderPlatform AT_PLATFORM_RN42;
 extern const AtCommanderPlatform AT_PLATFORM_XBEE;
+extern const AtCommanderPlatform AT_PLATFORM_HAYES;
+extern const AtCommanderPlatform AT_PLATFORM_ESPRESSIF;
 
 typedef struct {
     AtCommanderPlatform platform;
     void (*baud_rate_initializer)(void* device, int);
     void (*write_function)(void* device, uint8_t);
     int (*read_function)(void* device);
+    // Optional non-blocking bulk transfers for data mode - they return the
+    // number of bytes actually accepted or read, which may be 0.
+    int (*write_bytes_function)(void* device, const uint8_t* bytes, int size);
+    int (*read_bytes_function)(void* device, uint8_t* bytes, int size);
+    // Optional CTS input - if it returns false, the device can't take data.
+    bool (*clear_to_send_function)(void* device);
+    // Optional, fills in the UART's error totals since it was opened - see
+    // link_health.h. Returns false if they can't be read.
+    bool (*line_errors_function)(void* device, AtCommanderLineErrors* errors);
     void (*delay_function)(unsigned long);
     void (*log_function)(const char*, ...);
+    unsigned long (*millis_function)(void);
+    // Optional, called at the beginning and end of each span of work - spans
+    // nest, e.g. a command inside a store. The detail may be NULL.
+    void (*trace_function)(void* device, AtCommanderTraceSpan span,
+            bool begin, const char* detail, int value);
+
+    // Optional list of the baud rates the host's UART supports - the search
+    // for the device's baud rate skips any others. If NULL, all of the
+    // platform's rates are tried.
+    const int* supported_baud_rates;
+    int supported_baud_rate_count;
+
+    // Optional flag that stops any operation in progress as soon as it's set
+    // non-zero, e.g. from a signal or interrupt handler. A sig_atomic_t is
+    // read and written in one access, so setting it can't be torn.
+    volatile sig_atomic_t* cancel_flag;
+    // Optional deadline on the millis clock, see at_commander_set_budget
+    bool has_deadline;
+    unsigned long deadline;
+    // Optional, if NULL each command is tried once
+    const AtCommanderRetryPolicy* retry_policy;
+    // Optional bounded mode, for hosts that need a worst-case time for every
+    // operation (see at_commander_wcet_ms) - waiting for a response stops
+    // after AT_COMMANDER_BOUNDED_RESPONSE_BYTES as well as on its timeout, so
+    // a device streaming noise can't hold an operation up indefinitely
+    bool bounded;
+    // State of the jitter generator, seeded on first use if 0
+    uint32_t retry_jitter_state;
+    // The device's versions and AtCommanderCapability flags, filled in by
+    // at_commander_probe_capabilities - or restored from a previous probe of
+    // the same device, with capabilities_probed set
+    bool capabilities_probed;
+    unsigned int capabilities;
+    unsigned long firmware_version;
+    unsigned long hardware_version;
 
     bool connected;
     int baud;
     int device_baud;
     void* device;
+
+    // Optional storage for data that arrives, or is sent, while in command
+    // mode, so switching modes doesn't lose any of it.
+    AtCommanderRingBuffer data_rx_queue;
+    AtCommanderRingBuffer data_tx_queue;
+    AtCommanderDataStats data_stats;
+    // Progress of a pipelined exit's response through the receive stream
+    AtCommanderExitState exit_state;
+    int exit_response_progress;
 } AtCommanderConfig;
 
+/** Public: Limit how long operations may take from now on - once the budget
+ * is spent, the operation in progress returns early as if it failed, without
+ * starting any more waits. Requires a millis function.
+ *
+ *  budget_ms - the time allowed from now, or 0 to remove the limit.
+ */
+void at_commander_set_budget(AtCommanderConfig* config,
+        unsigned long budget_ms);
+
+/** Public: Check whether operations are being stopped early, e.g. to find out
+ * why one returned false.
+ *
+ *  Returns AT_COMMANDER_RESULT_CANCELLED if the cancel flag is set,
+ *  AT_COMMANDER_RESULT_BUDGET_EXHAUSTED if the deadline has passed, or
+ *  AT_COMMANDER_RESULT_OK if neither.
+ */
+AtCommanderResult at_commander_interrupted(AtCommanderConfig* config);
+
+/** Public: The longest an operation can take in bounded mode, from the
+ * config's platform, retry policy, supported baud rates and data mode queues.
+ *
+ * It counts every wait the operation can make, and the time to transfer every
+ * byte it can send or take from the device at the slowest baud rate it may be
+ * using - so it holds as long as the read and write functions return within a
+ * byte time. An operation only starts from the current mode, e.g. a get while
+ * already in command mode doesn't include entering it. A budget only ever
+ * makes an operation shorter.
+ *
+ *  operation - the operation to bound.
+ *  count - the number of commands for AT_OPERATION_SET, otherwise ignored.
+ *
+ *  Returns the bound in ms, or 0 if the platform doesn't have the operation.
+ */
+unsigned long at_commander_wcet_ms(AtCommanderConfig* config,
+        AtCommanderOperation operation, int count);
+
 /** Public: Switch to command mode.
  *
  * If unable to determine the current baud rate and enter command mode, returns
@@ -77,6 +345,18 @@ bool at_commander_exit_command_mode(AtCommanderConfig* config);
  */
 bool at_commander_reboot(AtCommanderConfig* config);
 
+/** Public: List the baud rates that will be tried, in order, when looking for
+ * the attached AT device's current baud rate - the platform's rates that the
+ * host also supports.
+ *
+ *  rates - an array to store the baud rates, may be NULL to just count them.
+ *  max_rates - the length of the array.
+ *
+ *  Returns the number of candidate baud rates.
+ */
+int at_commander_candidate_baud_rates(AtCommanderConfig* config, int* rates,
+        int max_rates);
+
 /** Public: Change the UART baud rate of the attached AT device, regardless of
  *      the current baud rate.
  *
@@ -86,7 +366,8 @@ bool at_commander_reboot(AtCommanderConfig* config);
  *
  *      baud - the desired baud rate.
  *
- *  Returns true if the baud rate was successfully changed.
+ *  Returns true if the baud rate was successfully changed, or false if it
+ *  couldn't be or isn't supported by the platform.
  */
 bool at_commander_set_baud(AtCommanderConfig* config, int baud);
 
@@ -99,7 +380,8 @@ bool at_commander_set_baud(AtCommanderConfig* config, int baud);
  *
  *      timeout - the desired configuration timeout in seconds.
  *
- *  Returns true if the configuration timer was successfully changed.
+ *  Returns true if the configuration timer was successfully changed and, on
+ *  platforms with a store command, stored.
  */
 bool at_commander_set_configuration_timer(AtCommanderConfig* config, int timeout_s);
 
@@ -144,6 +426,48 @@ int at_commander_get_name(AtCommanderConfig* config, char* buffer,
 int at_commander_get_name(AtCommanderConfig* config, char* buffer,
         int buflen);
 
+/** Public: Apply a batch of settings in a single command mode session, storing
+ * them once at the end.
+ *
+ * The batch stops at the first command that fails, and the settings are only
+ * stored if all of them succeeded.
+ *
+ *  commands - the commands to send - their request formats are sent as-is.
+ *  count - the number of commands.
+ *
+ * Returns true if every command succeeded.
+ */
+bool at_commander_apply_settings(AtCommanderConfig* config,
+        const AtCommand* commands, int count);
+
+/** Public: Configure the attached AT device's link for low latency, high
+ * throughput or a balance of the two, as one batch of settings.
+ *
+ * Some devices only pick up the new parameters after a reboot (RN-42) or on
+ * leaving command mode (XBee).
+ *
+ * Returns true if the profile was applied.
+ */
+bool at_commander_set_link_profile(AtCommanderConfig* config,
+        AtCommanderLinkProfile profile);
+
+/** Public: Read the attached AT device's firmware (and hardware, if the
+ * platform can report it) version once, and work out which optional features
+ * it has from the platform's capability rules.
+ *
+ * The result is kept in the config, so later calls return straight away.
+ * Until a probe succeeds, every operation sticks to the commands all firmware
+ * versions support.
+ *
+ * Returns true if the versions were read (or already known).
+ */
+bool at_commander_probe_capabilities(AtCommanderConfig* config);
+
+/** Public: Returns true if the device is known to have a capability.
+ */
+bool at_commander_has_capability(AtCommanderConfig* config,
+        AtCommanderCapability capability);
+
 /** Public: Send an AT "get" query, read a response, and verify it doesn't match
  * any known errors.
  *
@@ -160,8 +484,54 @@ int at_commander_get(AtCommanderConfig* config, AtCommand* command,
 bool at_commander_set(AtCommanderConfig* config, AtCommand* command,
         ...);
 
+/** Public: Send a request to a device that uses final result codes, and read
+ * response lines until the final result arrives or the timeout expires.
+ *
+ * The echo of the request (if echo is enabled on the device) and empty lines
+ * are skipped. The remaining intermediate lines are collected in the response
+ * buffer, one per line. If the device reports an error, the buffer holds the
+ * final result line instead, e.g. "+CME ERROR: 10".
+ *
+ * This returns as soon as the device has finished, so long-running commands
+ * (like network registration) only need a generous timeout. Failures are
+ * retried as the config's retry policy allows - leave non-idempotent requests
+ * like dialing to a config without one.
+ *
+ *  request - the complete request, e.g. "AT+CREG?\r".
+ *  response_buffer - a string buffer for the response lines, may be NULL.
+ *  response_buffer_length - the length of the buffer.
+ *  timeout_ms - the longest to wait for the final result code, or 0 to use
+ *      the platform's default.
+ *
+ * Returns the final result of the command.
+ */
+AtCommanderResult at_commander_command(AtCommanderConfig* config,
+        const char* request, char* response_buffer,
+        int response_buffer_length, int timeout_ms);
+
+/** Public: Send a request that prompts for input with '>' (like sending an SMS
+ * or a socket payload), then the payload itself, and wait for the final result.
+ *
+ * The payload is written straight from the caller's buffer without any
+ * formatting.
+ *
+ *  request - the complete request, e.g. "AT+CIPSEND=5\r\n".
+ *  payload - the data to send at the prompt.
+ *  size - the length of the payload.
+ *  expected_response - the final result code for success if not "OK", e.g.
+ *      "SEND OK", may be NULL.
+ *  timeout_ms - the longest to wait for the payload to be sent and for the
+ *      final result, or 0 to use the platform's default.
+ *
+ * Returns the final result of the command.
+ */
+AtCommanderResult at_commander_send_with_prompt(AtCommanderConfig* config,
+        const char* request, const uint8_t* payload, int size,
+        const char* expected_response, int timeout_ms);
+
 int rn42_baud_rate_mapper(int baud);
 int xbee_baud_rate_mapper(int baud);
+int hayes_baud_rate_mapper(int baud);
 
 #ifdef __cplusplus
 }
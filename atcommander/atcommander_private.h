@@ -0,0 +1,123 @@
+#ifndef _ATCOMMANDER_PRIVATE_H_
+#define _ATCOMMANDER_PRIVATE_H_
+
+#include "atcommander.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Helpers shared between the modules of the library - not part of the public
+ * API.
+ */
+
+// TODO hard coded max of 128 - I've never seen one anywhere near this
+// long so we're probably OK.
+#define AT_COMMANDER_MAX_REQUEST_LENGTH 128
+
+// How long to wait for a device when its platform doesn't say
+#define AT_COMMANDER_DEFAULT_RESPONSE_TIMEOUT_MS 1000
+
+#define at_commander_debug(config, ...) \
+    if(config->log_function != NULL) { \
+        config->log_function(__VA_ARGS__); \
+        config->log_function("\r\n"); \
+    }
+
+/* Change the host's UART to a baud rate, without touching the device.
+ */
+bool initialize_baud(AtCommanderConfig* config, int baud);
+
+void at_commander_write(AtCommanderConfig* config, const char* bytes, int size);
+
+void at_commander_delay_ms(AtCommanderConfig* config, unsigned long ms);
+
+unsigned long at_commander_millis(AtCommanderConfig* config);
+
+void at_commander_trace(AtCommanderConfig* config, AtCommanderTraceSpan span,
+        bool begin, const char* detail, int value);
+
+int at_commander_read(AtCommanderConfig* config, char* buffer, int size,
+        int max_retries);
+
+/* Send a request once, without retrying.
+ *
+ * Returns the result, telling a timeout from an error or a garbled response.
+ */
+AtCommanderResult command_request(AtCommanderConfig* config,
+        const char* command, const char* expected_response);
+
+bool set_request(AtCommanderConfig* config, const char* command,
+        const char* expected_response);
+
+/* Wait out the backoff before retrying a request that failed, if the config's
+ * retry policy allows another attempt for the result.
+ *
+ * Returns true if the request should be sent again.
+ */
+bool at_commander_retry(AtCommanderConfig* config, AtCommanderResult result,
+        int attempts);
+
+int get_request(AtCommanderConfig* config, AtCommand* command,
+        char* response_buffer, int response_buffer_length);
+
+bool at_commander_store_settings(AtCommanderConfig* config);
+
+/* Send a request to a device using final result codes and wait for the final
+ * result - a success is either "OK" or the given expected response (e.g.
+ * "CONNECT"). Intermediate lines are collected as for at_commander_command.
+ */
+AtCommanderResult final_result_request(AtCommanderConfig* config,
+        const char* request, const char* expected_response,
+        char* response_buffer, int response_buffer_length, int timeout_ms);
+
+/* The longest final_result_request can take in bounded mode, not counting
+ * the time to transfer bytes.
+ */
+unsigned long final_result_wait_wcet_ms(AtCommanderConfig* config,
+        int timeout_ms);
+
+/* Send a request to a device using final result codes and wait for its '>'
+ * input prompt.
+ */
+AtCommanderResult prompt_request(AtCommanderConfig* config,
+        const char* request, int timeout_ms);
+
+void at_commander_ring_init(AtCommanderRingBuffer* ring, uint8_t* storage,
+        int size);
+
+int at_commander_ring_push(AtCommanderRingBuffer* ring, const uint8_t* bytes,
+        int size);
+
+int at_commander_ring_pop(AtCommanderRingBuffer* ring, uint8_t* bytes,
+        int size);
+
+/* Returns the number of contiguous bytes available at the head of the ring,
+ * pointing 'bytes' at them without consuming them.
+ */
+int at_commander_ring_peek(AtCommanderRingBuffer* ring, const uint8_t** bytes);
+
+void at_commander_ring_drop(AtCommanderRingBuffer* ring, int size);
+
+/* Move any data already received from the transport into the data mode
+ * receive queue, before it can be mistaken for a command response.
+ */
+void at_commander_data_stash(AtCommanderConfig* config);
+
+int at_commander_data_flush(AtCommanderConfig* config);
+
+/* Write all of a buffer straight to the transport (bypassing the data mode
+ * queues), waiting out backpressure for up to timeout_ms - if that's 0, the
+ * platform's response timeout, or AT_COMMANDER_DEFAULT_RESPONSE_TIMEOUT_MS
+ * for platforms without one (e.g. the RN-42 and XBee).
+ *
+ * Returns true if everything was written.
+ */
+bool at_commander_write_all(AtCommanderConfig* config, const uint8_t* bytes,
+        int size, int timeout_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _ATCOMMANDER_PRIVATE_H_
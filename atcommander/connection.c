@@ -0,0 +1,252 @@
+#include "connection.h"
+#include "atcommander_private.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/** Private: Returns true if the time 'deadline' has been reached at 'now',
+ * tolerating wraparound of the millisecond clock.
+ */
+static bool time_reached(unsigned long now, unsigned long deadline) {
+    return (long)(now - deadline) >= 0;
+}
+
+/** Private: Move the peer at the given index to the front of the list, so it's
+ * the first to be retried.
+ */
+static void promote_peer(AtCommanderConnectionManager* manager, int index) {
+    char address[AT_COMMANDER_MAX_PEER_ADDRESS_LENGTH];
+    if(index <= 0 || index >= manager->peer_count) {
+        return;
+    }
+
+    strcpy(address, manager->peers[index]);
+    memmove(manager->peers[1], manager->peers[0],
+            index * AT_COMMANDER_MAX_PEER_ADDRESS_LENGTH);
+    strcpy(manager->peers[0], address);
+    if(manager->current_peer == index) {
+        manager->current_peer = 0;
+    } else if(manager->current_peer < index) {
+        manager->current_peer++;
+    }
+}
+
+/** Private: Schedule the next connection attempt after the current backoff,
+ * and grow the backoff for the attempt after that.
+ */
+static void schedule_retry(AtCommanderConnectionManager* manager,
+        unsigned long now) {
+    manager->state = AT_LINK_DISCONNECTED;
+    manager->next_attempt_at = now + manager->backoff_ms;
+    manager->backoff_ms *= 2;
+    if(manager->backoff_ms > manager->max_backoff_ms) {
+        manager->backoff_ms = manager->max_backoff_ms;
+    }
+}
+
+/** Private: Send the connect command for the current peer.
+ *
+ * Returns true if the device accepted the command.
+ */
+static bool start_attempt(AtCommanderConnectionManager* manager) {
+    AtCommanderConfig* config = manager->config;
+    AtCommand* command = &config->platform.connect_command;
+    unsigned long now = at_commander_millis(config);
+    char request[AT_COMMANDER_MAX_REQUEST_LENGTH];
+
+    if(command->request_format == NULL) {
+        at_commander_debug(config, "Platform has no connect command");
+        return false;
+    }
+
+    if(at_commander_enter_command_mode(config)) {
+        const char* address = manager->peers[manager->current_peer];
+        snprintf(request, sizeof(request), command->request_format, address);
+        if(command_request(config, request, command->expected_response)
+                == AT_COMMANDER_RESULT_OK) {
+            at_commander_debug(config, "Connecting to %s", address);
+            // The device drops out of command mode to make the connection
+            config->connected = false;
+            manager->state = AT_LINK_CONNECTING;
+            manager->attempt_started_at = at_commander_millis(config);
+            return true;
+        }
+        at_commander_debug(config, "Unable to connect to %s", address);
+    } else {
+        at_commander_debug(config,
+                "Unable to enter command mode, can't connect");
+    }
+
+    manager->failed_attempts++;
+    schedule_retry(manager, now);
+    return false;
+}
+
+void at_commander_connection_init(AtCommanderConnectionManager* manager,
+        AtCommanderConfig* config) {
+    memset(manager, 0, sizeof(AtCommanderConnectionManager));
+    manager->config = config;
+    manager->state = AT_LINK_DISCONNECTED;
+    manager->initial_backoff_ms = AT_COMMANDER_DEFAULT_INITIAL_BACKOFF_MS;
+    manager->max_backoff_ms = AT_COMMANDER_DEFAULT_MAX_BACKOFF_MS;
+    manager->connect_timeout_ms = AT_COMMANDER_DEFAULT_CONNECT_TIMEOUT_MS;
+    manager->backoff_ms = manager->initial_backoff_ms;
+
+    at_commander_token_matcher_init(&manager->matcher);
+    manager->connect_token = at_commander_token_matcher_add(&manager->matcher,
+            config->platform.connect_event);
+    manager->disconnect_token = at_commander_token_matcher_add(
+            &manager->matcher, config->platform.disconnect_event);
+}
+
+bool at_commander_connection_enable_events(
+        AtCommanderConnectionManager* manager) {
+    AtCommanderConfig* config = manager->config;
+    const char* event = config->platform.connect_event;
+    char prefix[AT_COMMANDER_MAX_PEER_ADDRESS_LENGTH];
+    int prefix_length;
+
+    if(config->platform.set_status_string_command.request_format == NULL
+            || event == NULL) {
+        at_commander_debug(config, "Platform has no connection events");
+        return false;
+    }
+
+    // The events are the status string followed by "CONNECT"/"DISCONNECT"
+    prefix_length = strlen(event) - strlen("CONNECT");
+    if(prefix_length <= 0 || prefix_length >= (int)sizeof(prefix)) {
+        return false;
+    }
+    memcpy(prefix, event, prefix_length);
+    prefix[prefix_length] = '\0';
+
+    return at_commander_set(config, &config->platform.set_status_string_command,
+            prefix);
+}
+
+bool at_commander_connection_add_peer(AtCommanderConnectionManager* manager,
+        const char* address) {
+    int i;
+    if(address == NULL
+            || strlen(address) >= AT_COMMANDER_MAX_PEER_ADDRESS_LENGTH) {
+        return false;
+    }
+
+    for(i = 0; i < manager->peer_count; i++) {
+        if(!strcmp(manager->peers[i], address)) {
+            promote_peer(manager, i);
+            return true;
+        }
+    }
+
+    if(manager->peer_count < AT_COMMANDER_MAX_PEERS) {
+        manager->peer_count++;
+    }
+    // The last slot is either new or the least recently connected peer
+    strcpy(manager->peers[manager->peer_count - 1], address);
+    promote_peer(manager, manager->peer_count - 1);
+    return true;
+}
+
+bool at_commander_connection_connect(AtCommanderConnectionManager* manager,
+        const char* address) {
+    if(!at_commander_connection_add_peer(manager, address)) {
+        return false;
+    }
+    manager->current_peer = 0;
+    manager->reconnect_enabled = true;
+    manager->backoff_ms = manager->initial_backoff_ms;
+    return start_attempt(manager);
+}
+
+bool at_commander_connection_disconnect(
+        AtCommanderConnectionManager* manager) {
+    AtCommanderConfig* config = manager->config;
+    AtCommand* command = &config->platform.disconnect_command;
+
+    manager->reconnect_enabled = false;
+    manager->awaiting_reconnect = false;
+    if(command->request_format == NULL) {
+        at_commander_debug(config, "Platform has no disconnect command");
+        return false;
+    }
+
+    if(at_commander_enter_command_mode(config)
+            && set_request(config, command->request_format,
+                command->expected_response)) {
+        at_commander_debug(config, "Disconnected");
+        manager->state = AT_LINK_DISCONNECTED;
+        return true;
+    }
+    at_commander_debug(config, "Unable to disconnect");
+    return false;
+}
+
+AtCommanderLinkState at_commander_connection_process(
+        AtCommanderConnectionManager* manager, const uint8_t* bytes,
+        int length) {
+    AtCommanderConfig* config = manager->config;
+    int i = 0;
+    while(i < length) {
+        int token;
+        i += at_commander_token_matcher_scan(&manager->matcher, &bytes[i],
+                length - i, &token);
+        if(token == -1) {
+            continue;
+        }
+
+        unsigned long now = at_commander_millis(config);
+        if(token == manager->connect_token) {
+            if(manager->awaiting_reconnect) {
+                manager->last_reconnect_latency_ms = now - manager->dropped_at;
+                manager->reconnect_count++;
+                manager->awaiting_reconnect = false;
+                at_commander_debug(config, "Reconnected after %lu ms",
+                        manager->last_reconnect_latency_ms);
+            }
+            manager->state = AT_LINK_CONNECTED;
+            manager->backoff_ms = manager->initial_backoff_ms;
+            manager->failed_attempts = 0;
+            if(manager->peer_count > 0) {
+                promote_peer(manager, manager->current_peer);
+            }
+        } else if(token == manager->disconnect_token) {
+            if(manager->state == AT_LINK_CONNECTED
+                    && manager->reconnect_enabled) {
+                manager->dropped_at = now;
+                manager->awaiting_reconnect = true;
+                at_commander_debug(config, "Link dropped, reconnecting");
+            }
+            // Retry the peer that just dropped immediately, then back off
+            manager->state = AT_LINK_DISCONNECTED;
+            manager->current_peer = 0;
+            manager->next_attempt_at = now;
+            manager->backoff_ms = manager->initial_backoff_ms;
+        }
+    }
+    return manager->state;
+}
+
+AtCommanderLinkState at_commander_connection_tick(
+        AtCommanderConnectionManager* manager) {
+    unsigned long now = at_commander_millis(manager->config);
+    if(!manager->reconnect_enabled || manager->peer_count == 0) {
+        return manager->state;
+    }
+
+    if(manager->state == AT_LINK_CONNECTING && time_reached(now,
+                manager->attempt_started_at + manager->connect_timeout_ms)) {
+        at_commander_debug(manager->config, "Connection to %s timed out",
+                manager->peers[manager->current_peer]);
+        manager->failed_attempts++;
+        manager->current_peer = (manager->current_peer + 1)
+                % manager->peer_count;
+        schedule_retry(manager, now);
+    }
+
+    if(manager->state == AT_LINK_DISCONNECTED
+            && time_reached(now, manager->next_attempt_at)) {
+        start_attempt(manager);
+    }
+    return manager->state;
+}
@@ -0,0 +1,131 @@
+#ifndef _ATCOMMANDER_CONNECTION_H_
+#define _ATCOMMANDER_CONNECTION_H_
+
+#include "atcommander.h"
+#include "token_matcher.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define AT_COMMANDER_MAX_PEERS 4
+// 12 hex digits of a Bluetooth address, plus a NUL
+#define AT_COMMANDER_MAX_PEER_ADDRESS_LENGTH 13
+#define AT_COMMANDER_DEFAULT_INITIAL_BACKOFF_MS 250
+#define AT_COMMANDER_DEFAULT_MAX_BACKOFF_MS 8000
+#define AT_COMMANDER_DEFAULT_CONNECT_TIMEOUT_MS 5000
+
+typedef enum {
+    AT_LINK_DISCONNECTED,
+    AT_LINK_CONNECTING,
+    AT_LINK_CONNECTED
+} AtCommanderLinkState;
+
+/** Public: Keeps a link to one of a set of known peers up, for platforms with
+ * connect/disconnect commands (e.g. the RN-42).
+ *
+ * Link state is tracked from the connect and disconnect status events the
+ * module writes into the data stream, so the application must pass everything
+ * it receives in data mode to at_commander_connection_process. Reconnects are
+ * driven from at_commander_connection_tick, which never blocks unless a
+ * connect command is due.
+ *
+ * Peers are kept most-recently-connected first, so the peer that was last up
+ * is the first one retried after a drop.
+ */
+typedef struct {
+    AtCommanderConfig* config;
+    char peers[AT_COMMANDER_MAX_PEERS][AT_COMMANDER_MAX_PEER_ADDRESS_LENGTH];
+    int peer_count;
+    int current_peer;
+
+    AtCommanderLinkState state;
+    bool reconnect_enabled;
+    bool awaiting_reconnect;
+    unsigned long initial_backoff_ms;
+    unsigned long max_backoff_ms;
+    unsigned long connect_timeout_ms;
+
+    unsigned long backoff_ms;
+    unsigned long next_attempt_at;
+    unsigned long attempt_started_at;
+    unsigned long dropped_at;
+    unsigned long last_reconnect_latency_ms;
+    int reconnect_count;
+    int failed_attempts;
+
+    AtCommanderTokenMatcher matcher;
+    int connect_token;
+    int disconnect_token;
+} AtCommanderConnectionManager;
+
+/** Public: Initialize a connection manager for the device in config with the
+ * default backoff and timeout, and no known peers.
+ *
+ * The config must have a millis_function for backoff and latency tracking.
+ */
+void at_commander_connection_init(AtCommanderConnectionManager* manager,
+        AtCommanderConfig* config);
+
+/** Public: Ask the device to report connect and disconnect events in the data
+ * stream (e.g. "%CONNECT" on the RN-42). This is stored on the device, so it
+ * only needs to be done once.
+ *
+ * Returns true if the status string was set.
+ */
+bool at_commander_connection_enable_events(
+        AtCommanderConnectionManager* manager);
+
+/** Public: Remember a peer address. If the list is full, the least recently
+ * connected peer is forgotten.
+ *
+ *  address - the peer's address, e.g. "00066646C2AF".
+ *
+ *  Returns false if the address is too long.
+ */
+bool at_commander_connection_add_peer(AtCommanderConnectionManager* manager,
+        const char* address);
+
+/** Public: Issue a connect command to the given peer, remembering it.
+ *
+ * This only starts the connection - the link is up once the connect event
+ * arrives through at_commander_connection_process.
+ *
+ * Returns true if the device accepted the connect command.
+ */
+bool at_commander_connection_connect(AtCommanderConnectionManager* manager,
+        const char* address);
+
+/** Public: Drop the current link and stop reconnecting until the next call to
+ * at_commander_connection_connect.
+ *
+ * Returns true if the device accepted the disconnect command.
+ */
+bool at_commander_connection_disconnect(
+        AtCommanderConnectionManager* manager);
+
+/** Public: Scan bytes received in data mode for connect and disconnect events.
+ *
+ * The bytes are not modified and should still be handled as data by the
+ * caller.
+ *
+ * Returns the link state after processing the bytes.
+ */
+AtCommanderLinkState at_commander_connection_process(
+        AtCommanderConnectionManager* manager, const uint8_t* bytes,
+        int length);
+
+/** Public: Retry a dropped link if the backoff has elapsed, and give up on a
+ * connection attempt that has timed out. Call this periodically from the main
+ * loop.
+ *
+ * Returns the link state.
+ */
+AtCommanderLinkState at_commander_connection_tick(
+        AtCommanderConnectionManager* manager);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _ATCOMMANDER_CONNECTION_H_
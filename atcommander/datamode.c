@@ -0,0 +1,341 @@
+#include "datamode.h"
+#include "atcommander_private.h"
+
+#include <stddef.h>
+#include <string.h>
+
+void at_commander_ring_init(AtCommanderRingBuffer* ring, uint8_t* storage,
+        int size) {
+    ring->buffer = storage;
+    ring->size = storage != NULL ? size : 0;
+    ring->head = 0;
+    ring->count = 0;
+}
+
+int at_commander_ring_push(AtCommanderRingBuffer* ring, const uint8_t* bytes,
+        int size) {
+    int pushed = 0;
+    while(pushed < size && ring->count < ring->size) {
+        int tail = (ring->head + ring->count) % ring->size;
+        int chunk = ring->size - tail;
+        if(chunk > ring->size - ring->count) {
+            chunk = ring->size - ring->count;
+        }
+        if(chunk > size - pushed) {
+            chunk = size - pushed;
+        }
+        memcpy(&ring->buffer[tail], &bytes[pushed], chunk);
+        ring->count += chunk;
+        pushed += chunk;
+    }
+    return pushed;
+}
+
+int at_commander_ring_peek(AtCommanderRingBuffer* ring, const uint8_t** bytes) {
+    int contiguous = ring->size - ring->head;
+    *bytes = ring->buffer != NULL ? &ring->buffer[ring->head] : NULL;
+    return contiguous < ring->count ? contiguous : ring->count;
+}
+
+void at_commander_ring_drop(AtCommanderRingBuffer* ring, int size) {
+    if(size > ring->count) {
+        size = ring->count;
+    }
+    ring->count -= size;
+    ring->head = ring->count == 0 ? 0 : (ring->head + size) % ring->size;
+}
+
+int at_commander_ring_pop(AtCommanderRingBuffer* ring, uint8_t* bytes,
+        int size) {
+    int popped = 0;
+    while(popped < size && ring->count > 0) {
+        const uint8_t* chunk_start;
+        int chunk = at_commander_ring_peek(ring, &chunk_start);
+        if(chunk > size - popped) {
+            chunk = size - popped;
+        }
+        memcpy(&bytes[popped], chunk_start, chunk);
+        at_commander_ring_drop(ring, chunk);
+        popped += chunk;
+    }
+    return popped;
+}
+
+/** Private: Hand bytes to the transport, respecting CTS.
+ *
+ * Returns the number of bytes the transport accepted.
+ */
+static int transport_write(AtCommanderConfig* config, const uint8_t* bytes,
+        int size) {
+    int written = 0;
+    if(config->write_bytes_function != NULL) {
+        if(config->clear_to_send_function == NULL
+                || config->clear_to_send_function(config->device)) {
+            written = config->write_bytes_function(config->device, bytes,
+                    size);
+        }
+    } else if(config->write_function != NULL) {
+        while(written < size && (config->clear_to_send_function == NULL
+                    || config->clear_to_send_function(config->device))) {
+            config->write_function(config->device, bytes[written++]);
+        }
+    }
+
+    if(written < 0) {
+        written = 0;
+    }
+    config->data_stats.bytes_sent += written;
+    return written;
+}
+
+/** Private: Read whatever the transport has ready, without blocking.
+ *
+ * Returns the number of bytes read.
+ */
+static int transport_read(AtCommanderConfig* config, uint8_t* bytes,
+        int size) {
+    int bytes_read = 0;
+    if(config->read_bytes_function != NULL) {
+        bytes_read = config->read_bytes_function(config->device, bytes, size);
+        if(bytes_read < 0) {
+            bytes_read = 0;
+        }
+    } else if(config->read_function != NULL) {
+        while(bytes_read < size) {
+            int byte = config->read_function(config->device);
+            if(byte == -1) {
+                break;
+            }
+            bytes[bytes_read++] = byte;
+        }
+    }
+    config->data_stats.bytes_received += bytes_read;
+    return bytes_read;
+}
+
+/** Private: Remove the response to a pipelined exit command from received
+ * bytes, updating the exit state as it's matched.
+ *
+ * If the response doesn't match, the device is still in command mode and the
+ * rest of the response is moved to the receive queue.
+ *
+ * Returns the number of bytes left in the buffer, which are data.
+ */
+static int consume_exit_response(AtCommanderConfig* config, uint8_t* bytes,
+        int size) {
+    const char* expected =
+            config->platform.exit_command_mode_command.expected_response;
+    int kept = 0;
+    int stashed;
+    int i;
+    for(i = 0; i < size; i++) {
+        uint8_t byte = bytes[i];
+        if(config->exit_state == AT_EXIT_AWAITING_RESPONSE) {
+            if(config->exit_response_progress == 0
+                    && (byte == '\r' || byte == '\n')) {
+                continue;
+            }
+
+            if(byte == expected[config->exit_response_progress]) {
+                if(expected[++config->exit_response_progress] == '\0') {
+                    at_commander_debug(config, "Switched back to data mode");
+                    config->exit_state = AT_EXIT_CONFIRMED;
+                }
+                continue;
+            }
+
+            // Anything else is a command mode response, not data - keep it,
+            // and whatever of it was taken for the exit response, in the
+            // receive queue so the caller can still see it
+            at_commander_debug(config, "Unable to exit command mode");
+            config->exit_state = AT_EXIT_IDLE;
+            config->connected = true;
+            stashed = at_commander_ring_push(&config->data_rx_queue,
+                    (const uint8_t*)expected, config->exit_response_progress);
+            stashed += at_commander_ring_push(&config->data_rx_queue,
+                    &bytes[i], size - i);
+            if(stashed < config->exit_response_progress + size - i) {
+                at_commander_debug(config, "Receive queue full, dropped %d "
+                        "bytes of the response",
+                        config->exit_response_progress + size - i - stashed);
+            }
+            break;
+        } else if(config->exit_state == AT_EXIT_CONFIRMED) {
+            // Drop the line ending after the response
+            if(byte == '\r' || byte == '\n') {
+                continue;
+            }
+            config->exit_state = AT_EXIT_IDLE;
+        }
+        bytes[kept++] = byte;
+    }
+    return kept;
+}
+
+void at_commander_data_stash(AtCommanderConfig* config) {
+    AtCommanderRingBuffer* queue = &config->data_rx_queue;
+    while(queue->count < queue->size) {
+        uint8_t chunk[32];
+        int space = queue->size - queue->count;
+        int bytes_read = transport_read(config, chunk,
+                space < (int)sizeof(chunk) ? space : (int)sizeof(chunk));
+        if(bytes_read == 0) {
+            break;
+        }
+        at_commander_ring_push(queue, chunk, bytes_read);
+    }
+}
+
+bool at_commander_write_all(AtCommanderConfig* config, const uint8_t* bytes,
+        int size, int timeout_ms) {
+    unsigned long started_at = at_commander_millis(config);
+    unsigned long waited_ms = 0;
+    int written = 0;
+
+    if(timeout_ms <= 0) {
+        timeout_ms = config->platform.response_timeout_ms;
+    }
+    if(timeout_ms <= 0) {
+        timeout_ms = AT_COMMANDER_DEFAULT_RESPONSE_TIMEOUT_MS;
+    }
+
+    while(written < size) {
+        int accepted = transport_write(config, &bytes[written],
+                size - written);
+        written += accepted;
+        if(accepted == 0) {
+            unsigned long elapsed = config->millis_function != NULL ?
+                    at_commander_millis(config) - started_at : waited_ms;
+            if(elapsed >= (unsigned long)timeout_ms
+                    || at_commander_interrupted(config)
+                        != AT_COMMANDER_RESULT_OK) {
+                return false;
+            }
+            at_commander_delay_ms(config, 1);
+            waited_ms++;
+        }
+    }
+    return true;
+}
+
+void at_commander_data_init(AtCommanderConfig* config, uint8_t* rx_storage,
+        int rx_size, uint8_t* tx_storage, int tx_size) {
+    at_commander_ring_init(&config->data_rx_queue, rx_storage, rx_size);
+    at_commander_ring_init(&config->data_tx_queue, tx_storage, tx_size);
+    at_commander_data_reset_stats(config);
+}
+
+int at_commander_data_flush(AtCommanderConfig* config) {
+    AtCommanderRingBuffer* queue = &config->data_tx_queue;
+    if(config->connected) {
+        // Still in command mode, anything sent now would be a command
+        return queue->count;
+    }
+
+    while(queue->count > 0) {
+        const uint8_t* chunk;
+        int size = at_commander_ring_peek(queue, &chunk);
+        int written = transport_write(config, chunk, size);
+        at_commander_ring_drop(queue, written);
+        if(written < size) {
+            break;
+        }
+    }
+    return queue->count;
+}
+
+int at_commander_data_write(AtCommanderConfig* config, const uint8_t* bytes,
+        int size) {
+    int accepted = 0;
+    if(bytes == NULL || size <= 0) {
+        return 0;
+    }
+
+    // Anything already queued has to go first to keep the stream in order
+    if(at_commander_data_flush(config) == 0 && !config->connected) {
+        accepted = transport_write(config, bytes, size);
+    }
+    accepted += at_commander_ring_push(&config->data_tx_queue,
+            &bytes[accepted], size - accepted);
+
+    if(accepted < size) {
+        config->data_stats.backpressure_events++;
+    }
+    return accepted;
+}
+
+int at_commander_data_read(AtCommanderConfig* config, uint8_t* bytes,
+        int size) {
+    int bytes_read;
+    if(bytes == NULL || size <= 0) {
+        return 0;
+    }
+
+    bytes_read = at_commander_ring_pop(&config->data_rx_queue, bytes, size);
+    if(!config->connected && bytes_read < size) {
+        int transport_bytes = transport_read(config, &bytes[bytes_read],
+                size - bytes_read);
+        if(config->exit_state != AT_EXIT_IDLE) {
+            transport_bytes = consume_exit_response(config,
+                    &bytes[bytes_read], transport_bytes);
+        }
+        bytes_read += transport_bytes;
+    }
+    return bytes_read;
+}
+
+int at_commander_exit_command_mode_pipelined(AtCommanderConfig* config,
+        const uint8_t* payload, int size) {
+    AtCommand* command = &config->platform.exit_command_mode_command;
+    if(config->connected) {
+        if(command->request_format == NULL
+                || command->expected_response == NULL) {
+            at_commander_debug(config, "Platform has no exit command");
+            return -1;
+        }
+
+        at_commander_write(config, command->request_format,
+                strlen(command->request_format));
+        at_commander_delay_ms(config, config->platform.mode_switch_delay_ms);
+        config->connected = false;
+        config->exit_state = AT_EXIT_AWAITING_RESPONSE;
+        config->exit_response_progress = 0;
+    }
+
+    if(payload == NULL || size <= 0) {
+        at_commander_data_flush(config);
+        return 0;
+    }
+    return at_commander_data_write(config, payload, size);
+}
+
+bool at_commander_exit_pending(AtCommanderConfig* config) {
+    return config->exit_state == AT_EXIT_AWAITING_RESPONSE;
+}
+
+void at_commander_data_reset_stats(AtCommanderConfig* config) {
+    config->data_stats.bytes_sent = 0;
+    config->data_stats.bytes_received = 0;
+    config->data_stats.backpressure_events = 0;
+    config->data_stats.started_at = at_commander_millis(config);
+}
+
+void at_commander_data_throughput(AtCommanderConfig* config,
+        unsigned long* tx_bytes_per_s, unsigned long* rx_bytes_per_s) {
+    unsigned long elapsed = at_commander_millis(config)
+            - config->data_stats.started_at;
+    if(elapsed == 0) {
+        elapsed = 1;
+    }
+
+    if(tx_bytes_per_s != NULL) {
+        *tx_bytes_per_s = (unsigned long)(
+                (unsigned long long)config->data_stats.bytes_sent * 1000
+                / elapsed);
+    }
+    if(rx_bytes_per_s != NULL) {
+        *rx_bytes_per_s = (unsigned long)(
+                (unsigned long long)config->data_stats.bytes_received * 1000
+                / elapsed);
+    }
+}
@@ -0,0 +1,95 @@
+#ifndef _ATCOMMANDER_DATAMODE_H_
+#define _ATCOMMANDER_DATAMODE_H_
+
+#include "atcommander.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Public: Set up the data mode queues and reset the throughput counters.
+ *
+ * The queues hold bytes that can't be handed to the transport right away -
+ * received data that was pending when the library switched into command mode,
+ * and data written while in command mode or under backpressure. Either
+ * storage may be NULL, in which case that direction is unbuffered.
+ *
+ *  rx_storage, rx_size - storage for the receive queue.
+ *  tx_storage, tx_size - storage for the transmit queue.
+ */
+void at_commander_data_init(AtCommanderConfig* config, uint8_t* rx_storage,
+        int rx_size, uint8_t* tx_storage, int tx_size);
+
+/** Public: Send data to the device without blocking.
+ *
+ * Bytes go straight to the transport when it's clear to send, then into the
+ * transmit queue, so a partial count means both are full and the caller
+ * should retry the remainder later. Data written while in command mode is
+ * queued and sent when data mode is resumed.
+ *
+ * Returns the number of bytes accepted.
+ */
+int at_commander_data_write(AtCommanderConfig* config, const uint8_t* bytes,
+        int size);
+
+/** Public: Receive data from the device without blocking.
+ *
+ * Returns bytes saved in the receive queue during a mode switch first, then
+ * whatever the transport has ready. While in command mode, only queued bytes
+ * are returned so command responses aren't consumed as data.
+ *
+ * Returns the number of bytes read, which may be 0.
+ */
+int at_commander_data_read(AtCommanderConfig* config, uint8_t* bytes,
+        int size);
+
+/** Public: Push as much of the transmit queue to the transport as it will
+ * take. Call this from the main loop when a write returned a partial count.
+ *
+ * Returns the number of bytes still queued.
+ */
+int at_commander_data_flush(AtCommanderConfig* config);
+
+/** Public: Switch to data mode and send the first data without waiting for the
+ * device to acknowledge the switch.
+ *
+ * The exit command is written, and the payload follows as soon as the
+ * platform's mode switch delay has passed. The device's response to the exit
+ * command is checked later, as at_commander_data_read finds it at the start of
+ * the receive stream - it's removed from the data. If the response turns out
+ * to be anything else, the device is still in command mode and
+ * config->connected is set again - the response is left in the receive queue,
+ * for at_commander_data_read to return.
+ *
+ *  payload - the first data to send, may be NULL to just switch modes.
+ *  size - the length of the payload.
+ *
+ * Returns the number of payload bytes accepted, or -1 if the platform has no
+ * exit command.
+ */
+int at_commander_exit_command_mode_pipelined(AtCommanderConfig* config,
+        const uint8_t* payload, int size);
+
+/** Public: Returns true if a pipelined exit from command mode hasn't been
+ * confirmed by the device yet.
+ */
+bool at_commander_exit_pending(AtCommanderConfig* config);
+
+/** Public: Restart the throughput counters.
+ */
+void at_commander_data_reset_stats(AtCommanderConfig* config);
+
+/** Public: Calculate the average data rates since the counters were last
+ * reset. Requires a millis_function.
+ *
+ *  tx_bytes_per_s - receives the transmit rate, may be NULL.
+ *  rx_bytes_per_s - receives the receive rate, may be NULL.
+ */
+void at_commander_data_throughput(AtCommanderConfig* config,
+        unsigned long* tx_bytes_per_s, unsigned long* rx_bytes_per_s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _ATCOMMANDER_DATAMODE_H_
@@ -0,0 +1,124 @@
+#include "espressif.h"
+#include "atcommander_private.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define AT_COMMANDER_ESPRESSIF_RESPONSE_TIMEOUT_MS 2000
+// The module only recognizes "+++" as a packet of its own, so it needs a gap
+// in the data before it, and a second after it before the next command.
+#define AT_COMMANDER_ESPRESSIF_PASSTHROUGH_GUARD_MS 20
+#define AT_COMMANDER_ESPRESSIF_PASSTHROUGH_EXIT_DELAY_MS 1000
+
+static const int ESPRESSIF_BAUD_RATES[] = {115200, 9600, 230400, 460800,
+    921600, 57600};
+
+const AtCommanderPlatform AT_PLATFORM_ESPRESSIF = {
+    0,
+    hayes_baud_rate_mapper,
+    { "AT\r\n", "OK" },
+    { NULL, NULL },
+    { "AT+UART_DEF=%d,8,1,0,0\r\n", "OK" },
+    { NULL, NULL },
+    { NULL, NULL },
+    { "AT+RST\r\n", "OK" },
+    { "AT+CWHOSTNAME=\"%s\"\r\n", "OK" },
+    { NULL, NULL },
+    { "AT+CWHOSTNAME?\r\n", NULL, "ERROR" },
+    { "AT+CIPSTAMAC?\r\n", NULL, "ERROR" },
+    { NULL, NULL },
+    { NULL, NULL },
+    { NULL, NULL },
+    NULL,
+    NULL,
+    0,
+    { NULL, NULL, NULL },
+    true,
+    AT_COMMANDER_ESPRESSIF_RESPONSE_TIMEOUT_MS,
+    ESPRESSIF_BAUD_RATES,
+    sizeof(ESPRESSIF_BAUD_RATES) / sizeof(int),
+    NULL,
+    { "AT+GMR\r\n", NULL, "ERROR" },
+    { NULL, NULL, NULL },
+    false,
+    NULL,
+    0,
+};
+
+AtCommanderResult at_commander_espressif_send(AtCommanderConfig* config,
+        int link_id, const uint8_t* payload, int size) {
+    int sent = 0;
+    while(sent < size) {
+        char request[AT_COMMANDER_MAX_REQUEST_LENGTH];
+        int chunk = size - sent;
+        if(chunk > AT_COMMANDER_ESPRESSIF_MAX_SEND_LENGTH) {
+            chunk = AT_COMMANDER_ESPRESSIF_MAX_SEND_LENGTH;
+        }
+
+        if(link_id >= 0) {
+            snprintf(request, sizeof(request), "AT+CIPSEND=%d,%d\r\n", link_id,
+                    chunk);
+        } else {
+            snprintf(request, sizeof(request), "AT+CIPSEND=%d\r\n", chunk);
+        }
+
+        AtCommanderResult result = at_commander_send_with_prompt(config,
+                request, &payload[sent], chunk, "SEND OK", 0);
+        if(result != AT_COMMANDER_RESULT_OK) {
+            return result;
+        }
+        sent += chunk;
+    }
+    return AT_COMMANDER_RESULT_OK;
+}
+
+bool at_commander_espressif_enter_passthrough(AtCommanderConfig* config) {
+    if(at_commander_command(config, "AT+CIPMODE=1\r\n", NULL, 0, 0)
+            != AT_COMMANDER_RESULT_OK) {
+        at_commander_debug(config, "Unable to enable passthrough mode");
+        return false;
+    }
+
+    if(prompt_request(config, "AT+CIPSEND\r\n", 0) != AT_COMMANDER_RESULT_OK) {
+        at_commander_debug(config, "Unable to start passthrough");
+        return false;
+    }
+
+    at_commander_debug(config, "Switched to passthrough mode");
+    config->connected = false;
+    at_commander_data_flush(config);
+    return true;
+}
+
+bool at_commander_espressif_exit_passthrough(AtCommanderConfig* config) {
+    AtCommanderRingBuffer* queue = &config->data_tx_queue;
+    if(config->connected) {
+        at_commander_debug(config, "Not in passthrough mode");
+        return true;
+    }
+
+    while(queue->count > 0) {
+        const uint8_t* chunk;
+        int size = at_commander_ring_peek(queue, &chunk);
+        if(!at_commander_write_all(config, chunk, size, 0)) {
+            at_commander_debug(config,
+                    "Unable to send queued data, can't leave passthrough");
+            return false;
+        }
+        at_commander_ring_drop(queue, size);
+    }
+
+    at_commander_delay_ms(config, AT_COMMANDER_ESPRESSIF_PASSTHROUGH_GUARD_MS);
+    at_commander_write(config, "+++", 3);
+    at_commander_delay_ms(config,
+            AT_COMMANDER_ESPRESSIF_PASSTHROUGH_EXIT_DELAY_MS);
+    config->connected = true;
+
+    if(at_commander_command(config, "AT+CIPMODE=0\r\n", NULL, 0, 0)
+            != AT_COMMANDER_RESULT_OK) {
+        at_commander_debug(config, "Unable to leave passthrough mode");
+        return false;
+    }
+    at_commander_debug(config, "Switched back to command mode");
+    return true;
+}
@@ -0,0 +1,54 @@
+#ifndef _ATCOMMANDER_ESPRESSIF_H_
+#define _ATCOMMANDER_ESPRESSIF_H_
+
+#include "atcommander.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The most an ESP8266/ESP32 accepts after a single AT+CIPSEND
+#define AT_COMMANDER_ESPRESSIF_MAX_SEND_LENGTH 2048
+
+/** Public: Send a payload on an open connection of an Espressif module in AT
+ * firmware (AT_PLATFORM_ESPRESSIF).
+ *
+ * The payload is written from the caller's buffer at the module's '>' prompt,
+ * split into multiple sends if it's longer than the module accepts at once.
+ * For sustained transfers, passthrough mode avoids the round trip per send.
+ *
+ *  link_id - the connection ID when the module is in multiple connection mode
+ *      (AT+CIPMUX=1), or -1 for single connection mode.
+ *  payload - the data to send.
+ *  size - the length of the payload.
+ *
+ * Returns AT_COMMANDER_RESULT_OK once the module reports "SEND OK" for all of
+ * the payload.
+ */
+AtCommanderResult at_commander_espressif_send(AtCommanderConfig* config,
+        int link_id, const uint8_t* payload, int size);
+
+/** Public: Switch the module's open connection into passthrough
+ * ("unvarnished") mode, where everything written goes straight to the
+ * connection - use the data mode API to transfer data from here.
+ *
+ * Passthrough requires single connection mode and a TCP or UDP connection
+ * that has already been opened with AT+CIPSTART.
+ *
+ * Returns true if the module is in passthrough mode.
+ */
+bool at_commander_espressif_enter_passthrough(AtCommanderConfig* config);
+
+/** Public: Leave passthrough mode and return to command mode, after anything
+ * left in the data mode transmit queue has been sent. The connection stays
+ * open.
+ *
+ * Returns true if the module is back in command mode.
+ */
+bool at_commander_espressif_exit_passthrough(AtCommanderConfig* config);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _ATCOMMANDER_ESPRESSIF_H_
@@ -0,0 +1,349 @@
+#include "atcommander.h"
+#include "atcommander_private.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#define AT_COMMANDER_LINE_POLL_DELAY_MS 5
+#define AT_COMMANDER_MAX_LINE_LENGTH 64
+#define AT_COMMANDER_INPUT_PROMPT '>'
+
+// Modems autobaud or default to 115200 these days, older ones to 9600
+static const int HAYES_BAUD_RATES[] = {115200, 9600, 57600, 38400, 19200,
+    230400, 460800};
+
+const AtCommanderPlatform AT_PLATFORM_HAYES = {
+    0,
+    hayes_baud_rate_mapper,
+    { "AT\r", "OK" },
+    { "ATO\r", "CONNECT" },
+    { "AT+IPR=%d\r", "OK" },
+    { NULL, NULL },
+    { "AT&W\r", "OK" },
+    { "AT+CFUN=1,1\r", "OK" },
+    { NULL, NULL },
+    { NULL, NULL },
+    { "AT+CGMM\r", NULL, "ERROR" },
+    { "AT+GSN\r", NULL, "ERROR" },
+    { NULL, NULL },
+    { NULL, NULL },
+    { NULL, NULL },
+    NULL,
+    NULL,
+    0,
+    { NULL, NULL, NULL },
+    true,
+    AT_COMMANDER_DEFAULT_RESPONSE_TIMEOUT_MS,
+    HAYES_BAUD_RATES,
+    sizeof(HAYES_BAUD_RATES) / sizeof(int),
+    NULL,
+    { "AT+GMR\r", NULL, "ERROR" },
+    { NULL, NULL, NULL },
+    false,
+    NULL,
+    0,
+};
+
+// Final result codes that mean the command failed - matched as prefixes, so
+// the error details in e.g. "+CME ERROR: 10" don't matter.
+static const char* const ERROR_RESULTS[] = {
+    "ERROR",
+    "+CME ERROR",
+    "+CMS ERROR",
+    "NO CARRIER",
+    "BUSY",
+    "NO ANSWER",
+    "NO DIALTONE",
+    "SEND FAIL",
+    NULL,
+};
+
+#define AT_COMMANDER_LINE_TIMEOUT -1
+#define AT_COMMANDER_LINE_PROMPT -2
+// In bounded mode, the device sent too much without a final result
+#define AT_COMMANDER_LINE_OVERFLOW -3
+
+/** Private: The time since a read started - from the millis function if
+ * there is one, otherwise the time spent polling plus the time the bytes read
+ * took to arrive at the host's baud rate.
+ */
+static unsigned long read_elapsed_ms(AtCommanderConfig* config,
+        unsigned long started_at, unsigned long waited_ms, int taken) {
+    if(config->millis_function != NULL) {
+        return at_commander_millis(config) - started_at;
+    }
+    if(config->baud <= 0) {
+        return waited_ms;
+    }
+    // 10 bits per byte, with the start and stop bits
+    return waited_ms + (unsigned long)taken * 10 * 1000 / config->baud;
+}
+
+/** Private: Read one line from the device, without the line ending.
+ *
+ * Lines longer than the buffer are truncated. 'waited_ms' accumulates the time
+ * spent waiting for bytes, so the caller can enforce a timeout even without a
+ * millis function. 'taken' accumulates the bytes read. The timeout, cancel
+ * flag and deadline are checked after every byte, not just while waiting, so
+ * a device streaming lines that aren't a final result (e.g. "RING") can't
+ * hold a request up - and in bounded mode, reading also stops at
+ * AT_COMMANDER_BOUNDED_RESPONSE_BYTES.
+ *
+ * If 'prompt' is not '\0', it ends the line as soon as it appears at the
+ * start of one, as devices don't follow input prompts with a line ending.
+ *
+ * Returns the length of the line, AT_COMMANDER_LINE_PROMPT if the prompt
+ * arrived, AT_COMMANDER_LINE_TIMEOUT if the timeout expired or the operation
+ * was interrupted first, or AT_COMMANDER_LINE_OVERFLOW if too much arrived in
+ * bounded mode.
+ */
+static int read_line(AtCommanderConfig* config, char* line, int size,
+        unsigned long started_at, unsigned long* waited_ms, int timeout_ms,
+        char prompt, int* taken) {
+    int length = 0;
+    while(true) {
+        int byte = config->read_function(config->device);
+        if(byte != -1) {
+            ++*taken;
+            if(config->bounded && *taken > AT_COMMANDER_BOUNDED_RESPONSE_BYTES) {
+                return AT_COMMANDER_LINE_OVERFLOW;
+            }
+        }
+
+        if(read_elapsed_ms(config, started_at, *waited_ms, *taken)
+                    >= (unsigned long)timeout_ms
+                || at_commander_interrupted(config)
+                    != AT_COMMANDER_RESULT_OK) {
+            return AT_COMMANDER_LINE_TIMEOUT;
+        }
+
+        if(byte == -1) {
+            at_commander_delay_ms(config, AT_COMMANDER_LINE_POLL_DELAY_MS);
+            *waited_ms += AT_COMMANDER_LINE_POLL_DELAY_MS;
+        } else if(prompt != '\0' && byte == prompt && length == 0) {
+            return AT_COMMANDER_LINE_PROMPT;
+        } else if(byte == '\n') {
+            // Drop trailing spaces, e.g. what follows a prompt
+            while(length > 0 && line[length - 1] == ' ') {
+                length--;
+            }
+            line[length] = '\0';
+            return length;
+        } else if(byte != '\r' && (byte != ' ' || length > 0)
+                && length < size - 1) {
+            line[length++] = byte;
+        }
+    }
+}
+
+/** Private: Returns true if the line is the device echoing the request.
+ */
+static bool is_echo(const char* line, const char* request) {
+    int request_length = strcspn(request, "\r\n");
+    return (int)strlen(line) == request_length
+            && !strncmp(line, request, request_length);
+}
+
+static bool is_error_result(const char* line) {
+    int i;
+    for(i = 0; ERROR_RESULTS[i] != NULL; i++) {
+        if(!strncmp(line, ERROR_RESULTS[i], strlen(ERROR_RESULTS[i]))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/** Private: Append a line to the response buffer, separating lines with
+ * '\n'. Whatever doesn't fit is dropped.
+ */
+static void append_line(char* buffer, int buffer_length, const char* line) {
+    int length;
+    if(buffer == NULL || buffer_length <= 0) {
+        return;
+    }
+
+    length = strlen(buffer);
+    if(length > 0 && length < buffer_length - 1) {
+        buffer[length++] = '\n';
+        buffer[length] = '\0';
+    }
+    strncat(buffer, line, buffer_length - length - 1);
+}
+
+/** Private: Read response lines until a final result code, or the prompt if
+ * one is given.
+ *
+ *  request - the request that was sent, to recognize its echo, may be NULL.
+ *  expected_response - a final result code meaning success besides "OK", may
+ *      be NULL.
+ *  prompt - the character that prompts for input, or '\0' if the request
+ *      doesn't expect one. While waiting for a prompt, "OK" isn't final.
+ */
+static AtCommanderResult await_final_result(AtCommanderConfig* config,
+        const char* request, const char* expected_response,
+        char* response_buffer, int response_buffer_length, int timeout_ms,
+        char prompt) {
+    char line[AT_COMMANDER_MAX_LINE_LENGTH];
+    unsigned long started_at = at_commander_millis(config);
+    unsigned long waited_ms = 0;
+    int taken = 0;
+
+    if(timeout_ms <= 0) {
+        timeout_ms = config->platform.response_timeout_ms;
+    }
+    if(response_buffer != NULL && response_buffer_length > 0) {
+        response_buffer[0] = '\0';
+    }
+
+    while(true) {
+        int length = read_line(config, line, sizeof(line), started_at,
+                &waited_ms, timeout_ms, prompt, &taken);
+        if(length == AT_COMMANDER_LINE_OVERFLOW) {
+            at_commander_debug(config, "No final result for %s in %d bytes",
+                    request != NULL ? request : "data", taken - 1);
+            return AT_COMMANDER_RESULT_GARBLED;
+        }
+
+        if(length == AT_COMMANDER_LINE_TIMEOUT) {
+            AtCommanderResult interrupted = at_commander_interrupted(config);
+            if(interrupted != AT_COMMANDER_RESULT_OK) {
+                at_commander_debug(config, "Stopped waiting for %s",
+                        request != NULL ? request : "data");
+                return interrupted;
+            }
+            at_commander_debug(config, "No final result for %s",
+                    request != NULL ? request : "data");
+            return AT_COMMANDER_RESULT_TIMEOUT;
+        }
+
+        if(length == AT_COMMANDER_LINE_PROMPT) {
+            return AT_COMMANDER_RESULT_OK;
+        }
+
+        if(length == 0 || (request != NULL && is_echo(line, request))) {
+            continue;
+        }
+
+        if(prompt == '\0' && (!strcmp(line, "OK") || (expected_response != NULL
+                    && !strcmp(line, expected_response)))) {
+            return AT_COMMANDER_RESULT_OK;
+        }
+
+        if(is_error_result(line)) {
+            at_commander_debug(config, "Request failed with \"%s\"", line);
+            if(response_buffer != NULL && response_buffer_length > 0) {
+                response_buffer[0] = '\0';
+                append_line(response_buffer, response_buffer_length, line);
+            }
+            return AT_COMMANDER_RESULT_ERROR;
+        }
+
+        if(prompt == '\0') {
+            append_line(response_buffer, response_buffer_length, line);
+        }
+    }
+}
+
+/** Private: The result when the device couldn't be reached - a timeout,
+ * unless the operation was stopped early.
+ */
+static AtCommanderResult unreachable_result(AtCommanderConfig* config) {
+    AtCommanderResult interrupted = at_commander_interrupted(config);
+    return interrupted != AT_COMMANDER_RESULT_OK ? interrupted :
+            AT_COMMANDER_RESULT_TIMEOUT;
+}
+
+AtCommanderResult final_result_request(AtCommanderConfig* config,
+        const char* request, const char* expected_response,
+        char* response_buffer, int response_buffer_length, int timeout_ms) {
+    AtCommanderResult result;
+    at_commander_trace(config, AT_TRACE_COMMAND, true, request, 0);
+    at_commander_write(config, request, strlen(request));
+    result = await_final_result(config, request, expected_response,
+            response_buffer, response_buffer_length, timeout_ms, '\0');
+    at_commander_trace(config, AT_TRACE_COMMAND, false, request, 0);
+    return result;
+}
+
+unsigned long final_result_wait_wcet_ms(AtCommanderConfig* config,
+        int timeout_ms) {
+    if(timeout_ms <= 0) {
+        timeout_ms = config->platform.response_timeout_ms;
+    }
+    // The last poll may start just before the timeout
+    return timeout_ms + AT_COMMANDER_LINE_POLL_DELAY_MS;
+}
+
+AtCommanderResult prompt_request(AtCommanderConfig* config,
+        const char* request, int timeout_ms) {
+    AtCommanderResult result;
+    at_commander_trace(config, AT_TRACE_COMMAND, true, request, 0);
+    at_commander_write(config, request, strlen(request));
+    result = await_final_result(config, request, NULL, NULL, 0, timeout_ms,
+            AT_COMMANDER_INPUT_PROMPT);
+    at_commander_trace(config, AT_TRACE_COMMAND, false, request, 0);
+    return result;
+}
+
+AtCommanderResult at_commander_send_with_prompt(AtCommanderConfig* config,
+        const char* request, const uint8_t* payload, int size,
+        const char* expected_response, int timeout_ms) {
+    AtCommanderResult result;
+    if(!config->platform.final_result_codes) {
+        at_commander_debug(config, "Platform doesn't use final result codes");
+        return AT_COMMANDER_RESULT_ERROR;
+    }
+
+    if(!at_commander_enter_command_mode(config)) {
+        at_commander_debug(config,
+                "Unable to enter command mode, can't send data");
+        return unreachable_result(config);
+    }
+
+    result = prompt_request(config, request, 0);
+    if(result != AT_COMMANDER_RESULT_OK) {
+        return result;
+    }
+
+    at_commander_trace(config, AT_TRACE_COMMAND, true, NULL, size);
+    if(!at_commander_write_all(config, payload, size, timeout_ms)) {
+        at_commander_debug(config, "Unable to send %d byte payload", size);
+        result = unreachable_result(config);
+    } else {
+        result = await_final_result(config, NULL, expected_response, NULL, 0,
+                timeout_ms, '\0');
+    }
+    at_commander_trace(config, AT_TRACE_COMMAND, false, NULL, size);
+    return result;
+}
+
+AtCommanderResult at_commander_command(AtCommanderConfig* config,
+        const char* request, char* response_buffer,
+        int response_buffer_length, int timeout_ms) {
+    AtCommanderResult result;
+    int attempts = 0;
+    if(!config->platform.final_result_codes) {
+        at_commander_debug(config, "Platform doesn't use final result codes");
+        return AT_COMMANDER_RESULT_ERROR;
+    }
+
+    if(!at_commander_enter_command_mode(config)) {
+        at_commander_debug(config,
+                "Unable to enter command mode, can't send command");
+        return unreachable_result(config);
+    }
+
+    do {
+        result = final_result_request(config, request, NULL, response_buffer,
+                response_buffer_length, timeout_ms);
+        attempts++;
+    } while(result != AT_COMMANDER_RESULT_OK
+            && at_commander_retry(config, result, attempts));
+    return result;
+}
+
+int hayes_baud_rate_mapper(int baud) {
+    // AT+IPR takes the baud rate itself
+    return baud;
+}
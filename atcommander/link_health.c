@@ -0,0 +1,244 @@
+#include "link_health.h"
+#include "atcommander_private.h"
+
+#include <string.h>
+
+/** Private: Read the UART's error totals, keeping the last ones if they can't
+ * be read - so an unreadable window counts as clean.
+ */
+static void read_errors(AtCommanderLinkHealth* health,
+        AtCommanderLineErrors* errors) {
+    AtCommanderConfig* config = health->config;
+    if(config->line_errors_function == NULL
+            || !config->line_errors_function(config->device, errors)) {
+        *errors = health->last_errors;
+    }
+}
+
+/** Private: Start a new window from now, without counting anything since the
+ * last one - e.g. the errors expected while the rate was being changed.
+ */
+static void start_window(AtCommanderLinkHealth* health, unsigned long now) {
+    read_errors(health, &health->last_errors);
+    health->last_bytes_received = health->config->data_stats.bytes_received;
+    health->window_started_at = now;
+}
+
+/** Private: Count the errors and bytes of the window that just ended, and
+ * start the next one.
+ *
+ * Returns true if the window was bad.
+ */
+static bool close_window(AtCommanderLinkHealth* health, unsigned long now) {
+    AtCommanderLineErrors errors;
+    unsigned long framing, parity, overrun;
+    unsigned long bytes_received = health->config->data_stats.bytes_received;
+
+    read_errors(health, &errors);
+    framing = errors.framing - health->last_errors.framing;
+    parity = errors.parity - health->last_errors.parity;
+    overrun = errors.overrun - health->last_errors.overrun;
+    health->errors.framing += framing;
+    health->errors.parity += parity;
+    health->errors.overrun += overrun;
+
+    health->window_errors = framing + parity + overrun;
+    health->window_bytes = bytes_received - health->last_bytes_received;
+    health->last_errors = errors;
+    health->last_bytes_received = bytes_received;
+    health->window_started_at = now;
+
+    return health->window_errors >= health->min_window_errors
+            && health->window_errors * 1000
+                > health->max_error_permille * health->window_bytes;
+}
+
+static int rate_index(AtCommanderLinkHealth* health, int baud) {
+    int i;
+    for(i = 0; i < health->rate_count; i++) {
+        if(health->rates[i] == baud) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/** Private: Enter command mode, trying the rate the device should be at on
+ * its own before sweeping them all.
+ */
+static bool enter_at(AtCommanderConfig* config, int baud) {
+    const int* rates = config->platform.baud_rates;
+    int rate_count = config->platform.baud_rate_count;
+    bool entered;
+
+    config->platform.baud_rates = &baud;
+    config->platform.baud_rate_count = 1;
+    entered = at_commander_enter_command_mode(config);
+    config->platform.baud_rates = rates;
+    config->platform.baud_rate_count = rate_count;
+
+    return entered || at_commander_enter_command_mode(config);
+}
+
+/** Private: Move the device and host to the rate at index, and make sure
+ * they're talking at it, leaving the device in data mode.
+ *
+ * Returns the action if the rate was changed, otherwise
+ * AT_LINK_HEALTH_CHANGE_FAILED.
+ */
+static AtCommanderLinkHealthAction change_rate(AtCommanderLinkHealth* health,
+        int index, AtCommanderLinkHealthAction action) {
+    AtCommanderConfig* config = health->config;
+    int baud = health->rates[index];
+    int expected = config->baud;
+    bool found;
+    int index_found;
+
+    at_commander_debug(config, "Link health moving from baud %d to %d",
+            config->baud, baud);
+    if(enter_at(config, config->baud) && at_commander_set_baud(config, baud)) {
+        // The new rate is only used once it's applied
+        if(config->platform.reboot_command.request_format != NULL) {
+            at_commander_reboot(config);
+            at_commander_delay_ms(config, health->reboot_settle_ms);
+        } else {
+            at_commander_exit_command_mode(config);
+        }
+        expected = baud;
+    }
+
+    // Wherever the device ended up, find it and leave it in data mode
+    found = enter_at(config, expected);
+    if(found) {
+        at_commander_exit_command_mode(config);
+        index_found = rate_index(health, config->baud);
+        if(index_found != -1) {
+            health->current = index_found;
+        }
+    }
+
+    health->bad_windows = 0;
+    health->clean_since = at_commander_millis(config);
+    start_window(health, health->clean_since);
+
+    if(found && config->baud == baud && !config->connected) {
+        at_commander_debug(config, "Link health moved to baud %d", baud);
+        if(action == AT_LINK_HEALTH_DOWNGRADED) {
+            health->downgrades++;
+        } else {
+            health->upgrades++;
+        }
+        return action;
+    }
+    at_commander_debug(config, "Link health unable to move to baud %d",
+            baud);
+    health->failed_changes++;
+    return AT_LINK_HEALTH_CHANGE_FAILED;
+}
+
+/** Private: Make the wait before the next upgrade probe twice as long, up to
+ * the limit.
+ */
+static void back_off_upgrades(AtCommanderLinkHealth* health) {
+    health->upgrade_ms *= 2;
+    if(health->upgrade_ms > health->max_upgrade_ms) {
+        health->upgrade_ms = health->max_upgrade_ms;
+    }
+}
+
+bool at_commander_link_health_init(AtCommanderLinkHealth* health,
+        AtCommanderConfig* config) {
+    int i;
+    memset(health, 0, sizeof(AtCommanderLinkHealth));
+    health->config = config;
+    health->window_ms = AT_COMMANDER_DEFAULT_HEALTH_WINDOW_MS;
+    health->max_error_permille = AT_COMMANDER_DEFAULT_MAX_ERROR_PERMILLE;
+    health->min_window_errors = AT_COMMANDER_DEFAULT_MIN_WINDOW_ERRORS;
+    health->downgrade_windows = AT_COMMANDER_DEFAULT_DOWNGRADE_WINDOWS;
+    health->probation_windows = AT_COMMANDER_DEFAULT_PROBATION_WINDOWS;
+    health->initial_upgrade_ms = AT_COMMANDER_DEFAULT_INITIAL_UPGRADE_MS;
+    health->max_upgrade_ms = AT_COMMANDER_DEFAULT_MAX_UPGRADE_MS;
+    health->reboot_settle_ms = AT_COMMANDER_DEFAULT_REBOOT_SETTLE_MS;
+    health->upgrade_ms = health->initial_upgrade_ms;
+
+    health->rate_count = at_commander_candidate_baud_rates(config,
+            health->rates, AT_COMMANDER_LINK_HEALTH_MAX_RATES);
+    if(health->rate_count > AT_COMMANDER_LINK_HEALTH_MAX_RATES) {
+        health->rate_count = AT_COMMANDER_LINK_HEALTH_MAX_RATES;
+    }
+    // Platforms list their rates most likely first, so sort them
+    for(i = 1; i < health->rate_count; i++) {
+        int baud = health->rates[i];
+        int j = i;
+        while(j > 0 && health->rates[j - 1] > baud) {
+            health->rates[j] = health->rates[j - 1];
+            j--;
+        }
+        health->rates[j] = baud;
+    }
+
+    health->current = rate_index(health, config->baud);
+    if(health->current == -1) {
+        at_commander_debug(config, "Baud %d isn't a candidate rate, can't "
+                "watch link health", config->baud);
+        return false;
+    }
+    health->ceiling = health->current;
+    health->clean_since = at_commander_millis(config);
+    start_window(health, health->clean_since);
+    return true;
+}
+
+AtCommanderLinkHealthAction at_commander_link_health_tick(
+        AtCommanderLinkHealth* health) {
+    unsigned long now = at_commander_millis(health->config);
+    bool bad;
+
+    if(now - health->window_started_at < health->window_ms) {
+        return AT_LINK_HEALTH_STEADY;
+    }
+
+    bad = close_window(health, now);
+    if(bad) {
+        at_commander_debug(health->config, "%lu line errors in %lu bytes",
+                health->window_errors, health->window_bytes);
+        health->bad_windows++;
+        health->clean_since = now;
+    } else {
+        health->bad_windows = 0;
+    }
+
+    if(health->probation_remaining > 0) {
+        if(bad) {
+            health->probation_remaining = 0;
+            back_off_upgrades(health);
+            return change_rate(health, health->current - 1,
+                    AT_LINK_HEALTH_DOWNGRADED);
+        }
+        if(--health->probation_remaining == 0) {
+            at_commander_debug(health->config, "Keeping baud %d",
+                    health->config->baud);
+            health->upgrade_ms = health->initial_upgrade_ms;
+        }
+        return AT_LINK_HEALTH_STEADY;
+    }
+
+    if(health->bad_windows >= health->downgrade_windows
+            && health->current > 0) {
+        return change_rate(health, health->current - 1,
+                AT_LINK_HEALTH_DOWNGRADED);
+    }
+
+    if(!bad && health->current < health->ceiling
+            && now - health->clean_since >= health->upgrade_ms) {
+        AtCommanderLinkHealthAction action = change_rate(health,
+                health->current + 1, AT_LINK_HEALTH_UPGRADED);
+        if(action == AT_LINK_HEALTH_UPGRADED) {
+            health->probation_remaining = health->probation_windows;
+        } else {
+            back_off_upgrades(health);
+        }
+        return action;
+    }
+    return AT_LINK_HEALTH_STEADY;
+}
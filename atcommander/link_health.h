@@ -0,0 +1,107 @@
+#ifndef _ATCOMMANDER_LINK_HEALTH_H_
+#define _ATCOMMANDER_LINK_HEALTH_H_
+
+#include "atcommander.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Enough for every rate of any platform
+#define AT_COMMANDER_LINK_HEALTH_MAX_RATES 16
+#define AT_COMMANDER_DEFAULT_HEALTH_WINDOW_MS 1000
+#define AT_COMMANDER_DEFAULT_MAX_ERROR_PERMILLE 2
+#define AT_COMMANDER_DEFAULT_MIN_WINDOW_ERRORS 3
+#define AT_COMMANDER_DEFAULT_DOWNGRADE_WINDOWS 3
+#define AT_COMMANDER_DEFAULT_PROBATION_WINDOWS 5
+#define AT_COMMANDER_DEFAULT_INITIAL_UPGRADE_MS 60000
+#define AT_COMMANDER_DEFAULT_MAX_UPGRADE_MS 3600000
+#define AT_COMMANDER_DEFAULT_REBOOT_SETTLE_MS 1000
+
+typedef enum {
+    AT_LINK_HEALTH_STEADY,
+    AT_LINK_HEALTH_DOWNGRADED,
+    AT_LINK_HEALTH_UPGRADED,
+    // A rate change was tried and didn't stick - the link is at config->baud
+    AT_LINK_HEALTH_CHANGE_FAILED
+} AtCommanderLinkHealthAction;
+
+/** Public: Watches the UART errors a config's line_errors_function reports
+ * while in data mode, and moves the link between the baud rates the device
+ * and host share to keep the fastest one that's still clean.
+ *
+ * Time is split into windows - a window is bad if it saw at least
+ * min_window_errors errors and more than max_error_permille per thousand bytes
+ * received. After downgrade_windows bad windows in a row the link steps down
+ * one rate. Once it's been clean for the upgrade interval it steps back up
+ * one rate on probation - a bad window during probation steps it straight
+ * back down and doubles the interval, so a rate that doesn't work is retried
+ * less and less often, while one that passes resets it.
+ *
+ * A rate change sets the device's rate, applies it with a reboot (or by
+ * leaving command mode, on platforms without one, e.g. the XBee), and then
+ * confirms it at the new rate. Rebooting drops any wireless link the device
+ * had, so changes are only made from at_commander_link_health_tick.
+ */
+typedef struct {
+    AtCommanderConfig* config;
+    // The rates the device and host share, slowest first
+    int rates[AT_COMMANDER_LINK_HEALTH_MAX_RATES];
+    int rate_count;
+    // Where config->baud is in rates, and the fastest rate to use
+    int current;
+    int ceiling;
+
+    unsigned long window_ms;
+    unsigned long max_error_permille;
+    unsigned long min_window_errors;
+    int downgrade_windows;
+    int probation_windows;
+    unsigned long initial_upgrade_ms;
+    unsigned long max_upgrade_ms;
+    unsigned long reboot_settle_ms;
+
+    unsigned long window_started_at;
+    unsigned long clean_since;
+    unsigned long upgrade_ms;
+    AtCommanderLineErrors last_errors;
+    unsigned long last_bytes_received;
+    int bad_windows;
+    // Windows left before a probed rate is kept, 0 when not probing
+    int probation_remaining;
+
+    // The last complete window
+    unsigned long window_errors;
+    unsigned long window_bytes;
+    // Totals since init
+    AtCommanderLineErrors errors;
+    int downgrades;
+    int upgrades;
+    int failed_changes;
+} AtCommanderLinkHealth;
+
+/** Public: Start watching the link of the device in config, which should be
+ * connected at its fastest wanted rate (e.g. after at_commander_set_baud).
+ * That rate is the ceiling - the link is never moved above it.
+ *
+ * The config must have millis and line errors functions.
+ *
+ * Returns false if config->baud isn't one of the candidate rates.
+ */
+bool at_commander_link_health_init(AtCommanderLinkHealth* health,
+        AtCommanderConfig* config);
+
+/** Public: Close the window if it's over, and step the baud rate down or up
+ * if it's due. Call this periodically from the main loop while in data mode -
+ * it only blocks while changing the rate.
+ *
+ * Returns what was done about the rate.
+ */
+AtCommanderLinkHealthAction at_commander_link_health_tick(
+        AtCommanderLinkHealth* health);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _ATCOMMANDER_LINK_HEALTH_H_
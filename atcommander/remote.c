@@ -0,0 +1,95 @@
+#include "remote.h"
+#include "atcommander_private.h"
+#include "datamode.h"
+
+#include <string.h>
+
+/** Private: The remote config's write function - the bytes go over the link
+ * as data, waiting out any backpressure from the local device.
+ *
+ * If the link doesn't take a byte, the rest of the command is dropped and the
+ * remote config's budget is spent, so the request stops right away rather
+ * than timing out as if the remote device hadn't answered.
+ */
+static void remote_write(void* device, uint8_t byte) {
+    AtCommanderRemoteSession* remote = (AtCommanderRemoteSession*)device;
+    if(remote->write_failed) {
+        return;
+    }
+    if(!at_commander_write_all(remote->link, &byte, 1, 0)) {
+        at_commander_debug(remote->link, "Link stalled, dropping command");
+        remote->write_failed = true;
+        remote->config.has_deadline = true;
+        remote->config.deadline = at_commander_millis(&remote->config);
+    }
+}
+
+static int remote_read(void* device) {
+    AtCommanderRemoteSession* remote = (AtCommanderRemoteSession*)device;
+    uint8_t byte;
+    if(at_commander_data_read(remote->link, &byte, 1) == 1) {
+        return byte;
+    }
+    return -1;
+}
+
+void at_commander_remote_init(AtCommanderRemoteSession* remote,
+        AtCommanderConfig* link) {
+    AtCommanderConfig* config = &remote->config;
+    memset(remote, 0, sizeof(AtCommanderRemoteSession));
+    remote->link = link;
+    remote->link_baud = link->baud;
+
+    config->platform = link->platform;
+    // One "baud rate", so entering command mode is tried exactly once
+    config->platform.baud_rates = &remote->link_baud;
+    config->platform.baud_rate_count = 1;
+    config->baud = link->baud;
+    config->device_baud = link->baud;
+
+    config->device = remote;
+    config->write_function = remote_write;
+    config->read_function = remote_read;
+    config->delay_function = link->delay_function;
+    config->log_function = link->log_function;
+    config->millis_function = link->millis_function;
+    config->trace_function = link->trace_function;
+    config->cancel_flag = link->cancel_flag;
+    config->retry_policy = link->retry_policy;
+}
+
+bool at_commander_remote_configure(AtCommanderRemoteSession* remote,
+        const AtCommand* commands, int count, bool reboot) {
+    AtCommanderConfig* config = &remote->config;
+    bool has_deadline = config->has_deadline;
+    unsigned long deadline = config->deadline;
+    bool configured;
+    if(remote->link->connected) {
+        at_commander_debug(config,
+                "Local device is in command mode, can't reach remote device");
+        return false;
+    }
+
+    remote->write_failed = false;
+    if(!at_commander_apply_settings(config, commands, count)) {
+        at_commander_debug(config, "Unable to configure remote device");
+        if(!remote->write_failed) {
+            at_commander_exit_command_mode(config);
+        }
+        configured = false;
+    } else if(reboot) {
+        configured = at_commander_reboot(config);
+    } else {
+        configured = at_commander_exit_command_mode(config);
+    }
+
+    if(remote->write_failed) {
+        at_commander_debug(config, "Link stalled, remote device may still be "
+                "in command mode");
+        configured = false;
+    }
+    // Put back any budget the caller set, which a stall overrides
+    config->has_deadline = has_deadline;
+    config->deadline = deadline;
+    return configured;
+}
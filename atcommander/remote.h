@@ -0,0 +1,63 @@
+#ifndef _ATCOMMANDER_REMOTE_H_
+#define _ATCOMMANDER_REMOTE_H_
+
+#include "atcommander.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Public: A session with the device at the far end of a data link, e.g. an
+ * RN-42 that the local module is connected to over Bluetooth.
+ *
+ * The remote device's config sends and receives through the local device's
+ * data mode, so the same commands used over a UART work over the air. The
+ * remote device only accepts its command mode escape within its configuration
+ * window - a timer (see at_commander_set_configuration_timer) of 1-252 seconds
+ * after it powers up, or always with 255.
+ *
+ * The link has no baud rate of its own, so entering command mode is a single
+ * attempt rather than a sweep.
+ */
+typedef struct {
+    AtCommanderConfig config;
+    // The local device, which must stay in data mode with the link up
+    AtCommanderConfig* link;
+    int link_baud;
+    // Set when the link stayed too backed up to take a byte of a command
+    bool write_failed;
+} AtCommanderRemoteSession;
+
+/** Public: Set up a session with the device at the other end of the local
+ * device's link.
+ *
+ * The remote device is assumed to be on the same platform as the local one -
+ * change remote->config.platform afterwards if it isn't. The delay, clock,
+ * log, trace, cancel and retry settings are shared with the link.
+ */
+void at_commander_remote_init(AtCommanderRemoteSession* remote,
+        AtCommanderConfig* link);
+
+/** Public: Apply a batch of settings to the remote device in one session -
+ * enter its command mode once, send each command, store them once and return
+ * it to data mode (or reboot it, for settings that only take effect on boot).
+ *
+ * If a setting fails, nothing is stored and the remote device is returned to
+ * data mode so the link keeps carrying data. If the link stalls partway
+ * through a command, the session stops there instead of waiting for a
+ * response to a command that was cut short.
+ *
+ *  commands - the settings to apply, in order.
+ *  count - the number of commands.
+ *  reboot - reboot the remote device afterwards, which drops the link.
+ *
+ * Returns true if every setting was applied.
+ */
+bool at_commander_remote_configure(AtCommanderRemoteSession* remote,
+        const AtCommand* commands, int count, bool reboot);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _ATCOMMANDER_REMOTE_H_
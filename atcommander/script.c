@@ -0,0 +1,249 @@
+#include "script.h"
+#include "atcommander_private.h"
+
+#include <string.h>
+
+/** Private: The bytecode being run and where the next operand is - every read
+ * is checked against the end, so a script that's cut short or corrupt is
+ * caught instead of reading past it.
+ */
+typedef struct {
+    const uint8_t* script;
+    int size;
+    int pc;
+} ScriptReader;
+
+static bool read_byte(ScriptReader* reader, uint8_t* value) {
+    if(reader->pc >= reader->size) {
+        return false;
+    }
+    *value = reader->script[reader->pc++];
+    return true;
+}
+
+static bool read_number(ScriptReader* reader, int bytes,
+        unsigned long* value) {
+    int i;
+    if(reader->size - reader->pc < bytes) {
+        return false;
+    }
+    *value = 0;
+    for(i = 0; i < bytes; i++) {
+        *value |= (unsigned long)reader->script[reader->pc++] << (8 * i);
+    }
+    return true;
+}
+
+/** Private: Point at a string in the script, without copying it.
+ */
+static bool read_string(ScriptReader* reader, const char** string) {
+    const uint8_t* start = &reader->script[reader->pc];
+    const uint8_t* end;
+    if(reader->pc >= reader->size) {
+        return false;
+    }
+    end = (const uint8_t*)memchr(start, '\0', reader->size - reader->pc);
+    if(end == NULL) {
+        return false;
+    }
+    *string = (const char*)start;
+    reader->pc += end - start + 1;
+    return true;
+}
+
+static bool read_register(ScriptReader* reader, AtCommanderScriptState* state,
+        bool optional, char** value) {
+    uint8_t index;
+    if(!read_byte(reader, &index)) {
+        return false;
+    }
+    if(optional && index == AT_SCRIPT_NO_REGISTER) {
+        *value = NULL;
+        return true;
+    }
+    if(index >= AT_SCRIPT_REGISTER_COUNT) {
+        return false;
+    }
+    *value = state->registers[index];
+    return true;
+}
+
+/** Private: Fill in a request with a register's value in place of its first
+ * "%s" - the request isn't used as a format, so a script can't use any other
+ * conversions.
+ *
+ * Returns false if the result doesn't fit.
+ */
+static bool substitute(char* request, const char* format, const char* value) {
+    const char* marker = value != NULL ? strstr(format, "%s") : NULL;
+    int prefix = marker != NULL ? (int)(marker - format) : (int)strlen(format);
+    int length = prefix;
+    if(marker != NULL) {
+        length += strlen(value) + strlen(marker + 2);
+    }
+    if(length >= AT_COMMANDER_MAX_REQUEST_LENGTH) {
+        return false;
+    }
+
+    memcpy(request, format, prefix);
+    request[prefix] = '\0';
+    if(marker != NULL) {
+        strcat(request, value);
+        strcat(request, marker + 2);
+    }
+    return true;
+}
+
+/** Private: Read a value into a register, leaving the register alone if the
+ * request fails.
+ */
+static bool run_get(AtCommanderConfig* config, char* value,
+        const char* request, const char* error) {
+    AtCommand command = { request, NULL, error[0] != '\0' ? error : NULL };
+    char response[AT_SCRIPT_REGISTER_LENGTH];
+    int length;
+    if(!at_commander_enter_command_mode(config)) {
+        return false;
+    }
+
+    length = get_request(config, &command, response, sizeof(response));
+    // Only a final result tells an empty value from no response at all
+    if(length < 0 || (length == 0 && !config->platform.final_result_codes)) {
+        return false;
+    }
+    strcpy(value, response);
+    return true;
+}
+
+static bool run_set(AtCommanderConfig* config, const char* value,
+        const char* format, const char* expected) {
+    char request[AT_COMMANDER_MAX_REQUEST_LENGTH];
+    if(!substitute(request, format, value)) {
+        at_commander_debug(config, "Script request too long: %s", format);
+        return false;
+    }
+    return at_commander_enter_command_mode(config)
+            && set_request(config, request, expected);
+}
+
+void at_commander_script_init(AtCommanderScriptState* state) {
+    memset(state, 0, sizeof(AtCommanderScriptState));
+}
+
+AtCommanderScriptResult at_commander_run_script(AtCommanderConfig* config,
+        const uint8_t* script, int size, AtCommanderScriptState* state) {
+    ScriptReader reader = { script, size, 0 };
+    uint8_t version;
+
+    state->pc = 0;
+    if(script == NULL || !read_byte(&reader, &version)
+            || version != AT_SCRIPT_VERSION) {
+        at_commander_debug(config, "Not a version %d script",
+                AT_SCRIPT_VERSION);
+        return AT_SCRIPT_MALFORMED;
+    }
+
+    while(true) {
+        const char* first;
+        const char* second;
+        char* value;
+        unsigned long number;
+        uint8_t opcode;
+        int operation;
+        bool succeeded = true;
+
+        state->pc = reader.pc;
+        if(at_commander_interrupted(config) != AT_COMMANDER_RESULT_OK) {
+            return AT_SCRIPT_INTERRUPTED;
+        }
+        if(!read_byte(&reader, &opcode)) {
+            return AT_SCRIPT_MALFORMED;
+        }
+
+        operation = opcode & ~AT_SCRIPT_OPTIONAL;
+        switch(operation) {
+        case AT_SCRIPT_END:
+            return AT_SCRIPT_SUCCEEDED;
+        case AT_SCRIPT_FAIL:
+            return AT_SCRIPT_FAILED;
+        case AT_SCRIPT_ENTER:
+            succeeded = at_commander_enter_command_mode(config);
+            break;
+        case AT_SCRIPT_EXIT:
+            succeeded = at_commander_exit_command_mode(config);
+            break;
+        case AT_SCRIPT_GET:
+            if(!read_register(&reader, state, false, &value)
+                    || !read_string(&reader, &first)
+                    || !read_string(&reader, &second)) {
+                return AT_SCRIPT_MALFORMED;
+            }
+            succeeded = run_get(config, value, first, second);
+            break;
+        case AT_SCRIPT_COMPARE:
+            if(!read_register(&reader, state, false, &value)
+                    || !read_string(&reader, &first)) {
+                return AT_SCRIPT_MALFORMED;
+            }
+            state->condition = !strcmp(value, first);
+            continue;
+        case AT_SCRIPT_SET:
+            if(!read_register(&reader, state, true, &value)
+                    || !read_string(&reader, &first)
+                    || !read_string(&reader, &second)) {
+                return AT_SCRIPT_MALFORMED;
+            }
+            succeeded = run_set(config, value, first, second);
+            break;
+        case AT_SCRIPT_STORE:
+            // Some devices (RN-42) save each setting as it's made
+            succeeded = config->platform.store_settings_command.request_format
+                        == NULL
+                    || (at_commander_enter_command_mode(config)
+                        && at_commander_store_settings(config));
+            break;
+        case AT_SCRIPT_REBOOT:
+            succeeded = at_commander_reboot(config);
+            break;
+        case AT_SCRIPT_WAIT:
+            if(!read_number(&reader, 2, &number)) {
+                return AT_SCRIPT_MALFORMED;
+            }
+            at_commander_delay_ms(config, number);
+            continue;
+        case AT_SCRIPT_BAUD:
+            if(!read_number(&reader, 4, &number)) {
+                return AT_SCRIPT_MALFORMED;
+            }
+            succeeded = at_commander_set_baud(config, (int)number);
+            break;
+        case AT_SCRIPT_JUMP:
+        case AT_SCRIPT_JUMP_IF:
+        case AT_SCRIPT_JUMP_UNLESS:
+            // Only the version byte is off limits, a target at the end is
+            // caught when the next opcode is read
+            if(!read_number(&reader, 2, &number) || number == 0) {
+                return AT_SCRIPT_MALFORMED;
+            }
+            if(operation == AT_SCRIPT_JUMP
+                    || (operation == AT_SCRIPT_JUMP_IF && state->condition)
+                    || (operation == AT_SCRIPT_JUMP_UNLESS
+                        && !state->condition)) {
+                reader.pc = (int)number;
+            }
+            continue;
+        default:
+            at_commander_debug(config, "Unknown script opcode 0x%x at %d",
+                    opcode, state->pc);
+            return AT_SCRIPT_MALFORMED;
+        }
+
+        if(opcode & AT_SCRIPT_OPTIONAL) {
+            state->condition = succeeded;
+        } else if(!succeeded) {
+            at_commander_debug(config, "Script operation 0x%x at %d failed",
+                    opcode, state->pc);
+            return AT_SCRIPT_FAILED;
+        }
+    }
+}
@@ -0,0 +1,123 @@
+#ifndef _ATCOMMANDER_SCRIPT_H_
+#define _ATCOMMANDER_SCRIPT_H_
+
+#include "atcommander.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Provisioning scripts - a sequence of library operations as bytecode, so it
+ * can be changed without rebuilding the firmware that runs it. Scripts are run
+ * in place, from flash or a buffer they were received into, and are checked as
+ * they run, so a corrupt one fails instead of running off its end.
+ *
+ * A script is a version byte, then instructions - an opcode byte and its
+ * operands. Strings are NUL terminated, registers are a byte, and numbers and
+ * jump targets (offsets from the start of the script) are little endian.
+ *
+ *  END                          - stop, the script succeeded
+ *  FAIL                         - stop, the script failed
+ *  ENTER                        - enter command mode
+ *  EXIT                         - return to data mode
+ *  GET reg request error        - send a query and keep its response in a
+ *                                 register - an empty error means any
+ *                                 response is a success
+ *  COMPARE reg string           - set the condition if the register holds
+ *                                 the string
+ *  SET reg request expected     - send a setting, with the register's value in
+ *                                 place of the first "%s" in the request, or
+ *                                 AT_SCRIPT_NO_REGISTER for none
+ *  STORE                        - store the settings in non-volatile memory
+ *  REBOOT                       - reboot the device
+ *  WAIT ms(16)                  - delay
+ *  BAUD baud(32)                - change the device's baud rate, see
+ *                                 at_commander_set_baud
+ *  JUMP target(16)              - continue at the target
+ *  JUMP_IF target(16)           - continue at the target if the condition is
+ *                                 set
+ *  JUMP_UNLESS target(16)       - continue at the target if it isn't
+ *
+ * If an operation fails, the script stops and fails - unless its opcode has
+ * AT_SCRIPT_OPTIONAL set, in which case the condition is set to whether it
+ * succeeded and the script carries on.
+ *
+ * GET, SET and STORE enter command mode first if need be. A script that loops
+ * forever runs until the config's cancel flag is set or its budget is spent.
+ */
+
+#define AT_SCRIPT_VERSION 1
+
+#ifndef AT_SCRIPT_REGISTER_COUNT
+#define AT_SCRIPT_REGISTER_COUNT 4
+#endif
+
+#ifndef AT_SCRIPT_REGISTER_LENGTH
+#define AT_SCRIPT_REGISTER_LENGTH 32
+#endif
+
+// Set on an operation's opcode to carry on if it fails
+#define AT_SCRIPT_OPTIONAL 0x80
+#define AT_SCRIPT_NO_REGISTER 0xff
+
+typedef enum {
+    AT_SCRIPT_END,
+    AT_SCRIPT_FAIL,
+    AT_SCRIPT_ENTER,
+    AT_SCRIPT_EXIT,
+    AT_SCRIPT_GET,
+    AT_SCRIPT_COMPARE,
+    AT_SCRIPT_SET,
+    AT_SCRIPT_STORE,
+    AT_SCRIPT_REBOOT,
+    AT_SCRIPT_WAIT,
+    AT_SCRIPT_BAUD,
+    AT_SCRIPT_JUMP,
+    AT_SCRIPT_JUMP_IF,
+    AT_SCRIPT_JUMP_UNLESS,
+    AT_SCRIPT_OPCODE_COUNT
+} AtCommanderScriptOpcode;
+
+typedef enum {
+    // Reached END
+    AT_SCRIPT_SUCCEEDED,
+    // Reached FAIL, or an operation failed
+    AT_SCRIPT_FAILED,
+    // An unknown opcode or version, a bad register or jump target, or an
+    // instruction that runs off the end of the script
+    AT_SCRIPT_MALFORMED,
+    // Stopped by the config's cancel flag or budget
+    AT_SCRIPT_INTERRUPTED
+} AtCommanderScriptResult;
+
+/** Public: What a script works with - its registers can be filled in before
+ * it runs (e.g. with a name for this unit) and read once it's done.
+ */
+typedef struct {
+    char registers[AT_SCRIPT_REGISTER_COUNT][AT_SCRIPT_REGISTER_LENGTH];
+    bool condition;
+    // The offset of the instruction that's running, or that stopped the script
+    int pc;
+} AtCommanderScriptState;
+
+/** Public: Clear a script's registers and condition.
+ */
+void at_commander_script_init(AtCommanderScriptState* state);
+
+/** Public: Run a script until it ends.
+ *
+ *  script - the bytecode, which isn't copied.
+ *  size - the length of the script.
+ *  state - the registers, from at_commander_script_init.
+ *
+ * Returns how the script ended, with state->pc at the instruction that ended
+ * it.
+ */
+AtCommanderScriptResult at_commander_run_script(AtCommanderConfig* config,
+        const uint8_t* script, int size, AtCommanderScriptState* state);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _ATCOMMANDER_SCRIPT_H_
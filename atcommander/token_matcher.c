@@ -0,0 +1,169 @@
+#include "token_matcher.h"
+
+#include <stddef.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static const uint8_t LINE_ENDINGS[] = {'\r', '\n'};
+
+void at_commander_token_matcher_init(AtCommanderTokenMatcher* matcher) {
+    matcher->token_count = 0;
+    matcher->first_byte_count = 0;
+    at_commander_token_matcher_reset(matcher);
+}
+
+int at_commander_token_matcher_add(AtCommanderTokenMatcher* matcher,
+        const char* token) {
+    int i;
+    if(token == NULL || token[0] == '\0'
+            || matcher->token_count >= AT_COMMANDER_MAX_TOKENS) {
+        return -1;
+    }
+    matcher->tokens[matcher->token_count] = token;
+    matcher->progress[matcher->token_count] = 0;
+
+    for(i = 0; i < matcher->first_byte_count
+            && matcher->first_bytes[i] != (uint8_t)token[0]; i++);
+    if(i == matcher->first_byte_count) {
+        matcher->first_bytes[matcher->first_byte_count++] = token[0];
+    }
+    return matcher->token_count++;
+}
+
+void at_commander_token_matcher_reset(AtCommanderTokenMatcher* matcher) {
+    int i;
+    for(i = 0; i < AT_COMMANDER_MAX_TOKENS; i++) {
+        matcher->progress[i] = 0;
+    }
+}
+
+int at_commander_token_matcher_feed(AtCommanderTokenMatcher* matcher,
+        uint8_t byte) {
+    int matched = -1;
+    int i;
+    for(i = 0; i < matcher->token_count; i++) {
+        const char* token = matcher->tokens[i];
+        if(token[matcher->progress[i]] != byte) {
+            // Restart, but the mismatched byte may itself begin a new match
+            matcher->progress[i] = 0;
+            if(token[0] != byte) {
+                continue;
+            }
+        }
+
+        matcher->progress[i]++;
+        if(token[matcher->progress[i]] == '\0') {
+            matcher->progress[i] = 0;
+            if(matched == -1) {
+                matched = i;
+            }
+        }
+    }
+    return matched;
+}
+
+/** Private: Find the first byte in a buffer that's any of a small set (at most
+ * AT_COMMANDER_MAX_TOKENS bytes), a vector of bytes at a time if possible.
+ *
+ * Returns the index of the byte, or size if there isn't one.
+ */
+static int find_any(const uint8_t* bytes, int size, const uint8_t* set,
+        int set_size) {
+    int i = 0;
+    int j;
+    if(set_size == 0) {
+        return size;
+    }
+
+#if defined(__AVX2__)
+    {
+        __m256i needles[AT_COMMANDER_MAX_TOKENS];
+        for(j = 0; j < set_size; j++) {
+            needles[j] = _mm256_set1_epi8((char)set[j]);
+        }
+        for(; i + 32 <= size; i += 32) {
+            __m256i block = _mm256_loadu_si256((const __m256i*)&bytes[i]);
+            __m256i hits = _mm256_cmpeq_epi8(block, needles[0]);
+            unsigned int mask;
+            for(j = 1; j < set_size; j++) {
+                hits = _mm256_or_si256(hits,
+                        _mm256_cmpeq_epi8(block, needles[j]));
+            }
+            mask = (unsigned int)_mm256_movemask_epi8(hits);
+            if(mask != 0) {
+                return i + __builtin_ctz(mask);
+            }
+        }
+    }
+#endif
+
+#if defined(__SSE2__)
+    {
+        __m128i needles[AT_COMMANDER_MAX_TOKENS];
+        for(j = 0; j < set_size; j++) {
+            needles[j] = _mm_set1_epi8((char)set[j]);
+        }
+        for(; i + 16 <= size; i += 16) {
+            __m128i block = _mm_loadu_si128((const __m128i*)&bytes[i]);
+            __m128i hits = _mm_cmpeq_epi8(block, needles[0]);
+            unsigned int mask;
+            for(j = 1; j < set_size; j++) {
+                hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, needles[j]));
+            }
+            mask = (unsigned int)_mm_movemask_epi8(hits);
+            if(mask != 0) {
+                return i + __builtin_ctz(mask);
+            }
+        }
+    }
+#endif
+
+    for(; i < size; i++) {
+        for(j = 0; j < set_size; j++) {
+            if(bytes[i] == set[j]) {
+                return i;
+            }
+        }
+    }
+    return size;
+}
+
+static bool in_partial_match(AtCommanderTokenMatcher* matcher) {
+    int i;
+    for(i = 0; i < matcher->token_count; i++) {
+        if(matcher->progress[i] != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int at_commander_token_matcher_scan(AtCommanderTokenMatcher* matcher,
+        const uint8_t* bytes, int size, int* matched) {
+    int i = 0;
+    *matched = -1;
+    while(i < size) {
+        if(!in_partial_match(matcher)) {
+            // Nothing but a token's first byte can change the state from here
+            i += find_any(&bytes[i], size - i, matcher->first_bytes,
+                    matcher->first_byte_count);
+            if(i == size) {
+                break;
+            }
+        }
+
+        *matched = at_commander_token_matcher_feed(matcher, bytes[i++]);
+        if(*matched != -1) {
+            break;
+        }
+    }
+    return i;
+}
+
+int at_commander_find_line_end(const uint8_t* bytes, int size) {
+    return find_any(bytes, size, LINE_ENDINGS, sizeof(LINE_ENDINGS));
+}
@@ -0,0 +1,80 @@
+#ifndef _ATCOMMANDER_TOKEN_MATCHER_H_
+#define _ATCOMMANDER_TOKEN_MATCHER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define AT_COMMANDER_MAX_TOKENS 4
+
+/** Public: An incremental matcher for a small set of fixed tokens (e.g. status
+ * strings like "%CONNECT") in a stream of bytes.
+ *
+ * Bytes are fed one at a time as they arrive, or a buffer at a time with
+ * at_commander_token_matcher_scan, so the matcher can sit directly on the RX
+ * path without buffering complete lines.
+ */
+typedef struct {
+    const char* tokens[AT_COMMANDER_MAX_TOKENS];
+    uint8_t progress[AT_COMMANDER_MAX_TOKENS];
+    int token_count;
+    // The distinct first bytes of the tokens - only these can start a match
+    uint8_t first_bytes[AT_COMMANDER_MAX_TOKENS];
+    int first_byte_count;
+} AtCommanderTokenMatcher;
+
+/** Public: Clear all registered tokens and any partial matches.
+ */
+void at_commander_token_matcher_init(AtCommanderTokenMatcher* matcher);
+
+/** Public: Register a token to watch for.
+ *
+ *  token - the string to match, must remain valid while the matcher is used.
+ *
+ *  Returns the ID of the token (its index), or -1 if the token is empty or the
+ *  matcher is full.
+ */
+int at_commander_token_matcher_add(AtCommanderTokenMatcher* matcher,
+        const char* token);
+
+/** Public: Drop any partial matches, e.g. after a mode change.
+ */
+void at_commander_token_matcher_reset(AtCommanderTokenMatcher* matcher);
+
+/** Public: Feed the next byte from the stream into the matcher.
+ *
+ *  Returns the ID of the token completed by this byte, or -1 if none was.
+ */
+int at_commander_token_matcher_feed(AtCommanderTokenMatcher* matcher,
+        uint8_t byte);
+
+/** Public: Feed a buffer from the stream into the matcher, stopping at the
+ * first token it completes.
+ *
+ * Outside of a partial match, bytes that can't begin a token are skipped
+ * several at a time where the CPU supports it (SSE2 or AVX2), so this is much
+ * cheaper than feeding each byte on a busy stream.
+ *
+ *  matched - set to the ID of the completed token, or -1 if none was.
+ *
+ *  Returns the number of bytes consumed, up to and including the end of the
+ *  matched token - call again with the rest of the buffer to continue.
+ */
+int at_commander_token_matcher_scan(AtCommanderTokenMatcher* matcher,
+        const uint8_t* bytes, int size, int* matched);
+
+/** Public: Find the first line ending ('\r' or '\n') in a buffer, using the
+ * same vectorized search as at_commander_token_matcher_scan.
+ *
+ *  Returns the index of the line ending, or size if there isn't one.
+ */
+int at_commander_find_line_end(const uint8_t* bytes, int size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _ATCOMMANDER_TOKEN_MATCHER_H_
@@ -0,0 +1,502 @@
+#include "xbee_api.h"
+#include "atcommander_private.h"
+#include "datamode.h"
+
+#include <string.h>
+
+#define AT_XBEE_START_DELIMITER 0x7E
+#define AT_XBEE_ESCAPE 0x7D
+#define AT_XBEE_XON 0x11
+#define AT_XBEE_XOFF 0x13
+#define AT_XBEE_ESCAPE_MASK 0x20
+
+// "Unknown" 16-bit network address - the 64-bit one is used instead
+#define AT_XBEE_UNKNOWN_NETWORK_ADDRESS 0xFFFE
+#define AT_XBEE_TRANSMIT_HEADER_LENGTH 14
+#define AT_XBEE_TRANSMIT_STATUS_LENGTH 7
+#define AT_XBEE_DELIVERY_SUCCESS 0
+#define AT_XBEE_COMMAND_HEADER_LENGTH 4
+#define AT_XBEE_REMOTE_COMMAND_HEADER_LENGTH 15
+#define AT_XBEE_APPLY_CHANGES 0x02
+
+#define AT_XBEE_FLUSH_POLL_MS 1
+
+enum {
+    PARSER_AWAITING_START,
+    PARSER_LENGTH_HIGH,
+    PARSER_LENGTH_LOW,
+    PARSER_FRAME,
+    PARSER_CHECKSUM,
+    // Passing over a frame that doesn't fit
+    PARSER_SKIPPING
+};
+
+static const AtCommand ENABLE_API_MODE[] = {
+    { "ATAP 1\r", "OK" },
+};
+
+static const AtCommand ENABLE_ESCAPED_API_MODE[] = {
+    { "ATAP 2\r", "OK" },
+};
+
+void at_commander_xbee_parser_init(AtCommanderXBeeFrameParser* parser,
+        bool escaped) {
+    memset(parser, 0, sizeof(AtCommanderXBeeFrameParser));
+    parser->escaped = escaped;
+    parser->state = PARSER_AWAITING_START;
+}
+
+int at_commander_xbee_parser_feed(AtCommanderXBeeFrameParser* parser,
+        uint8_t byte) {
+    if(byte == AT_XBEE_START_DELIMITER && (parser->escaped
+                || parser->state == PARSER_AWAITING_START)) {
+        // Unescaped, the delimiter always starts a frame, even if the last
+        // one was cut short
+        parser->state = PARSER_LENGTH_HIGH;
+        parser->unescape_next = false;
+        return 0;
+    }
+
+    if(parser->escaped) {
+        if(byte == AT_XBEE_ESCAPE) {
+            parser->unescape_next = true;
+            return 0;
+        }
+        if(parser->unescape_next) {
+            byte ^= AT_XBEE_ESCAPE_MASK;
+            parser->unescape_next = false;
+        }
+    }
+
+    switch(parser->state) {
+        case PARSER_LENGTH_HIGH:
+            parser->length = byte << 8;
+            parser->state = PARSER_LENGTH_LOW;
+            break;
+        case PARSER_LENGTH_LOW:
+            parser->length |= byte;
+            parser->received = 0;
+            parser->checksum = 0;
+            if(parser->length == 0) {
+                parser->state = PARSER_AWAITING_START;
+            } else if(parser->length > AT_COMMANDER_XBEE_MAX_FRAME_LENGTH) {
+                parser->oversized_frames++;
+                parser->state = PARSER_SKIPPING;
+            } else {
+                parser->state = PARSER_FRAME;
+            }
+            break;
+        case PARSER_FRAME:
+            parser->frame[parser->received++] = byte;
+            parser->checksum += byte;
+            if(parser->received == parser->length) {
+                parser->state = PARSER_CHECKSUM;
+            }
+            break;
+        case PARSER_CHECKSUM:
+            parser->state = PARSER_AWAITING_START;
+            if((uint8_t)(parser->checksum + byte) == 0xFF) {
+                return parser->length;
+            }
+            parser->checksum_errors++;
+            break;
+        case PARSER_SKIPPING:
+            // The frame and its checksum
+            if(++parser->received > parser->length) {
+                parser->state = PARSER_AWAITING_START;
+            }
+            break;
+        default:
+            break;
+    }
+    return 0;
+}
+
+uint64_t at_commander_xbee_read_address(const uint8_t* bytes) {
+    uint64_t address = 0;
+    int i;
+    for(i = 0; i < 8; i++) {
+        address = (address << 8) | bytes[i];
+    }
+    return address;
+}
+
+void at_commander_xbee_write_address(uint8_t* bytes, uint64_t address) {
+    int i;
+    for(i = 7; i >= 0; i--) {
+        bytes[i] = address & 0xFF;
+        address >>= 8;
+    }
+}
+
+bool at_commander_xbee_frame_source(const uint8_t* frame, int length,
+        uint64_t* address) {
+    int offset;
+    switch(frame[0]) {
+        case AT_XBEE_FRAME_RECEIVE_PACKET:
+        case AT_XBEE_FRAME_IO_SAMPLE:
+        case AT_XBEE_FRAME_NODE_IDENTIFICATION:
+            offset = 1;
+            break;
+        case AT_XBEE_FRAME_REMOTE_AT_RESPONSE:
+            // After the frame ID
+            offset = 2;
+            break;
+        default:
+            return false;
+    }
+    if(length < offset + 8) {
+        return false;
+    }
+    *address = at_commander_xbee_read_address(&frame[offset]);
+    return true;
+}
+
+void at_commander_xbee_api_init(AtCommanderXBeeApi* api,
+        AtCommanderConfig* config, bool escaped) {
+    memset(api, 0, sizeof(AtCommanderXBeeApi));
+    api->config = config;
+    at_commander_xbee_parser_init(&api->parser, escaped);
+    api->window = AT_COMMANDER_XBEE_DEFAULT_WINDOW;
+    api->max_attempts = AT_COMMANDER_XBEE_DEFAULT_MAX_ATTEMPTS;
+    api->status_timeout_ms = AT_COMMANDER_XBEE_DEFAULT_STATUS_TIMEOUT_MS;
+}
+
+bool at_commander_xbee_enable_api_mode(AtCommanderConfig* config,
+        bool escaped) {
+    if(config->capabilities_probed
+            && !at_commander_has_capability(config, AT_CAPABILITY_API_MODE)) {
+        at_commander_debug(config, "Firmware doesn't support API mode");
+        return false;
+    }
+    if(!at_commander_apply_settings(config, escaped ? ENABLE_ESCAPED_API_MODE
+                : ENABLE_API_MODE, 1)) {
+        at_commander_debug(config, "Unable to switch to API mode");
+        return false;
+    }
+    return at_commander_exit_command_mode(config);
+}
+
+int at_commander_xbee_add_destination(AtCommanderXBeeApi* api,
+        uint64_t address) {
+    AtCommanderXBeeDestination* destination;
+    if(api->destination_count == AT_COMMANDER_XBEE_MAX_DESTINATIONS) {
+        return -1;
+    }
+
+    destination = &api->destinations[api->destination_count];
+    memset(destination, 0, sizeof(AtCommanderXBeeDestination));
+    destination->address = address;
+    return api->destination_count++;
+}
+
+/** Private: The time from the config's millis function, or counted in
+ * process calls without one.
+ */
+static unsigned long api_millis(AtCommanderXBeeApi* api) {
+    if(api->config->millis_function != NULL) {
+        return at_commander_millis(api->config);
+    }
+    return api->process_clock_ms;
+}
+
+/** Private: Add a byte of a frame to the chunk being written, escaping it if
+ * needed, and write the chunk out once it's full.
+ *
+ * Returns false if the chunk couldn't be written - the rest of the frame must
+ * not follow it, or the device's parser would take it for a whole frame.
+ */
+static bool put_byte(AtCommanderXBeeApi* api, uint8_t* chunk, int* count,
+        int capacity, uint8_t byte) {
+    bool escape = api->parser.escaped && (byte == AT_XBEE_START_DELIMITER
+            || byte == AT_XBEE_ESCAPE || byte == AT_XBEE_XON
+            || byte == AT_XBEE_XOFF);
+    if(*count + 2 > capacity) {
+        if(!at_commander_write_all(api->config, chunk, *count, 0)) {
+            at_commander_debug(api->config, "Unable to write frame, dropped");
+            return false;
+        }
+        *count = 0;
+    }
+    if(escape) {
+        chunk[(*count)++] = AT_XBEE_ESCAPE;
+        byte ^= AT_XBEE_ESCAPE_MASK;
+    }
+    chunk[(*count)++] = byte;
+    return true;
+}
+
+bool at_commander_xbee_write_frame(AtCommanderXBeeApi* api,
+        const uint8_t* header, int header_size, const uint8_t* payload,
+        int size) {
+    uint8_t chunk[32];
+    int count = 0;
+    int length = header_size + size;
+    uint8_t checksum = 0;
+    int i;
+
+    chunk[count++] = AT_XBEE_START_DELIMITER;
+    if(!put_byte(api, chunk, &count, sizeof(chunk), length >> 8)
+            || !put_byte(api, chunk, &count, sizeof(chunk), length & 0xFF)) {
+        return false;
+    }
+    for(i = 0; i < header_size; i++) {
+        checksum += header[i];
+        if(!put_byte(api, chunk, &count, sizeof(chunk), header[i])) {
+            return false;
+        }
+    }
+    for(i = 0; i < size; i++) {
+        checksum += payload[i];
+        if(!put_byte(api, chunk, &count, sizeof(chunk), payload[i])) {
+            return false;
+        }
+    }
+    return put_byte(api, chunk, &count, sizeof(chunk), 0xFF - checksum)
+            && at_commander_write_all(api->config, chunk, count, 0);
+}
+
+uint8_t at_commander_xbee_next_frame_id(AtCommanderXBeeApi* api) {
+    int attempts;
+    for(attempts = 0; attempts < 255; attempts++) {
+        bool in_use = false;
+        int i;
+        api->last_frame_id = api->last_frame_id == 255 ? 1 :
+                api->last_frame_id + 1;
+        for(i = 0; i < AT_COMMANDER_XBEE_MAX_WINDOW; i++) {
+            if(api->outstanding[i].in_use
+                    && api->outstanding[i].frame_id == api->last_frame_id) {
+                in_use = true;
+                break;
+            }
+        }
+        if(!in_use) {
+            break;
+        }
+    }
+    return api->last_frame_id;
+}
+
+/** Private: Send (or resend) a transmit request, with a fresh frame ID so a
+ * late status for an earlier attempt can't be mistaken for this one's.
+ */
+static bool transmit(AtCommanderXBeeApi* api,
+        AtCommanderXBeeOutstanding* request) {
+    uint8_t header[AT_XBEE_TRANSMIT_HEADER_LENGTH];
+    AtCommanderXBeeDestination* destination =
+            &api->destinations[request->destination];
+
+    request->frame_id = at_commander_xbee_next_frame_id(api);
+    header[0] = AT_XBEE_FRAME_TRANSMIT_REQUEST;
+    header[1] = request->frame_id;
+    at_commander_xbee_write_address(&header[2], destination->address);
+    header[10] = AT_XBEE_UNKNOWN_NETWORK_ADDRESS >> 8;
+    header[11] = AT_XBEE_UNKNOWN_NETWORK_ADDRESS & 0xFF;
+    // Default broadcast radius and options
+    header[12] = 0;
+    header[13] = 0;
+
+    request->attempts++;
+    request->sent_at = api_millis(api);
+    return at_commander_xbee_write_frame(api, header, sizeof(header),
+            request->payload, request->size);
+}
+
+bool at_commander_xbee_send_command(AtCommanderXBeeApi* api, uint8_t frame_id,
+        const char* command, const uint8_t* parameter, int length) {
+    uint8_t header[AT_XBEE_COMMAND_HEADER_LENGTH];
+    header[0] = AT_XBEE_FRAME_AT_COMMAND;
+    header[1] = frame_id;
+    header[2] = command[0];
+    header[3] = command[1];
+    return at_commander_xbee_write_frame(api, header, sizeof(header),
+            parameter, parameter != NULL ? length : 0);
+}
+
+bool at_commander_xbee_send_remote_command(AtCommanderXBeeApi* api,
+        uint64_t address, uint8_t frame_id, const char* command,
+        const uint8_t* parameter, int length, bool apply) {
+    uint8_t header[AT_XBEE_REMOTE_COMMAND_HEADER_LENGTH];
+    header[0] = AT_XBEE_FRAME_REMOTE_AT_COMMAND;
+    header[1] = frame_id;
+    at_commander_xbee_write_address(&header[2], address);
+    header[10] = AT_XBEE_UNKNOWN_NETWORK_ADDRESS >> 8;
+    header[11] = AT_XBEE_UNKNOWN_NETWORK_ADDRESS & 0xFF;
+    header[12] = apply ? AT_XBEE_APPLY_CHANGES : 0;
+    header[13] = command[0];
+    header[14] = command[1];
+    return at_commander_xbee_write_frame(api, header, sizeof(header),
+            parameter, parameter != NULL ? length : 0);
+}
+
+bool at_commander_xbee_send(AtCommanderXBeeApi* api, int destination,
+        const uint8_t* payload, int size) {
+    AtCommanderXBeeOutstanding* request = NULL;
+    AtCommanderXBeeDestination* stats;
+    int window = api->window < AT_COMMANDER_XBEE_MAX_WINDOW ? api->window :
+            AT_COMMANDER_XBEE_MAX_WINDOW;
+    int i;
+    if(destination < 0 || destination >= api->destination_count
+            || api->outstanding_count >= window) {
+        return false;
+    }
+
+    for(i = 0; i < AT_COMMANDER_XBEE_MAX_WINDOW; i++) {
+        if(!api->outstanding[i].in_use) {
+            request = &api->outstanding[i];
+            break;
+        }
+    }
+
+    request->destination = destination;
+    request->payload = payload;
+    request->size = size;
+    request->attempts = 0;
+    if(!transmit(api, request)) {
+        at_commander_debug(api->config, "Unable to write transmit request");
+        return false;
+    }
+
+    stats = &api->destinations[destination];
+    if(stats->frames_sent == 0) {
+        stats->first_sent_at = request->sent_at;
+    }
+    stats->frames_sent++;
+    request->in_use = true;
+    api->outstanding_count++;
+    return true;
+}
+
+static void release(AtCommanderXBeeApi* api,
+        AtCommanderXBeeOutstanding* request, bool delivered) {
+    request->in_use = false;
+    api->outstanding_count--;
+    if(api->sent != NULL) {
+        api->sent(api, request->destination, request->payload, request->size,
+                delivered);
+    }
+}
+
+/** Private: Settle a transmit request with its status, retrying it if it
+ * failed and has attempts left.
+ */
+static void settle(AtCommanderXBeeApi* api,
+        AtCommanderXBeeOutstanding* request, bool delivered) {
+    AtCommanderXBeeDestination* destination =
+            &api->destinations[request->destination];
+    unsigned long now = api_millis(api);
+
+    if(delivered) {
+        unsigned long latency = now - request->sent_at;
+        destination->frames_delivered++;
+        destination->bytes_delivered += request->size;
+        destination->total_latency_ms += latency;
+        if(latency > destination->max_latency_ms) {
+            destination->max_latency_ms = latency;
+        }
+        destination->last_delivered_at = now;
+        release(api, request, true);
+        return;
+    }
+
+    if(request->attempts < api->max_attempts) {
+        destination->retries++;
+        if(transmit(api, request)) {
+            return;
+        }
+    }
+    destination->frames_failed++;
+    release(api, request, false);
+}
+
+static void handle_frame(AtCommanderXBeeApi* api, const uint8_t* frame,
+        int length) {
+    int i;
+    if(frame[0] == AT_XBEE_FRAME_TRANSMIT_STATUS
+            && length >= AT_XBEE_TRANSMIT_STATUS_LENGTH) {
+        for(i = 0; i < AT_COMMANDER_XBEE_MAX_WINDOW; i++) {
+            AtCommanderXBeeOutstanding* request = &api->outstanding[i];
+            if(request->in_use && request->frame_id == frame[1]) {
+                settle(api, request, frame[5] == AT_XBEE_DELIVERY_SUCCESS);
+                return;
+            }
+        }
+        // The status of a request that was already given up on
+        return;
+    }
+
+    if(api->frame_received != NULL) {
+        api->frame_received(api, frame, length);
+    }
+}
+
+int at_commander_xbee_process(AtCommanderXBeeApi* api) {
+    uint8_t chunk[32];
+    unsigned long now;
+    int processed = 0;
+    int bytes_read;
+    int i;
+
+    api->process_clock_ms += AT_COMMANDER_XBEE_PROCESS_TICK_MS;
+    while((!api->config->bounded
+                || processed < AT_COMMANDER_XBEE_BOUNDED_PROCESS_BYTES)
+            && (bytes_read = at_commander_data_read(api->config, chunk,
+                    sizeof(chunk))) > 0) {
+        processed += bytes_read;
+        for(i = 0; i < bytes_read; i++) {
+            int length = at_commander_xbee_parser_feed(&api->parser,
+                    chunk[i]);
+            if(length > 0) {
+                handle_frame(api, api->parser.frame, length);
+            }
+        }
+    }
+
+    now = api_millis(api);
+    for(i = 0; i < AT_COMMANDER_XBEE_MAX_WINDOW; i++) {
+        AtCommanderXBeeOutstanding* request = &api->outstanding[i];
+        if(request->in_use && now - request->sent_at
+                >= api->status_timeout_ms) {
+            at_commander_debug(api->config, "No status for frame %d",
+                    request->frame_id);
+            settle(api, request, false);
+        }
+    }
+    return api->outstanding_count;
+}
+
+bool at_commander_xbee_flush(AtCommanderXBeeApi* api, int timeout_ms) {
+    unsigned long started_at = at_commander_millis(api->config);
+    unsigned long waited_ms = 0;
+    while(at_commander_xbee_process(api) > 0) {
+        unsigned long elapsed = api->config->millis_function != NULL ?
+                at_commander_millis(api->config) - started_at : waited_ms;
+        if(elapsed >= (unsigned long)timeout_ms
+                || at_commander_interrupted(api->config)
+                    != AT_COMMANDER_RESULT_OK) {
+            return false;
+        }
+        at_commander_delay_ms(api->config, AT_XBEE_FLUSH_POLL_MS);
+        waited_ms += AT_XBEE_FLUSH_POLL_MS;
+    }
+    return true;
+}
+
+unsigned long at_commander_xbee_throughput(AtCommanderXBeeApi* api,
+        int destination) {
+    AtCommanderXBeeDestination* stats = &api->destinations[destination];
+    unsigned long elapsed = stats->last_delivered_at - stats->first_sent_at;
+    if(stats->frames_delivered == 0 || elapsed == 0) {
+        return 0;
+    }
+    return (unsigned long)((uint64_t)stats->bytes_delivered * 1000 / elapsed);
+}
+
+unsigned long at_commander_xbee_mean_latency_ms(AtCommanderXBeeApi* api,
+        int destination) {
+    AtCommanderXBeeDestination* stats = &api->destinations[destination];
+    if(stats->frames_delivered == 0) {
+        return 0;
+    }
+    return stats->total_latency_ms / stats->frames_delivered;
+}
@@ -0,0 +1,304 @@
+#ifndef _ATCOMMANDER_XBEE_API_H_
+#define _ATCOMMANDER_XBEE_API_H_
+
+#include "atcommander.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The largest frame (from the API identifier to the end of the data) that can
+// be received - longer frames are dropped. Override for bigger payloads.
+#ifndef AT_COMMANDER_XBEE_MAX_FRAME_LENGTH
+#define AT_COMMANDER_XBEE_MAX_FRAME_LENGTH 128
+#endif
+
+// The most transmit requests that can be awaiting their status at once
+#define AT_COMMANDER_XBEE_MAX_WINDOW 16
+#define AT_COMMANDER_XBEE_MAX_DESTINATIONS 8
+#define AT_COMMANDER_XBEE_DEFAULT_WINDOW 4
+#define AT_COMMANDER_XBEE_DEFAULT_MAX_ATTEMPTS 3
+#define AT_COMMANDER_XBEE_DEFAULT_STATUS_TIMEOUT_MS 5000
+// Without a millis function, each call to at_commander_xbee_process counts as
+// this long - the time at_commander_xbee_flush waits between calls
+#define AT_COMMANDER_XBEE_PROCESS_TICK_MS 1
+// Two full frames, escaped
+#define AT_COMMANDER_XBEE_BOUNDED_PROCESS_BYTES 512
+
+#define AT_COMMANDER_XBEE_BROADCAST_ADDRESS 0x000000000000FFFFULL
+
+// The longest parameter of a remote AT command (NI is up to 20 characters)
+#define AT_COMMANDER_XBEE_MAX_PARAMETER_LENGTH 20
+
+// API identifiers of the frames the library sends and understands
+#define AT_XBEE_FRAME_AT_COMMAND 0x08
+#define AT_XBEE_FRAME_TRANSMIT_REQUEST 0x10
+#define AT_XBEE_FRAME_REMOTE_AT_COMMAND 0x17
+#define AT_XBEE_FRAME_AT_RESPONSE 0x88
+#define AT_XBEE_FRAME_MODEM_STATUS 0x8A
+#define AT_XBEE_FRAME_TRANSMIT_STATUS 0x8B
+#define AT_XBEE_FRAME_RECEIVE_PACKET 0x90
+#define AT_XBEE_FRAME_IO_SAMPLE 0x92
+#define AT_XBEE_FRAME_NODE_IDENTIFICATION 0x95
+#define AT_XBEE_FRAME_REMOTE_AT_RESPONSE 0x97
+
+/** Public: The outcome of a remote AT command - the first five are the
+ * statuses in a Remote AT Command Response frame.
+ */
+typedef enum {
+    AT_XBEE_COMMAND_OK = 0,
+    AT_XBEE_COMMAND_ERROR = 1,
+    AT_XBEE_COMMAND_INVALID_COMMAND = 2,
+    AT_XBEE_COMMAND_INVALID_PARAMETER = 3,
+    // The remote node didn't acknowledge the request
+    AT_XBEE_COMMAND_TRANSMISSION_FAILED = 4,
+    // Never sent, or never answered, before it expired
+    AT_XBEE_COMMAND_EXPIRED
+} AtCommanderXBeeCommandStatus;
+
+/** Public: An incremental parser for XBee API frames:
+ *
+ *      0x7E, length (2 bytes, big endian), frame data, checksum
+ *
+ * where the frame data starts with the API identifier. In escaped mode
+ * (ATAP 2), the bytes 0x7E, 0x7D, 0x11 and 0x13 after the start delimiter are
+ * sent as 0x7D followed by the byte XOR 0x20.
+ */
+typedef struct {
+    bool escaped;
+    uint8_t frame[AT_COMMANDER_XBEE_MAX_FRAME_LENGTH];
+    int length;
+    int received;
+    uint8_t checksum;
+    int state;
+    bool unescape_next;
+    unsigned long checksum_errors;
+    unsigned long oversized_frames;
+} AtCommanderXBeeFrameParser;
+
+void at_commander_xbee_parser_init(AtCommanderXBeeFrameParser* parser,
+        bool escaped);
+
+/** Public: Feed the next received byte into the parser.
+ *
+ *  Returns the length of the frame completed by this byte (its data is in
+ *  parser->frame until the next byte is fed), or 0 if none was.
+ */
+int at_commander_xbee_parser_feed(AtCommanderXBeeFrameParser* parser,
+        uint8_t byte);
+
+/** Public: Delivery counters for one destination of transmit requests.
+ */
+typedef struct {
+    uint64_t address;
+    unsigned long frames_sent;
+    unsigned long frames_delivered;
+    unsigned long frames_failed;
+    // Frames sent again after a failed status or none at all
+    unsigned long retries;
+    unsigned long bytes_delivered;
+    // From sending a frame to its (successful) status
+    unsigned long total_latency_ms;
+    unsigned long max_latency_ms;
+    unsigned long first_sent_at;
+    unsigned long last_delivered_at;
+} AtCommanderXBeeDestination;
+
+/** Private: A transmit request awaiting its status.
+ */
+typedef struct {
+    bool in_use;
+    uint8_t frame_id;
+    int destination;
+    const uint8_t* payload;
+    int size;
+    int attempts;
+    unsigned long sent_at;
+} AtCommanderXBeeOutstanding;
+
+typedef struct AtCommanderXBeeApi AtCommanderXBeeApi;
+
+/** Public: A data path to an XBee in API mode (ATAP 1 or 2) that keeps a
+ * window of transmit requests in flight, instead of waiting for each one's
+ * status before sending the next.
+ *
+ * Transmit status frames are matched to their requests by frame ID as they
+ * arrive in at_commander_xbee_process. A request that failed, or whose status
+ * never came, is sent again up to max_attempts times - only that frame, not
+ * the ones after it.
+ *
+ * The device must be in data mode, and everything it sends must be passed
+ * through at_commander_xbee_process - frames that aren't transmit statuses go
+ * to the frame_received callback.
+ *
+ * Status timeouts and latencies are measured with the config's millis
+ * function. Without one, time is counted in calls to
+ * at_commander_xbee_process (see AT_COMMANDER_XBEE_PROCESS_TICK_MS), so a
+ * lost status is still retried as long as the application keeps processing.
+ */
+struct AtCommanderXBeeApi {
+    AtCommanderConfig* config;
+    AtCommanderXBeeFrameParser parser;
+
+    AtCommanderXBeeDestination destinations[AT_COMMANDER_XBEE_MAX_DESTINATIONS];
+    int destination_count;
+
+    AtCommanderXBeeOutstanding outstanding[AT_COMMANDER_XBEE_MAX_WINDOW];
+    int outstanding_count;
+    // How many transmit requests may be awaiting status at once, up to
+    // AT_COMMANDER_XBEE_MAX_WINDOW
+    int window;
+    int max_attempts;
+    unsigned long status_timeout_ms;
+    // The clock used without a millis function, advanced by each process
+    unsigned long process_clock_ms;
+    uint8_t last_frame_id;
+
+    // Optional, called with each payload once it's delivered or has failed
+    // for good - its buffer can be reused from then on.
+    void (*sent)(AtCommanderXBeeApi* api, int destination,
+            const uint8_t* payload, int size, bool delivered);
+    // Optional, called with every received frame that isn't a transmit
+    // status, starting at the API identifier.
+    void (*frame_received)(AtCommanderXBeeApi* api, const uint8_t* frame,
+            int length);
+    void* context;
+};
+
+/** Public: Set up an API mode data path with the default window, attempts and
+ * status timeout, and no destinations.
+ *
+ *  escaped - true if the device is in escaped API mode (ATAP 2).
+ */
+void at_commander_xbee_api_init(AtCommanderXBeeApi* api,
+        AtCommanderConfig* config, bool escaped);
+
+/** Public: Switch the device to API mode and store it, returning to data mode.
+ *
+ * Returns true if the device accepted the change.
+ */
+bool at_commander_xbee_enable_api_mode(AtCommanderConfig* config,
+        bool escaped);
+
+/** Public: Add a destination for transmit requests.
+ *
+ *  address - the 64-bit address of the destination, or
+ *      AT_COMMANDER_XBEE_BROADCAST_ADDRESS.
+ *
+ *  Returns the destination's index for at_commander_xbee_send, or -1 if the
+ *  list is full.
+ */
+int at_commander_xbee_add_destination(AtCommanderXBeeApi* api,
+        uint64_t address);
+
+/** Public: Send a payload to a destination without waiting for its status.
+ *
+ * The payload is sent from the caller's buffer, which must stay unchanged
+ * until the sent callback reports its outcome, as it may be sent again.
+ *
+ * Returns true if the request was sent, false if the window is full (call
+ * at_commander_xbee_process to make room) or the destination is unknown.
+ */
+bool at_commander_xbee_send(AtCommanderXBeeApi* api, int destination,
+        const uint8_t* payload, int size);
+
+/** Public: Handle every frame the device has sent since the last call, and
+ * retry any transmit request whose status is overdue. Call this from the main
+ * loop - it never blocks. In bounded mode, it handles at most
+ * AT_COMMANDER_XBEE_BOUNDED_PROCESS_BYTES per call, leaving the rest for the
+ * next.
+ *
+ * Returns the number of transmit requests still awaiting their status.
+ */
+int at_commander_xbee_process(AtCommanderXBeeApi* api);
+
+/** Public: Process frames until every transmit request has its outcome, or
+ * the timeout expires.
+ *
+ * Returns true if nothing is outstanding.
+ */
+bool at_commander_xbee_flush(AtCommanderXBeeApi* api, int timeout_ms);
+
+/** Public: Write one API frame to the device - the checksum (and escaping, if
+ * enabled) are added here.
+ *
+ *  header - the start of the frame data, from the API identifier.
+ *  payload - the rest of the frame data, may be NULL.
+ *
+ *  Returns true if the frame was written.
+ */
+bool at_commander_xbee_write_frame(AtCommanderXBeeApi* api,
+        const uint8_t* header, int header_size, const uint8_t* payload,
+        int size);
+
+/** Public: Allocate a frame ID for a request that expects a response - never
+ * 0 (which asks for none), and not one of a transmit request in flight.
+ */
+uint8_t at_commander_xbee_next_frame_id(AtCommanderXBeeApi* api);
+
+/** Public: The rate data is being delivered to a destination, in bytes per
+ * second, from its first transmit request to its last delivery.
+ */
+unsigned long at_commander_xbee_throughput(AtCommanderXBeeApi* api,
+        int destination);
+
+/** Public: The mean time from sending a frame to a destination to its
+ * successful status, in ms.
+ */
+unsigned long at_commander_xbee_mean_latency_ms(AtCommanderXBeeApi* api,
+        int destination);
+
+/** Public: Send an AT command to the local module as a frame, for when it
+ * has no command mode to send it in (e.g. on SPI). Its response arrives as
+ * an AT Command Response frame with the same frame ID (through the
+ * frame_received callback).
+ *
+ *  frame_id - from at_commander_xbee_next_frame_id.
+ *  command - the two character command, e.g. "NI".
+ *  parameter - the value to set, may be NULL to query the current one.
+ *
+ * Returns true if the frame was written.
+ */
+bool at_commander_xbee_send_command(AtCommanderXBeeApi* api, uint8_t frame_id,
+        const char* command, const uint8_t* parameter, int length);
+
+/** Public: Send a remote AT command to another node in the network, whose
+ * response arrives as a Remote AT Command Response frame with the same frame
+ * ID (through the frame_received callback).
+ *
+ *  address - the node's 64-bit address, or
+ *      AT_COMMANDER_XBEE_BROADCAST_ADDRESS for every node.
+ *  frame_id - from at_commander_xbee_next_frame_id.
+ *  command - the two character command, e.g. "NI".
+ *  parameter - the value to set, may be NULL to query the current one.
+ *  apply - true to apply the change (and any queued before it) immediately,
+ *      false to queue it on the node until a later command applies them.
+ *
+ * Returns true if the frame was written.
+ */
+bool at_commander_xbee_send_remote_command(AtCommanderXBeeApi* api,
+        uint64_t address, uint8_t frame_id, const char* command,
+        const uint8_t* parameter, int length, bool apply);
+
+/** Public: Find the 64-bit address of the node that sent a received frame -
+ * a receive packet, I/O sample, node identification or remote AT command
+ * response.
+ *
+ * Returns true if the frame carries its sender's address.
+ */
+bool at_commander_xbee_frame_source(const uint8_t* frame, int length,
+        uint64_t* address);
+
+/** Public: Read a big endian 64-bit address from a frame.
+ */
+uint64_t at_commander_xbee_read_address(const uint8_t* bytes);
+
+/** Public: Write a 64-bit address into a frame, big endian.
+ */
+void at_commander_xbee_write_address(uint8_t* bytes, uint64_t address);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _ATCOMMANDER_XBEE_API_H_
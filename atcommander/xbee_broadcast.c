@@ -0,0 +1,209 @@
+#include "xbee_broadcast.h"
+#include "atcommander_private.h"
+
+#include <string.h>
+
+// Offsets in a Remote AT Command Response frame
+#define RESPONSE_STATUS 14
+
+void at_commander_xbee_broadcast_init(AtCommanderXBeeBroadcast* broadcast,
+        AtCommanderXBeeApi* api) {
+    memset(broadcast, 0, sizeof(AtCommanderXBeeBroadcast));
+    broadcast->api = api;
+    broadcast->straggler_delay_ms = AT_COMMANDER_XBEE_DEFAULT_STRAGGLER_DELAY_MS;
+    broadcast->unicast_timeout_ms = AT_COMMANDER_XBEE_DEFAULT_UNICAST_TIMEOUT_MS;
+    broadcast->unicast_window = AT_COMMANDER_XBEE_DEFAULT_UNICAST_WINDOW;
+    broadcast->max_unicast_attempts =
+            AT_COMMANDER_XBEE_DEFAULT_UNICAST_ATTEMPTS;
+}
+
+bool at_commander_xbee_broadcast_add_node(AtCommanderXBeeBroadcast* broadcast,
+        uint64_t address) {
+    if(broadcast->node_count == AT_COMMANDER_XBEE_MAX_BROADCAST_NODES) {
+        return false;
+    }
+    memset(&broadcast->nodes[broadcast->node_count], 0,
+            sizeof(AtCommanderXBeeBroadcastNode));
+    broadcast->nodes[broadcast->node_count++].address = address;
+    return true;
+}
+
+bool at_commander_xbee_broadcast_start(AtCommanderXBeeBroadcast* broadcast,
+        const char* command, const uint8_t* parameter, int length,
+        unsigned long budget_ms) {
+    int i;
+    if(parameter == NULL) {
+        length = 0;
+    }
+    if(length > AT_COMMANDER_XBEE_MAX_PARAMETER_LENGTH) {
+        return false;
+    }
+    if(broadcast->api->config->millis_function == NULL) {
+        // The stragglers would never be retried, nor the budget run out
+        at_commander_debug(broadcast->api->config,
+                "A broadcast needs a millis function");
+        return false;
+    }
+
+    broadcast->command[0] = command[0];
+    broadcast->command[1] = command[1];
+    broadcast->command[2] = '\0';
+    if(length > 0) {
+        memcpy(broadcast->parameter, parameter, length);
+    }
+    broadcast->length = length;
+    for(i = 0; i < broadcast->node_count; i++) {
+        AtCommanderXBeeBroadcastNode* node = &broadcast->nodes[i];
+        node->responded = false;
+        node->unicast_attempts = 0;
+        node->unicast_frame_id = 0;
+    }
+    memset(&broadcast->report, 0, sizeof(AtCommanderXBeeBroadcastReport));
+    broadcast->report.expected = broadcast->node_count;
+
+    broadcast->frame_id = at_commander_xbee_next_frame_id(broadcast->api);
+    broadcast->started_at = at_commander_millis(broadcast->api->config);
+    broadcast->budget_ms = budget_ms;
+    broadcast->running = at_commander_xbee_send_remote_command(
+            broadcast->api, AT_COMMANDER_XBEE_BROADCAST_ADDRESS,
+            broadcast->frame_id, broadcast->command, broadcast->parameter,
+            broadcast->length, true);
+    return broadcast->running;
+}
+
+bool at_commander_xbee_broadcast_handle_frame(
+        AtCommanderXBeeBroadcast* broadcast, const uint8_t* frame,
+        int length) {
+    uint64_t address;
+    int i;
+
+    if(!broadcast->running || frame[0] != AT_XBEE_FRAME_REMOTE_AT_RESPONSE
+            || length <= RESPONSE_STATUS
+            || !at_commander_xbee_frame_source(frame, length, &address)) {
+        return false;
+    }
+
+    for(i = 0; i < broadcast->node_count; i++) {
+        AtCommanderXBeeBroadcastNode* node = &broadcast->nodes[i];
+        bool unicast = node->unicast_frame_id != 0
+                && frame[1] == node->unicast_frame_id;
+        if(node->address != address
+                || (frame[1] != broadcast->frame_id && !unicast)) {
+            continue;
+        }
+
+        if(unicast) {
+            node->unicast_frame_id = 0;
+            // Not acknowledged by the node - it may get another attempt
+            if(frame[RESPONSE_STATUS] == AT_XBEE_COMMAND_TRANSMISSION_FAILED) {
+                return true;
+            }
+        }
+        if(!node->responded) {
+            node->responded = true;
+            node->status = (AtCommanderXBeeCommandStatus) frame[RESPONSE_STATUS];
+            node->responded_at = at_commander_millis(broadcast->api->config);
+            if(unicast) {
+                broadcast->report.from_unicast++;
+            }
+        }
+        return true;
+    }
+
+    if(frame[1] == broadcast->frame_id) {
+        broadcast->report.unexpected++;
+        return true;
+    }
+    return false;
+}
+
+static void finish(AtCommanderXBeeBroadcast* broadcast, unsigned long now) {
+    AtCommanderXBeeBroadcastReport* report = &broadcast->report;
+    int i;
+
+    report->acknowledged = 0;
+    report->failed = 0;
+    report->missing = 0;
+    for(i = 0; i < broadcast->node_count; i++) {
+        AtCommanderXBeeBroadcastNode* node = &broadcast->nodes[i];
+        if(!node->responded) {
+            report->missing++;
+        } else if(node->status == AT_XBEE_COMMAND_OK) {
+            report->acknowledged++;
+        } else {
+            report->failed++;
+        }
+    }
+    report->elapsed_ms = now - broadcast->started_at;
+    broadcast->running = false;
+
+    at_commander_debug(broadcast->api->config,
+            "Broadcast %s: %d of %d nodes acknowledged, %d missing",
+            broadcast->command, report->acknowledged, report->expected,
+            report->missing);
+    if(broadcast->complete != NULL) {
+        broadcast->complete(broadcast, report);
+    }
+}
+
+bool at_commander_xbee_broadcast_process(
+        AtCommanderXBeeBroadcast* broadcast) {
+    unsigned long now;
+    int in_flight = 0;
+    int waiting = 0;
+    int i;
+
+    if(!broadcast->running) {
+        return false;
+    }
+
+    now = at_commander_millis(broadcast->api->config);
+    for(i = 0; i < broadcast->node_count; i++) {
+        AtCommanderXBeeBroadcastNode* node = &broadcast->nodes[i];
+        if(node->responded) {
+            continue;
+        }
+        if(node->unicast_frame_id != 0 && now - node->unicast_sent_at
+                >= broadcast->unicast_timeout_ms) {
+            node->unicast_frame_id = 0;
+        }
+        if(node->unicast_frame_id != 0) {
+            in_flight++;
+        }
+        if(node->unicast_frame_id != 0
+                || node->unicast_attempts < broadcast->max_unicast_attempts) {
+            waiting++;
+        }
+    }
+
+    // Done when everyone has answered, or nobody left could
+    if(now - broadcast->started_at >= broadcast->budget_ms || waiting == 0) {
+        finish(broadcast, now);
+        return false;
+    }
+    if(now - broadcast->started_at < broadcast->straggler_delay_ms) {
+        return true;
+    }
+
+    for(i = 0; i < broadcast->node_count
+            && in_flight < broadcast->unicast_window; i++) {
+        AtCommanderXBeeBroadcastNode* node = &broadcast->nodes[i];
+        uint8_t frame_id;
+        if(node->responded || node->unicast_frame_id != 0
+                || node->unicast_attempts >= broadcast->max_unicast_attempts) {
+            continue;
+        }
+
+        frame_id = at_commander_xbee_next_frame_id(broadcast->api);
+        node->unicast_attempts++;
+        broadcast->report.unicast_requests++;
+        if(at_commander_xbee_send_remote_command(broadcast->api,
+                    node->address, frame_id, broadcast->command,
+                    broadcast->parameter, broadcast->length, true)) {
+            node->unicast_frame_id = frame_id;
+            node->unicast_sent_at = now;
+            in_flight++;
+        }
+    }
+    return true;
+}
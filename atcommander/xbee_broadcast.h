@@ -0,0 +1,136 @@
+#ifndef _ATCOMMANDER_XBEE_BROADCAST_H_
+#define _ATCOMMANDER_XBEE_BROADCAST_H_
+
+#include "xbee_api.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define AT_COMMANDER_XBEE_MAX_BROADCAST_NODES 32
+#define AT_COMMANDER_XBEE_DEFAULT_STRAGGLER_DELAY_MS 1000
+#define AT_COMMANDER_XBEE_DEFAULT_UNICAST_TIMEOUT_MS 2000
+#define AT_COMMANDER_XBEE_DEFAULT_UNICAST_WINDOW 4
+#define AT_COMMANDER_XBEE_DEFAULT_UNICAST_ATTEMPTS 2
+
+/** Public: Where one node stands in a broadcast configuration.
+ */
+typedef struct {
+    uint64_t address;
+    bool responded;
+    // Only meaningful once it has responded
+    AtCommanderXBeeCommandStatus status;
+    unsigned long responded_at;
+    // Unicast retries sent to it, and the frame ID of the one in flight
+    int unicast_attempts;
+    uint8_t unicast_frame_id;
+    unsigned long unicast_sent_at;
+} AtCommanderXBeeBroadcastNode;
+
+/** Public: The outcome of a broadcast configuration.
+ */
+typedef struct {
+    int expected;
+    // Nodes that responded OK
+    int acknowledged;
+    // Nodes that responded with an error
+    int failed;
+    // Nodes never heard from within the budget
+    int missing;
+    // How many of the responses came from unicast retries
+    int from_unicast;
+    int unicast_requests;
+    // Responses from nodes that weren't on the list
+    int unexpected;
+    unsigned long elapsed_ms;
+} AtCommanderXBeeBroadcastReport;
+
+typedef struct AtCommanderXBeeBroadcast AtCommanderXBeeBroadcast;
+
+/** Public: The same remote AT command applied to every node in the network
+ * at once.
+ *
+ * The command is broadcast once and each node's response (they all carry the
+ * broadcast's frame ID) is checked off the list of expected nodes as it
+ * arrives. Broadcasts aren't acknowledged at the radio level, so after the
+ * straggler delay, the nodes that haven't responded are sent the command by
+ * unicast, a few at a time, until they respond or the time budget runs out.
+ *
+ * Pass every frame the API data path doesn't handle itself to
+ * at_commander_xbee_broadcast_handle_frame, and call
+ * at_commander_xbee_broadcast_process from the main loop until it returns
+ * false.
+ *
+ * The straggler delay and the budget are measured with the config's millis
+ * function, so one is required.
+ */
+struct AtCommanderXBeeBroadcast {
+    AtCommanderXBeeApi* api;
+    AtCommanderXBeeBroadcastNode nodes[AT_COMMANDER_XBEE_MAX_BROADCAST_NODES];
+    int node_count;
+
+    char command[3];
+    uint8_t parameter[AT_COMMANDER_XBEE_MAX_PARAMETER_LENGTH];
+    int length;
+    uint8_t frame_id;
+    bool running;
+    unsigned long started_at;
+    unsigned long budget_ms;
+    AtCommanderXBeeBroadcastReport report;
+
+    // How long to collect responses to the broadcast before retrying
+    unsigned long straggler_delay_ms;
+    unsigned long unicast_timeout_ms;
+    // Unicast retries in flight at once
+    int unicast_window;
+    int max_unicast_attempts;
+
+    // Optional, called once when every node has responded or the budget is
+    // spent.
+    void (*complete)(AtCommanderXBeeBroadcast* broadcast,
+            const AtCommanderXBeeBroadcastReport* report);
+    void* context;
+};
+
+void at_commander_xbee_broadcast_init(AtCommanderXBeeBroadcast* broadcast,
+        AtCommanderXBeeApi* api);
+
+/** Public: Add a node expected to respond, e.g. one found by node discovery.
+ *
+ * Returns false if the list is full.
+ */
+bool at_commander_xbee_broadcast_add_node(AtCommanderXBeeBroadcast* broadcast,
+        uint64_t address);
+
+/** Public: Broadcast a command to every node and start collecting responses.
+ *
+ *  command - the two character command, e.g. "SP".
+ *  parameter - the value to set, may be NULL to query the current one.
+ *  budget_ms - how long to wait for every node to respond.
+ *
+ * Returns true if the broadcast was sent, or false if the config has no
+ * millis function.
+ */
+bool at_commander_xbee_broadcast_start(AtCommanderXBeeBroadcast* broadcast,
+        const char* command, const uint8_t* parameter, int length,
+        unsigned long budget_ms);
+
+/** Public: Handle a frame received from the device.
+ *
+ * Returns true if it was a response to the broadcast or one of its retries.
+ */
+bool at_commander_xbee_broadcast_handle_frame(
+        AtCommanderXBeeBroadcast* broadcast, const uint8_t* frame, int length);
+
+/** Public: Send unicast retries to the stragglers and finish the operation
+ * once every node has responded or the budget is spent.
+ *
+ * Returns true while the operation is still running.
+ */
+bool at_commander_xbee_broadcast_process(AtCommanderXBeeBroadcast* broadcast);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _ATCOMMANDER_XBEE_BROADCAST_H_
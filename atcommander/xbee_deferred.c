@@ -0,0 +1,213 @@
+#include "xbee_deferred.h"
+#include "atcommander_private.h"
+
+#include <string.h>
+
+// Offsets in a Remote AT Command Response frame
+#define RESPONSE_STATUS 14
+#define RESPONSE_DATA 15
+
+void at_commander_xbee_deferred_init(AtCommanderXBeeDeferred* deferred,
+        AtCommanderXBeeApi* api) {
+    memset(deferred, 0, sizeof(AtCommanderXBeeDeferred));
+    deferred->api = api;
+    deferred->response_timeout_ms =
+            AT_COMMANDER_XBEE_DEFAULT_RESPONSE_TIMEOUT_MS;
+}
+
+static AtCommanderXBeeDeferredNode* find_node(
+        AtCommanderXBeeDeferred* deferred, uint64_t address) {
+    int i;
+    for(i = 0; i < AT_COMMANDER_XBEE_MAX_DEFERRED_NODES; i++) {
+        if(deferred->nodes[i].count > 0
+                && deferred->nodes[i].address == address) {
+            return &deferred->nodes[i];
+        }
+    }
+    return NULL;
+}
+
+/** Private: Report a command's outcome and remove it from its node's queue.
+ */
+static void finish(AtCommanderXBeeDeferred* deferred,
+        AtCommanderXBeeDeferredNode* node, int index,
+        AtCommanderXBeeCommandStatus status, const uint8_t* data,
+        int length) {
+    AtCommanderXBeeDeferredCommand finished = node->commands[index];
+    memmove(&node->commands[index], &node->commands[index + 1],
+            (node->count - index - 1) * sizeof(AtCommanderXBeeDeferredCommand));
+    node->count--;
+    if(deferred->result != NULL) {
+        deferred->result(deferred, node->address, finished.command, status,
+                data, length);
+    }
+}
+
+bool at_commander_xbee_defer_command(AtCommanderXBeeDeferred* deferred,
+        uint64_t address, const char* command, const uint8_t* parameter,
+        int length, unsigned long ttl_ms) {
+    AtCommanderXBeeDeferredNode* node = find_node(deferred, address);
+    AtCommanderXBeeDeferredCommand* queued;
+    int i;
+
+    if(parameter == NULL) {
+        length = 0;
+    }
+    if(length > AT_COMMANDER_XBEE_MAX_PARAMETER_LENGTH) {
+        return false;
+    }
+
+    if(node == NULL) {
+        for(i = 0; i < AT_COMMANDER_XBEE_MAX_DEFERRED_NODES; i++) {
+            if(deferred->nodes[i].count == 0) {
+                node = &deferred->nodes[i];
+                memset(node, 0, sizeof(AtCommanderXBeeDeferredNode));
+                node->address = address;
+                break;
+            }
+        }
+    }
+    if(node == NULL || node->count == AT_COMMANDER_XBEE_MAX_DEFERRED_COMMANDS) {
+        return false;
+    }
+
+    queued = &node->commands[node->count++];
+    memset(queued, 0, sizeof(AtCommanderXBeeDeferredCommand));
+    queued->command[0] = command[0];
+    queued->command[1] = command[1];
+    if(length > 0) {
+        memcpy(queued->parameter, parameter, length);
+    }
+    queued->length = length;
+    queued->queued_at = at_commander_millis(deferred->api->config);
+    queued->ttl_ms = ttl_ms;
+    return true;
+}
+
+/** Private: Send every command the node isn't already answering, back to
+ * back - it only stays awake briefly, so nothing waits for a response first.
+ */
+static void send_burst(AtCommanderXBeeDeferred* deferred,
+        AtCommanderXBeeDeferredNode* node) {
+    unsigned long now = at_commander_millis(deferred->api->config);
+    int unsent = 0;
+    int last = -1;
+    int i;
+
+    node->last_seen_at = now;
+    for(i = 0; i < node->count; i++) {
+        if(node->commands[i].frame_id == 0) {
+            last = i;
+            unsent++;
+        }
+    }
+    if(unsent == 0) {
+        return;
+    }
+
+    node->bursts++;
+    at_commander_debug(deferred->api->config,
+            "Node awake, sending %d deferred commands", unsent);
+    for(i = 0; i <= last; i++) {
+        AtCommanderXBeeDeferredCommand* command = &node->commands[i];
+        uint8_t frame_id;
+        if(command->frame_id != 0) {
+            continue;
+        }
+        frame_id = at_commander_xbee_next_frame_id(deferred->api);
+        // Changes are queued on the node and applied together with the last
+        if(at_commander_xbee_send_remote_command(deferred->api, node->address,
+                    frame_id, command->command, command->parameter,
+                    command->length, i == last)) {
+            command->frame_id = frame_id;
+            command->sent_at = now;
+        }
+    }
+}
+
+void at_commander_xbee_deferred_node_awake(AtCommanderXBeeDeferred* deferred,
+        uint64_t address) {
+    AtCommanderXBeeDeferredNode* node = find_node(deferred, address);
+    if(node != NULL) {
+        send_burst(deferred, node);
+    }
+}
+
+bool at_commander_xbee_deferred_handle_frame(
+        AtCommanderXBeeDeferred* deferred, const uint8_t* frame, int length) {
+    AtCommanderXBeeDeferredNode* node;
+    uint64_t address;
+    int i;
+
+    if(!at_commander_xbee_frame_source(frame, length, &address)) {
+        return false;
+    }
+    node = find_node(deferred, address);
+    if(node == NULL) {
+        return false;
+    }
+
+    if(frame[0] != AT_XBEE_FRAME_REMOTE_AT_RESPONSE
+            || length <= RESPONSE_STATUS) {
+        send_burst(deferred, node);
+        return false;
+    }
+
+    // The local radio reports a failure when the node didn't acknowledge the
+    // request - it's asleep again, so try when it next wakes
+    if(frame[RESPONSE_STATUS] == AT_XBEE_COMMAND_TRANSMISSION_FAILED) {
+        for(i = 0; i < node->count; i++) {
+            if(node->commands[i].frame_id == frame[1]) {
+                node->commands[i].frame_id = 0;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    for(i = 0; i < node->count; i++) {
+        if(node->commands[i].frame_id == frame[1]) {
+            finish(deferred, node, i,
+                    (AtCommanderXBeeCommandStatus) frame[RESPONSE_STATUS],
+                    &frame[RESPONSE_DATA], length - RESPONSE_DATA);
+            // Anything queued since the burst can go while it's awake
+            send_burst(deferred, node);
+            return true;
+        }
+    }
+
+    // A response to something else, but the node is awake all the same
+    send_burst(deferred, node);
+    return false;
+}
+
+int at_commander_xbee_deferred_process(AtCommanderXBeeDeferred* deferred) {
+    unsigned long now = at_commander_millis(deferred->api->config);
+    int pending = 0;
+    int i, j;
+
+    for(i = 0; i < AT_COMMANDER_XBEE_MAX_DEFERRED_NODES; i++) {
+        AtCommanderXBeeDeferredNode* node = &deferred->nodes[i];
+        for(j = 0; j < node->count;) {
+            AtCommanderXBeeDeferredCommand* command = &node->commands[j];
+            if(command->ttl_ms != 0
+                    && now - command->queued_at >= command->ttl_ms) {
+                finish(deferred, node, j, AT_XBEE_COMMAND_EXPIRED, NULL, 0);
+                continue;
+            }
+            if(command->frame_id != 0
+                    && now - command->sent_at >= deferred->response_timeout_ms) {
+                command->frame_id = 0;
+            }
+            j++;
+        }
+        pending += node->count;
+    }
+    return pending;
+}
+
+int at_commander_xbee_deferred_pending(AtCommanderXBeeDeferred* deferred,
+        uint64_t address) {
+    AtCommanderXBeeDeferredNode* node = find_node(deferred, address);
+    return node != NULL ? node->count : 0;
+}
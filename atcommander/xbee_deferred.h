@@ -0,0 +1,119 @@
+#ifndef _ATCOMMANDER_XBEE_DEFERRED_H_
+#define _ATCOMMANDER_XBEE_DEFERRED_H_
+
+#include "xbee_api.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define AT_COMMANDER_XBEE_MAX_DEFERRED_NODES 8
+#define AT_COMMANDER_XBEE_MAX_DEFERRED_COMMANDS 4
+#define AT_COMMANDER_XBEE_DEFAULT_RESPONSE_TIMEOUT_MS 2000
+
+/** Private: A remote AT command waiting for its node to wake up.
+ */
+typedef struct {
+    char command[3];
+    uint8_t parameter[AT_COMMANDER_XBEE_MAX_PARAMETER_LENGTH];
+    int length;
+    unsigned long queued_at;
+    // 0 if it never expires
+    unsigned long ttl_ms;
+    // Non-zero while sent and awaiting a response
+    uint8_t frame_id;
+    unsigned long sent_at;
+} AtCommanderXBeeDeferredCommand;
+
+/** Private: The commands queued for one sleeping node.
+ */
+typedef struct {
+    uint64_t address;
+    AtCommanderXBeeDeferredCommand commands[AT_COMMANDER_XBEE_MAX_DEFERRED_COMMANDS];
+    int count;
+    unsigned long last_seen_at;
+    // How many bursts of commands have been sent to it
+    unsigned long bursts;
+} AtCommanderXBeeDeferredNode;
+
+typedef struct AtCommanderXBeeDeferred AtCommanderXBeeDeferred;
+
+/** Public: Remote AT commands for sleeping end devices, held until each node
+ * is seen awake and then sent to it in one burst.
+ *
+ * A sleeping node only listens for a short while after it wakes, so a remote
+ * command sent at any other time times out. Instead, a node is known to be
+ * awake when a frame from it arrives (data, an I/O sample, its node
+ * identification or a response), and everything queued for it is sent
+ * straight away, back to back, applying the changes with the last command.
+ *
+ * A command that isn't answered (or wasn't acknowledged by the node) is kept
+ * for its next wake, until it expires. Every command's outcome is reported
+ * once through the result callback.
+ *
+ * Pass every frame the API data path doesn't handle itself (from its
+ * frame_received callback) to at_commander_xbee_deferred_handle_frame, and
+ * call at_commander_xbee_deferred_process from the main loop.
+ */
+struct AtCommanderXBeeDeferred {
+    AtCommanderXBeeApi* api;
+    AtCommanderXBeeDeferredNode nodes[AT_COMMANDER_XBEE_MAX_DEFERRED_NODES];
+    // How long to wait for a response before keeping a command for the next
+    // wake
+    unsigned long response_timeout_ms;
+
+    // Optional, called once with the outcome of each command - data is the
+    // response's value, if any.
+    void (*result)(AtCommanderXBeeDeferred* deferred, uint64_t address,
+            const char* command, AtCommanderXBeeCommandStatus status,
+            const uint8_t* data, int length);
+    void* context;
+};
+
+void at_commander_xbee_deferred_init(AtCommanderXBeeDeferred* deferred,
+        AtCommanderXBeeApi* api);
+
+/** Public: Queue a remote AT command until the node is next awake.
+ *
+ *  address - the node's 64-bit address.
+ *  command - the two character command, e.g. "SP".
+ *  parameter - the value to set, may be NULL to query the current one.
+ *  ttl_ms - how long to keep trying, or 0 to wait indefinitely.
+ *
+ * Returns true if the command was queued, false if the node's queue (or the
+ * list of nodes) is full or the parameter is too long.
+ */
+bool at_commander_xbee_defer_command(AtCommanderXBeeDeferred* deferred,
+        uint64_t address, const char* command, const uint8_t* parameter,
+        int length, unsigned long ttl_ms);
+
+/** Public: Tell the queue a node is awake, when it's known from something
+ * other than a received frame. Its queued commands are sent right away.
+ */
+void at_commander_xbee_deferred_node_awake(AtCommanderXBeeDeferred* deferred,
+        uint64_t address);
+
+/** Public: Handle a frame received from the device - a frame from a node
+ * with queued commands sends them, and their responses are reported.
+ *
+ * Returns true if the frame was a response to a deferred command.
+ */
+bool at_commander_xbee_deferred_handle_frame(
+        AtCommanderXBeeDeferred* deferred, const uint8_t* frame, int length);
+
+/** Public: Expire old commands and give up waiting for overdue responses.
+ *
+ * Returns the number of commands still queued for all nodes.
+ */
+int at_commander_xbee_deferred_process(AtCommanderXBeeDeferred* deferred);
+
+/** Public: The number of commands queued for a node.
+ */
+int at_commander_xbee_deferred_pending(AtCommanderXBeeDeferred* deferred,
+        uint64_t address);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _ATCOMMANDER_XBEE_DEFERRED_H_
@@ -0,0 +1,125 @@
+#include "xbee_spi.h"
+#include "atcommander_private.h"
+
+#include <string.h>
+
+#define AT_XBEE_START_DELIMITER 0x7E
+
+enum {
+    SPI_BETWEEN_FRAMES,
+    SPI_LENGTH_HIGH,
+    SPI_LENGTH_LOW,
+    SPI_FRAME
+};
+
+/** Private: Keep only the bytes that are part of a frame, tracking the frame
+ * by its length - SPI frames are never escaped, so this needs no more than
+ * the header.
+ *
+ * Returns the number of bytes kept, moved to the start of the buffer.
+ */
+static int keep_frame_bytes(AtCommanderXBeeSpi* spi, uint8_t* bytes,
+        int size) {
+    int kept = 0;
+    int i;
+    for(i = 0; i < size; i++) {
+        uint8_t byte = bytes[i];
+        switch(spi->frame_state) {
+        case SPI_BETWEEN_FRAMES:
+            if(byte != AT_XBEE_START_DELIMITER) {
+                continue;
+            }
+            spi->frame_state = SPI_LENGTH_HIGH;
+            break;
+        case SPI_LENGTH_HIGH:
+            spi->frame_remaining = byte << 8;
+            spi->frame_state = SPI_LENGTH_LOW;
+            break;
+        case SPI_LENGTH_LOW:
+            // The frame data and its checksum
+            spi->frame_remaining |= byte;
+            spi->frame_remaining++;
+            spi->frame_state = SPI_FRAME;
+            break;
+        default:
+            if(--spi->frame_remaining == 0) {
+                spi->frame_state = SPI_BETWEEN_FRAMES;
+            }
+            break;
+        }
+        bytes[kept++] = byte;
+    }
+    return kept;
+}
+
+static int spi_write_bytes(void* device, const uint8_t* bytes, int size) {
+    AtCommanderXBeeSpi* spi = (AtCommanderXBeeSpi*)device;
+    uint8_t received[AT_COMMANDER_XBEE_SPI_CHUNK];
+    int written = 0;
+    while(written < size) {
+        int chunk = size - written < AT_COMMANDER_XBEE_SPI_CHUNK ?
+                size - written : AT_COMMANDER_XBEE_SPI_CHUNK;
+        int kept;
+        spi->transfer_function(spi->device, &bytes[written], received, chunk);
+        kept = keep_frame_bytes(spi, received, chunk);
+        if(at_commander_ring_push(&spi->received, received, kept) < kept) {
+            spi->overflows++;
+        }
+        written += chunk;
+    }
+    return written;
+}
+
+static int spi_read_bytes(void* device, uint8_t* bytes, int size) {
+    AtCommanderXBeeSpi* spi = (AtCommanderXBeeSpi*)device;
+    uint8_t filler[AT_COMMANDER_XBEE_SPI_CHUNK];
+    int bytes_read = at_commander_ring_pop(&spi->received, bytes, size);
+
+    memset(filler, AT_COMMANDER_XBEE_SPI_FILLER, sizeof(filler));
+    while(bytes_read < size && (spi->attention_function == NULL
+                || spi->attention_function(spi->device))) {
+        int chunk = size - bytes_read < AT_COMMANDER_XBEE_SPI_CHUNK ?
+                size - bytes_read : AT_COMMANDER_XBEE_SPI_CHUNK;
+        int kept;
+        spi->transfer_function(spi->device, filler, &bytes[bytes_read],
+                chunk);
+        kept = keep_frame_bytes(spi, &bytes[bytes_read], chunk);
+        bytes_read += kept;
+        // Without ATTN, an idle chunk is the only sign there's nothing more
+        if(spi->attention_function == NULL && kept == 0) {
+            break;
+        }
+    }
+    return bytes_read;
+}
+
+void at_commander_xbee_spi_init(AtCommanderXBeeSpi* spi,
+        AtCommanderConfig* config,
+        void (*transfer)(void* device, const uint8_t* tx, uint8_t* rx,
+            int size),
+        bool (*attention)(void* device), void* device) {
+    memset(spi, 0, sizeof(AtCommanderXBeeSpi));
+    spi->transfer_function = transfer;
+    spi->attention_function = attention;
+    spi->device = device;
+    at_commander_ring_init(&spi->received, spi->received_storage,
+            sizeof(spi->received_storage));
+
+    config->platform = AT_PLATFORM_XBEE;
+    // No baud rates to sweep and no escape sequence, so entering command mode
+    // fails without sending anything
+    config->platform.baud_rates = NULL;
+    config->platform.baud_rate_count = 0;
+    config->platform.enter_command_mode_command.request_format = NULL;
+    config->platform.enter_command_mode_command.expected_response = NULL;
+    config->baud_rate_initializer = NULL;
+    config->write_function = NULL;
+    config->read_function = NULL;
+    config->write_bytes_function = spi_write_bytes;
+    config->read_bytes_function = spi_read_bytes;
+    config->clear_to_send_function = NULL;
+    config->line_errors_function = NULL;
+    config->device = spi;
+    config->connected = false;
+    config->exit_state = AT_EXIT_IDLE;
+}
@@ -0,0 +1,73 @@
+#ifndef _ATCOMMANDER_XBEE_SPI_H_
+#define _ATCOMMANDER_XBEE_SPI_H_
+
+#include "atcommander.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The most bytes clocked in one transfer
+#define AT_COMMANDER_XBEE_SPI_CHUNK 32
+// Clocked out when the host is only reading - the module ignores anything
+// outside a frame
+#define AT_COMMANDER_XBEE_SPI_FILLER 0xFF
+
+// Room for frame bytes the module sends while the host is writing, until
+// they're read. Override for bigger frames.
+#ifndef AT_COMMANDER_XBEE_SPI_RECEIVE_SIZE
+#define AT_COMMANDER_XBEE_SPI_RECEIVE_SIZE 256
+#endif
+
+/** Public: An XBee on its SPI port, as the transport for a config - much
+ * faster than any of its UART rates.
+ *
+ * On SPI the module only speaks API frames (ATAP 1, unescaped) and has no
+ * baud rate or command mode, so the config is left in data mode for an
+ * AtCommanderXBeeApi, and entering command mode fails straight away instead of
+ * sweeping baud rates. Settings are made with AT command frames instead, see
+ * at_commander_xbee_send_command.
+ *
+ * Every transfer is full duplex - while a frame is written, whatever the
+ * module sends in the same clocks is kept for the next read, so nothing it
+ * says is lost. The module signals that it has something to send on its ATTN
+ * line, and reads only clock it in while it's asserted. The bytes it sends
+ * between frames are dropped here, before they reach the parser.
+ */
+typedef struct {
+    // Clock size bytes out of tx while clocking the same number into rx, with
+    // the module selected
+    void (*transfer_function)(void* device, const uint8_t* tx, uint8_t* rx,
+            int size);
+    // Optional, returns true while the module asserts ATTN. Without it, every
+    // read clocks in a chunk to find out.
+    bool (*attention_function)(void* device);
+    void* device;
+
+    AtCommanderRingBuffer received;
+    uint8_t received_storage[AT_COMMANDER_XBEE_SPI_RECEIVE_SIZE];
+    // Where the module is in the frame it's sending
+    int frame_state;
+    int frame_remaining;
+    // Frame bytes clocked in while writing that didn't fit
+    unsigned long overflows;
+} AtCommanderXBeeSpi;
+
+/** Public: Use an XBee's SPI port as a config's transport, in place of its
+ * UART functions. The delay, clock and log functions are left alone.
+ *
+ *  transfer - the full duplex SPI transfer.
+ *  attention - reads the ATTN line, may be NULL.
+ *  device - passed to both.
+ */
+void at_commander_xbee_spi_init(AtCommanderXBeeSpi* spi,
+        AtCommanderConfig* config,
+        void (*transfer)(void* device, const uint8_t* tx, uint8_t* rx,
+            int size),
+        bool (*attention)(void* device), void* device);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _ATCOMMANDER_XBEE_SPI_H_
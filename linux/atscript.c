@@ -0,0 +1,118 @@
+/* Compile a provisioning script (see scriptc.h) to the bytecode the library
+ * runs with at_commander_run_script - as a binary to send to devices, or as a
+ * C array to build into firmware, where it stays in flash.
+ *
+ * Example:
+ *    $ ./atscript -o name.bin name.ats
+ *    $ ./atscript -C name_script name.ats > name_script.h
+ */
+#include "scriptc.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ATSCRIPT_MAX_SOURCE_SIZE (256 * 1024)
+#define ATSCRIPT_MAX_SCRIPT_SIZE 0xffff
+
+static void usage(const char* name) {
+    fprintf(stderr, "Usage: %s [-o output] [-C array name] <script>\n", name);
+    fprintf(stderr, "  -o  write the bytecode to a file instead of stdout\n");
+    fprintf(stderr, "  -C  write it as a C array with this name\n");
+}
+
+static char* read_source(const char* path) {
+    char* source;
+    size_t length;
+    FILE* file = fopen(path, "r");
+    if(file == NULL) {
+        perror(path);
+        return NULL;
+    }
+
+    source = malloc(ATSCRIPT_MAX_SOURCE_SIZE + 1);
+    if(source == NULL) {
+        fclose(file);
+        return NULL;
+    }
+    length = fread(source, 1, ATSCRIPT_MAX_SOURCE_SIZE + 1, file);
+    fclose(file);
+    if(length > ATSCRIPT_MAX_SOURCE_SIZE) {
+        fprintf(stderr, "%s is too long\n", path);
+        free(source);
+        return NULL;
+    }
+    source[length] = '\0';
+    return source;
+}
+
+static void write_array(FILE* output, const char* name, const uint8_t* bytes,
+        int size) {
+    int i;
+    fprintf(output, "#include <stdint.h>\n\n");
+    fprintf(output, "static const uint8_t %s[%d] = {", name, size);
+    for(i = 0; i < size; i++) {
+        fprintf(output, "%s0x%02x,", i % 12 == 0 ? "\n    " : " ", bytes[i]);
+    }
+    fprintf(output, "\n};\n");
+}
+
+int main(int argc, char** argv) {
+    static uint8_t bytecode[ATSCRIPT_MAX_SCRIPT_SIZE];
+    const char* output_path = NULL;
+    const char* array_name = NULL;
+    ScriptcError error;
+    FILE* output = stdout;
+    char* source;
+    int size;
+    int option;
+
+    while((option = getopt(argc, argv, "o:C:h")) != -1) {
+        switch(option) {
+            case 'o':
+                output_path = optarg;
+                break;
+            case 'C':
+                array_name = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if(optind != argc - 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    source = read_source(argv[optind]);
+    if(source == NULL) {
+        return 1;
+    }
+    size = scriptc_compile(source, bytecode, sizeof(bytecode), &error);
+    free(source);
+    if(size < 0) {
+        fprintf(stderr, "%s:%d: %s\n", argv[optind], error.line,
+                error.message);
+        return 1;
+    }
+
+    if(output_path != NULL) {
+        output = fopen(output_path, array_name != NULL ? "w" : "wb");
+        if(output == NULL) {
+            perror(output_path);
+            return 1;
+        }
+    }
+    if(array_name != NULL) {
+        write_array(output, array_name, bytecode, size);
+    } else {
+        fwrite(bytecode, 1, size, output);
+    }
+    if(output != stdout) {
+        fclose(output);
+    }
+    fprintf(stderr, "%d bytes\n", size);
+    return 0;
+}
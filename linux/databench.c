@@ -0,0 +1,232 @@
+/* Measure data mode throughput and latency through an AT device, optionally
+ * under each of the link profiles.
+ *
+ * The device's link should be connected to a peer that echoes everything back
+ * (or its UART looped back), so both directions are exercised and round trips
+ * can be timed.
+ *
+ * Example:
+ *    $ ./databench -p rn42 -s 10 -P all -f /dev/ttyUSB0
+ */
+#include "atcommander.h"
+#include "datamode.h"
+#include "serial.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_CHUNK_SIZE 256
+#define BENCH_PING_COUNT 20
+#define BENCH_PING_TIMEOUT_MS 2000
+#define BENCH_REBOOT_DELAY_MS 1000
+
+static const char* PROFILE_NAMES[AT_LINK_PROFILE_COUNT] = {
+    "balanced",
+    "low-latency",
+    "bulk",
+};
+
+static uint8_t transmit_storage[4096];
+static uint8_t receive_storage[4096];
+
+static void usage(const char* name) {
+    fprintf(stderr, "Usage: %s [-p rn42|xbee] [-s seconds] "
+            "[-P balanced|low-latency|bulk|all] [-f] [-v] <serial port>\n",
+            name);
+    fprintf(stderr, "  -P  apply a link profile before measuring\n");
+    fprintf(stderr, "  -f  use RTS/CTS hardware flow control\n");
+    fprintf(stderr, "  -v  log library debug output\n");
+}
+
+/** Private: Apply a link profile and make sure it's in effect before returning
+ * to data mode.
+ */
+static bool apply_profile(AtCommanderConfig* config,
+        AtCommanderLinkProfile profile) {
+    if(!at_commander_set_link_profile(config, profile)) {
+        return false;
+    }
+
+    if(config->platform.reboot_command.request_format != NULL) {
+        at_commander_reboot(config);
+        host_delay_ms(BENCH_REBOOT_DELAY_MS);
+        return at_commander_enter_command_mode(config)
+                && at_commander_exit_command_mode(config);
+    }
+    return at_commander_exit_command_mode(config);
+}
+
+/** Private: Stream data for the given time, reading back whatever is echoed.
+ */
+static void measure_throughput(AtCommanderConfig* config, int seconds) {
+    uint8_t chunk[BENCH_CHUNK_SIZE];
+    uint8_t received[BENCH_CHUNK_SIZE];
+    int offset = 0;
+    int i;
+    for(i = 0; i < BENCH_CHUNK_SIZE; i++) {
+        chunk[i] = i;
+    }
+
+    at_commander_data_reset_stats(config);
+    unsigned long deadline = host_millis() + seconds * 1000UL;
+    while((long)(host_millis() - deadline) < 0) {
+        int accepted = at_commander_data_write(config, &chunk[offset],
+                BENCH_CHUNK_SIZE - offset);
+        offset = (offset + accepted) % BENCH_CHUNK_SIZE;
+        int bytes_read = at_commander_data_read(config, received,
+                sizeof(received));
+        if(accepted == 0 && bytes_read == 0) {
+            host_delay_ms(1);
+        }
+    }
+
+    unsigned long tx_rate, rx_rate;
+    at_commander_data_throughput(config, &tx_rate, &rx_rate);
+    printf("  throughput: sent %lu bytes (%lu B/s), received %lu bytes "
+            "(%lu B/s), %lu backpressure events\n",
+            config->data_stats.bytes_sent, tx_rate,
+            config->data_stats.bytes_received, rx_rate,
+            config->data_stats.backpressure_events);
+}
+
+/** Private: Time the round trip of single bytes through the echoing peer.
+ */
+static void measure_latency(AtCommanderConfig* config) {
+    uint8_t received[BENCH_CHUNK_SIZE];
+    unsigned long total = 0;
+    unsigned long worst = 0;
+    int answered = 0;
+    int i;
+
+    // Let the echo of the throughput run drain first
+    host_delay_ms(BENCH_PING_TIMEOUT_MS);
+    while(at_commander_data_read(config, received, sizeof(received)) > 0);
+
+    for(i = 0; i < BENCH_PING_COUNT; i++) {
+        uint8_t ping = 'a' + i % 26;
+        unsigned long sent_at = host_millis();
+        at_commander_data_write(config, &ping, 1);
+
+        while(host_millis() - sent_at < BENCH_PING_TIMEOUT_MS) {
+            uint8_t echo;
+            if(at_commander_data_read(config, &echo, 1) == 1
+                    && echo == ping) {
+                unsigned long round_trip = host_millis() - sent_at;
+                total += round_trip;
+                if(round_trip > worst) {
+                    worst = round_trip;
+                }
+                answered++;
+                break;
+            }
+        }
+    }
+
+    if(answered > 0) {
+        printf("  latency: %d/%d pings, average %lu ms, worst %lu ms\n",
+                answered, BENCH_PING_COUNT, total / answered, worst);
+    } else {
+        printf("  latency: no pings echoed\n");
+    }
+}
+
+int main(int argc, char** argv) {
+    AtCommanderConfig config;
+    SerialPort port;
+    int seconds = 10;
+    int first_profile = -1;
+    int last_profile = -1;
+    int option;
+    int profile;
+
+    memset(&config, 0, sizeof(config));
+    memset(&port, 0, sizeof(port));
+    config.platform = AT_PLATFORM_RN42;
+
+    while((option = getopt(argc, argv, "p:s:P:fvh")) != -1) {
+        switch(option) {
+            case 'p':
+                if(!strcmp(optarg, "xbee")) {
+                    config.platform = AT_PLATFORM_XBEE;
+                } else if(strcmp(optarg, "rn42")) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 's':
+                seconds = atoi(optarg);
+                break;
+            case 'P':
+                if(!strcmp(optarg, "all")) {
+                    first_profile = 0;
+                    last_profile = AT_LINK_PROFILE_COUNT - 1;
+                    break;
+                }
+                for(profile = 0; profile < AT_LINK_PROFILE_COUNT; profile++) {
+                    if(!strcmp(optarg, PROFILE_NAMES[profile])) {
+                        first_profile = last_profile = profile;
+                    }
+                }
+                if(first_profile == -1) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'f':
+                port.hardware_flow_control = true;
+                break;
+            case 'v':
+                config.log_function = host_debug;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if(optind >= argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    port.path = argv[optind];
+    if(!serial_open(&port)) {
+        perror(port.path);
+        return 1;
+    }
+    serial_configure(&config, &port);
+    at_commander_data_init(&config, receive_storage, sizeof(receive_storage),
+            transmit_storage, sizeof(transmit_storage));
+
+    // Find the device's baud rate, then drop back into data mode
+    if(!at_commander_enter_command_mode(&config)
+            || !at_commander_exit_command_mode(&config)) {
+        fprintf(stderr, "Unable to find device on %s\n", port.path);
+        serial_close(&port);
+        return 1;
+    }
+
+    profile = first_profile;
+    do {
+        if(profile != -1) {
+            if(!apply_profile(&config, (AtCommanderLinkProfile)profile)) {
+                fprintf(stderr, "Unable to apply the %s profile\n",
+                        PROFILE_NAMES[profile]);
+                serial_close(&port);
+                return 1;
+            }
+            printf("%s profile at baud %d:\n", PROFILE_NAMES[profile],
+                    config.baud);
+        } else {
+            printf("current settings at baud %d:\n", config.baud);
+        }
+
+        measure_throughput(&config, seconds);
+        measure_latency(&config);
+    } while(profile != -1 && ++profile <= last_profile);
+
+    serial_close(&port);
+    return 0;
+}
@@ -0,0 +1,67 @@
+#include "emulated.h"
+#include "serial.h"
+
+#include <stdio.h>
+#include <string.h>
+
+void emulated_init(EmulatedDevice* device, int device_baud) {
+    memset(device, 0, sizeof(EmulatedDevice));
+    device->device_baud = device_baud;
+}
+
+void emulated_initialize_baud(void* device, int baud) {
+    ((EmulatedDevice*)device)->baud = baud;
+}
+
+static void respond(EmulatedDevice* device, const char* response) {
+    device->response = response;
+    device->response_index = 0;
+    // Make the session wait for the response, like a real device
+    device->response_at = host_millis() + 1;
+}
+
+void emulated_write(void* device, uint8_t byte) {
+    EmulatedDevice* emulated = (EmulatedDevice*)device;
+    if(emulated->baud != emulated->device_baud) {
+        return;
+    }
+
+    if(emulated->line_length < (int)sizeof(emulated->line) - 1) {
+        emulated->line[emulated->line_length++] = byte;
+        emulated->line[emulated->line_length] = '\0';
+    }
+
+    if(!strcmp(emulated->line, "$$$")) {
+        respond(emulated, "CMD\r\n");
+    } else if(byte == '\r') {
+        if(!strcmp(emulated->line, "---\r")) {
+            respond(emulated, "END\r\n");
+        } else {
+            if(!strcmp(emulated->line, "GN\r")) {
+                snprintf(emulated->reply, sizeof(emulated->reply), "%s\r\n",
+                        emulated->name);
+                respond(emulated, emulated->reply);
+            } else {
+                if(!strncmp(emulated->line, "SN,", 3)) {
+                    strcpy(emulated->name, &emulated->line[3]);
+                    emulated->name[strlen(emulated->name) - 1] = '\0';
+                    emulated->names_set++;
+                }
+                respond(emulated, "AOK\r\n");
+            }
+        }
+    } else {
+        return;
+    }
+    emulated->line_length = 0;
+}
+
+int emulated_read(void* device) {
+    EmulatedDevice* emulated = (EmulatedDevice*)device;
+    if(emulated->response == NULL
+            || (long)(host_millis() - emulated->response_at) < 0
+            || emulated->response[emulated->response_index] == '\0') {
+        return -1;
+    }
+    return emulated->response[emulated->response_index++];
+}
@@ -0,0 +1,35 @@
+#ifndef _EMULATED_H_
+#define _EMULATED_H_
+
+#include <stdint.h>
+
+/* An RN-42 that answers in its command mode, only at its baud rate - for
+ * exercising the host tools without hardware. Each response takes a
+ * millisecond, like a real device, so sessions wait for it.
+ */
+
+typedef struct {
+    // The rate it answers at, and the one the host is using
+    int device_baud;
+    int baud;
+    char line[32];
+    int line_length;
+    const char* response;
+    int response_index;
+    unsigned long response_at;
+    // The last name it was given with SN, and how many times it was given one
+    char name[32];
+    int names_set;
+    // Storage for responses built from its state, e.g. to GN
+    char reply[40];
+} EmulatedDevice;
+
+void emulated_init(EmulatedDevice* device, int device_baud);
+
+// An AtCommanderConfig's baud rate initializer, write and read functions for
+// an EmulatedDevice
+void emulated_initialize_baud(void* device, int baud);
+void emulated_write(void* device, uint8_t byte);
+int emulated_read(void* device);
+
+#endif // _EMULATED_H_
@@ -0,0 +1,223 @@
+#include "fleet.h"
+#include "datamode.h"
+#include "serial.h"
+
+#include <stdlib.h>
+
+#define FLEET_ARENA_ALIGNMENT 16
+// Each allocation can lose up to this much to alignment
+#define FLEET_ARENA_SLACK (FLEET_ARENA_ALIGNMENT - 1)
+
+// The fleet whose sessions are running on this thread - the library's delay
+// and trace functions don't say which device they're for, so they find it
+// here. Each thread can run a fleet of its own, see shards.h.
+static __thread Fleet* running_fleet;
+
+static void* arena_alloc(Fleet* fleet, size_t size) {
+    uintptr_t start = (uintptr_t)fleet->arena;
+    uintptr_t address = (start + fleet->arena_used + FLEET_ARENA_SLACK)
+            & ~(uintptr_t)FLEET_ARENA_SLACK;
+    if(address + size > start + fleet->arena_size) {
+        return NULL;
+    }
+    fleet->arena_used = address + size - start;
+    return (void*)address;
+}
+
+size_t fleet_arena_size(const FleetLimits* limits) {
+    size_t session_size = limits->stack_size + FLEET_ARENA_SLACK
+            + limits->response_buffer_size + FLEET_ARENA_SLACK
+            + limits->queue_size * 2 + FLEET_ARENA_SLACK
+            + limits->trace_events * sizeof(TraceEvent) + FLEET_ARENA_SLACK;
+    return sizeof(FleetSession) * limits->max_sessions + FLEET_ARENA_SLACK
+            + session_size * limits->max_sessions;
+}
+
+static void fleet_trace(void* device, AtCommanderTraceSpan span, bool begin,
+        const char* detail, int value) {
+    if(running_fleet != NULL && running_fleet->current != NULL) {
+        trace_library_span(&running_fleet->current->trace, span, begin,
+                detail, value);
+    }
+}
+
+bool fleet_init(Fleet* fleet, const FleetLimits* limits, void* arena,
+        size_t arena_size) {
+    size_t required = fleet_arena_size(limits);
+    int i;
+    if(limits->max_sessions <= 0 || limits->stack_size <= 0) {
+        return false;
+    }
+
+    fleet->limits = *limits;
+    fleet->owns_arena = arena == NULL;
+    if(arena == NULL) {
+        arena = malloc(required);
+        arena_size = required;
+    }
+    if(arena == NULL || arena_size < required) {
+        return false;
+    }
+
+    fleet->arena = (uint8_t*)arena;
+    fleet->arena_size = arena_size;
+    fleet->arena_used = 0;
+    fleet->active_sessions = 0;
+    fleet->started_sessions = 0;
+    fleet->finished = NULL;
+    fleet->current = NULL;
+    fleet->free_sessions = NULL;
+
+    fleet->sessions = (FleetSession*)arena_alloc(fleet,
+            sizeof(FleetSession) * limits->max_sessions);
+    // Hand sessions out in order, as it makes traces easier to follow
+    for(i = limits->max_sessions - 1; i >= 0; i--) {
+        FleetSession* session = &fleet->sessions[i];
+        session->stack = (uint8_t*)arena_alloc(fleet, limits->stack_size);
+        session->response_buffer = (char*)arena_alloc(fleet,
+                limits->response_buffer_size);
+        session->response_buffer_size = limits->response_buffer_size;
+        session->queue_storage = (uint8_t*)arena_alloc(fleet,
+                limits->queue_size * 2);
+        trace_track_init_ring(&session->trace, NULL,
+                (TraceEvent*)arena_alloc(fleet,
+                    limits->trace_events * sizeof(TraceEvent)),
+                limits->trace_events);
+        session->state = FLEET_SESSION_FREE;
+        session->next_free = fleet->free_sessions;
+        fleet->free_sessions = session;
+    }
+    return true;
+}
+
+void fleet_free(Fleet* fleet) {
+    if(fleet->owns_arena) {
+        free(fleet->arena);
+    }
+    fleet->arena = NULL;
+    fleet->sessions = NULL;
+    fleet->free_sessions = NULL;
+}
+
+/** Private: The entry point of a session's stack - when it returns, the
+ * scheduler picks up where it switched to the session.
+ */
+static void run_session(int index) {
+    FleetSession* session = &running_fleet->sessions[index];
+    session->succeeded = session->job(session);
+    session->state = FLEET_SESSION_DONE;
+}
+
+FleetSession* fleet_start(Fleet* fleet, const AtCommanderConfig* config,
+        const char* name, FleetJob job, void* context) {
+    FleetSession* session = fleet->free_sessions;
+    int queue_size = fleet->limits.queue_size;
+    if(session == NULL) {
+        return NULL;
+    }
+    fleet->free_sessions = session->next_free;
+
+    session->config = *config;
+    session->config.delay_function = fleet_delay_ms;
+    session->config.trace_function = fleet->limits.trace_events > 0 ?
+            fleet_trace : NULL;
+    at_commander_data_init(&session->config, session->queue_storage,
+            queue_size, session->queue_storage + queue_size, queue_size);
+    trace_track_reset(&session->trace, name);
+
+    session->context = context;
+    session->job = job;
+    session->id = ++fleet->started_sessions;
+    session->succeeded = false;
+
+    getcontext(&session->context_switch);
+    session->context_switch.uc_stack.ss_sp = session->stack;
+    session->context_switch.uc_stack.ss_size = fleet->limits.stack_size;
+    session->context_switch.uc_link = &fleet->scheduler;
+    makecontext(&session->context_switch, (void (*)(void))run_session, 1,
+            (int)(session - fleet->sessions));
+
+    session->state = FLEET_SESSION_RUNNABLE;
+    session->wake_at = host_millis();
+    fleet->active_sessions++;
+    return session;
+}
+
+static void finish_session(Fleet* fleet, FleetSession* session) {
+    if(fleet->finished != NULL) {
+        fleet->finished(fleet, session);
+    }
+    session->state = FLEET_SESSION_FREE;
+    session->next_free = fleet->free_sessions;
+    fleet->free_sessions = session;
+    fleet->active_sessions--;
+}
+
+int fleet_run_ready(Fleet* fleet) {
+    Fleet* outer_fleet = running_fleet;
+    unsigned long now = host_millis();
+    int ran = 0;
+    int i;
+
+    running_fleet = fleet;
+    for(i = 0; i < fleet->limits.max_sessions; i++) {
+        FleetSession* session = &fleet->sessions[i];
+        if(session->state != FLEET_SESSION_RUNNABLE
+                || (long)(session->wake_at - now) > 0) {
+            continue;
+        }
+
+        fleet->current = session;
+        swapcontext(&fleet->scheduler, &session->context_switch);
+        fleet->current = NULL;
+        ran++;
+
+        if(session->state == FLEET_SESSION_DONE) {
+            finish_session(fleet, session);
+        }
+    }
+    running_fleet = outer_fleet;
+    return ran;
+}
+
+bool fleet_next_wake(Fleet* fleet, unsigned long* wake_at) {
+    bool waiting = false;
+    int i;
+    for(i = 0; i < fleet->limits.max_sessions; i++) {
+        FleetSession* session = &fleet->sessions[i];
+        if(session->state == FLEET_SESSION_RUNNABLE && (!waiting
+                    || (long)(session->wake_at - *wake_at) < 0)) {
+            *wake_at = session->wake_at;
+            waiting = true;
+        }
+    }
+    return waiting;
+}
+
+int fleet_step(Fleet* fleet) {
+    unsigned long next_wake = 0;
+    if(fleet_run_ready(fleet) == 0 && fleet_next_wake(fleet, &next_wake)) {
+        unsigned long now = host_millis();
+        if((long)(next_wake - now) > 0) {
+            host_delay_ms(next_wake - now);
+        }
+    }
+    return fleet->active_sessions;
+}
+
+void fleet_run(Fleet* fleet) {
+    while(fleet_step(fleet) > 0);
+}
+
+void fleet_delay_ms(unsigned long ms) {
+    Fleet* fleet = running_fleet;
+    FleetSession* session;
+    if(fleet == NULL || fleet->current == NULL) {
+        host_delay_ms(ms);
+        return;
+    }
+
+    session = fleet->current;
+    session->wake_at = host_millis() + ms;
+    swapcontext(&session->context_switch, &fleet->scheduler);
+}
@@ -0,0 +1,159 @@
+#ifndef _FLEET_H_
+#define _FLEET_H_
+
+#include "atcommander.h"
+#include "trace.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <ucontext.h>
+
+/* A fleet engine runs the library's blocking calls for many devices at once
+ * on a single thread. Each device gets a session that runs a job on its own
+ * stack - whenever the library waits on the device, the session yields to the
+ * others.
+ *
+ * Everything the sessions need (stacks, response buffers, data mode queues
+ * and trace rings) is carved out of one arena sized when the fleet is
+ * initialized, and sessions are recycled through a pool, so a running fleet
+ * never touches the heap.
+ *
+ * A fleet belongs to the thread that steps it - to use more cores, see
+ * shards.h.
+ */
+
+typedef struct FleetSession FleetSession;
+
+/** Public: The work to do for one device - runs on the session's stack, and
+ * can make any blocking library call with the session's config.
+ *
+ * Returns true if the job succeeded.
+ */
+typedef bool (*FleetJob)(FleetSession* session);
+
+/** Public: How many sessions a fleet can run at once, and the size of what
+ * each one gets - fixed for the life of the fleet.
+ */
+typedef struct {
+    int max_sessions;
+    int stack_size;
+    int response_buffer_size;
+    // The size of each of the data mode receive and transmit queues
+    int queue_size;
+    // The number of events in each session's trace ring, 0 to disable tracing
+    int trace_events;
+} FleetLimits;
+
+typedef enum {
+    FLEET_SESSION_FREE,
+    FLEET_SESSION_RUNNABLE,
+    FLEET_SESSION_DONE,
+} FleetSessionState;
+
+struct FleetSession {
+    AtCommanderConfig config;
+    // The caller's data for the job, e.g. the device's port
+    void* context;
+    // Unique across the life of the fleet, even as sessions are recycled
+    int id;
+    bool succeeded;
+
+    // Scratch space for the job's responses
+    char* response_buffer;
+    int response_buffer_size;
+    TraceTrack trace;
+    uint8_t* queue_storage;
+
+    FleetJob job;
+    FleetSessionState state;
+    unsigned long wake_at;
+    ucontext_t context_switch;
+    uint8_t* stack;
+    FleetSession* next_free;
+};
+
+typedef struct Fleet Fleet;
+
+struct Fleet {
+    FleetLimits limits;
+    uint8_t* arena;
+    size_t arena_size;
+    size_t arena_used;
+    bool owns_arena;
+
+    FleetSession* sessions;
+    FleetSession* free_sessions;
+    int active_sessions;
+    int started_sessions;
+
+    // Optional, called with each session as its job completes - the session
+    // is recycled once it returns
+    void (*finished)(Fleet* fleet, FleetSession* session);
+    void* context;
+
+    FleetSession* current;
+    ucontext_t scheduler;
+};
+
+/** Public: The size of the arena a fleet needs for the given limits.
+ */
+size_t fleet_arena_size(const FleetLimits* limits);
+
+/** Public: Set up a fleet and carve its sessions out of an arena.
+ *
+ *  arena - storage of at least fleet_arena_size(limits) bytes, or NULL to
+ *      allocate it once here.
+ *
+ *  Returns true if the fleet is ready to start sessions.
+ */
+bool fleet_init(Fleet* fleet, const FleetLimits* limits, void* arena,
+        size_t arena_size);
+
+/** Public: Release an arena allocated by fleet_init.
+ */
+void fleet_free(Fleet* fleet);
+
+/** Public: Start a job for a device in a session from the pool.
+ *
+ *  config - the device's config, copied into the session. Its delay and trace
+ *      functions and data mode queues are replaced with the fleet's.
+ *  name - a name for the session's trace track, must outlive the session.
+ *
+ *  Returns the session, or NULL if all of them are in use.
+ */
+FleetSession* fleet_start(Fleet* fleet, const AtCommanderConfig* config,
+        const char* name, FleetJob job, void* context);
+
+/** Public: Run every session that's ready once, or if none are, sleep until
+ * the next one will be.
+ *
+ *  Returns the number of sessions still active.
+ */
+int fleet_step(Fleet* fleet);
+
+/** Public: Run every session that's ready once, without waiting for the
+ * others - for driving a fleet from an event loop, see loop.h.
+ *
+ *  Returns the number of sessions that ran.
+ */
+int fleet_run_ready(Fleet* fleet);
+
+/** Public: Find when the next session will be ready.
+ *
+ *  wake_at - set to the host_millis time, which may already have passed.
+ *
+ *  Returns false if no sessions are active.
+ */
+bool fleet_next_wake(Fleet* fleet, unsigned long* wake_at);
+
+/** Public: Run sessions until all of their jobs have completed.
+ */
+void fleet_run(Fleet* fleet);
+
+/** Public: An AtCommanderConfig delay function for jobs in a fleet - it
+ * yields to the other sessions for the delay. Outside of a fleet, it sleeps.
+ */
+void fleet_delay_ms(unsigned long ms);
+
+#endif // _FLEET_H_
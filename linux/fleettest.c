@@ -0,0 +1,140 @@
+/* Run a fleet of emulated RN-42s through a provisioning job and check that,
+ * once the fleet is initialized, nothing touches the heap - not the fleet
+ * engine, the tracing or the library.
+ *
+ * It's linked with malloc, calloc, realloc and free wrapped, so every
+ * allocation made by this code and the library is counted.
+ */
+#include "atcommander.h"
+#include "emulated.h"
+#include "fleet.h"
+#include "serial.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEVICE_COUNT 64
+#define ROUNDS 2
+#define DEVICE_BAUD 115200
+#define DEVICE_NAME "fleet"
+
+static bool counting;
+static int allocations;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* pointer, size_t size);
+void __real_free(void* pointer);
+
+void* __wrap_malloc(size_t size) {
+    if(counting) {
+        allocations++;
+    }
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+    if(counting) {
+        allocations++;
+    }
+    return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* pointer, size_t size) {
+    if(counting) {
+        allocations++;
+    }
+    return __real_realloc(pointer, size);
+}
+
+void __wrap_free(void* pointer) {
+    if(counting && pointer != NULL) {
+        allocations++;
+    }
+    __real_free(pointer);
+}
+
+static bool provision(FleetSession* session) {
+    snprintf(session->response_buffer, session->response_buffer_size,
+            DEVICE_NAME);
+    return at_commander_set_name(&session->config, session->response_buffer,
+                false)
+            && at_commander_exit_command_mode(&session->config);
+}
+
+static int succeeded;
+static int traced_events;
+
+static void finished(Fleet* fleet, FleetSession* session) {
+    succeeded += session->succeeded;
+    traced_events += session->trace.count;
+}
+
+int main(int argc, char** argv) {
+    static EmulatedDevice devices[DEVICE_COUNT];
+    FleetLimits limits;
+    Fleet fleet;
+    int started = 0;
+    int failures = 0;
+    int round;
+    int i;
+
+    limits.max_sessions = DEVICE_COUNT / 2;
+    limits.stack_size = 32 * 1024;
+    limits.response_buffer_size = 64;
+    limits.queue_size = 64;
+    limits.trace_events = 64;
+    if(!fleet_init(&fleet, &limits, NULL, 0)) {
+        fprintf(stderr, "Unable to initialize the fleet\n");
+        return 1;
+    }
+    fleet.finished = finished;
+
+    counting = true;
+    for(round = 0; round < ROUNDS; round++) {
+        AtCommanderConfig config;
+        int next_device = 0;
+        memset(&config, 0, sizeof(config));
+        config.platform = AT_PLATFORM_RN42;
+        config.baud_rate_initializer = emulated_initialize_baud;
+        config.write_function = emulated_write;
+        config.read_function = emulated_read;
+        config.millis_function = host_millis;
+
+        for(i = 0; i < DEVICE_COUNT; i++) {
+            emulated_init(&devices[i], DEVICE_BAUD);
+        }
+        while(next_device < DEVICE_COUNT || fleet.active_sessions > 0) {
+            while(next_device < DEVICE_COUNT) {
+                config.device = &devices[next_device];
+                if(fleet_start(&fleet, &config, "device", provision,
+                            NULL) == NULL) {
+                    break;
+                }
+                next_device++;
+                started++;
+            }
+            fleet_step(&fleet);
+        }
+
+        for(i = 0; i < DEVICE_COUNT; i++) {
+            if(strcmp(devices[i].name, DEVICE_NAME)) {
+                failures++;
+            }
+        }
+    }
+    counting = false;
+    fleet_free(&fleet);
+
+    printf("%d of %d sessions succeeded, %d devices misconfigured, "
+            "%d events traced, %d allocations after startup\n", succeeded,
+            started, failures, traced_events, allocations);
+    if(succeeded != started || failures > 0 || traced_events == 0
+            || allocations > 0) {
+        printf("FAIL\n");
+        return 1;
+    }
+    printf("PASS\n");
+    return 0;
+}
@@ -0,0 +1,91 @@
+#include "hotplug.h"
+
+#include <linux/netlink.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Uevents are limited to a page by the kernel
+#define HOTPLUG_MAX_MESSAGE_LENGTH 4096
+
+int hotplug_open(void) {
+    struct sockaddr_nl address;
+    int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+            NETLINK_KOBJECT_UEVENT);
+    if(fd < 0) {
+        return -1;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.nl_family = AF_NETLINK;
+    // Group 1 is the kernel's own events, as opposed to udev's re-broadcasts
+    address.nl_groups = 1;
+    if(bind(fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void hotplug_close(int fd) {
+    if(fd >= 0) {
+        close(fd);
+    }
+}
+
+bool hotplug_parse(const char* message, int size, HotplugEvent* event) {
+    const char* action = NULL;
+    const char* subsystem = NULL;
+    const char* name = NULL;
+    int offset = 0;
+
+    // The header is the first string, the variables follow
+    while(offset < size) {
+        const char* field = &message[offset];
+        int length = strnlen(field, size - offset);
+        if(!strncmp(field, "ACTION=", 7)) {
+            action = field + 7;
+        } else if(!strncmp(field, "SUBSYSTEM=", 10)) {
+            subsystem = field + 10;
+        } else if(!strncmp(field, "DEVNAME=", 8)) {
+            name = field + 8;
+        }
+        offset += length + 1;
+    }
+
+    if(action == NULL || subsystem == NULL || name == NULL
+            || strcmp(subsystem, "tty")) {
+        return false;
+    }
+
+    if(!strcmp(action, "add")) {
+        event->action = HOTPLUG_ADDED;
+    } else if(!strcmp(action, "remove")) {
+        event->action = HOTPLUG_REMOVED;
+    } else {
+        return false;
+    }
+
+    // DEVNAME is relative to /dev, but may include subdirectories
+    snprintf(event->name, sizeof(event->name), "%s", name);
+    return true;
+}
+
+bool hotplug_read(int fd, HotplugEvent* event) {
+    char message[HOTPLUG_MAX_MESSAGE_LENGTH];
+    while(true) {
+        struct sockaddr_nl sender;
+        socklen_t sender_length = sizeof(sender);
+        ssize_t size = recvfrom(fd, message, sizeof(message) - 1, 0,
+                (struct sockaddr*)&sender, &sender_length);
+        if(size <= 0) {
+            return false;
+        }
+        message[size] = '\0';
+        // Only trust messages from the kernel itself
+        if(sender.nl_pid == 0 && hotplug_parse(message, size, event)) {
+            return true;
+        }
+    }
+}
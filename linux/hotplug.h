@@ -0,0 +1,49 @@
+#ifndef _HOTPLUG_H_
+#define _HOTPLUG_H_
+
+#include <stdbool.h>
+
+/* Notifications of serial ports appearing and disappearing, e.g. as USB-serial
+ * adapters are plugged in, straight from the kernel's uevent netlink socket -
+ * no udev library needed.
+ *
+ * The kernel announces a port before udev has finished with it (e.g. set its
+ * permissions), so the first attempts to open a new port may fail.
+ */
+
+#define HOTPLUG_MAX_NAME_LENGTH 64
+
+typedef enum {
+    HOTPLUG_ADDED,
+    HOTPLUG_REMOVED
+} HotplugAction;
+
+typedef struct {
+    HotplugAction action;
+    // The name of the port's device node, e.g. "ttyUSB0"
+    char name[HOTPLUG_MAX_NAME_LENGTH];
+} HotplugEvent;
+
+/** Public: Start listening for hotplug events.
+ *
+ *  Returns a non-blocking file descriptor to poll for events, or -1 if the
+ *  socket couldn't be opened.
+ */
+int hotplug_open(void);
+
+void hotplug_close(int fd);
+
+/** Public: Read the next pending event for a tty.
+ *
+ *  Returns true if an event was read, false once there are none pending.
+ */
+bool hotplug_read(int fd, HotplugEvent* event);
+
+/** Public: Parse a kernel uevent message - a header like
+ * "add@/devices/.../ttyUSB0" followed by NUL separated KEY=value pairs.
+ *
+ *  Returns true if it's a tty being added or removed.
+ */
+bool hotplug_parse(const char* message, int size, HotplugEvent* event);
+
+#endif // _HOTPLUG_H_
@@ -0,0 +1,57 @@
+/* Check that kernel uevents for serial ports are recognized, and everything
+ * else is ignored.
+ */
+#include "hotplug.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static int failures;
+
+static void check(bool condition, const char* description) {
+    if(!condition) {
+        printf("failed: %s\n", description);
+        failures++;
+    }
+}
+
+// The fields of a uevent are NUL separated, so they're built with sizeof
+#define UEVENT(literal) literal, sizeof(literal)
+
+int main(int argc, char** argv) {
+    HotplugEvent event;
+
+    check(hotplug_parse(UEVENT("add@/devices/pci0000:00/usb1/1-1/1-1:1.0/"
+                    "ttyUSB0/tty/ttyUSB0\0ACTION=add\0DEVPATH=/devices/"
+                    "pci0000:00/usb1/1-1/1-1:1.0/ttyUSB0/tty/ttyUSB0\0"
+                    "SUBSYSTEM=tty\0MAJOR=188\0MINOR=0\0DEVNAME=ttyUSB0\0"
+                    "SEQNUM=4242"), &event), "a tty being added");
+    check(event.action == HOTPLUG_ADDED, "the action is add");
+    check(!strcmp(event.name, "ttyUSB0"), "the device name");
+
+    check(hotplug_parse(UEVENT("remove@/devices/virtual/tty/ttyACM3\0"
+                    "ACTION=remove\0SUBSYSTEM=tty\0DEVNAME=ttyACM3"), &event),
+            "a tty being removed");
+    check(event.action == HOTPLUG_REMOVED, "the action is remove");
+    check(!strcmp(event.name, "ttyACM3"), "the removed device name");
+
+    check(!hotplug_parse(UEVENT("add@/devices/usb1/1-1\0ACTION=add\0"
+                    "SUBSYSTEM=usb\0DEVNAME=bus/usb/001/002"), &event),
+            "another subsystem is ignored");
+    check(!hotplug_parse(UEVENT("change@/devices/virtual/tty/ttyUSB0\0"
+                    "ACTION=change\0SUBSYSTEM=tty\0DEVNAME=ttyUSB0"), &event),
+            "other actions are ignored");
+    check(!hotplug_parse(UEVENT("add@/devices/virtual/tty/ttyUSB0\0"
+                    "ACTION=add\0SUBSYSTEM=tty"), &event),
+            "an event without a device node is ignored");
+    // A truncated message mustn't be read past its end
+    check(!hotplug_parse("ACTION=add\0SUBSYSTEM=tty\0DEVNAME=ttyUSB0", 24,
+                &event), "a truncated event is ignored");
+
+    if(failures > 0) {
+        printf("FAIL\n");
+        return 1;
+    }
+    printf("hotplug events parsed\nPASS\n");
+    return 0;
+}
@@ -0,0 +1,234 @@
+#include "journal.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define JOURNAL_MAX_RECORD_LENGTH 512
+#define JOURNAL_INITIAL_CAPACITY 64
+
+static const char* STEP_NAMES[] = {
+    "baud",
+    "name",
+    "reboot",
+};
+
+static int find_step(const char* name) {
+    int i;
+    for(i = 0; i < JOURNAL_STEP_COUNT; i++) {
+        if(!strcmp(name, STEP_NAMES[i])) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+JournalEntry* journal_entry(Journal* journal, const char* device) {
+    JournalEntry* entry;
+    int i;
+    for(i = 0; i < journal->entry_count; i++) {
+        if(!strcmp(journal->entries[i].device, device)) {
+            return &journal->entries[i];
+        }
+    }
+
+    if(journal->entry_count == journal->entry_capacity) {
+        int capacity = journal->entry_capacity > 0 ?
+                journal->entry_capacity * 2 : JOURNAL_INITIAL_CAPACITY;
+        JournalEntry* entries = realloc(journal->entries,
+                capacity * sizeof(JournalEntry));
+        if(entries == NULL) {
+            return NULL;
+        }
+        journal->entries = entries;
+        journal->entry_capacity = capacity;
+    }
+
+    entry = &journal->entries[journal->entry_count];
+    memset(entry, 0, sizeof(JournalEntry));
+    entry->device = strdup(device);
+    if(entry->device == NULL) {
+        return NULL;
+    }
+    journal->entry_count++;
+    return entry;
+}
+
+/** Private: Apply one record, a line without its line ending, to the entries.
+ *
+ * Returns false if the record isn't one the journal writes.
+ */
+static bool replay(Journal* journal, char* record) {
+    char* verb = record;
+    char* value = strchr(verb, ' ');
+    char* device;
+    JournalEntry* entry;
+    int step;
+    if(value == NULL) {
+        return false;
+    }
+    *value++ = '\0';
+
+    if(!strcmp(verb, "settings")) {
+        free(journal->settings);
+        journal->settings = strdup(value);
+        return journal->settings != NULL;
+    }
+
+    device = strchr(value, ' ');
+    if(device == NULL) {
+        return false;
+    }
+    *device++ = '\0';
+    entry = journal_entry(journal, device);
+    if(entry == NULL) {
+        return false;
+    }
+
+    step = find_step(value);
+    if(!strcmp(verb, "connected")) {
+        entry->connected_baud = atoi(value);
+    } else if(!strcmp(verb, "begin") && step != -1) {
+        entry->begun |= 1 << step;
+    } else if(!strcmp(verb, "done") && step != -1) {
+        entry->done |= 1 << step;
+    } else if(!strcmp(verb, "complete")) {
+        entry->complete = true;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/** Private: Replay the records in an existing journal file.
+ *
+ * Returns the length of the file up to the end of its last complete record,
+ * or -1 if it couldn't be read.
+ */
+static long load(Journal* journal, const char* path) {
+    char record[JOURNAL_MAX_RECORD_LENGTH];
+    long complete_length = 0;
+    FILE* file = fopen(path, "r");
+    if(file == NULL) {
+        return 0;
+    }
+
+    while(fgets(record, sizeof(record), file) != NULL) {
+        int length = strlen(record);
+        if(length == 0 || record[length - 1] != '\n') {
+            // Torn by a crash while it was being written
+            break;
+        }
+        record[length - 1] = '\0';
+        if(!replay(journal, record)) {
+            fprintf(stderr, "%s: skipping unknown record \"%s\"\n", path,
+                    record);
+        }
+        complete_length += length;
+    }
+
+    if(ferror(file)) {
+        complete_length = -1;
+    }
+    fclose(file);
+    return complete_length;
+}
+
+bool journal_open(Journal* journal, const char* path, const char* settings) {
+    long length;
+    memset(journal, 0, sizeof(Journal));
+    journal->fd = -1;
+
+    length = load(journal, path);
+    if(length == -1) {
+        journal_close(journal);
+        return false;
+    }
+
+    journal->fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if(journal->fd == -1 || ftruncate(journal->fd, length) == -1) {
+        journal_close(journal);
+        return false;
+    }
+
+    if(journal->settings == NULL) {
+        char record[JOURNAL_MAX_RECORD_LENGTH];
+        int size = snprintf(record, sizeof(record), "settings %s\n",
+                settings);
+        if(size >= (int)sizeof(record) || write(journal->fd, record, size)
+                != size || fdatasync(journal->fd) == -1) {
+            journal_close(journal);
+            return false;
+        }
+    }
+    return true;
+}
+
+void journal_close(Journal* journal) {
+    int i;
+    if(journal->fd != -1) {
+        close(journal->fd);
+        journal->fd = -1;
+    }
+    for(i = 0; i < journal->entry_count; i++) {
+        free(journal->entries[i].device);
+    }
+    free(journal->entries);
+    free(journal->settings);
+    journal->entries = NULL;
+    journal->entry_count = 0;
+    journal->entry_capacity = 0;
+    journal->settings = NULL;
+}
+
+/** Private: Append a record and wait for it to reach the disk, so the
+ * journal never claims less progress than was made before a crash.
+ */
+static bool append(Journal* journal, JournalEntry* entry, const char* verb,
+        const char* value) {
+    char record[JOURNAL_MAX_RECORD_LENGTH];
+    int size = snprintf(record, sizeof(record), "%s %s %s\n", verb, value,
+            entry->device);
+    if(size >= (int)sizeof(record)) {
+        return false;
+    }
+    // One write per record, so records from different sessions can't
+    // interleave
+    return write(journal->fd, record, size) == size
+            && fdatasync(journal->fd) == 0;
+}
+
+bool journal_connected(Journal* journal, JournalEntry* entry, int baud) {
+    char value[16];
+    if(entry->connected_baud == baud) {
+        return true;
+    }
+    snprintf(value, sizeof(value), "%d", baud);
+    entry->connected_baud = baud;
+    return append(journal, entry, "connected", value);
+}
+
+bool journal_begin(Journal* journal, JournalEntry* entry, JournalStep step) {
+    entry->begun |= 1 << step;
+    return append(journal, entry, "begin", STEP_NAMES[step]);
+}
+
+bool journal_done(Journal* journal, JournalEntry* entry, JournalStep step) {
+    entry->done |= 1 << step;
+    return append(journal, entry, "done", STEP_NAMES[step]);
+}
+
+bool journal_complete(Journal* journal, JournalEntry* entry) {
+    entry->complete = true;
+    return append(journal, entry, "complete", "-");
+}
+
+bool journal_step_done(const JournalEntry* entry, JournalStep step) {
+    return (entry->done & (1 << step)) != 0;
+}
+
+bool journal_step_uncertain(const JournalEntry* entry, JournalStep step) {
+    return (entry->begun & (1 << step)) != 0 && !journal_step_done(entry, step);
+}
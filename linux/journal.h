@@ -0,0 +1,81 @@
+#ifndef _JOURNAL_H_
+#define _JOURNAL_H_
+
+#include <stdbool.h>
+
+/* An append-only journal of each device's progress through a provisioning
+ * run, so a run that dies midway can resume where it left off.
+ *
+ * Every record is one line, written with a single write and flushed to disk
+ * before the journal carries on, so a crash can at worst leave a torn last
+ * line - it's dropped when the journal is opened again.
+ *
+ * A step is begun before its command is sent and done once the device has
+ * confirmed it, so a step that was begun but never done is the one whose
+ * outcome is uncertain.
+ */
+
+typedef enum {
+    JOURNAL_STEP_BAUD,
+    JOURNAL_STEP_NAME,
+    JOURNAL_STEP_REBOOT,
+    JOURNAL_STEP_COUNT
+} JournalStep;
+
+/** Public: What the journal knows about one device.
+ */
+typedef struct {
+    char* device;
+    // The baud rate the device last entered command mode at, 0 if unknown
+    int connected_baud;
+    // Bit masks of the steps by JournalStep
+    unsigned int begun;
+    unsigned int done;
+    // The device finished the run
+    bool complete;
+} JournalEntry;
+
+typedef struct {
+    int fd;
+    // The settings the journal was started with, NULL for a new journal
+    char* settings;
+    JournalEntry* entries;
+    int entry_count;
+    int entry_capacity;
+} Journal;
+
+/** Public: Open a journal, loading the progress recorded in it so far.
+ *
+ *  settings - a description of the run's settings, recorded in a new journal
+ *      so a journal isn't resumed with different ones - compare it with
+ *      journal->settings after opening.
+ *
+ *  Returns true if the journal was opened.
+ */
+bool journal_open(Journal* journal, const char* path, const char* settings);
+
+void journal_close(Journal* journal);
+
+/** Public: Find the entry for a device, adding an empty one if it has none.
+ *
+ *  Returns the entry, or NULL if it couldn't be allocated. It's valid until
+ *  the next entry is added.
+ */
+JournalEntry* journal_entry(Journal* journal, const char* device);
+
+/** Public: Record progress for a device - each returns false if the record
+ * couldn't be written to disk.
+ */
+bool journal_connected(Journal* journal, JournalEntry* entry, int baud);
+bool journal_begin(Journal* journal, JournalEntry* entry, JournalStep step);
+bool journal_done(Journal* journal, JournalEntry* entry, JournalStep step);
+bool journal_complete(Journal* journal, JournalEntry* entry);
+
+bool journal_step_done(const JournalEntry* entry, JournalStep step);
+
+/** Public: Returns true if the step was begun but not confirmed, e.g. the
+ * process died while waiting for the device's response.
+ */
+bool journal_step_uncertain(const JournalEntry* entry, JournalStep step);
+
+#endif // _JOURNAL_H_
@@ -0,0 +1,84 @@
+/* Check that a provisioning journal survives a crash - records written before
+ * it are all replayed, a record torn by it is dropped, and the journal carries
+ * on cleanly after it.
+ */
+#include "journal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SETTINGS "-p rn42 -b 115200 -n sensor -r"
+
+static int failures;
+
+static void check(bool condition, const char* description) {
+    if(!condition) {
+        printf("failed: %s\n", description);
+        failures++;
+    }
+}
+
+int main(int argc, char** argv) {
+    char path[] = "/tmp/journaltest.XXXXXX";
+    Journal journal;
+    JournalEntry* first;
+    JournalEntry* second;
+    FILE* file;
+    int fd = mkstemp(path);
+    if(fd == -1) {
+        perror(path);
+        return 1;
+    }
+    close(fd);
+
+    check(journal_open(&journal, path, SETTINGS), "open a new journal");
+    check(journal.settings == NULL, "a new journal has no settings");
+    first = journal_entry(&journal, "/dev/ttyUSB0");
+    journal_connected(&journal, first, 9600);
+    journal_begin(&journal, first, JOURNAL_STEP_BAUD);
+    journal_done(&journal, first, JOURNAL_STEP_BAUD);
+    journal_begin(&journal, first, JOURNAL_STEP_NAME);
+    second = journal_entry(&journal, "/dev/ttyUSB1");
+    journal_connected(&journal, second, 115200);
+    journal_begin(&journal, second, JOURNAL_STEP_REBOOT);
+    journal_done(&journal, second, JOURNAL_STEP_REBOOT);
+    journal_complete(&journal, second);
+    journal_close(&journal);
+
+    // Crash halfway through confirming the first device's name
+    file = fopen(path, "a");
+    fputs("done na", file);
+    fclose(file);
+
+    check(journal_open(&journal, path, SETTINGS), "reopen the journal");
+    check(journal.settings != NULL && !strcmp(journal.settings, SETTINGS),
+            "the settings are recorded");
+    first = journal_entry(&journal, "/dev/ttyUSB0");
+    check(first->connected_baud == 9600, "the connected baud is replayed");
+    check(journal_step_done(first, JOURNAL_STEP_BAUD),
+            "a confirmed step is done");
+    check(journal_step_uncertain(first, JOURNAL_STEP_NAME),
+            "the step with the torn record is uncertain");
+    check(!first->complete, "an unfinished device isn't complete");
+    check(journal_entry(&journal, "/dev/ttyUSB1")->complete,
+            "a finished device is complete");
+
+    journal_done(&journal, first, JOURNAL_STEP_NAME);
+    journal_close(&journal);
+
+    check(journal_open(&journal, path, SETTINGS), "reopen after resuming");
+    check(journal_step_done(journal_entry(&journal, "/dev/ttyUSB0"),
+                JOURNAL_STEP_NAME), "a record after the torn one is kept");
+    check(journal.entry_count == 2, "no devices are made up");
+    journal_close(&journal);
+    unlink(path);
+
+    if(failures > 0) {
+        printf("FAIL\n");
+        return 1;
+    }
+    printf("journal survived a torn record\nPASS\n");
+    return 0;
+}
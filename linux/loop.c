@@ -0,0 +1,246 @@
+#include "loop.h"
+#include "datamode.h"
+#include "serial.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+// Ready fds handled per wait
+#define LOOP_EPOLL_BATCH 32
+
+static bool fleet_deadline(LoopSource* source, unsigned long* at) {
+    return fleet_next_wake((Fleet*)source->context, at);
+}
+
+static void fleet_timeout(LoopSource* source) {
+    fleet_run_ready((Fleet*)source->context);
+}
+
+void loop_fleet_source(LoopSource* source, Fleet* fleet) {
+    memset(source, 0, sizeof(LoopSource));
+    source->fd = -1;
+    source->deadline = fleet_deadline;
+    source->on_timeout = fleet_timeout;
+    source->context = fleet;
+}
+
+static int data_interest(LoopSource* source) {
+    AtCommanderConfig* config = ((LoopDataDevice*)source)->config;
+    // Data queued in command mode has to wait for data mode
+    return LOOP_READABLE | (!config->connected
+            && config->data_tx_queue.count > 0 ? LOOP_WRITABLE : 0);
+}
+
+static bool data_deadline(LoopSource* source, unsigned long* at) {
+    LoopDataDevice* device = (LoopDataDevice*)source;
+    *at = device->next_tick;
+    return device->tick_ms > 0;
+}
+
+static void data_readable(LoopSource* source) {
+    LoopDataDevice* device = (LoopDataDevice*)source;
+    device->process(device);
+}
+
+static void data_writable(LoopSource* source) {
+    at_commander_data_flush(((LoopDataDevice*)source)->config);
+}
+
+static void data_timeout(LoopSource* source) {
+    LoopDataDevice* device = (LoopDataDevice*)source;
+    device->next_tick = host_millis() + device->tick_ms;
+    device->process(device);
+}
+
+void loop_data_device_init(LoopDataDevice* device, AtCommanderConfig* config,
+        int fd, void (*process)(LoopDataDevice* device),
+        unsigned long tick_ms) {
+    memset(device, 0, sizeof(LoopDataDevice));
+    device->source.fd = fd;
+    device->source.interest = data_interest;
+    device->source.deadline = data_deadline;
+    device->source.on_readable = data_readable;
+    device->source.on_writable = data_writable;
+    device->source.on_timeout = data_timeout;
+    device->source.context = device;
+    device->config = config;
+    device->process = process;
+    device->tick_ms = tick_ms;
+    device->next_tick = host_millis() + tick_ms;
+}
+
+bool loop_epoll_init(LoopEpoll* loop, int max_sources) {
+    memset(loop, 0, sizeof(LoopEpoll));
+    loop->sources = calloc(max_sources, sizeof(LoopSource*));
+    if(loop->sources == NULL) {
+        return false;
+    }
+    loop->fd = epoll_create1(EPOLL_CLOEXEC);
+    if(loop->fd == -1) {
+        free(loop->sources);
+        loop->sources = NULL;
+        return false;
+    }
+    loop->max_sources = max_sources;
+    return true;
+}
+
+void loop_epoll_free(LoopEpoll* loop) {
+    if(loop->fd != -1) {
+        close(loop->fd);
+        loop->fd = -1;
+    }
+    free(loop->sources);
+    loop->sources = NULL;
+    loop->source_count = 0;
+}
+
+static int epoll_events(LoopSource* source) {
+    int interest = source->interest != NULL ? source->interest(source) : 0;
+    return (interest & LOOP_READABLE ? EPOLLIN : 0)
+            | (interest & LOOP_WRITABLE ? EPOLLOUT : 0);
+}
+
+/** Private: Bring what epoll watches a source's fd for up to date, as its
+ * interest changes with what it's doing (e.g. data waiting to be flushed).
+ */
+static void update_watch(LoopEpoll* loop, LoopSource* source) {
+    struct epoll_event event;
+    int events;
+    if(source->fd < 0) {
+        return;
+    }
+
+    events = epoll_events(source);
+    if(events != source->watched) {
+        memset(&event, 0, sizeof(event));
+        event.events = events;
+        event.data.ptr = source;
+        if(epoll_ctl(loop->fd, EPOLL_CTL_MOD, source->fd, &event) == 0) {
+            source->watched = events;
+        }
+    }
+}
+
+bool loop_epoll_add(LoopEpoll* loop, LoopSource* source) {
+    struct epoll_event event;
+    if(loop->source_count == loop->max_sources) {
+        return false;
+    }
+
+    if(source->fd >= 0) {
+        memset(&event, 0, sizeof(event));
+        event.events = epoll_events(source);
+        event.data.ptr = source;
+        if(epoll_ctl(loop->fd, EPOLL_CTL_ADD, source->fd, &event) == -1) {
+            return false;
+        }
+        source->watched = event.events;
+    }
+    loop->sources[loop->source_count++] = source;
+    return true;
+}
+
+void loop_epoll_remove(LoopEpoll* loop, LoopSource* source) {
+    int i;
+    for(i = 0; i < loop->source_count; i++) {
+        if(loop->sources[i] == source) {
+            if(source->fd >= 0) {
+                epoll_ctl(loop->fd, EPOLL_CTL_DEL, source->fd, NULL);
+            }
+            loop->sources[i] = loop->sources[--loop->source_count];
+            return;
+        }
+    }
+}
+
+int loop_epoll_timeout_ms(LoopEpoll* loop) {
+    unsigned long now = host_millis();
+    long timeout = -1;
+    int i;
+    for(i = 0; i < loop->source_count; i++) {
+        LoopSource* source = loop->sources[i];
+        unsigned long at;
+        if(source->deadline != NULL && source->deadline(source, &at)) {
+            long remaining = (long)(at - now);
+            if(remaining < 0) {
+                remaining = 0;
+            }
+            if(timeout == -1 || remaining < timeout) {
+                timeout = remaining;
+            }
+        }
+    }
+    return timeout > INT_MAX ? INT_MAX : (int)timeout;
+}
+
+/** Private: Wait up to timeout_ms for fds to be ready, then call back every
+ * source with a ready fd or a deadline that has passed.
+ */
+static int wait_and_dispatch(LoopEpoll* loop, int timeout_ms) {
+    struct epoll_event events[LOOP_EPOLL_BATCH];
+    unsigned long now;
+    int callbacks = 0;
+    int ready;
+    int i;
+
+    ready = epoll_wait(loop->fd, events, LOOP_EPOLL_BATCH, timeout_ms);
+    if(ready == -1) {
+        if(errno != EINTR) {
+            return -1;
+        }
+        ready = 0;
+    }
+
+    for(i = 0; i < ready; i++) {
+        LoopSource* source = (LoopSource*)events[i].data.ptr;
+        // A hung up fd reads as the end of its data, so it's readable too
+        if((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                && source->on_readable != NULL) {
+            source->on_readable(source);
+            callbacks++;
+        }
+        if((events[i].events & EPOLLOUT) && source->on_writable != NULL) {
+            source->on_writable(source);
+            callbacks++;
+        }
+    }
+
+    now = host_millis();
+    for(i = 0; i < loop->source_count; i++) {
+        LoopSource* source = loop->sources[i];
+        unsigned long at;
+        if(source->deadline != NULL && source->on_timeout != NULL
+                && source->deadline(source, &at)
+                && (long)(at - now) <= 0) {
+            source->on_timeout(source);
+            callbacks++;
+        }
+    }
+
+    // Leave the epoll fd showing what's ready now, for an outer reactor
+    for(i = 0; i < loop->source_count; i++) {
+        update_watch(loop, loop->sources[i]);
+    }
+    return callbacks;
+}
+
+int loop_epoll_dispatch(LoopEpoll* loop) {
+    return wait_and_dispatch(loop, 0);
+}
+
+int loop_epoll_run_once(LoopEpoll* loop, int max_wait_ms) {
+    int timeout = loop_epoll_timeout_ms(loop);
+    int i;
+    for(i = 0; i < loop->source_count; i++) {
+        update_watch(loop, loop->sources[i]);
+    }
+    if(max_wait_ms >= 0 && (timeout == -1 || max_wait_ms < timeout)) {
+        timeout = max_wait_ms;
+    }
+    return wait_and_dispatch(loop, timeout);
+}
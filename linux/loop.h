@@ -0,0 +1,129 @@
+#ifndef _LOOP_H_
+#define _LOOP_H_
+
+#include "atcommander.h"
+#include "fleet.h"
+
+#include <stdbool.h>
+
+/* Event loop adapters let a host that already runs a reactor (epoll, libuv,
+ * libevent, GLib) drive its devices from it, without blocking the loop or a
+ * helper thread.
+ *
+ * Each thing the loop drives is a source: the fd of its transport, what it's
+ * waiting for on it, and when it next needs to run. The loop watches for those
+ * and calls back into the source. Two kinds are ready made:
+ *
+ *  - a fleet, whose sessions make the library's blocking calls - it has no fd
+ *    of its own, it's driven by when its sessions next wake.
+ *  - a data mode device, driven by its transport's fd - it's processed as data
+ *    arrives (e.g. with at_commander_xbee_process), the data queued while in
+ *    command mode is flushed as the port can take it, and it can be ticked
+ *    for its own timeouts.
+ *
+ * LoopEpoll is the adapter for epoll. Its fd is readable whenever one of its
+ * sources is ready, so another reactor can drive it too - watch the fd, with
+ * a timer for loop_epoll_timeout_ms, and call loop_epoll_dispatch when either
+ * fires.
+ */
+
+#define LOOP_READABLE (1 << 0)
+#define LOOP_WRITABLE (1 << 1)
+
+typedef struct LoopSource LoopSource;
+
+struct LoopSource {
+    // The transport's fd, or -1 if it's only driven by time
+    int fd;
+    // Returns the LOOP_READABLE and LOOP_WRITABLE events it's waiting for
+    int (*interest)(LoopSource* source);
+    // Returns true with the host_millis time it next needs on_timeout, which
+    // may already have passed, or false if it doesn't
+    bool (*deadline)(LoopSource* source, unsigned long* at);
+    void (*on_readable)(LoopSource* source);
+    void (*on_writable)(LoopSource* source);
+    void (*on_timeout)(LoopSource* source);
+    void* context;
+
+    // The events the loop is watching for, to only update it on a change
+    int watched;
+};
+
+/** Public: Set up a source that runs a fleet's sessions as they wake.
+ */
+void loop_fleet_source(LoopSource* source, Fleet* fleet);
+
+typedef struct LoopDataDevice LoopDataDevice;
+
+/** Public: A device in data mode, driven by its transport's fd.
+ */
+struct LoopDataDevice {
+    // Must be first, the callbacks find the device from it
+    LoopSource source;
+    AtCommanderConfig* config;
+    // Called as data arrives and on each tick - read it with
+    // at_commander_data_read or hand it to e.g. at_commander_xbee_process
+    void (*process)(LoopDataDevice* device);
+    // How often to call process when nothing arrives, for its own timeouts
+    // (e.g. at_commander_connection_tick), or 0 for never
+    unsigned long tick_ms;
+    unsigned long next_tick;
+    void* context;
+};
+
+/** Public: Set up a data mode device's source.
+ *
+ *  fd - the transport's fd, e.g. a SerialPort's.
+ *  process - called as data arrives.
+ *  tick_ms - how often to call process regardless, or 0 for never.
+ */
+void loop_data_device_init(LoopDataDevice* device, AtCommanderConfig* config,
+        int fd, void (*process)(LoopDataDevice* device),
+        unsigned long tick_ms);
+
+/** Public: An epoll reactor for a fixed number of sources.
+ */
+typedef struct {
+    int fd;
+    LoopSource** sources;
+    int source_count;
+    int max_sources;
+} LoopEpoll;
+
+/** Public: Create the epoll instance.
+ *
+ *  Returns false if it couldn't be created.
+ */
+bool loop_epoll_init(LoopEpoll* loop, int max_sources);
+
+void loop_epoll_free(LoopEpoll* loop);
+
+/** Public: Start watching a source - not from one of the callbacks.
+ *
+ *  Returns false if the loop is full or its fd can't be watched.
+ */
+bool loop_epoll_add(LoopEpoll* loop, LoopSource* source);
+
+void loop_epoll_remove(LoopEpoll* loop, LoopSource* source);
+
+/** Public: How long until a source's deadline, for an outer reactor's timer.
+ *
+ *  Returns the ms until the earliest deadline, 0 if one has passed, or -1 if
+ *  no source has one.
+ */
+int loop_epoll_timeout_ms(LoopEpoll* loop);
+
+/** Public: Handle every source that's ready, without waiting.
+ *
+ *  Returns the number of callbacks made.
+ */
+int loop_epoll_dispatch(LoopEpoll* loop);
+
+/** Public: Wait for a source to be ready, up to max_wait_ms (or -1 to wait
+ * for as long as it takes), then handle every one that is.
+ *
+ *  Returns the number of callbacks made, or -1 if waiting failed.
+ */
+int loop_epoll_run_once(LoopEpoll* loop, int max_wait_ms);
+
+#endif // _LOOP_H_
@@ -0,0 +1,195 @@
+/* Drive a fleet of emulated RN-42s and a data mode device on a socketpair from
+ * one epoll loop, first on its own and then nested in a poll() loop, and check
+ * that every device is configured, data flows both ways and the device ticks.
+ */
+#include "atcommander.h"
+#include "datamode.h"
+#include "emulated.h"
+#include "loop.h"
+#include "serial.h"
+
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define DEVICE_COUNT 16
+#define DEVICE_BAUD 115200
+#define DEVICE_NAME "loop"
+#define TICK_MS 5
+#define TIMEOUT_MS 5000
+
+typedef struct {
+    char received[64];
+    int received_length;
+    int ticks;
+} DataContext;
+
+static int succeeded;
+
+static bool provision(FleetSession* session) {
+    snprintf(session->response_buffer, session->response_buffer_size,
+            DEVICE_NAME);
+    return at_commander_set_name(&session->config, session->response_buffer,
+                false)
+            && at_commander_exit_command_mode(&session->config);
+}
+
+static void finished(Fleet* fleet, FleetSession* session) {
+    succeeded += session->succeeded;
+}
+
+static void process(LoopDataDevice* device) {
+    DataContext* context = (DataContext*)device->context;
+    int space = sizeof(context->received) - 1 - context->received_length;
+    int bytes_read = at_commander_data_read(device->config,
+            (uint8_t*)&context->received[context->received_length], space);
+    if(bytes_read == 0) {
+        context->ticks++;
+    }
+    context->received_length += bytes_read;
+    context->received[context->received_length] = '\0';
+}
+
+static bool start_devices(Fleet* fleet, EmulatedDevice* devices) {
+    AtCommanderConfig config;
+    int i;
+    memset(&config, 0, sizeof(config));
+    config.platform = AT_PLATFORM_RN42;
+    config.baud_rate_initializer = emulated_initialize_baud;
+    config.write_function = emulated_write;
+    config.read_function = emulated_read;
+    config.millis_function = host_millis;
+    for(i = 0; i < DEVICE_COUNT; i++) {
+        emulated_init(&devices[i], DEVICE_BAUD);
+        config.device = &devices[i];
+        if(fleet_start(fleet, &config, "device", provision,
+                    &devices[i]) == NULL) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int misconfigured(EmulatedDevice* devices) {
+    int failures = 0;
+    int i;
+    for(i = 0; i < DEVICE_COUNT; i++) {
+        failures += strcmp(devices[i].name, DEVICE_NAME) != 0;
+    }
+    return failures;
+}
+
+// Append whatever the peer end of the socketpair has received
+static void read_peer(int fd, char* buffer, int* length, int size) {
+    int bytes_read = read(fd, &buffer[*length], size - 1 - *length);
+    if(bytes_read > 0) {
+        *length += bytes_read;
+    }
+    buffer[*length] = '\0';
+}
+
+int main(int argc, char** argv) {
+    static EmulatedDevice devices[DEVICE_COUNT];
+    static uint8_t rx_storage[64];
+    static uint8_t tx_storage[64];
+    AtCommanderConfig config;
+    DataContext context;
+    LoopDataDevice device;
+    LoopSource fleet_source;
+    LoopEpoll loop;
+    SerialPort port;
+    FleetLimits limits;
+    Fleet fleet;
+    char peer[64];
+    int peer_length = 0;
+    unsigned long deadline;
+    int pair[2];
+    int failures;
+
+    limits.max_sessions = DEVICE_COUNT;
+    limits.stack_size = 32 * 1024;
+    limits.response_buffer_size = 64;
+    limits.queue_size = 64;
+    limits.trace_events = 0;
+    if(!fleet_init(&fleet, &limits, NULL, 0)
+            || !loop_epoll_init(&loop, 2)) {
+        fprintf(stderr, "Unable to initialize the loop\n");
+        return 1;
+    }
+    fleet.finished = finished;
+
+    if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pair) == -1) {
+        perror("socketpair");
+        return 1;
+    }
+    memset(&port, 0, sizeof(port));
+    port.path = "socketpair";
+    port.fd = pair[0];
+    memset(&config, 0, sizeof(config));
+    serial_configure(&config, &port);
+    at_commander_data_init(&config, rx_storage, sizeof(rx_storage),
+            tx_storage, sizeof(tx_storage));
+    // Written while in command mode, so it waits for the loop to flush it
+    config.connected = true;
+    at_commander_data_write(&config, (const uint8_t*)"hello", 5);
+    config.connected = false;
+
+    memset(&context, 0, sizeof(context));
+    loop_data_device_init(&device, &config, pair[0], process, TICK_MS);
+    device.context = &context;
+    loop_fleet_source(&fleet_source, &fleet);
+    if(!start_devices(&fleet, devices)
+            || !loop_epoll_add(&loop, &device.source)
+            || !loop_epoll_add(&loop, &fleet_source)) {
+        fprintf(stderr, "Unable to add the sources\n");
+        return 1;
+    }
+
+    // On its own
+    if(write(pair[1], "ping", 4) != 4) {
+        perror("write");
+        return 1;
+    }
+    deadline = host_millis() + TIMEOUT_MS;
+    while((fleet.active_sessions > 0 || context.received_length < 4
+                || peer_length < 5)
+            && (long)(host_millis() - deadline) < 0) {
+        loop_epoll_run_once(&loop, 10);
+        read_peer(pair[1], peer, &peer_length, sizeof(peer));
+    }
+    failures = misconfigured(devices);
+
+    // Nested in another reactor, watching the epoll fd with its own timer
+    if(!start_devices(&fleet, devices) || write(pair[1], "pong", 4) != 4) {
+        fprintf(stderr, "Unable to start the second round\n");
+        return 1;
+    }
+    deadline = host_millis() + TIMEOUT_MS;
+    while((fleet.active_sessions > 0 || context.received_length < 8)
+            && (long)(host_millis() - deadline) < 0) {
+        struct pollfd outer;
+        outer.fd = loop.fd;
+        outer.events = POLLIN;
+        poll(&outer, 1, loop_epoll_timeout_ms(&loop));
+        loop_epoll_dispatch(&loop);
+    }
+    failures += misconfigured(devices);
+
+    loop_epoll_free(&loop);
+    fleet_free(&fleet);
+    close(pair[0]);
+    close(pair[1]);
+
+    printf("%d of %d devices succeeded, received \"%s\", sent \"%s\", "
+            "%d ticks, %d misconfigured\n", succeeded, DEVICE_COUNT * 2,
+            context.received, peer, context.ticks, failures);
+    if(succeeded != DEVICE_COUNT * 2 || strcmp(context.received, "pingpong")
+            || strcmp(peer, "hello") || context.ticks == 0 || failures > 0) {
+        printf("FAIL\n");
+        return 1;
+    }
+    printf("PASS\n");
+    return 0;
+}
@@ -0,0 +1,817 @@
+/* Apply the same settings to AT devices on many serial ports in parallel,
+ * optionally recording a timeline of the run.
+ *
+ * The devices are driven by a fleet engine on a single thread, a limited
+ * number at a time (-j). With -c, they're spread over that many threads
+ * instead, each with a fleet of its own, for when one core can't keep up.
+ *
+ * The timeline is written in the Chrome trace event format - open it in
+ * chrome://tracing or https://ui.perfetto.dev to see each device's baud sweep,
+ * commands, stores, reboots and waits side by side.
+ *
+ * With a journal (-J), each device's progress is recorded as it's made, and a
+ * run with the same journal and settings resumes where the last one stopped -
+ * devices that finished are skipped, the others start at the baud rate they
+ * were last seen at and skip the steps that are done. A step that was in
+ * flight is checked before it's applied again, where the device can say.
+ *
+ * In watch mode (-w), it runs until interrupted and provisions each port as
+ * it's plugged in, instead of a list of ports - the arguments are patterns for
+ * the ports to watch for, by default USB serial adapters. Each unit's time from
+ * being plugged in to being done is reported, and a unit that's unplugged
+ * midway is given up on right away.
+ *
+ * Example:
+ *    $ ./provision -p rn42 -b 115200 -n sensor -S -r -t run.json \
+ *          -J run.journal /dev/ttyUSB0 /dev/ttyUSB1
+ *    $ ./provision -p rn42 -n sensor -V -w
+ */
+#include "atcommander.h"
+#include "fleet.h"
+#include "hotplug.h"
+#include "journal.h"
+#include "serial.h"
+#include "shards.h"
+#include "trace.h"
+
+#include <fnmatch.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PROVISION_REBOOT_DELAY_MS 1000
+#define PROVISION_DEFAULT_SESSIONS 256
+#define PROVISION_STACK_SIZE (32 * 1024)
+#define PROVISION_RESPONSE_BUFFER_SIZE 128
+#define PROVISION_QUEUE_SIZE 256
+#define PROVISION_TRACE_EVENTS 4096
+// How long to keep trying to open a port that was just plugged in, while udev
+// sets it up
+#define PROVISION_OPEN_GRACE_MS 2000
+#define PROVISION_OPEN_RETRY_MS 50
+// How long to wait for hotplug events when nothing else is going on
+#define PROVISION_IDLE_POLL_MS 100
+// How many results to collect from the shards at once
+#define PROVISION_SHARD_RESULTS 64
+
+typedef struct {
+    SerialPort port;
+    bool succeeded;
+    // The device's progress in the journal, NULL without one
+    JournalEntry* journal_entry;
+    // Set to stop the device's work, e.g. when shutting down
+    volatile sig_atomic_t cancelled;
+
+    // In watch mode - whether the slot holds a plugged in port, and if its
+    // session has started
+    bool in_use;
+    bool started;
+    bool unplugged;
+    char path[HOTPLUG_MAX_NAME_LENGTH + 8];
+    unsigned long plugged_at;
+    // Keep trying to open the port until then, as udev may not be done with it
+    unsigned long open_deadline;
+} Device;
+
+typedef struct {
+    const AtCommanderPlatform* platform;
+    const char* platform_name;
+    int baud;
+    const char* name;
+    bool serialized_name;
+    bool reboot;
+    bool hardware_flow_control;
+    bool verbose;
+    // Read back what the device can report after applying the settings
+    bool verify;
+    // The most time to spend on each device, 0 for no limit
+    unsigned long budget_ms;
+} Settings;
+
+static Settings settings;
+
+// Where progress is recorded, NULL without a journal
+static Journal* journal;
+
+// The baud rate the last device was found at - the next one is likely the
+// same, as they're usually from the same batch. Shared by the shards.
+static int likely_baud;
+
+// Where the timeline is written, NULL without one - shards take turns
+static FILE* trace_file;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Watch mode's tally of units, and their time from plug in to done
+typedef struct {
+    int units;
+    int succeeded;
+    unsigned long total_latency_ms;
+    unsigned long max_latency_ms;
+} WatchStats;
+
+static WatchStats watch_stats;
+
+// Set on SIGINT/SIGTERM to stop every device's work right away
+static volatile sig_atomic_t shutting_down;
+
+static void shut_down(int signal) {
+    shutting_down = 1;
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "Usage: %s [-p rn42|xbee|hayes|esp] [-b baud] "
+            "[-n name [-S]] [-r] [-j sessions] [-c threads] [-T seconds] "
+            "[-t trace.json] "
+            "[-J journal] [-V] [-f] [-v] "
+            "<serial port>...\n", name);
+    fprintf(stderr, "       %s -w [options] [port name pattern]...\n", name);
+    fprintf(stderr, "  -S  append the device's serial number to the name\n");
+    fprintf(stderr, "  -r  reboot the devices after applying the settings\n");
+    fprintf(stderr, "  -j  the most devices to provision at once\n");
+    fprintf(stderr, "  -c  spread the devices over this many threads, 0 for "
+            "one per core\n");
+    fprintf(stderr, "  -T  give up on a device after this long\n");
+    fprintf(stderr, "  -t  write a timeline of the run for a trace viewer\n");
+    fprintf(stderr, "  -J  record progress in a journal, and resume from it\n");
+    fprintf(stderr, "  -V  verify the settings the devices can report\n");
+    fprintf(stderr, "  -w  provision ports as they're plugged in, by default "
+            "ttyUSB* and ttyACM*\n");
+    fprintf(stderr, "  -f  use RTS/CTS hardware flow control\n");
+    fprintf(stderr, "  -v  log library debug output\n");
+}
+
+static const AtCommanderPlatform* find_platform(const char* name) {
+    if(!strcmp(name, "rn42")) {
+        return &AT_PLATFORM_RN42;
+    } else if(!strcmp(name, "xbee")) {
+        return &AT_PLATFORM_XBEE;
+    } else if(!strcmp(name, "hayes")) {
+        return &AT_PLATFORM_HAYES;
+    } else if(!strcmp(name, "esp")) {
+        return &AT_PLATFORM_ESPRESSIF;
+    }
+    return NULL;
+}
+
+/** Private: Enter command mode, trying the baud rates the device is likely at
+ * (where the journal last saw it, or where the last device was) before
+ * falling back to a full sweep.
+ */
+static bool enter_command_mode(FleetSession* session) {
+    AtCommanderConfig* config = &session->config;
+    JournalEntry* entry = ((Device*)session->context)->journal_entry;
+    int hint = entry != NULL && entry->connected_baud != 0 ?
+            entry->connected_baud : __atomic_load_n(&likely_baud,
+                __ATOMIC_RELAXED);
+    bool connected = false;
+
+    if(hint != 0) {
+        // Where it's likely to be, or where the settings may have moved it
+        int likely_bauds[2] = {hint, settings.baud};
+        config->supported_baud_rates = likely_bauds;
+        config->supported_baud_rate_count = settings.baud != 0 ? 2 : 1;
+        connected = at_commander_enter_command_mode(config);
+        config->supported_baud_rates = NULL;
+        config->supported_baud_rate_count = 0;
+    }
+
+    if(!connected && !at_commander_enter_command_mode(config)) {
+        return false;
+    }
+    __atomic_store_n(&likely_baud, config->baud, __ATOMIC_RELAXED);
+    return entry == NULL || journal_connected(journal, entry, config->baud);
+}
+
+static bool apply_baud(FleetSession* session) {
+    return at_commander_set_baud(&session->config, settings.baud);
+}
+
+static bool apply_name(FleetSession* session) {
+    return at_commander_set_name(&session->config, settings.name,
+            settings.serialized_name);
+}
+
+static bool verify_name(FleetSession* session) {
+    int length = at_commander_get_name(&session->config,
+            session->response_buffer, session->response_buffer_size);
+    if(length <= 0) {
+        return false;
+    }
+    // A serialized name has the device's serial number appended
+    return settings.serialized_name ? !strncmp(session->response_buffer,
+                settings.name, strlen(settings.name)) :
+            !strcmp(session->response_buffer, settings.name);
+}
+
+static bool apply_reboot(FleetSession* session) {
+    if(!at_commander_reboot(&session->config)) {
+        return false;
+    }
+    trace_begin(&session->trace, "reboot wait", NULL);
+    fleet_delay_ms(PROVISION_REBOOT_DELAY_MS);
+    trace_end(&session->trace, "reboot wait");
+    return true;
+}
+
+/** Private: Apply one step of the settings, unless the journal says it's
+ * done. If it was in flight when the last run stopped and the device can say
+ * whether it took effect (verify isn't NULL), it's only applied again if not.
+ */
+static bool run_step(FleetSession* session, JournalStep step,
+        bool (*apply)(FleetSession*), bool (*verify)(FleetSession*)) {
+    JournalEntry* entry = ((Device*)session->context)->journal_entry;
+    if(entry == NULL) {
+        return apply(session);
+    }
+
+    if(journal_step_done(entry, step)) {
+        return true;
+    }
+
+    if(!(journal_step_uncertain(entry, step) && verify != NULL
+                && verify(session))) {
+        if(!journal_begin(journal, entry, step) || !apply(session)) {
+            return false;
+        }
+    }
+    return journal_done(journal, entry, step);
+}
+
+/** Private: Apply the settings to one device, returning it to data mode
+ * afterwards.
+ */
+static bool provision(FleetSession* session) {
+    AtCommanderConfig* config = &session->config;
+    JournalEntry* entry = ((Device*)session->context)->journal_entry;
+    if(!enter_command_mode(session)) {
+        return false;
+    }
+
+    if(settings.baud != 0 && !run_step(session, JOURNAL_STEP_BAUD, apply_baud,
+                NULL)) {
+        return false;
+    }
+
+    if(settings.name != NULL && !run_step(session, JOURNAL_STEP_NAME,
+                apply_name, verify_name)) {
+        return false;
+    }
+
+    if(settings.verify && settings.name != NULL && !verify_name(session)) {
+        printf("%s: name didn't verify, read back \"%s\"\n",
+                ((Device*)session->context)->port.path,
+                session->response_buffer);
+        return false;
+    }
+
+    if(settings.reboot) {
+        if(!run_step(session, JOURNAL_STEP_REBOOT, apply_reboot, NULL)) {
+            return false;
+        }
+    } else if(!at_commander_exit_command_mode(config)) {
+        return false;
+    }
+    return entry == NULL || journal_complete(journal, entry);
+}
+
+static bool run_device(FleetSession* session) {
+    bool succeeded;
+    at_commander_set_budget(&session->config, settings.budget_ms);
+    trace_begin(&session->trace, "provision", NULL);
+    succeeded = provision(session);
+    trace_end(&session->trace, "provision");
+    return succeeded;
+}
+
+static void finished(Fleet* fleet, FleetSession* session) {
+    Device* device = (Device*)session->context;
+    AtCommanderResult interrupted = at_commander_interrupted(&session->config);
+    const char* outcome;
+    device->succeeded = session->succeeded;
+    serial_close(&device->port);
+    outcome = device->succeeded ? "ok" : device->unplugged ? "UNPLUGGED" :
+            interrupted == AT_COMMANDER_RESULT_CANCELLED ? "CANCELLED" :
+            interrupted == AT_COMMANDER_RESULT_BUDGET_EXHAUSTED ?
+                "OUT OF TIME" : "FAILED";
+
+    if(device->in_use) {
+        unsigned long latency = host_millis() - device->plugged_at;
+        watch_stats.units++;
+        if(device->succeeded) {
+            watch_stats.succeeded++;
+            watch_stats.total_latency_ms += latency;
+            if(latency > watch_stats.max_latency_ms) {
+                watch_stats.max_latency_ms = latency;
+            }
+        }
+        printf("%s: %s, %lu ms from plug in\n", device->port.path, outcome,
+                latency);
+        device->in_use = false;
+    } else {
+        printf("%s: %s\n", device->port.path, outcome);
+    }
+
+    if(trace_file != NULL) {
+        pthread_mutex_lock(&trace_lock);
+        trace_json_write_track(trace_file, &session->trace, session->id);
+        pthread_mutex_unlock(&trace_lock);
+    }
+}
+
+static void shard_finished(Shards* shards, Shard* shard,
+        FleetSession* session) {
+    finished(&shard->fleet, session);
+}
+
+/** Private: Open the port of a device and start provisioning it, in the
+ * fleet or, if shards isn't NULL, on the next shard.
+ *
+ * Returns false if there isn't a free session to start it in yet, or its port
+ * can't be opened yet.
+ */
+static bool start_device(Fleet* fleet, Shards* shards, Device* device) {
+    AtCommanderConfig config;
+    if(device->journal_entry != NULL && device->journal_entry->complete) {
+        device->succeeded = true;
+        printf("%s: ok (done in an earlier run)\n", device->port.path);
+        return true;
+    }
+
+    // Only as many ports open as there are sessions to use them
+    if(shards != NULL ? shards->pending >= shards->count
+                * shards->shards[0].fleet.limits.max_sessions :
+            fleet->free_sessions == NULL) {
+        return false;
+    }
+
+    if(!serial_open(&device->port)) {
+        if((long)(device->open_deadline - host_millis()) > 0) {
+            return false;
+        }
+        perror(device->port.path);
+        printf("%s: FAILED\n", device->port.path);
+        device->in_use = false;
+        return true;
+    }
+
+    memset(&config, 0, sizeof(config));
+    config.platform = *settings.platform;
+    serial_configure(&config, &device->port);
+    config.cancel_flag = &device->cancelled;
+    // USB serial adapters drop the odd response, so give settings a few tries
+    config.retry_policy = &AT_RETRY_POLICY_DEFAULT;
+    if(settings.verbose) {
+        config.log_function = host_debug;
+    }
+    if(shards != NULL) {
+        if(!shards_submit(shards, &config, device->port.path, run_device,
+                    device)) {
+            serial_close(&device->port);
+            return false;
+        }
+        return true;
+    }
+    fleet_start(fleet, &config, device->port.path, run_device, device);
+    return true;
+}
+
+/** Private: Describe the settings for the journal, so it isn't resumed with
+ * different ones.
+ */
+static void describe_settings(char* description, int size) {
+    snprintf(description, size, "-p %s -b %d -n %s%s%s",
+            settings.platform_name, settings.baud,
+            settings.name != NULL ? settings.name : "-",
+            settings.serialized_name ? " -S" : "",
+            settings.reboot ? " -r" : "");
+}
+
+/** Private: Open the journal and find each device's progress in it.
+ *
+ * Returns false if the journal can't be used for this run.
+ */
+static bool open_journal(const char* path, Device* devices,
+        int device_count) {
+    static Journal opened;
+    char description[256];
+    int i;
+
+    describe_settings(description, sizeof(description));
+    if(!journal_open(&opened, path, description)) {
+        perror(path);
+        return false;
+    }
+
+    if(opened.settings != NULL && strcmp(opened.settings, description)) {
+        fprintf(stderr, "%s was written for different settings (%s) - "
+                "remove it to start over\n", path, opened.settings);
+        journal_close(&opened);
+        return false;
+    }
+
+    // Add every device first, as adding entries can move them
+    for(i = 0; i < device_count; i++) {
+        if(journal_entry(&opened, devices[i].port.path) == NULL) {
+            perror(path);
+            journal_close(&opened);
+            return false;
+        }
+    }
+    for(i = 0; i < device_count; i++) {
+        devices[i].journal_entry = journal_entry(&opened,
+                devices[i].port.path);
+    }
+    journal = &opened;
+    return true;
+}
+
+static void cancel_all(Device* devices, int device_count) {
+    int i;
+    for(i = 0; i < device_count; i++) {
+        devices[i].cancelled = 1;
+    }
+}
+
+static bool matches_any(const char* name, char** patterns,
+        int pattern_count) {
+    int i;
+    for(i = 0; i < pattern_count; i++) {
+        if(fnmatch(patterns[i], name, 0) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/** Private: Take a port that was just plugged in, or give up on one that was
+ * unplugged.
+ */
+static void handle_hotplug(HotplugEvent* event, Device* devices,
+        int device_count) {
+    char path[sizeof(devices[0].path)];
+    int i;
+    snprintf(path, sizeof(path), "/dev/%s", event->name);
+
+    if(event->action == HOTPLUG_REMOVED) {
+        for(i = 0; i < device_count; i++) {
+            Device* device = &devices[i];
+            if(device->in_use && !strcmp(device->path, path)) {
+                device->unplugged = true;
+                device->cancelled = 1;
+                if(!device->started) {
+                    printf("%s: UNPLUGGED before it started\n", path);
+                    device->in_use = false;
+                }
+            }
+        }
+        return;
+    }
+
+    for(i = 0; i < device_count; i++) {
+        Device* device = &devices[i];
+        if(!device->in_use) {
+            memset(device, 0, sizeof(Device));
+            strcpy(device->path, path);
+            device->port.path = device->path;
+            device->port.fd = -1;
+            device->port.hardware_flow_control =
+                    settings.hardware_flow_control;
+            device->in_use = true;
+            device->plugged_at = host_millis();
+            device->open_deadline = device->plugged_at
+                    + PROVISION_OPEN_GRACE_MS;
+            printf("%s: plugged in\n", path);
+            return;
+        }
+    }
+    printf("%s: SKIPPED, all %d sessions are busy\n", path, device_count);
+}
+
+/** Private: Provision a list of devices in the fleet, starting them as
+ * sessions free up, until they're done or it's shut down.
+ */
+static void provision_devices(Fleet* fleet, Device* devices,
+        int device_count) {
+    int next_device = 0;
+    while((next_device < device_count && !shutting_down)
+            || fleet->active_sessions > 0) {
+        if(shutting_down) {
+            cancel_all(devices, device_count);
+        }
+        while(next_device < device_count && !shutting_down
+                && start_device(fleet, NULL, &devices[next_device])) {
+            next_device++;
+        }
+        fleet_step(fleet);
+    }
+}
+
+/** Private: Provision a list of devices on several shards - the same as
+ * provision_devices, but the fleets are stepped by the shards' threads while
+ * this one keeps them supplied.
+ */
+static void provision_devices_sharded(Shards* shards, Device* devices,
+        int device_count) {
+    ShardResult results[PROVISION_SHARD_RESULTS];
+    int next_device = 0;
+    while((next_device < device_count && !shutting_down)
+            || shards->pending > 0) {
+        if(shutting_down) {
+            cancel_all(devices, device_count);
+        }
+        while(next_device < device_count && !shutting_down
+                && start_device(NULL, shards, &devices[next_device])) {
+            next_device++;
+        }
+        // Each device was reported by its shard as it finished
+        if(shards_poll(shards, results, PROVISION_SHARD_RESULTS) == 0) {
+            host_delay_ms(1);
+        }
+    }
+}
+
+/** Private: Provision ports as they're plugged in, until shut down.
+ *
+ *  devices - a slot for each session.
+ *  patterns - the names of the ports to provision, as shell patterns.
+ */
+static void watch_ports(Fleet* fleet, int hotplug_fd, Device* devices,
+        int device_count, char** patterns, int pattern_count) {
+    unsigned long next_open_attempt = 0;
+    while(!shutting_down || fleet->active_sessions > 0) {
+        HotplugEvent event;
+        bool pending = false;
+        int i;
+
+        if(shutting_down) {
+            cancel_all(devices, device_count);
+        }
+
+        while(hotplug_read(hotplug_fd, &event)) {
+            if(!shutting_down && matches_any(event.name, patterns,
+                        pattern_count)) {
+                handle_hotplug(&event, devices, device_count);
+            }
+        }
+
+        // Retrying ports udev isn't done with yet, every so often
+        if((long)(host_millis() - next_open_attempt) >= 0) {
+            for(i = 0; i < device_count; i++) {
+                Device* device = &devices[i];
+                if(device->in_use && !device->started && !shutting_down) {
+                    device->started = start_device(fleet, NULL, device);
+                    pending |= device->in_use && !device->started;
+                }
+            }
+            next_open_attempt = pending ?
+                    host_millis() + PROVISION_OPEN_RETRY_MS : host_millis();
+        }
+
+        if(fleet->active_sessions > 0) {
+            fleet_step(fleet);
+        } else {
+            struct pollfd hotplug = {hotplug_fd, POLLIN, 0};
+            poll(&hotplug, 1, pending ? PROVISION_OPEN_RETRY_MS :
+                    PROVISION_IDLE_POLL_MS);
+        }
+    }
+
+    printf("%d units, %d ok", watch_stats.units, watch_stats.succeeded);
+    if(watch_stats.succeeded > 0) {
+        printf(", plug in to done: mean %lu ms, max %lu ms",
+                watch_stats.total_latency_ms / watch_stats.succeeded,
+                watch_stats.max_latency_ms);
+    }
+    printf("\n");
+}
+
+int main(int argc, char** argv) {
+    static char* default_patterns[] = {"ttyUSB*", "ttyACM*"};
+    const char* trace_path = NULL;
+    const char* journal_path = NULL;
+    FleetLimits limits;
+    Fleet fleet;
+    Shards shards;
+    Device* devices;
+    int device_count;
+    // The number of threads, or 0 to run the fleet on this one
+    int shard_count = 0;
+    bool watching = false;
+    int hotplug_fd = -1;
+    int failures = 0;
+    int option;
+    int i;
+
+    limits.max_sessions = PROVISION_DEFAULT_SESSIONS;
+    limits.stack_size = PROVISION_STACK_SIZE;
+    limits.response_buffer_size = PROVISION_RESPONSE_BUFFER_SIZE;
+    limits.queue_size = PROVISION_QUEUE_SIZE;
+    limits.trace_events = 0;
+
+    settings.platform = &AT_PLATFORM_RN42;
+    settings.platform_name = "rn42";
+    while((option = getopt(argc, argv, "p:b:n:Srj:c:T:t:J:Vwfvh")) != -1) {
+        switch(option) {
+            case 'p':
+                settings.platform_name = optarg;
+                settings.platform = find_platform(optarg);
+                if(settings.platform == NULL) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'b':
+                settings.baud = atoi(optarg);
+                break;
+            case 'n':
+                settings.name = optarg;
+                break;
+            case 'S':
+                settings.serialized_name = true;
+                break;
+            case 'r':
+                settings.reboot = true;
+                break;
+            case 'j':
+                limits.max_sessions = atoi(optarg);
+                break;
+            case 'c':
+                shard_count = atoi(optarg);
+                if(shard_count <= 0) {
+                    shard_count = shards_default_count();
+                }
+                break;
+            case 'T':
+                settings.budget_ms = strtoul(optarg, NULL, 10) * 1000;
+                break;
+            case 't':
+                trace_path = optarg;
+                limits.trace_events = PROVISION_TRACE_EVENTS;
+                break;
+            case 'J':
+                journal_path = optarg;
+                break;
+            case 'V':
+                settings.verify = true;
+                break;
+            case 'w':
+                watching = true;
+                break;
+            case 'f':
+                settings.hardware_flow_control = true;
+                break;
+            case 'v':
+                settings.verbose = true;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    // The platform has to have a command for every setting asked for
+    if(settings.baud != 0 && settings.platform->set_baud_rate_command
+            .request_format == NULL) {
+        fprintf(stderr, "%s devices can't change baud rate\n",
+                settings.platform_name);
+        return 1;
+    }
+    if(settings.name != NULL && (settings.serialized_name ?
+                settings.platform->set_serialized_name_command :
+                settings.platform->set_name_command).request_format == NULL) {
+        fprintf(stderr, "%s devices can't set %s name\n",
+                settings.platform_name,
+                settings.serialized_name ? "a serialized" : "a");
+        return 1;
+    }
+    if(settings.reboot
+            && settings.platform->reboot_command.request_format == NULL) {
+        fprintf(stderr, "%s devices can't be rebooted\n",
+                settings.platform_name);
+        return 1;
+    }
+
+    device_count = argc - optind;
+    if(watching) {
+        if(journal_path != NULL) {
+            // Different units come and go on the same port
+            fprintf(stderr, "A journal can't be used in watch mode\n");
+            return 1;
+        }
+        if(shard_count > 0) {
+            // Hotplug events come in on this thread, one at a time
+            fprintf(stderr, "Threads can't be used in watch mode\n");
+            return 1;
+        }
+        hotplug_fd = hotplug_open();
+        if(hotplug_fd < 0) {
+            perror("Unable to listen for hotplug events");
+            return 1;
+        }
+        device_count = limits.max_sessions;
+    } else if(limits.max_sessions > device_count) {
+        limits.max_sessions = device_count;
+    }
+    if(device_count <= 0 || limits.max_sessions <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if(shard_count > limits.max_sessions) {
+        shard_count = limits.max_sessions;
+    }
+
+    devices = calloc(device_count, sizeof(Device));
+    if(devices == NULL) {
+        perror("Unable to allocate the devices");
+        return 1;
+    }
+    if(shard_count > 0) {
+        // -j is shared between the shards
+        int total_sessions = limits.max_sessions;
+        limits.max_sessions = (total_sessions + shard_count - 1)
+                / shard_count;
+        if(!shards_init(&shards, shard_count, &limits, limits.max_sessions,
+                    false)) {
+            perror("Unable to allocate the shards");
+            return 1;
+        }
+        shards.finished = shard_finished;
+    } else {
+        if(!fleet_init(&fleet, &limits, NULL, 0)) {
+            perror("Unable to allocate the fleet");
+            return 1;
+        }
+        fleet.finished = finished;
+    }
+    if(trace_path != NULL) {
+        trace_file = trace_json_open(trace_path);
+        if(trace_file == NULL) {
+            perror(trace_path);
+            return 1;
+        }
+    }
+
+    signal(SIGINT, shut_down);
+    signal(SIGTERM, shut_down);
+
+    if(watching) {
+        if(optind < argc) {
+            watch_ports(&fleet, hotplug_fd, devices, device_count,
+                    &argv[optind], argc - optind);
+        } else {
+            watch_ports(&fleet, hotplug_fd, devices, device_count,
+                    default_patterns, 2);
+        }
+        hotplug_close(hotplug_fd);
+        if(trace_file != NULL && !trace_json_close(trace_file)) {
+            perror(trace_path);
+        }
+        fleet_free(&fleet);
+        free(devices);
+        return watch_stats.succeeded == watch_stats.units ? 0 : 1;
+    }
+
+    for(i = 0; i < device_count; i++) {
+        devices[i].port.path = argv[optind + i];
+        devices[i].port.fd = -1;
+        devices[i].port.hardware_flow_control =
+                settings.hardware_flow_control;
+    }
+
+    if(journal_path != NULL && !open_journal(journal_path, devices,
+                device_count)) {
+        return 1;
+    }
+
+    if(shard_count > 0) {
+        if(!shards_start(&shards)) {
+            perror("Unable to start the shards");
+            return 1;
+        }
+        provision_devices_sharded(&shards, devices, device_count);
+        shards_stop(&shards);
+        shards_free(&shards);
+    } else {
+        provision_devices(&fleet, devices, device_count);
+        fleet_free(&fleet);
+    }
+
+    for(i = 0; i < device_count; i++) {
+        if(!devices[i].succeeded) {
+            failures++;
+        }
+    }
+
+    if(trace_file != NULL && !trace_json_close(trace_file)) {
+        perror(trace_path);
+    }
+    if(journal != NULL) {
+        journal_close(journal);
+    }
+    free(devices);
+    return failures > 0 ? 1 : 0;
+}
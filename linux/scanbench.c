@@ -0,0 +1,209 @@
+/* Compare feeding a stream to the token matcher a byte at a time with the
+ * vectorized bulk scan, at a range of token densities, and the same for
+ * finding line endings.
+ *
+ * Both paths must find the same tokens at the same offsets, so this doubles as
+ * a check of the scan against the scalar matcher.
+ *
+ * Build with e.g. "make ARCH_FLAGS=-march=native" to use AVX2 where the CPU
+ * has it - otherwise x86-64 builds use SSE2.
+ *
+ * Example:
+ *    $ ./scanbench -m 64
+ */
+#include "token_matcher.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_DEFAULT_MEGABYTES 32
+#define BENCH_PASSES 3
+
+static const char* TOKENS[] = {"%CONNECT", "%DISCONNECT"};
+
+// Average bytes between tokens (and between line endings), 0 for none
+static const int DENSITIES[] = {0, 65536, 4096, 256, 64, 16};
+
+static void usage(const char* name) {
+    fprintf(stderr, "Usage: %s [-m megabytes]\n", name);
+}
+
+static double now_s(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/** Private: Fill a buffer with printable data that contains none of the token
+ * or line ending bytes, then sprinkle tokens and line endings through it.
+ */
+static void fill_stream(uint8_t* stream, size_t size, int spacing) {
+    size_t i;
+    for(i = 0; i < size; i++) {
+        stream[i] = 'a' + rand() % 26;
+    }
+
+    if(spacing == 0) {
+        return;
+    }
+    for(i = rand() % spacing; i + 16 < size; i += 1 + rand() % (spacing * 2)) {
+        const char* token = TOKENS[rand() % 2];
+        memcpy(&stream[i], token, strlen(token));
+        i += strlen(token);
+        stream[i] = rand() % 2 ? '\r' : '\n';
+    }
+}
+
+static void init_matcher(AtCommanderTokenMatcher* matcher) {
+    at_commander_token_matcher_init(matcher);
+    at_commander_token_matcher_add(matcher, TOKENS[0]);
+    at_commander_token_matcher_add(matcher, TOKENS[1]);
+}
+
+/** Private: Sum the offsets of the matched tokens, so the two paths can be
+ * checked against each other.
+ */
+static unsigned long long feed_bytes(const uint8_t* stream, size_t size) {
+    AtCommanderTokenMatcher matcher;
+    unsigned long long checksum = 0;
+    size_t i;
+    init_matcher(&matcher);
+    for(i = 0; i < size; i++) {
+        int token = at_commander_token_matcher_feed(&matcher, stream[i]);
+        if(token != -1) {
+            checksum += i * (token + 1);
+        }
+    }
+    return checksum;
+}
+
+static unsigned long long scan_bytes(const uint8_t* stream, size_t size) {
+    AtCommanderTokenMatcher matcher;
+    unsigned long long checksum = 0;
+    size_t i = 0;
+    init_matcher(&matcher);
+    while(i < size) {
+        int token;
+        // The scan takes an int size, so go a chunk at a time
+        int chunk = size - i > (1 << 30) ? 1 << 30 : (int)(size - i);
+        i += at_commander_token_matcher_scan(&matcher, &stream[i], chunk,
+                &token);
+        if(token != -1) {
+            checksum += (i - 1) * (token + 1);
+        }
+    }
+    return checksum;
+}
+
+static unsigned long long line_ends_scalar(const uint8_t* stream,
+        size_t size) {
+    unsigned long long checksum = 0;
+    size_t i;
+    for(i = 0; i < size; i++) {
+        if(stream[i] == '\r' || stream[i] == '\n') {
+            checksum += i;
+        }
+    }
+    return checksum;
+}
+
+static unsigned long long line_ends_scan(const uint8_t* stream, size_t size) {
+    unsigned long long checksum = 0;
+    size_t i = 0;
+    while(i < size) {
+        int chunk = size - i > (1 << 30) ? 1 << 30 : (int)(size - i);
+        int end = at_commander_find_line_end(&stream[i], chunk);
+        i += end;
+        if(end < chunk) {
+            checksum += i++;
+        }
+    }
+    return checksum;
+}
+
+/** Private: Run a path over the stream a few times, keeping the best time.
+ *
+ * Returns the throughput in MB/s.
+ */
+static double measure(unsigned long long (*path)(const uint8_t*, size_t),
+        const uint8_t* stream, size_t size, unsigned long long* checksum) {
+    double best = 0;
+    int pass;
+    for(pass = 0; pass < BENCH_PASSES; pass++) {
+        double started = now_s();
+        *checksum = path(stream, size);
+        double elapsed = now_s() - started;
+        if(pass == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    return size / best / 1e6;
+}
+
+int main(int argc, char** argv) {
+    size_t size = BENCH_DEFAULT_MEGABYTES * 1000000UL;
+    uint8_t* stream;
+    bool mismatched = false;
+    int option;
+    int i;
+
+    while((option = getopt(argc, argv, "m:h")) != -1) {
+        switch(option) {
+            case 'm':
+                size = strtoul(optarg, NULL, 10) * 1000000UL;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    stream = malloc(size);
+    if(stream == NULL || size == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+#if defined(__AVX2__)
+    printf("vector width: AVX2\n");
+#elif defined(__SSE2__)
+    printf("vector width: SSE2\n");
+#else
+    printf("vector width: none (portable fallback)\n");
+#endif
+    printf("%10s  %12s %12s %8s  %12s %12s %8s\n", "spacing", "feed MB/s",
+            "scan MB/s", "speedup", "eol MB/s", "eol scan", "speedup");
+
+    for(i = 0; i < (int)(sizeof(DENSITIES) / sizeof(int)); i++) {
+        unsigned long long expected, actual;
+        double feed_rate, scan_rate, eol_rate, eol_scan_rate;
+        srand(i);
+        fill_stream(stream, size, DENSITIES[i]);
+
+        feed_rate = measure(feed_bytes, stream, size, &expected);
+        scan_rate = measure(scan_bytes, stream, size, &actual);
+        mismatched |= expected != actual;
+        eol_rate = measure(line_ends_scalar, stream, size, &expected);
+        eol_scan_rate = measure(line_ends_scan, stream, size, &actual);
+        mismatched |= expected != actual;
+
+        if(DENSITIES[i] == 0) {
+            printf("%10s", "none");
+        } else {
+            printf("%10d", DENSITIES[i]);
+        }
+        printf("  %12.0f %12.0f %7.1fx  %12.0f %12.0f %7.1fx\n", feed_rate,
+                scan_rate, scan_rate / feed_rate, eol_rate, eol_scan_rate,
+                eol_scan_rate / eol_rate);
+    }
+
+    free(stream);
+    if(mismatched) {
+        fprintf(stderr, "The scan and byte at a time paths disagree\n");
+        return 1;
+    }
+    return 0;
+}
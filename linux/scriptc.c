@@ -0,0 +1,489 @@
+#include "scriptc.h"
+#include "script.h"
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SCRIPTC_MAX_LABELS 64
+#define SCRIPTC_MAX_FIXUPS 128
+#define SCRIPTC_MAX_LABEL_LENGTH 32
+#define SCRIPTC_MAX_TOKEN_LENGTH 128
+
+typedef enum {
+    TOKEN_END,
+    TOKEN_WORD,
+    TOKEN_STRING
+} TokenType;
+
+typedef struct {
+    TokenType type;
+    char text[SCRIPTC_MAX_TOKEN_LENGTH];
+} Token;
+
+typedef struct {
+    char name[SCRIPTC_MAX_LABEL_LENGTH];
+    int offset;
+    int line;
+} Label;
+
+typedef struct {
+    const char* name;
+    AtCommanderScriptOpcode opcode;
+    // Has a result that "try" can turn into the condition
+    bool can_fail;
+} Instruction;
+
+static const Instruction INSTRUCTIONS[] = {
+    { "end", AT_SCRIPT_END, false },
+    { "fail", AT_SCRIPT_FAIL, false },
+    { "enter", AT_SCRIPT_ENTER, true },
+    { "exit", AT_SCRIPT_EXIT, true },
+    { "get", AT_SCRIPT_GET, true },
+    { "compare", AT_SCRIPT_COMPARE, false },
+    { "set", AT_SCRIPT_SET, true },
+    { "store", AT_SCRIPT_STORE, true },
+    { "reboot", AT_SCRIPT_REBOOT, true },
+    { "wait", AT_SCRIPT_WAIT, false },
+    { "baud", AT_SCRIPT_BAUD, true },
+    { "jump", AT_SCRIPT_JUMP, false },
+    { "jump_if", AT_SCRIPT_JUMP_IF, false },
+    { "jump_unless", AT_SCRIPT_JUMP_UNLESS, false },
+};
+
+typedef struct {
+    const char* cursor;
+    int line;
+    ScriptcError* error;
+
+    uint8_t* output;
+    int size;
+    int max_size;
+
+    Label labels[SCRIPTC_MAX_LABELS];
+    int label_count;
+    // Jump targets to fill in once every label is known
+    Label fixups[SCRIPTC_MAX_FIXUPS];
+    int fixup_count;
+} Compiler;
+
+static bool fail(Compiler* compiler, const char* format, ...) {
+    va_list args;
+    compiler->error->line = compiler->line;
+    va_start(args, format);
+    vsnprintf(compiler->error->message, sizeof(compiler->error->message),
+            format, args);
+    va_end(args);
+    return false;
+}
+
+static bool emit(Compiler* compiler, const void* bytes, int size) {
+    if(compiler->size + size > compiler->max_size) {
+        return fail(compiler, "Script is longer than %d bytes",
+                compiler->max_size);
+    }
+    memcpy(&compiler->output[compiler->size], bytes, size);
+    compiler->size += size;
+    return true;
+}
+
+static bool emit_byte(Compiler* compiler, uint8_t byte) {
+    return emit(compiler, &byte, 1);
+}
+
+static bool emit_number(Compiler* compiler, unsigned long value, int bytes) {
+    uint8_t encoded[4];
+    int i;
+    for(i = 0; i < bytes; i++) {
+        encoded[i] = (value >> (8 * i)) & 0xff;
+    }
+    return emit(compiler, encoded, bytes);
+}
+
+static bool emit_string(Compiler* compiler, const char* string) {
+    return emit(compiler, string, strlen(string) + 1);
+}
+
+/** Private: Read the next token on the current line, stopping at its end or
+ * a comment.
+ */
+static bool next_token(Compiler* compiler, Token* token) {
+    const char* cursor = compiler->cursor;
+    int length = 0;
+
+    while(*cursor == ' ' || *cursor == '\t' || *cursor == '\r') {
+        cursor++;
+    }
+    token->text[0] = '\0';
+    if(*cursor == '\0' || *cursor == '\n' || *cursor == '#') {
+        token->type = TOKEN_END;
+        compiler->cursor = cursor;
+        return true;
+    }
+
+    if(*cursor == '"') {
+        token->type = TOKEN_STRING;
+        for(cursor++; *cursor != '"'; cursor++) {
+            char character = *cursor;
+            if(character == '\0' || character == '\n') {
+                return fail(compiler, "Unterminated string");
+            }
+            if(character == '\\') {
+                cursor++;
+                switch(*cursor) {
+                case 'r':
+                    character = '\r';
+                    break;
+                case 'n':
+                    character = '\n';
+                    break;
+                case 't':
+                    character = '\t';
+                    break;
+                case '\\':
+                case '"':
+                    character = *cursor;
+                    break;
+                default:
+                    return fail(compiler, "Unknown escape \\%c", *cursor);
+                }
+            }
+            if(length == SCRIPTC_MAX_TOKEN_LENGTH - 1) {
+                return fail(compiler, "String is too long");
+            }
+            token->text[length++] = character;
+        }
+        cursor++;
+    } else {
+        token->type = TOKEN_WORD;
+        while(*cursor != '\0' && !isspace((unsigned char)*cursor)
+                && *cursor != '#' && *cursor != '"') {
+            if(length == SCRIPTC_MAX_TOKEN_LENGTH - 1) {
+                return fail(compiler, "Word is too long");
+            }
+            token->text[length++] = *cursor++;
+        }
+    }
+    token->text[length] = '\0';
+    compiler->cursor = cursor;
+    return true;
+}
+
+static bool expect(Compiler* compiler, Token* token, TokenType type,
+        const char* what) {
+    if(!next_token(compiler, token)) {
+        return false;
+    }
+    if(token->type != type) {
+        return fail(compiler, "Expected %s", what);
+    }
+    return true;
+}
+
+static bool parse_register(Compiler* compiler, const Token* token,
+        uint8_t* index) {
+    char* end;
+    long value;
+    if(token->type != TOKEN_WORD || token->text[0] != 'r') {
+        return fail(compiler, "Expected a register, r0 to r%d",
+                AT_SCRIPT_REGISTER_COUNT - 1);
+    }
+    value = strtol(&token->text[1], &end, 10);
+    if(end == &token->text[1] || *end != '\0' || value < 0
+            || value >= AT_SCRIPT_REGISTER_COUNT) {
+        return fail(compiler, "No register %s, there's r0 to r%d",
+                token->text, AT_SCRIPT_REGISTER_COUNT - 1);
+    }
+    *index = value;
+    return true;
+}
+
+static bool parse_number(Compiler* compiler, unsigned long max,
+        unsigned long* value) {
+    Token token;
+    char* end;
+    if(!expect(compiler, &token, TOKEN_WORD, "a number")) {
+        return false;
+    }
+    *value = strtoul(token.text, &end, 0);
+    if(end == token.text || *end != '\0' || token.text[0] == '-'
+            || *value > max) {
+        return fail(compiler, "Expected a number up to %lu, not %s", max,
+                token.text);
+    }
+    return true;
+}
+
+static bool valid_label(const char* name) {
+    int i;
+    if(name[0] == '\0' || strlen(name) >= SCRIPTC_MAX_LABEL_LENGTH
+            || isdigit((unsigned char)name[0])) {
+        return false;
+    }
+    for(i = 0; name[i] != '\0'; i++) {
+        if(!isalnum((unsigned char)name[i]) && name[i] != '_') {
+            return false;
+        }
+    }
+    return true;
+}
+
+static Label* find_label(Compiler* compiler, const char* name) {
+    int i;
+    for(i = 0; i < compiler->label_count; i++) {
+        if(!strcmp(compiler->labels[i].name, name)) {
+            return &compiler->labels[i];
+        }
+    }
+    return NULL;
+}
+
+static bool define_label(Compiler* compiler, const char* name) {
+    Label* label;
+    if(!valid_label(name)) {
+        return fail(compiler, "Bad label name '%s'", name);
+    }
+    if(find_label(compiler, name) != NULL) {
+        return fail(compiler, "Label %s is already defined", name);
+    }
+    if(compiler->label_count == SCRIPTC_MAX_LABELS) {
+        return fail(compiler, "More than %d labels", SCRIPTC_MAX_LABELS);
+    }
+    label = &compiler->labels[compiler->label_count++];
+    strcpy(label->name, name);
+    label->offset = compiler->size;
+    label->line = compiler->line;
+    return true;
+}
+
+/** Private: Emit a jump target, to be filled in once the label is known.
+ */
+static bool emit_target(Compiler* compiler) {
+    Token token;
+    Label* fixup;
+    if(!expect(compiler, &token, TOKEN_WORD, "a label")) {
+        return false;
+    }
+    if(!valid_label(token.text)) {
+        return fail(compiler, "Bad label name '%s'", token.text);
+    }
+    if(compiler->fixup_count == SCRIPTC_MAX_FIXUPS) {
+        return fail(compiler, "More than %d jumps", SCRIPTC_MAX_FIXUPS);
+    }
+    fixup = &compiler->fixups[compiler->fixup_count++];
+    strcpy(fixup->name, token.text);
+    fixup->offset = compiler->size;
+    fixup->line = compiler->line;
+    return emit_number(compiler, 0, 2);
+}
+
+/** Private: The operands of set - a literal argument is put in the request
+ * here, so only a register is left for the device to fill in.
+ */
+static bool emit_set(Compiler* compiler) {
+    char request[SCRIPTC_MAX_TOKEN_LENGTH * 2];
+    Token format;
+    Token expected;
+    Token argument;
+    const char* marker;
+    uint8_t index = AT_SCRIPT_NO_REGISTER;
+
+    if(!expect(compiler, &format, TOKEN_STRING, "a request string")
+            || !expect(compiler, &expected, TOKEN_STRING,
+                "an expected response string")
+            || !next_token(compiler, &argument)) {
+        return false;
+    }
+
+    marker = strstr(format.text, "%s");
+    strcpy(request, format.text);
+    if(argument.type == TOKEN_END) {
+        if(marker != NULL) {
+            return fail(compiler, "Missing an argument for the request's %%s");
+        }
+    } else if(marker == NULL) {
+        return fail(compiler, "An argument needs a %%s in the request");
+    } else if(argument.type == TOKEN_WORD) {
+        if(!parse_register(compiler, &argument, &index)) {
+            return false;
+        }
+    } else {
+        snprintf(&request[marker - format.text],
+                sizeof(request) - (marker - format.text), "%s%s",
+                argument.text, marker + 2);
+    }
+
+    return emit_byte(compiler, index)
+            && emit_string(compiler, request)
+            && emit_string(compiler, expected.text);
+}
+
+static bool emit_operands(Compiler* compiler, AtCommanderScriptOpcode opcode) {
+    Token token;
+    unsigned long number;
+    uint8_t index;
+
+    switch(opcode) {
+    case AT_SCRIPT_GET:
+        if(!next_token(compiler, &token)
+                || !parse_register(compiler, &token, &index)
+                || !emit_byte(compiler, index)
+                || !expect(compiler, &token, TOKEN_STRING, "a request string")
+                || !emit_string(compiler, token.text)
+                || !next_token(compiler, &token)) {
+            return false;
+        }
+        if(token.type == TOKEN_WORD) {
+            return fail(compiler, "Expected an error response string");
+        }
+        return emit_string(compiler, token.text);
+    case AT_SCRIPT_COMPARE:
+        return next_token(compiler, &token)
+                && parse_register(compiler, &token, &index)
+                && emit_byte(compiler, index)
+                && expect(compiler, &token, TOKEN_STRING, "a string")
+                && emit_string(compiler, token.text);
+    case AT_SCRIPT_SET:
+        return emit_set(compiler);
+    case AT_SCRIPT_WAIT:
+        return parse_number(compiler, 0xffff, &number)
+                && emit_number(compiler, number, 2);
+    case AT_SCRIPT_BAUD:
+        return parse_number(compiler, 0xffffffffUL, &number)
+                && emit_number(compiler, number, 4);
+    case AT_SCRIPT_JUMP:
+    case AT_SCRIPT_JUMP_IF:
+    case AT_SCRIPT_JUMP_UNLESS:
+        return emit_target(compiler);
+    default:
+        return true;
+    }
+}
+
+static const Instruction* find_instruction(const char* name) {
+    int i;
+    for(i = 0; i < (int)(sizeof(INSTRUCTIONS) / sizeof(Instruction)); i++) {
+        if(!strcmp(INSTRUCTIONS[i].name, name)) {
+            return &INSTRUCTIONS[i];
+        }
+    }
+    return NULL;
+}
+
+/** Private: Compile one line - an optional label, then an optional
+ * instruction.
+ *
+ *  last - set to the opcode of the instruction on the line, if there is one.
+ */
+static bool compile_line(Compiler* compiler, int* last) {
+    const Instruction* instruction;
+    Token token;
+    bool optional = false;
+    int length;
+
+    if(!next_token(compiler, &token)) {
+        return false;
+    }
+    length = strlen(token.text);
+    if(token.type == TOKEN_WORD && length > 0 && token.text[length - 1] == ':') {
+        token.text[length - 1] = '\0';
+        if(!define_label(compiler, token.text) || !next_token(compiler, &token)) {
+            return false;
+        }
+    }
+    if(token.type == TOKEN_END) {
+        return true;
+    }
+    if(token.type == TOKEN_WORD && !strcmp(token.text, "try")) {
+        optional = true;
+        if(!next_token(compiler, &token)) {
+            return false;
+        }
+    }
+
+    instruction = token.type == TOKEN_WORD ? find_instruction(token.text) : NULL;
+    if(instruction == NULL) {
+        return fail(compiler, "Unknown instruction '%s'", token.text);
+    }
+    if(optional && !instruction->can_fail) {
+        return fail(compiler, "%s can't fail, so it can't be tried",
+                instruction->name);
+    }
+    if(!emit_byte(compiler, instruction->opcode
+                | (optional ? AT_SCRIPT_OPTIONAL : 0))
+            || !emit_operands(compiler, instruction->opcode)
+            || !next_token(compiler, &token)) {
+        return false;
+    }
+    if(token.type != TOKEN_END) {
+        return fail(compiler, "Unexpected '%s' after %s", token.text,
+                instruction->name);
+    }
+    *last = instruction->opcode;
+    return true;
+}
+
+static bool resolve_jumps(Compiler* compiler) {
+    int i;
+    for(i = 0; i < compiler->fixup_count; i++) {
+        Label* fixup = &compiler->fixups[i];
+        Label* label = find_label(compiler, fixup->name);
+        compiler->line = fixup->line;
+        if(label == NULL) {
+            return fail(compiler, "No label %s", fixup->name);
+        }
+        if(label->offset == compiler->size) {
+            return fail(compiler, "Label %s is past the end of the script",
+                    fixup->name);
+        }
+        compiler->output[fixup->offset] = label->offset & 0xff;
+        compiler->output[fixup->offset + 1] = (label->offset >> 8) & 0xff;
+    }
+    return true;
+}
+
+int scriptc_compile(const char* source, uint8_t* output, int max_size,
+        ScriptcError* error) {
+    Compiler* compiler = calloc(1, sizeof(Compiler));
+    int last = -1;
+    int size = -1;
+
+    if(compiler == NULL) {
+        error->line = 0;
+        snprintf(error->message, sizeof(error->message), "Out of memory");
+        return -1;
+    }
+    compiler->cursor = source;
+    compiler->error = error;
+    compiler->output = output;
+    // Jump targets are 16 bits
+    compiler->max_size = max_size < 0xffff ? max_size : 0xffff;
+
+    if(emit_byte(compiler, AT_SCRIPT_VERSION)) {
+        bool compiled = true;
+        while(compiled && *compiler->cursor != '\0') {
+            compiler->line++;
+            compiled = compile_line(compiler, &last);
+            // Skip the rest of the line, i.e. a comment
+            compiler->cursor += strcspn(compiler->cursor, "\n");
+            if(*compiler->cursor == '\n') {
+                compiler->cursor++;
+            }
+        }
+
+        compiler->line = 0;
+        if(compiled && last != AT_SCRIPT_END && last != AT_SCRIPT_FAIL
+                && last != AT_SCRIPT_JUMP) {
+            compiled = fail(compiler,
+                    "The script has to finish with end, fail or jump");
+        }
+        if(compiled && resolve_jumps(compiler)) {
+            size = compiler->size;
+        }
+    }
+    free(compiler);
+    return size;
+}
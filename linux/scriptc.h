@@ -0,0 +1,52 @@
+#ifndef _SCRIPTC_H_
+#define _SCRIPTC_H_
+
+#include <stdint.h>
+
+/* A compiler for provisioning scripts (see script.h), from a line per
+ * instruction to the bytecode the library runs:
+ *
+ *    # Name the device, unless it already has the name
+ *    enter
+ *    get r0 "GN\r" "ERR"
+ *    compare r0 "Sensor"
+ *    jump_if done
+ *    set "SN,%s\r" "AOK" "Sensor"
+ *    reboot
+ *    done:
+ *    exit
+ *    end
+ *
+ * Instructions are the opcodes in lower case, with their operands separated by
+ * spaces - registers r0 to r3, "strings" (with \r, \n, \t, \\ and \"
+ * escapes), numbers and labels. Labels end in ':' and jumps go to them. A
+ * '#' starts a comment.
+ *
+ * set takes an optional argument for the request's "%s" - a register, or a
+ * string that's filled in here so the device doesn't have to. get's error
+ * response is optional too. Operations that can fail may be prefixed with
+ * "try" to carry on if they do, with the condition set to whether they
+ * succeeded.
+ *
+ * The last instruction has to end the script - end, fail or jump.
+ */
+
+typedef struct {
+    // The line the error is on, from 1, or 0 for the script as a whole
+    int line;
+    char message[80];
+} ScriptcError;
+
+/** Public: Compile a script.
+ *
+ *  source - the script's text.
+ *  output - a buffer for the bytecode.
+ *  max_size - the length of the buffer.
+ *  error - set to what's wrong if it fails.
+ *
+ *  Returns the size of the bytecode, or -1 if it couldn't be compiled.
+ */
+int scriptc_compile(const char* source, uint8_t* output, int max_size,
+        ScriptcError* error);
+
+#endif // _SCRIPTC_H_
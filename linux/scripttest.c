@@ -0,0 +1,133 @@
+/* Compile provisioning scripts and run them on an emulated RN-42, checking
+ * that branches skip settings the device already has, registers fill in
+ * requests, and bad scripts are rejected at the right line.
+ */
+#include "atcommander.h"
+#include "emulated.h"
+#include "script.h"
+#include "scriptc.h"
+#include "serial.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define DEVICE_BAUD 115200
+
+static const char* NAME_SCRIPT =
+    "# Name the device, unless it already has the name\n"
+    "enter\n"
+    "get r0 \"GN\\r\" \"ERR\"\n"
+    "compare r0 \"Sensor\"\n"
+    "jump_if done\n"
+    "set \"SN,%s\\r\" \"AOK\" \"Sensor\"   # filled in by the compiler\n"
+    "done: exit\n"
+    "end\n";
+
+static const char* REGISTER_SCRIPT =
+    "set \"SN,%s\\r\" \"AOK\" r1\n"
+    "try set \"SN,%s\\r\" \"Nope\" r1\n"
+    "jump_unless refused\n"
+    "fail\n"
+    "refused:\n"
+    "exit\n"
+    "end\n";
+
+typedef struct {
+    const char* source;
+    int line;
+} BadScript;
+
+static const BadScript BAD_SCRIPTS[] = {
+    { "enter\nfrobnicate\nend\n", 2 },
+    { "enter\nget r7 \"GN\\r\"\nend\n", 2 },
+    { "jump nowhere\n", 1 },
+    { "enter\nexit\n", 0 },
+    { "compare r0 \"x\"\ntry compare r0 \"y\"\nend\n", 2 },
+    { "set \"SN,%s\\r\" \"AOK\"\nend\n", 1 },
+    { "wait 70000\nend\n", 1 },
+    { "get r0 \"GN\\r\nend\n", 1 },
+    { "end\nloop: jump loop\nloop: end\n", 3 },
+};
+
+static int failures;
+
+static void check(bool passed, const char* what) {
+    if(!passed) {
+        printf("%s failed\n", what);
+        failures++;
+    }
+}
+
+static AtCommanderScriptResult run(AtCommanderConfig* config,
+        const char* source, AtCommanderScriptState* state) {
+    uint8_t bytecode[256];
+    ScriptcError error;
+    int size = scriptc_compile(source, bytecode, sizeof(bytecode), &error);
+    if(size < 0) {
+        printf("Line %d: %s\n", error.line, error.message);
+        return AT_SCRIPT_MALFORMED;
+    }
+    printf("Running a %d byte script\n", size);
+    return at_commander_run_script(config, bytecode, size, state);
+}
+
+int main(int argc, char** argv) {
+    static EmulatedDevice device;
+    AtCommanderScriptState state;
+    AtCommanderConfig config;
+    uint8_t bytecode[256];
+    ScriptcError error;
+    int i;
+
+    emulated_init(&device, DEVICE_BAUD);
+    strcpy(device.name, "RN42-1234");
+    memset(&config, 0, sizeof(config));
+    config.platform = AT_PLATFORM_RN42;
+    config.baud_rate_initializer = emulated_initialize_baud;
+    config.write_function = emulated_write;
+    config.read_function = emulated_read;
+    config.delay_function = host_delay_ms;
+    config.millis_function = host_millis;
+    config.device = &device;
+
+    at_commander_script_init(&state);
+    check(run(&config, NAME_SCRIPT, &state) == AT_SCRIPT_SUCCEEDED,
+            "Naming the device");
+    check(!strcmp(device.name, "Sensor") && device.names_set == 1,
+            "Setting the name");
+    check(!strcmp(state.registers[0], "RN42-1234"), "Getting the name");
+
+    // Already named, so the set is skipped
+    at_commander_script_init(&state);
+    check(run(&config, NAME_SCRIPT, &state) == AT_SCRIPT_SUCCEEDED
+                && state.condition, "Naming the device again");
+    check(device.names_set == 1, "Skipping the set");
+
+    at_commander_script_init(&state);
+    strcpy(state.registers[1], "Unit-7");
+    check(run(&config, REGISTER_SCRIPT, &state) == AT_SCRIPT_SUCCEEDED,
+            "Carrying on after a tried set failed");
+    check(!strcmp(device.name, "Unit-7") && device.names_set == 3,
+            "Setting the name from a register");
+
+    for(i = 0; i < (int)(sizeof(BAD_SCRIPTS) / sizeof(BadScript)); i++) {
+        bool rejected = scriptc_compile(BAD_SCRIPTS[i].source, bytecode,
+                sizeof(bytecode), &error) == -1;
+        if(rejected) {
+            printf("Bad script %d, line %d: %s\n", i, error.line,
+                    error.message);
+        }
+        check(rejected && error.line == BAD_SCRIPTS[i].line,
+                "Rejecting a bad script");
+    }
+
+    check(scriptc_compile(NAME_SCRIPT, bytecode, 16, &error) == -1,
+            "Rejecting a script that doesn't fit");
+
+    if(failures > 0) {
+        printf("FAIL\n");
+        return 1;
+    }
+    printf("PASS\n");
+    return 0;
+}
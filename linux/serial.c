@@ -0,0 +1,168 @@
+#include "serial.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/serial.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+/** Private: Map a baud rate to its termios speed constant.
+ *
+ * Returns B0 if the host doesn't support the rate.
+ */
+static speed_t baud_to_speed(int baud) {
+    switch(baud) {
+        case 1200: return B1200;
+        case 2400: return B2400;
+        case 4800: return B4800;
+        case 9600: return B9600;
+        case 19200: return B19200;
+        case 38400: return B38400;
+        case 57600: return B57600;
+        case 115200: return B115200;
+        case 230400: return B230400;
+#ifdef B460800
+        case 460800: return B460800;
+#endif
+#ifdef B921600
+        case 921600: return B921600;
+#endif
+    }
+    return B0;
+}
+
+bool serial_open(SerialPort* port) {
+    struct termios options;
+    port->fd = open(port->path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if(port->fd < 0) {
+        return false;
+    }
+
+    if(tcgetattr(port->fd, &options) < 0) {
+        serial_close(port);
+        return false;
+    }
+    cfmakeraw(&options);
+    options.c_cflag |= CLOCAL | CREAD;
+    if(port->hardware_flow_control) {
+        options.c_cflag |= CRTSCTS;
+    } else {
+        options.c_cflag &= ~CRTSCTS;
+    }
+    options.c_cc[VMIN] = 0;
+    options.c_cc[VTIME] = 0;
+    tcsetattr(port->fd, TCSANOW, &options);
+    tcflush(port->fd, TCIOFLUSH);
+    return true;
+}
+
+void serial_close(SerialPort* port) {
+    if(port->fd >= 0) {
+        close(port->fd);
+        port->fd = -1;
+    }
+}
+
+void serial_configure(AtCommanderConfig* config, SerialPort* port) {
+    config->device = port;
+    config->baud_rate_initializer = serial_initialize_baud;
+    config->write_function = serial_write_byte;
+    config->read_function = serial_read_byte;
+    config->write_bytes_function = serial_write_bytes;
+    config->read_bytes_function = serial_read_bytes;
+    config->clear_to_send_function = port->hardware_flow_control ?
+            serial_clear_to_send : NULL;
+    config->line_errors_function = serial_line_errors;
+    config->delay_function = host_delay_ms;
+    config->millis_function = host_millis;
+}
+
+void serial_initialize_baud(void* device, int baud) {
+    SerialPort* port = (SerialPort*)device;
+    struct termios options;
+    speed_t speed = baud_to_speed(baud);
+    if(speed == B0 || tcgetattr(port->fd, &options) < 0) {
+        return;
+    }
+    cfsetispeed(&options, speed);
+    cfsetospeed(&options, speed);
+    tcsetattr(port->fd, TCSADRAIN, &options);
+    tcflush(port->fd, TCIFLUSH);
+}
+
+bool serial_line_errors(void* device, AtCommanderLineErrors* errors) {
+    SerialPort* port = (SerialPort*)device;
+    struct serial_icounter_struct counters;
+    // Not every driver keeps counters, e.g. some USB-serial adapters
+    if(ioctl(port->fd, TIOCGICOUNT, &counters) < 0) {
+        return false;
+    }
+    errors->framing = counters.frame;
+    errors->parity = counters.parity;
+    // Bytes lost in the UART's FIFO or in the driver's buffer
+    errors->overrun = counters.overrun + counters.buf_overrun;
+    return true;
+}
+
+void serial_write_byte(void* device, uint8_t byte) {
+    SerialPort* port = (SerialPort*)device;
+    // The library expects single bytes to always go out, so wait for room
+    while(write(port->fd, &byte, 1) < 0 && (errno == EAGAIN
+                || errno == EINTR)) {
+        tcdrain(port->fd);
+    }
+}
+
+int serial_read_byte(void* device) {
+    SerialPort* port = (SerialPort*)device;
+    uint8_t byte;
+    if(read(port->fd, &byte, 1) == 1) {
+        return byte;
+    }
+    return -1;
+}
+
+int serial_write_bytes(void* device, const uint8_t* bytes, int size) {
+    SerialPort* port = (SerialPort*)device;
+    ssize_t written = write(port->fd, bytes, size);
+    return written < 0 ? 0 : (int)written;
+}
+
+int serial_read_bytes(void* device, uint8_t* bytes, int size) {
+    SerialPort* port = (SerialPort*)device;
+    ssize_t bytes_read = read(port->fd, bytes, size);
+    return bytes_read < 0 ? 0 : (int)bytes_read;
+}
+
+bool serial_clear_to_send(void* device) {
+    SerialPort* port = (SerialPort*)device;
+    int status;
+    if(ioctl(port->fd, TIOCMGET, &status) < 0) {
+        return true;
+    }
+    return (status & TIOCM_CTS) != 0;
+}
+
+void host_delay_ms(unsigned long ms) {
+    struct timespec delay;
+    delay.tv_sec = ms / 1000;
+    delay.tv_nsec = (ms % 1000) * 1000000L;
+    while(nanosleep(&delay, &delay) < 0 && errno == EINTR);
+}
+
+unsigned long host_millis(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+void host_debug(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
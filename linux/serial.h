@@ -0,0 +1,50 @@
+#ifndef _SERIAL_H_
+#define _SERIAL_H_
+
+#include "atcommander.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Public: A host serial port (e.g. a USB-serial adapter) used as the transport
+ * for an AT device.
+ */
+typedef struct {
+    const char* path;
+    int fd;
+    bool hardware_flow_control;
+} SerialPort;
+
+/** Public: Open a serial port in raw, non-blocking mode.
+ *
+ *  port - the port to open, with its path set.
+ *
+ *  Returns true if the port was opened.
+ */
+bool serial_open(SerialPort* port);
+
+void serial_close(SerialPort* port);
+
+/** Public: Point the transport callbacks of an AtCommanderConfig at a serial
+ * port, and fill in the host delay, clock and log functions.
+ */
+void serial_configure(AtCommanderConfig* config, SerialPort* port);
+
+/** Public: The AtCommanderConfig transport callbacks for a SerialPort device.
+ */
+void serial_initialize_baud(void* device, int baud);
+void serial_write_byte(void* device, uint8_t byte);
+int serial_read_byte(void* device);
+int serial_write_bytes(void* device, const uint8_t* bytes, int size);
+int serial_read_bytes(void* device, uint8_t* bytes, int size);
+bool serial_clear_to_send(void* device);
+// The kernel's receive error counters, for drivers that keep them
+bool serial_line_errors(void* device, AtCommanderLineErrors* errors);
+
+/** Public: Host implementations of the delay, clock and log functions.
+ */
+void host_delay_ms(unsigned long ms);
+unsigned long host_millis(void);
+void host_debug(const char* format, ...);
+
+#endif // _SERIAL_H_
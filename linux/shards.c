@@ -0,0 +1,334 @@
+#define _GNU_SOURCE
+#include "shards.h"
+#include "serial.h"
+
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// How long an idle shard waits before looking for work again
+#define SHARDS_IDLE_POLL_MS 1
+// How long a shard waits for room to report a result
+#define SHARDS_RESULT_RETRY_MS 1
+
+static size_t* cell_sequence(ShardQueue* queue, size_t position) {
+    return (size_t*)(queue->cells
+            + (position & (queue->capacity - 1)) * queue->cell_size);
+}
+
+static void* cell_item(ShardQueue* queue, size_t position) {
+    return cell_sequence(queue, position) + 1;
+}
+
+bool shard_queue_init(ShardQueue* queue, size_t capacity, size_t item_size) {
+    size_t i;
+    memset(queue, 0, sizeof(ShardQueue));
+    queue->capacity = 2;
+    while(queue->capacity < capacity) {
+        queue->capacity *= 2;
+    }
+    queue->item_size = item_size;
+    // Keep each cell's sequence number aligned
+    queue->cell_size = (sizeof(size_t) + item_size + sizeof(size_t) - 1)
+            & ~(sizeof(size_t) - 1);
+    queue->cells = malloc(queue->cell_size * queue->capacity);
+    if(queue->cells == NULL) {
+        return false;
+    }
+    for(i = 0; i < queue->capacity; i++) {
+        *cell_sequence(queue, i) = i;
+    }
+    return true;
+}
+
+void shard_queue_free(ShardQueue* queue) {
+    free(queue->cells);
+    queue->cells = NULL;
+}
+
+bool shard_queue_push(ShardQueue* queue, const void* item) {
+    size_t position = __atomic_load_n(&queue->enqueue_position,
+            __ATOMIC_RELAXED);
+    while(true) {
+        size_t sequence = __atomic_load_n(cell_sequence(queue, position),
+                __ATOMIC_ACQUIRE);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+        if(difference == 0) {
+            // The cell is free - claim it, unless another producer got there
+            // first, which updates position to try the next one
+            if(__atomic_compare_exchange_n(&queue->enqueue_position,
+                        &position, position + 1, true, __ATOMIC_RELAXED,
+                        __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if(difference < 0) {
+            // Not yet read since the last time around
+            return false;
+        } else {
+            position = __atomic_load_n(&queue->enqueue_position,
+                    __ATOMIC_RELAXED);
+        }
+    }
+
+    memcpy(cell_item(queue, position), item, queue->item_size);
+    __atomic_store_n(cell_sequence(queue, position), position + 1,
+            __ATOMIC_RELEASE);
+    return true;
+}
+
+bool shard_queue_pop(ShardQueue* queue, void* item) {
+    size_t position = __atomic_load_n(&queue->dequeue_position,
+            __ATOMIC_RELAXED);
+    while(true) {
+        size_t sequence = __atomic_load_n(cell_sequence(queue, position),
+                __ATOMIC_ACQUIRE);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+        if(difference == 0) {
+            if(__atomic_compare_exchange_n(&queue->dequeue_position,
+                        &position, position + 1, true, __ATOMIC_RELAXED,
+                        __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if(difference < 0) {
+            // Nothing written there yet
+            return false;
+        } else {
+            position = __atomic_load_n(&queue->dequeue_position,
+                    __ATOMIC_RELAXED);
+        }
+    }
+
+    memcpy(item, cell_item(queue, position), queue->item_size);
+    // Free for the producer on the next time around
+    __atomic_store_n(cell_sequence(queue, position),
+            position + queue->capacity, __ATOMIC_RELEASE);
+    return true;
+}
+
+int shards_default_count(void) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cores > 0 ? (int)cores : 1;
+}
+
+static void tally(unsigned long* counter) {
+    __atomic_fetch_add(counter, 1, __ATOMIC_RELAXED);
+}
+
+static void shard_finished(Fleet* fleet, FleetSession* session) {
+    Shard* shard = (Shard*)fleet->context;
+    Shards* shards = shard->shards;
+    ShardResult result;
+
+    result.context = session->context;
+    result.shard = shard->index;
+    result.succeeded = session->succeeded;
+    result.interrupted = at_commander_interrupted(&session->config);
+    result.latency_ms = host_millis()
+            - shard->submitted_at[session - fleet->sessions];
+    if(shards->finished != NULL) {
+        shards->finished(shards, shard, session);
+    }
+    tally(session->succeeded ? &shard->stats.succeeded :
+            &shard->stats.failed);
+
+    while(!shard_queue_push(&shard->results, &result)) {
+        host_delay_ms(SHARDS_RESULT_RETRY_MS);
+    }
+}
+
+bool shards_init(Shards* shards, int count, const FleetLimits* limits,
+        size_t queue_capacity, bool pin) {
+    void* storage;
+    int i;
+    memset(shards, 0, sizeof(Shards));
+    if(count <= 0 || posix_memalign(&storage, SHARDS_CACHE_LINE,
+                sizeof(Shard) * count) != 0) {
+        return false;
+    }
+
+    memset(storage, 0, sizeof(Shard) * count);
+    shards->shards = (Shard*)storage;
+    shards->count = count;
+    shards->pin = pin;
+    for(i = 0; i < count; i++) {
+        Shard* shard = &shards->shards[i];
+        shard->shards = shards;
+        shard->index = i;
+        if(!fleet_init(&shard->fleet, limits, NULL, 0)
+                || !shard_queue_init(&shard->inbox, queue_capacity,
+                    sizeof(ShardWork))
+                || !shard_queue_init(&shard->results, queue_capacity,
+                    sizeof(ShardResult))) {
+            shards_free(shards);
+            return false;
+        }
+        shard->submitted_at = calloc(limits->max_sessions,
+                sizeof(unsigned long));
+        if(shard->submitted_at == NULL) {
+            shards_free(shards);
+            return false;
+        }
+        shard->fleet.finished = shard_finished;
+        shard->fleet.context = shard;
+    }
+    return true;
+}
+
+/** Private: Take the next device queued for this shard, or failing that,
+ * one queued for another.
+ */
+static bool take_work(Shard* shard, ShardWork* work) {
+    Shards* shards = shard->shards;
+    int i;
+    if(shard_queue_pop(&shard->inbox, work)) {
+        return true;
+    }
+
+    for(i = 1; i < shards->count; i++) {
+        Shard* victim = &shards->shards[(shard->index + i) % shards->count];
+        if(shard_queue_pop(&victim->inbox, work)) {
+            tally(&shard->stats.stolen);
+            return true;
+        }
+    }
+    return false;
+}
+
+static void pin_to_core(Shard* shard) {
+    cpu_set_t cores;
+    CPU_ZERO(&cores);
+    CPU_SET(shard->index % shards_default_count(), &cores);
+    pthread_setaffinity_np(pthread_self(), sizeof(cores), &cores);
+}
+
+static void* run_shard(void* argument) {
+    Shard* shard = (Shard*)argument;
+    Shards* shards = shard->shards;
+    ShardWork work;
+
+    if(shards->pin) {
+        pin_to_core(shard);
+    }
+
+    while(true) {
+        bool took = false;
+        while(shard->fleet.free_sessions != NULL
+                && take_work(shard, &work)) {
+            FleetSession* session = fleet_start(&shard->fleet, &work.config,
+                    work.name, work.job, work.context);
+            shard->submitted_at[session - shard->fleet.sessions] =
+                    work.submitted_at;
+            tally(&shard->stats.started);
+            took = true;
+        }
+
+        if(shard->fleet.active_sessions > 0) {
+            fleet_step(&shard->fleet);
+            tally(&shard->stats.steps);
+        } else if(!took) {
+            if(__atomic_load_n(&shards->stopping, __ATOMIC_ACQUIRE)) {
+                break;
+            }
+            host_delay_ms(SHARDS_IDLE_POLL_MS);
+        }
+    }
+    return NULL;
+}
+
+bool shards_start(Shards* shards) {
+    int i;
+    for(i = 0; i < shards->count; i++) {
+        Shard* shard = &shards->shards[i];
+        if(pthread_create(&shard->thread, NULL, run_shard, shard) != 0) {
+            return false;
+        }
+        shard->thread_started = true;
+    }
+    return true;
+}
+
+bool shards_submit_to(Shards* shards, int shard,
+        const AtCommanderConfig* config, const char* name, FleetJob job,
+        void* context) {
+    ShardWork work;
+    work.config = *config;
+    work.name = name;
+    work.job = job;
+    work.context = context;
+    work.submitted_at = host_millis();
+    if(!shard_queue_push(&shards->shards[shard].inbox, &work)) {
+        return false;
+    }
+    shards->pending++;
+    return true;
+}
+
+bool shards_submit(Shards* shards, const AtCommanderConfig* config,
+        const char* name, FleetJob job, void* context) {
+    int i;
+    for(i = 0; i < shards->count; i++) {
+        int shard = shards->next_shard;
+        shards->next_shard = (shards->next_shard + 1) % shards->count;
+        if(shards_submit_to(shards, shard, config, name, job, context)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int shards_poll(Shards* shards, ShardResult* results, int max_results) {
+    int polled = 0;
+    int i;
+    for(i = 0; i < shards->count && polled < max_results; i++) {
+        while(polled < max_results && shard_queue_pop(
+                    &shards->shards[i].results, &results[polled])) {
+            polled++;
+            shards->pending--;
+        }
+    }
+    return polled;
+}
+
+void shards_stats(Shards* shards, ShardStats* total) {
+    int i;
+    memset(total, 0, sizeof(ShardStats));
+    for(i = 0; i < shards->count; i++) {
+        ShardStats* stats = &shards->shards[i].stats;
+        total->started += __atomic_load_n(&stats->started, __ATOMIC_RELAXED);
+        total->succeeded += __atomic_load_n(&stats->succeeded,
+                __ATOMIC_RELAXED);
+        total->failed += __atomic_load_n(&stats->failed, __ATOMIC_RELAXED);
+        total->stolen += __atomic_load_n(&stats->stolen, __ATOMIC_RELAXED);
+        total->steps += __atomic_load_n(&stats->steps, __ATOMIC_RELAXED);
+    }
+}
+
+void shards_stop(Shards* shards) {
+    int i;
+    __atomic_store_n(&shards->stopping, 1, __ATOMIC_RELEASE);
+    for(i = 0; i < shards->count; i++) {
+        Shard* shard = &shards->shards[i];
+        if(shard->thread_started) {
+            pthread_join(shard->thread, NULL);
+            shard->thread_started = false;
+        }
+    }
+}
+
+void shards_free(Shards* shards) {
+    int i;
+    if(shards->shards == NULL) {
+        return;
+    }
+    for(i = 0; i < shards->count; i++) {
+        Shard* shard = &shards->shards[i];
+        fleet_free(&shard->fleet);
+        shard_queue_free(&shard->inbox);
+        shard_queue_free(&shard->results);
+        free(shard->submitted_at);
+    }
+    free(shards->shards);
+    shards->shards = NULL;
+    shards->count = 0;
+}
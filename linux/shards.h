@@ -0,0 +1,189 @@
+#ifndef _SHARDS_H_
+#define _SHARDS_H_
+
+#include "atcommander.h"
+#include "fleet.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* A sharded fleet spreads devices over several fleet engines, each stepped by
+ * a thread of its own (optionally pinned to a core), for when one thread
+ * can't keep up with every port.
+ *
+ * New devices are queued to the shards in turn, and a shard with free
+ * sessions and nothing queued steals from the others, so a shard stuck with
+ * slow devices doesn't hold up the rest. Each device's outcome comes back
+ * through a per-shard queue that the submitting thread polls.
+ *
+ * The queues are lock-free and preallocated, so the threads never wait on
+ * each other or touch the heap once started.
+ */
+
+#define SHARDS_CACHE_LINE 64
+
+/** Public: A bounded multi-producer, multi-consumer queue of fixed size items
+ * (after Dmitry Vyukov's), where each cell's sequence number says whether
+ * it's ready to be written or read.
+ */
+typedef struct {
+    uint8_t* cells;
+    size_t cell_size;
+    size_t item_size;
+    // A power of 2
+    size_t capacity;
+    // On their own cache lines, as producers and consumers update them
+    size_t enqueue_position __attribute__((aligned(SHARDS_CACHE_LINE)));
+    size_t dequeue_position __attribute__((aligned(SHARDS_CACHE_LINE)));
+} ShardQueue;
+
+/** Public: Allocate a queue for up to capacity items (rounded up to a power
+ * of 2).
+ */
+bool shard_queue_init(ShardQueue* queue, size_t capacity, size_t item_size);
+
+void shard_queue_free(ShardQueue* queue);
+
+/** Public: Copy an item into the queue.
+ *
+ *  Returns false if it's full.
+ */
+bool shard_queue_push(ShardQueue* queue, const void* item);
+
+/** Public: Copy the oldest item out of the queue.
+ *
+ *  Returns false if it's empty.
+ */
+bool shard_queue_pop(ShardQueue* queue, void* item);
+
+/** Public: The outcome of one device's job.
+ */
+typedef struct {
+    // The context the device was submitted with
+    void* context;
+    int shard;
+    bool succeeded;
+    // Why the job stopped early, if it did
+    AtCommanderResult interrupted;
+    // From being submitted to the job completing
+    unsigned long latency_ms;
+} ShardResult;
+
+/** Public: A shard's running totals - each is only written by the shard's
+ * own thread.
+ */
+typedef struct {
+    unsigned long started;
+    unsigned long succeeded;
+    unsigned long failed;
+    // Devices taken from other shards' queues
+    unsigned long stolen;
+    unsigned long steps;
+} ShardStats;
+
+typedef struct Shards Shards;
+
+/** Private: A work item - a device waiting for a session.
+ */
+typedef struct {
+    AtCommanderConfig config;
+    const char* name;
+    FleetJob job;
+    void* context;
+    unsigned long submitted_at;
+} ShardWork;
+
+typedef struct {
+    Shards* shards;
+    int index;
+    Fleet fleet;
+    pthread_t thread;
+    bool thread_started;
+    // Devices for this shard - others may steal from it
+    ShardQueue inbox;
+    // Outcomes, read by the thread that submitted the devices
+    ShardQueue results;
+    // When each session's device was submitted, by session index
+    unsigned long* submitted_at;
+    ShardStats stats;
+} __attribute__((aligned(SHARDS_CACHE_LINE))) Shard;
+
+struct Shards {
+    Shard* shards;
+    int count;
+    bool pin;
+    // Set to let the threads exit once there's nothing left to do
+    int stopping;
+    int next_shard;
+    // Submitted devices whose results haven't been polled yet
+    int pending;
+
+    // Optional, called on the shard's thread as each job completes, before
+    // its session is recycled - e.g. to close the port or save the trace.
+    // Runs concurrently with other shards, so anything shared needs a lock.
+    void (*finished)(Shards* shards, Shard* shard, FleetSession* session);
+    void* context;
+};
+
+/** Public: The number of cores online, a good number of shards.
+ */
+int shards_default_count(void);
+
+/** Public: Set up shards, each with a fleet of its own.
+ *
+ *  count - the number of shards (threads).
+ *  limits - the limits of each shard's fleet.
+ *  queue_capacity - how many devices can be queued for each shard, and how
+ *      many results can wait to be polled from it.
+ *  pin - pin each shard's thread to a core.
+ *
+ *  Returns true if the shards are ready to start.
+ */
+bool shards_init(Shards* shards, int count, const FleetLimits* limits,
+        size_t queue_capacity, bool pin);
+
+/** Public: Start each shard's thread - set the finished callback first.
+ *
+ *  Returns false if a thread couldn't be started.
+ */
+bool shards_start(Shards* shards);
+
+/** Public: Queue a device for the next shard in turn.
+ *
+ *  config - the device's config, copied into the session, as in fleet_start.
+ *  name - a name for the session's trace track, must outlive the session.
+ *
+ *  Returns false if every shard's queue is full - poll for results and try
+ *  again.
+ */
+bool shards_submit(Shards* shards, const AtCommanderConfig* config,
+        const char* name, FleetJob job, void* context);
+
+/** Public: Queue a device for a particular shard (other shards may still
+ * steal it).
+ */
+bool shards_submit_to(Shards* shards, int shard,
+        const AtCommanderConfig* config, const char* name, FleetJob job,
+        void* context);
+
+/** Public: Collect the outcomes of completed jobs from every shard - call
+ * this regularly, as a shard waits for room to report a result.
+ *
+ *  Returns the number of results stored, up to max_results.
+ */
+int shards_poll(Shards* shards, ShardResult* results, int max_results);
+
+/** Public: Add up the running totals of every shard.
+ */
+void shards_stats(Shards* shards, ShardStats* total);
+
+/** Public: Let the threads exit, and wait for them - once every result has
+ * been polled (pending is 0), or a thread may be left waiting to report one.
+ */
+void shards_stop(Shards* shards);
+
+void shards_free(Shards* shards);
+
+#endif // _SHARDS_H_
@@ -0,0 +1,102 @@
+/* Run emulated RN-42s through a provisioning job on several shards, all of
+ * them queued for the first shard, and check that every device is configured,
+ * every result comes back once and the other shards stole their share.
+ */
+#include "atcommander.h"
+#include "emulated.h"
+#include "serial.h"
+#include "shards.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define SHARD_COUNT 4
+#define DEVICE_COUNT 64
+#define DEVICE_BAUD 115200
+#define DEVICE_NAME "shard"
+
+static bool provision(FleetSession* session) {
+    snprintf(session->response_buffer, session->response_buffer_size,
+            DEVICE_NAME);
+    return at_commander_set_name(&session->config, session->response_buffer,
+                false)
+            && at_commander_exit_command_mode(&session->config);
+}
+
+int main(int argc, char** argv) {
+    static EmulatedDevice devices[DEVICE_COUNT];
+    ShardResult results[DEVICE_COUNT];
+    int reported[DEVICE_COUNT];
+    AtCommanderConfig config;
+    FleetLimits limits;
+    ShardStats stats;
+    Shards shards;
+    int collected = 0;
+    int succeeded = 0;
+    int failures = 0;
+    int i;
+
+    limits.max_sessions = 8;
+    limits.stack_size = 32 * 1024;
+    limits.response_buffer_size = 64;
+    limits.queue_size = 64;
+    limits.trace_events = 0;
+    if(!shards_init(&shards, SHARD_COUNT, &limits, DEVICE_COUNT, false)) {
+        fprintf(stderr, "Unable to initialize the shards\n");
+        return 1;
+    }
+
+    memset(&config, 0, sizeof(config));
+    config.platform = AT_PLATFORM_RN42;
+    config.baud_rate_initializer = emulated_initialize_baud;
+    config.write_function = emulated_write;
+    config.read_function = emulated_read;
+    config.millis_function = host_millis;
+    memset(reported, 0, sizeof(reported));
+    for(i = 0; i < DEVICE_COUNT; i++) {
+        emulated_init(&devices[i], DEVICE_BAUD);
+        config.device = &devices[i];
+        if(!shards_submit_to(&shards, 0, &config, "device", provision,
+                    &devices[i])) {
+            fprintf(stderr, "Unable to queue device %d\n", i);
+            return 1;
+        }
+    }
+
+    if(!shards_start(&shards)) {
+        fprintf(stderr, "Unable to start the shards\n");
+        return 1;
+    }
+    while(shards.pending > 0) {
+        int polled = shards_poll(&shards, results, DEVICE_COUNT);
+        for(i = 0; i < polled; i++) {
+            reported[(EmulatedDevice*)results[i].context - devices]++;
+            succeeded += results[i].succeeded;
+        }
+        collected += polled;
+        if(polled == 0) {
+            host_delay_ms(1);
+        }
+    }
+    shards_stop(&shards);
+    shards_stats(&shards, &stats);
+    shards_free(&shards);
+
+    for(i = 0; i < DEVICE_COUNT; i++) {
+        if(strcmp(devices[i].name, DEVICE_NAME) || reported[i] != 1) {
+            failures++;
+        }
+    }
+
+    printf("%d of %d devices succeeded on %d shards, %lu stolen, "
+            "%d misconfigured\n", succeeded, collected, SHARD_COUNT,
+            stats.stolen, failures);
+    if(collected != DEVICE_COUNT || succeeded != DEVICE_COUNT
+            || stats.started != DEVICE_COUNT || stats.stolen == 0
+            || failures > 0) {
+        printf("FAIL\n");
+        return 1;
+    }
+    printf("PASS\n");
+    return 0;
+}
@@ -0,0 +1,219 @@
+#include "trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define TRACE_INITIAL_CAPACITY 256
+
+static const char* LIBRARY_SPAN_NAMES[] = {
+    "baud sweep",
+    "command",
+    "store",
+    "reboot",
+    "io wait",
+};
+
+static unsigned long long now_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+void trace_track_init(TraceTrack* track, const char* name) {
+    track->name = name;
+    track->events = NULL;
+    track->head = 0;
+    track->count = 0;
+    track->capacity = 0;
+    track->ring = false;
+}
+
+void trace_track_init_ring(TraceTrack* track, const char* name,
+        TraceEvent* storage, int capacity) {
+    trace_track_init(track, name);
+    track->events = storage;
+    track->capacity = capacity;
+    track->ring = true;
+}
+
+void trace_track_reset(TraceTrack* track, const char* name) {
+    track->name = name;
+    track->head = 0;
+    track->count = 0;
+}
+
+void trace_track_free(TraceTrack* track) {
+    if(!track->ring) {
+        free(track->events);
+        trace_track_init(track, track->name);
+    }
+}
+
+static TraceEvent* event_at(TraceTrack* track, int index) {
+    return &track->events[(track->head + index) % track->capacity];
+}
+
+/** Private: Append an event to a track, growing it or overwriting its oldest
+ * event as needed.
+ *
+ * Returns the new event, or NULL if it couldn't be stored.
+ */
+static TraceEvent* append_event(TraceTrack* track, const char* name,
+        bool begin) {
+    TraceEvent* event;
+    if(track == NULL || (track->ring && track->capacity == 0)) {
+        return NULL;
+    }
+
+    if(track->count == track->capacity) {
+        if(track->ring) {
+            track->head = (track->head + 1) % track->capacity;
+            track->count--;
+        } else {
+            int capacity = track->capacity > 0 ? track->capacity * 2 :
+                    TRACE_INITIAL_CAPACITY;
+            TraceEvent* events = realloc(track->events,
+                    capacity * sizeof(TraceEvent));
+            if(events == NULL) {
+                return NULL;
+            }
+            track->events = events;
+            track->capacity = capacity;
+        }
+    }
+
+    event = event_at(track, track->count++);
+    event->name = name;
+    event->detail[0] = '\0';
+    event->begin = begin;
+    event->timestamp_us = now_us();
+    return event;
+}
+
+void trace_begin(TraceTrack* track, const char* name, const char* detail) {
+    TraceEvent* event = append_event(track, name, true);
+    if(event != NULL && detail != NULL) {
+        // Line endings are noise in the viewer
+        int length = strcspn(detail, "\r\n");
+        if(length > TRACE_MAX_DETAIL_LENGTH - 1) {
+            length = TRACE_MAX_DETAIL_LENGTH - 1;
+        }
+        memcpy(event->detail, detail, length);
+        event->detail[length] = '\0';
+    }
+}
+
+void trace_end(TraceTrack* track, const char* name) {
+    append_event(track, name, false);
+}
+
+void trace_library_span(TraceTrack* track, AtCommanderTraceSpan span,
+        bool begin, const char* detail, int value) {
+    const char* name = LIBRARY_SPAN_NAMES[span];
+    char formatted[TRACE_MAX_DETAIL_LENGTH];
+    if(track == NULL) {
+        return;
+    }
+
+    if(!begin) {
+        trace_end(track, name);
+        return;
+    }
+
+    // The library waits in short polls - back to back, they're one wait
+    if(span == AT_TRACE_WAIT && track->count > 0) {
+        TraceEvent* last = event_at(track, track->count - 1);
+        if(last->name == name && !last->begin) {
+            track->count--;
+            return;
+        }
+    }
+
+    if(span == AT_TRACE_BAUD_SWEEP) {
+        snprintf(formatted, sizeof(formatted), "%d baud", value);
+        detail = formatted;
+    } else if(span == AT_TRACE_COMMAND && detail == NULL) {
+        snprintf(formatted, sizeof(formatted), "%d byte payload", value);
+        detail = formatted;
+    }
+    trace_begin(track, name, detail);
+}
+
+static void write_json_string(FILE* file, const char* string) {
+    fputc('"', file);
+    for(; *string != '\0'; string++) {
+        unsigned char c = *string;
+        if(c == '"' || c == '\\') {
+            fprintf(file, "\\%c", c);
+        } else if(c < 0x20) {
+            fprintf(file, "\\u%04x", c);
+        } else {
+            fputc(c, file);
+        }
+    }
+    fputc('"', file);
+}
+
+FILE* trace_json_open(const char* path) {
+    FILE* file = fopen(path, "w");
+    if(file != NULL) {
+        fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+                "{\"ph\":\"M\",\"pid\":1,\"name\":\"process_name\","
+                "\"args\":{\"name\":\"atcommander\"}}");
+    }
+    return file;
+}
+
+void trace_json_write_track(FILE* file, TraceTrack* track, int id) {
+    int depth = 0;
+    int i;
+
+    // Name the track's row, in the order they were given
+    fprintf(file, ",\n{\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+            "\"name\":\"thread_name\",\"args\":{\"name\":", id);
+    write_json_string(file, track->name != NULL ? track->name : "");
+    fprintf(file, "}},\n{\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+            "\"name\":\"thread_sort_index\",\"args\":{\"sort_index\":%d}}",
+            id, id);
+
+    for(i = 0; i < track->count; i++) {
+        TraceEvent* event = event_at(track, i);
+        if(!event->begin && depth == 0) {
+            // The beginning was overwritten in the ring
+            continue;
+        }
+        depth += event->begin ? 1 : -1;
+
+        // Ends are matched to the innermost open span, so only begins need
+        // the name
+        fprintf(file, ",\n{\"ph\":\"%c\",\"pid\":1,\"tid\":%d,\"ts\":%llu",
+                event->begin ? 'B' : 'E', id, event->timestamp_us);
+        if(event->begin) {
+            fprintf(file, ",\"cat\":");
+            write_json_string(file, event->name);
+            fprintf(file, ",\"name\":");
+            write_json_string(file, event->detail[0] != '\0' ?
+                    event->detail : event->name);
+        }
+        fputc('}', file);
+    }
+}
+
+bool trace_json_close(FILE* file) {
+    fprintf(file, "\n]}\n");
+    return fclose(file) == 0;
+}
+
+bool trace_write_json(const char* path, TraceTrack* tracks, int count) {
+    FILE* file = trace_json_open(path);
+    int i;
+    if(file == NULL) {
+        return false;
+    }
+
+    for(i = 0; i < count; i++) {
+        trace_json_write_track(file, &tracks[i], i + 1);
+    }
+    return trace_json_close(file);
+}
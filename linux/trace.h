@@ -0,0 +1,86 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include "atcommander.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#define TRACE_MAX_DETAIL_LENGTH 32
+
+/** Public: One end of a span on a trace track.
+ */
+typedef struct {
+    const char* name;
+    char detail[TRACE_MAX_DETAIL_LENGTH];
+    bool begin;
+    unsigned long long timestamp_us;
+} TraceEvent;
+
+/** Public: The timeline of one device (or anything else that does work in
+ * order), shown as a row in the trace viewer.
+ *
+ * A track must only be written from one thread at a time, so devices that are
+ * provisioned in parallel each get their own.
+ *
+ * A track either grows on the heap as needed, or is a ring in fixed storage
+ * that keeps only the most recent events.
+ */
+typedef struct {
+    const char* name;
+    TraceEvent* events;
+    int head;
+    int count;
+    int capacity;
+    bool ring;
+} TraceTrack;
+
+void trace_track_init(TraceTrack* track, const char* name);
+
+/** Public: Initialize a track that records into fixed storage, overwriting
+ * its oldest events when full - recording never allocates.
+ */
+void trace_track_init_ring(TraceTrack* track, const char* name,
+        TraceEvent* storage, int capacity);
+
+/** Public: Discard a track's events, keeping its storage, and rename it.
+ */
+void trace_track_reset(TraceTrack* track, const char* name);
+
+void trace_track_free(TraceTrack* track);
+
+/** Public: Mark the beginning or end of a span on a track - spans on a track
+ * must be properly nested. If the track is NULL, nothing is recorded.
+ *
+ *  name - the name of the span, must outlive the track.
+ *  detail - optional text to attach to the span, may be NULL. It's copied and
+ *      truncated to TRACE_MAX_DETAIL_LENGTH.
+ */
+void trace_begin(TraceTrack* track, const char* name, const char* detail);
+void trace_end(TraceTrack* track, const char* name);
+
+/** Public: Record one of the library's spans, as reported to an
+ * AtCommanderConfig trace function, on a track.
+ */
+void trace_library_span(TraceTrack* track, AtCommanderTraceSpan span,
+        bool begin, const char* detail, int value);
+
+/** Public: Write tracks out in the Chrome trace event JSON format, which opens
+ * in chrome://tracing and the Perfetto UI (https://ui.perfetto.dev).
+ *
+ * Tracks can be written one at a time as they complete - each gets its own
+ * row, identified by 'id'.
+ *
+ * Returns the open file, or NULL if it couldn't be opened.
+ */
+FILE* trace_json_open(const char* path);
+void trace_json_write_track(FILE* file, TraceTrack* track, int id);
+bool trace_json_close(FILE* file);
+
+/** Public: Write a set of tracks to a new file, see trace_json_open.
+ *
+ * Returns true if the file was written.
+ */
+bool trace_write_json(const char* path, TraceTrack* tracks, int count);
+
+#endif // _TRACE_H_
@@ -11,6 +11,7 @@
 #include <string.h>
 
 #include "atcommander.h"
+#include "datamode.h"
 
 #define DESIRED_BAUDRATE 115200
 
@@ -32,6 +33,12 @@ QUEUE_DECLARE(uint8_t, 512);
 QUEUE_DEFINE(uint8_t);
 QUEUE_TYPE(uint8_t) receive_queue;
 
+uint8_t data_receive_storage[128];
+uint8_t data_transmit_storage[256];
+
+// Counted from the line status interrupt, for the library's link health
+volatile AtCommanderLineErrors line_errors;
+
 void debug(const char* format, ...) {
     va_list args;
     va_start(args, format);
@@ -89,7 +96,7 @@ void configureUart(void* device, int baud) {
 
 
     UART_IntConfig(UART1_DEVICE, UART_INTCFG_RBR, ENABLE);
-    /* UART_IntConfig(UART1_DEVICE, UART_INTCFG_RLS, ENABLE); */
+    UART_IntConfig(UART1_DEVICE, UART_INTCFG_RLS, ENABLE);
     /* preemption = 1, sub-priority = 1 */
     NVIC_SetPriority(UART1_IRQn, ((0x01<<3)|0x01));
     NVIC_EnableIRQ(UART1_IRQn);
@@ -124,10 +131,27 @@ void handleReceiveInterrupt() {
     }
 }
 
+void handleLineStatusInterrupt() {
+    // Reading LSR clears the error bits
+    uint8_t status = UART_GetLineStatus(UART1_DEVICE);
+    if(status & UART_LSR_FE) {
+        line_errors.framing++;
+    }
+    if(status & UART_LSR_PE) {
+        line_errors.parity++;
+    }
+    if(status & UART_LSR_OE) {
+        line_errors.overrun++;
+    }
+}
+
 void UART1_IRQHandler() {
     uint32_t interruptSource = UART_GetIntId(UART1_DEVICE)
         & UART_IIR_INTID_MASK;
     switch(interruptSource) {
+        case UART_IIR_INTID_RLS:
+            handleLineStatusInterrupt();
+            break;
         case UART_IIR_INTID_RDA:
         case UART_IIR_INTID_CTI:
             handleReceiveInterrupt();
@@ -142,6 +166,29 @@ int readByte(void* device) {
     return -1;
 }
 
+int writeBytes(void* device, const uint8_t* bytes, int size) {
+    // Only fills the TX FIFO - the auto-CTS hardware holds it off when the
+    // RN-42 can't take any more
+    return UART_Send(UART1_DEVICE, (uint8_t*)bytes, size, NONE_BLOCKING);
+}
+
+int readBytes(void* device, uint8_t* bytes, int size) {
+    int bytesRead = 0;
+    while(bytesRead < size && !QUEUE_EMPTY(uint8_t, &receive_queue)) {
+        bytes[bytesRead++] = QUEUE_POP(uint8_t, &receive_queue);
+    }
+    return bytesRead;
+}
+
+bool readLineErrors(void* device, AtCommanderLineErrors* errors) {
+    NVIC_DisableIRQ(UART1_IRQn);
+    errors->framing = line_errors.framing;
+    errors->parity = line_errors.parity;
+    errors->overrun = line_errors.overrun;
+    NVIC_EnableIRQ(UART1_IRQn);
+    return true;
+}
+
 int main (void) {
     debug_frmwrk_init();
     _printf("About to change baud rate of RN-42 to %d\r\n", DESIRED_BAUDRATE);
@@ -154,11 +201,21 @@ int main (void) {
     config.baud_rate_initializer = configureUart;
     config.write_function = writeByte;
     config.read_function = readByte;
+    config.write_bytes_function = writeBytes;
+    config.read_bytes_function = readBytes;
+    config.line_errors_function = readLineErrors;
     config.delay_function = delayMs;
     config.log_function = debug;
+    at_commander_data_init(&config, data_receive_storage,
+            sizeof(data_receive_storage), data_transmit_storage,
+            sizeof(data_transmit_storage));
 
     configurePins();
 
+    const char* message = "Sending data over the RN-42";
+    int messageLength = strlen(message);
+    int sent = 0;
+
     delayMs(1000);
     while(true) {
         if(!configured) {
@@ -185,8 +242,11 @@ int main (void) {
                 delayMs(1000);
             }
         } else {
-            char* message = "Sending data over the RN-42";
-            UART_Send(UART1_DEVICE, (uint8_t*)message, strlen(message), BLOCKING);
+            sent += at_commander_data_write(&config,
+                    (const uint8_t*)&message[sent], messageLength - sent);
+            if(sent == messageLength) {
+                sent = 0;
+            }
         }
     }
 
@@ -1,9 +1,21 @@
 #include "atcommander.h"
+#include "atcommander_private.h"
+#include "connection.h"
+#include "datamode.h"
+#include "espressif.h"
+#include "link_health.h"
+#include "remote.h"
+#include "script.h"
+#include "xbee_api.h"
+#include "xbee_broadcast.h"
+#include "xbee_deferred.h"
+#include "xbee_spi.h"
 #include <check.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <string.h>
 
 AtCommanderConfig config;
 
@@ -14,19 +26,88 @@ void debug(const char* format, ...) {
     va_end(args);
 }
 
+static int tried_bauds[16];
+static int tried_baud_count;
+
 void baud_rate_initializer(void* device, int baud) {
+    if(tried_baud_count < (int)(sizeof(tried_bauds) / sizeof(int))) {
+        tried_bauds[tried_baud_count++] = baud;
+    }
 }
 
-void mock_write(void* device, uint8_t byte) {
-}
+static char written[256];
+static int written_length;
+static int read_pause_index;
 
 static char* read_message;
 static int read_message_length;
 static int read_index;
+// The response to the next request, once the current one has been read
+static char* next_response;
+
+void mock_write(void* device, uint8_t byte) {
+    // The device doesn't respond until it's sent something
+    read_pause_index = -1;
+    if(next_response != NULL && read_index >= read_message_length) {
+        read_message = next_response;
+        read_message_length = strlen(next_response);
+        read_index = 0;
+        next_response = NULL;
+    }
+    if(written_length < (int)sizeof(written) - 1) {
+        written[written_length++] = byte;
+        written[written_length] = '\0';
+    }
+}
+
+static int transport_capacity;
+static bool clear_to_send;
+
+int mock_write_bytes(void* device, const uint8_t* bytes, int size) {
+    int accepted = size < transport_capacity ? size : transport_capacity;
+    for(int i = 0; i < accepted; i++) {
+        mock_write(device, bytes[i]);
+    }
+    transport_capacity -= accepted;
+    return accepted;
+}
+
+bool mock_clear_to_send(void* device) {
+    return clear_to_send;
+}
+
+static unsigned long now_ms;
+static volatile sig_atomic_t cancelled;
+
+unsigned long mock_millis() {
+    return now_ms;
+}
+
+typedef struct {
+    AtCommanderTraceSpan span;
+    bool begin;
+    int value;
+} TracedSpan;
+
+static TracedSpan traced[32];
+static int traced_count;
+
+void mock_trace(void* device, AtCommanderTraceSpan span, bool begin,
+        const char* detail, int value) {
+    if(traced_count < (int)(sizeof(traced) / sizeof(TracedSpan))) {
+        traced[traced_count].span = span;
+        traced[traced_count].begin = begin;
+        traced[traced_count].value = value;
+        traced_count++;
+    }
+}
 
 int mock_read(void* device) {
+    if(read_index == read_pause_index) {
+        return -1;
+    }
     if(read_message != NULL && read_index < read_message_length) {
-        return read_message[read_index++];
+        return (uint8_t)read_message[read_index++];
     }
     return -1;
 }
@@ -42,9 +123,61 @@ void setup() {
     config.delay_function = NULL;
     config.log_function = debug;
 
+    config.millis_function = mock_millis;
+    config.supported_baud_rates = NULL;
+    config.supported_baud_rate_count = 0;
+    tried_baud_count = 0;
+    config.trace_function = NULL;
+    traced_count = 0;
+    cancelled = 0;
+    config.cancel_flag = NULL;
+    config.has_deadline = false;
+    config.retry_policy = NULL;
+    config.capabilities_probed = false;
+    config.capabilities = 0;
+    config.bounded = false;
+
     read_message = NULL;
     read_message_length = 0;
     read_index = 0;
+    read_pause_index = -1;
+    next_response = NULL;
+    written[0] = '\0';
+    written_length = 0;
+    now_ms = 0;
+
+    config.write_bytes_function = NULL;
+    config.read_bytes_function = NULL;
+    config.clear_to_send_function = NULL;
+    config.line_errors_function = NULL;
+    at_commander_data_init(&config, NULL, 0, NULL, 0);
+    transport_capacity = 0;
+    clear_to_send = true;
+}
+
+void mock_delay(unsigned long ms) {
+    now_ms += ms;
+}
+
+// Cancels whatever is in progress after 60ms, like a watchdog would
+void cancelling_delay(unsigned long ms) {
+    now_ms += ms;
+    if(now_ms >= 60) {
+        cancelled = 1;
+    }
+}
+
+static void respond_with(char* response) {
+    read_message = response;
+    read_message_length = strlen(response);
+    read_index = 0;
+}
+
+// For binary responses that may contain NULs
+static void respond_with_bytes(uint8_t* response, int length) {
+    read_message = (char*)response;
+    read_message_length = length;
+    read_index = 0;
 }
 
 
@@ -106,6 +239,41 @@ START_TEST (test_enter_command_mode_fail_no_response)
 }
 END_TEST
 
+START_TEST (test_enter_command_mode_platform_bauds)
+{
+    int i;
+    config.platform = AT_PLATFORM_XBEE;
+    ck_assert(!at_commander_enter_command_mode(&config));
+    ck_assert_int_eq(tried_baud_count, AT_PLATFORM_XBEE.baud_rate_count);
+    ck_assert_int_eq(tried_bauds[0], 9600);
+    for(i = 0; i < tried_baud_count; i++) {
+        ck_assert_int_ne(tried_bauds[i], 230400);
+        ck_assert_int_ne(tried_bauds[i], 460800);
+    }
+}
+END_TEST
+
+START_TEST (test_enter_command_mode_host_bauds)
+{
+    static const int host_bauds[] = {9600, 57600, 460800};
+    int candidates[8];
+    config.supported_baud_rates = host_bauds;
+    config.supported_baud_rate_count = 3;
+
+    ck_assert_int_eq(at_commander_candidate_baud_rates(&config, candidates,
+                8), 3);
+    ck_assert_int_eq(candidates[0], 9600);
+    ck_assert_int_eq(candidates[1], 57600);
+    ck_assert_int_eq(candidates[2], 460800);
+
+    ck_assert(!at_commander_enter_command_mode(&config));
+    ck_assert_int_eq(tried_baud_count, 3);
+    ck_assert_int_eq(tried_bauds[0], 9600);
+    ck_assert_int_eq(tried_bauds[1], 57600);
+    ck_assert_int_eq(tried_bauds[2], 460800);
+}
+END_TEST
+
 START_TEST (test_exit_command_mode_success)
 {
     char* response = "END\r\n";
@@ -152,6 +320,74 @@ START_TEST (test_exit_command_mode_already_done)
 }
 END_TEST
 
+START_TEST (test_reboot_success)
+{
+    respond_with("CMD\r\nReboot!\r\n");
+    ck_assert(at_commander_reboot(&config));
+    ck_assert_str_eq(written, "$$$R,1\r");
+    ck_assert(!config.connected);
+}
+END_TEST
+
+START_TEST (test_reboot_refused)
+{
+    respond_with("CMD\r\n?\r\n");
+    ck_assert(!at_commander_reboot(&config));
+    ck_assert(config.connected);
+}
+END_TEST
+
+START_TEST (test_reboot_unsupported)
+{
+    config.platform = AT_PLATFORM_XBEE;
+    ck_assert(!at_commander_reboot(&config));
+    ck_assert_int_eq(written_length, 0);
+}
+END_TEST
+
+START_TEST (test_missing_platform_commands)
+{
+    char name[20];
+    config.platform = AT_PLATFORM_XBEE;
+    ck_assert(!at_commander_set_name(&config, "FOO", false));
+    ck_assert(!at_commander_set_name(&config, "FOO", true));
+    ck_assert_int_eq(at_commander_get_name(&config, name, sizeof(name)), -1);
+    ck_assert_int_eq(written_length, 0);
+}
+END_TEST
+
+START_TEST (test_set_configuration_timer)
+{
+    respond_with("CMD\r\nAOK\r\n");
+    ck_assert(at_commander_set_configuration_timer(&config, 255));
+    ck_assert(strstr(written, "ST,255\r") != NULL);
+}
+END_TEST
+
+START_TEST (test_set_configuration_timer_store_fails)
+{
+    config.platform.store_settings_command.request_format = "WR\r";
+    config.platform.store_settings_command.expected_response = "AOK";
+    respond_with("CMD\r\nAOK\r\nERR\r\n");
+    ck_assert(!at_commander_set_configuration_timer(&config, 255));
+    ck_assert(strstr(written, "ST,255\rWR\r") != NULL);
+}
+END_TEST
+
+START_TEST (test_set_configuration_timer_unsupported)
+{
+    const AtCommanderPlatform* platforms[] = {
+        &AT_PLATFORM_XBEE, &AT_PLATFORM_HAYES, &AT_PLATFORM_ESPRESSIF
+    };
+    int i;
+    for(i = 0; i < 3; i++) {
+        config.platform = *platforms[i];
+        ck_assert(!at_commander_set_configuration_timer(&config, 60));
+    }
+    ck_assert_int_eq(written_length, 0);
+}
+END_TEST
+
 START_TEST (test_set_baud_success)
 {
     char* response = "CMD\r\nAOK\r\n";
@@ -193,149 +429,2261 @@ START_TEST (test_set_baud_no_response)
 }
 END_TEST
 
-START_TEST (test_xbee_enter_command_mode_success)
+START_TEST (test_set_baud_unsupported)
 {
+    static const int host_bauds[] = {9600, 57600};
+    respond_with("CMD\r\nAOK\r\n");
+
+    ck_assert(!at_commander_set_baud(&config, 300));
     config.platform = AT_PLATFORM_XBEE;
-    char* response = "OK";
-    read_message = response;
-    read_message_length = 2;
+    ck_assert(!at_commander_set_baud(&config, 230400));
+    config.platform = AT_PLATFORM_RN42;
+    config.supported_baud_rates = host_bauds;
+    config.supported_baud_rate_count = 2;
+    ck_assert(!at_commander_set_baud(&config, 115200));
+    ck_assert_int_eq(written_length, 0);
+    ck_assert_int_eq(config.device_baud, 9600);
+}
+END_TEST
 
-    ck_assert(!config.connected);
-    ck_assert(at_commander_enter_command_mode(&config));
-    ck_assert(config.connected);
+START_TEST (test_baud_rate_mappers)
+{
+    ck_assert_int_eq(rn42_baud_rate_mapper(2400), 24);
+    ck_assert_int_eq(rn42_baud_rate_mapper(230400), 23);
+    ck_assert_int_eq(rn42_baud_rate_mapper(2300), -1);
+    ck_assert_int_eq(xbee_baud_rate_mapper(2400), 1);
+    ck_assert_int_eq(xbee_baud_rate_mapper(230400), -1);
 }
 END_TEST
 
-START_TEST (test_get_device_id_success)
+START_TEST (test_trace_set_baud)
 {
-    char* response = "CMD\r\n00066646C2AF\r\n";
-    read_message = response;
-    read_message_length = 19;
+    static const AtCommanderTraceSpan expected[] = {
+        AT_TRACE_BAUD_SWEEP, AT_TRACE_COMMAND, AT_TRACE_COMMAND,
+        AT_TRACE_BAUD_SWEEP, AT_TRACE_BAUD_SWEEP, AT_TRACE_COMMAND,
+        AT_TRACE_COMMAND, AT_TRACE_BAUD_SWEEP, AT_TRACE_COMMAND,
+        AT_TRACE_COMMAND};
+    static const bool begins[] = {true, true, false, false, true, true, false,
+        false, true, false};
+    int i;
+    config.trace_function = mock_trace;
+    respond_with("BADCMD\r\nAOK\r\n");
 
-    char device_id[20];
-    ck_assert(!config.connected);
-    ck_assert(at_commander_get_device_id(&config, device_id,
-                sizeof(device_id)) == 12);
-    ck_assert(config.connected);
-    ck_assert_str_eq(device_id, "00066646C2AF");
+    ck_assert(at_commander_set_baud(&config, 115200));
+    ck_assert_int_eq(traced_count, 10);
+    for(i = 0; i < traced_count; i++) {
+        ck_assert_int_eq(traced[i].span, expected[i]);
+        ck_assert(traced[i].begin == begins[i]);
+    }
+    ck_assert_int_eq(traced[0].value, 230400);
+    ck_assert_int_eq(traced[4].value, 115200);
 }
 END_TEST
 
-START_TEST (test_get_device_id_bad_response)
+START_TEST (test_trace_nested_spans)
 {
-    char* response = "CMD\r\nERR";
-    read_message = response;
-    read_message_length = 8;
+    int depth = 0;
+    int waits = 0;
+    int i;
+    config.platform = AT_PLATFORM_XBEE;
+    config.delay_function = mock_delay;
+    config.trace_function = mock_trace;
+    respond_with("OK\r\nOK\r\nOK\r\n");
 
-    char device_id[20];
-    ck_assert(!config.connected);
-    ck_assert(at_commander_get_device_id(&config, device_id, sizeof(device_id)) == -1);
-    ck_assert(config.connected);
-    ck_assert_str_ne(device_id, "00066646C2AF");
+    ck_assert(at_commander_set_baud(&config, 9600));
+    for(i = 0; i < traced_count; i++) {
+        depth += traced[i].begin ? 1 : -1;
+        ck_assert_int_ge(depth, 0);
+        if(traced[i].span == AT_TRACE_WAIT && traced[i].begin) {
+            waits++;
+        }
+        if(traced[i].span == AT_TRACE_STORE && traced[i].begin) {
+            ck_assert_int_eq(traced[i + 1].span, AT_TRACE_COMMAND);
+        }
+    }
+    ck_assert_int_eq(depth, 0);
+    ck_assert_int_gt(waits, 0);
 }
 END_TEST
 
-START_TEST (test_get_device_id_no_response)
+START_TEST (test_cancel_before_enter)
 {
-    char* response = "CMD\r\n";
-    read_message = response;
-    read_message_length = 5;
+    config.cancel_flag = &cancelled;
+    cancelled = 1;
+    respond_with("CMD\r\n");
 
-    char device_id[20];
-    ck_assert(!config.connected);
-    ck_assert_int_eq(at_commander_get_device_id(&config, device_id,
-                sizeof(device_id)), 0);
-    ck_assert(config.connected);
-    ck_assert_str_ne(device_id, "00066646C2AF");
+    ck_assert(!at_commander_enter_command_mode(&config));
+    ck_assert_int_eq(written_length, 0);
+    ck_assert_int_eq(at_commander_interrupted(&config),
+            AT_COMMANDER_RESULT_CANCELLED);
 }
 END_TEST
 
-START_TEST (test_get_name_success)
+START_TEST (test_cancel_during_wait)
 {
-    char* response = "CMD\r\nFOO\r\n";
-    read_message = response;
-    read_message_length = 10;
+    config.delay_function = cancelling_delay;
+    config.cancel_flag = &cancelled;
 
-    char name[20];
-    ck_assert(!config.connected);
-    ck_assert(at_commander_get_name(&config, name, sizeof(name)) == 3);
-    ck_assert(config.connected);
-    ck_assert_str_eq(name, "FOO");
+    ck_assert(!at_commander_enter_command_mode(&config));
+    ck_assert_int_lt(now_ms, 70);
+    ck_assert_int_eq(at_commander_interrupted(&config),
+            AT_COMMANDER_RESULT_CANCELLED);
 }
 END_TEST
 
-START_TEST (test_get_name_bad_response)
+START_TEST (test_budget_stops_sweep)
 {
-    char* response = "CMD\r\nERR";
-    read_message = response;
-    read_message_length = 8;
+    config.delay_function = mock_delay;
+    at_commander_set_budget(&config, 120);
 
-    char name[20];
-    ck_assert(!config.connected);
-    ck_assert(at_commander_get_name(&config, name, sizeof(name)) == -1);
-    ck_assert(config.connected);
-    ck_assert_str_ne(name, "FOO");
+    ck_assert(!at_commander_set_baud(&config, 115200));
+    ck_assert_int_le(now_ms, 120);
+    ck_assert_int_eq(at_commander_interrupted(&config),
+            AT_COMMANDER_RESULT_BUDGET_EXHAUSTED);
+
+    at_commander_set_budget(&config, 0);
+    ck_assert_int_eq(at_commander_interrupted(&config),
+            AT_COMMANDER_RESULT_OK);
 }
 END_TEST
 
-START_TEST (test_get_name_no_response)
+START_TEST (test_budget_hayes_command)
 {
-    char* response = "CMD\r\n";
-    read_message = response;
-    read_message_length = 5;
+    char response[32];
+    config.platform = AT_PLATFORM_HAYES;
+    config.connected = true;
+    config.delay_function = mock_delay;
+    at_commander_set_budget(&config, 200);
 
-    char name[20];
-    ck_assert(!config.connected);
-    ck_assert_int_eq(at_commander_get_name(&config, name, sizeof(name)), 0);
-    ck_assert(config.connected);
-    ck_assert_str_ne(name, "FOO");
+    ck_assert_int_eq(at_commander_command(&config, "AT+CSQ\r", response,
+                sizeof(response), 0), AT_COMMANDER_RESULT_BUDGET_EXHAUSTED);
+    ck_assert_int_le(now_ms, 200);
 }
 END_TEST
 
-Suite* suite(void) {
-    Suite* s = suite_create("atcommander");
-    TCase *tc_enter_command_mode = tcase_create("enter_command_mode");
-    tcase_add_checked_fixture(tc_enter_command_mode, setup, NULL);
-    tcase_add_test(tc_enter_command_mode, test_enter_command_mode_success);
-    tcase_add_test(tc_enter_command_mode, test_enter_command_mode_already_active);
-    tcase_add_test(tc_enter_command_mode, test_enter_command_mode_fail_bad_response);
-    tcase_add_test(tc_enter_command_mode, test_enter_command_mode_fail_no_response);
-    tcase_add_test(tc_enter_command_mode, test_enter_command_mode_at_baud);
-    suite_add_tcase(s, tc_enter_command_mode);
+// Retries everything but errors, without jitter so the backoff is exact
+static const AtCommanderRetryPolicy test_retry_policy = {
+    3, 100, 1000, 0, true, true, false, 0, 0,
+};
 
-    TCase *tc_exit_command_mode = tcase_create("exit_command_mode");
-    tcase_add_checked_fixture(tc_exit_command_mode, setup, NULL);
-    tcase_add_test(tc_exit_command_mode, test_exit_command_mode_success);
-    tcase_add_test(tc_exit_command_mode, test_exit_command_mode_fail_bad_response);
-    tcase_add_test(tc_exit_command_mode, test_exit_command_mode_fail_no_response);
-    tcase_add_test(tc_exit_command_mode, test_exit_command_mode_already_done);
-    suite_add_tcase(s, tc_exit_command_mode);
+static int count_written(const char* request) {
+    int count = 0;
+    const char* found = written;
+    while((found = strstr(found, request)) != NULL) {
+        count++;
+        found += strlen(request);
+    }
+    return count;
+}
 
-    TCase *tc_set_baud = tcase_create("set_baud");
-    tcase_add_checked_fixture(tc_set_baud, setup, NULL);
-    tcase_add_test(tc_set_baud, test_set_baud_success);
-    tcase_add_test(tc_set_baud, test_set_baud_bad_response);
-    tcase_add_test(tc_set_baud, test_set_baud_no_response);
-    suite_add_tcase(s, tc_set_baud);
+START_TEST (test_retry_garbled_response)
+{
+    config.connected = true;
+    config.delay_function = mock_delay;
+    config.retry_policy = &test_retry_policy;
+    respond_with("A#K\r\nAOK\r\n");
 
-    TCase *tc_get_device_id = tcase_create("get_device_id");
-    tcase_add_checked_fixture(tc_get_device_id, setup, NULL);
-    tcase_add_test(tc_get_device_id, test_get_device_id_success);
-    tcase_add_test(tc_get_device_id, test_get_device_id_bad_response);
-    tcase_add_test(tc_get_device_id, test_get_device_id_no_response);
-    suite_add_tcase(s, tc_get_device_id);
+    ck_assert(at_commander_set_baud(&config, 115200));
+    ck_assert_int_eq(count_written("SU,11\r"), 2);
+    ck_assert_int_ge(now_ms, 100);
+}
+END_TEST
 
-    TCase *tc_get_name = tcase_create("get_name");
-    tcase_add_checked_fixture(tc_get_name, setup, NULL);
-    tcase_add_test(tc_get_name, test_get_name_success);
-    tcase_add_test(tc_get_name, test_get_name_bad_response);
-    tcase_add_test(tc_get_name, test_get_name_no_response);
-    suite_add_tcase(s, tc_get_name);
+START_TEST (test_retry_error_fails_fast)
+{
+    config.connected = true;
+    config.delay_function = mock_delay;
+    config.retry_policy = &test_retry_policy;
+    respond_with("ERR\r\nAOK\r\n");
 
-    TCase *tc_xbee = tcase_create("xbee");
-    tcase_add_checked_fixture(tc_xbee, setup, NULL);
-    tcase_add_test(tc_xbee, test_xbee_enter_command_mode_success);
-    suite_add_tcase(s, tc_xbee);
+    ck_assert(!at_commander_set_baud(&config, 115200));
+    ck_assert_int_eq(count_written("SU,11\r"), 1);
+    // Only the response delay, no backoff
+    ck_assert_int_eq(now_ms, 100);
+}
+END_TEST
+
+START_TEST (test_retry_timeout_backoff)
+{
+    config.connected = true;
+    config.delay_function = mock_delay;
+    config.retry_policy = &test_retry_policy;
+
+    ck_assert(!at_commander_set_baud(&config, 115200));
+    ck_assert_int_eq(count_written("SU,11\r"), 3);
+    // Three response delays and reads, and backoffs of 100 and 200ms
+    ck_assert_int_eq(now_ms, 3 * (100 + 3 * 50) + 300);
+}
+END_TEST
+
+START_TEST (test_retry_jitter_bounded)
+{
+    AtCommanderRetryPolicy policy = test_retry_policy;
+    policy.max_attempts = 2;
+    policy.jitter_percent = 50;
+    policy.read_retries = 1;
+    config.connected = true;
+    config.delay_function = mock_delay;
+    config.retry_policy = &policy;
+
+    ck_assert(!at_commander_set_baud(&config, 115200));
+    ck_assert_int_eq(count_written("SU,11\r"), 2);
+    ck_assert_int_ge(now_ms, 2 * (100 + 50) + 100);
+    ck_assert_int_le(now_ms, 2 * (100 + 50) + 150);
+}
+END_TEST
+
+START_TEST (test_retry_not_used_for_baud_sweep)
+{
+    config.retry_policy = &test_retry_policy;
+
+    ck_assert(!at_commander_enter_command_mode(&config));
+    ck_assert_int_eq(tried_baud_count, config.platform.baud_rate_count);
+    ck_assert_int_eq(count_written("$$$"), config.platform.baud_rate_count);
+}
+END_TEST
+
+START_TEST (test_remote_configure_batch)
+{
+    AtCommanderRemoteSession remote;
+    at_commander_remote_init(&remote, &config);
+    respond_with("CMD\r\nAOK\r\nAOK\r\nEND\r\n");
+
+    ck_assert(at_commander_remote_configure(&remote,
+                AT_PLATFORM_RN42.link_profiles[AT_LINK_PROFILE_LOW_LATENCY],
+                2, false));
+    ck_assert_str_eq(written, "$$$SQ,16\rSW,0000\r---\r");
+    ck_assert(!remote.config.connected);
+    // The local device's baud rate is left alone
+    ck_assert_int_eq(tried_baud_count, 0);
+}
+END_TEST
+
+START_TEST (test_remote_configure_failure_returns_to_data)
+{
+    AtCommanderRemoteSession remote;
+    at_commander_remote_init(&remote, &config);
+    respond_with("CMD\r\nERR\r\nEND\r\n");
+
+    ck_assert(!at_commander_remote_configure(&remote,
+                AT_PLATFORM_RN42.link_profiles[AT_LINK_PROFILE_LOW_LATENCY],
+                2, false));
+    ck_assert_str_eq(written, "$$$SQ,16\r---\r");
+    ck_assert(!remote.config.connected);
+}
+END_TEST
+
+START_TEST (test_remote_configure_stalled_link)
+{
+    AtCommanderRemoteSession remote;
+    config.write_bytes_function = mock_write_bytes;
+    config.delay_function = mock_delay;
+    transport_capacity = 5;
+    at_commander_remote_init(&remote, &config);
+    respond_with("CMD\r\n");
+
+    ck_assert(!at_commander_remote_configure(&remote,
+                AT_PLATFORM_RN42.link_profiles[AT_LINK_PROFILE_LOW_LATENCY],
+                2, false));
+    ck_assert(remote.write_failed);
+    ck_assert_str_eq(written, "$$$SQ");
+    // Given up after one stall, not a response timeout for every byte
+    ck_assert_int_lt(now_ms, 2 * AT_COMMANDER_DEFAULT_RESPONSE_TIMEOUT_MS);
+    ck_assert(!remote.config.has_deadline);
+}
+END_TEST
+
+START_TEST (test_remote_configure_single_attempt)
+{
+    AtCommanderRemoteSession remote;
+    at_commander_remote_init(&remote, &config);
+
+    ck_assert(!at_commander_remote_configure(&remote,
+                AT_PLATFORM_RN42.link_profiles[AT_LINK_PROFILE_LOW_LATENCY],
+                2, false));
+    ck_assert_str_eq(written, "$$$");
+
+    written_length = 0;
+    written[0] = '\0';
+    config.connected = true;
+    ck_assert(!at_commander_remote_configure(&remote,
+                AT_PLATFORM_RN42.link_profiles[AT_LINK_PROFILE_LOW_LATENCY],
+                2, false));
+    ck_assert_int_eq(written_length, 0);
+}
+END_TEST
+
+START_TEST (test_xbee_parser_frames)
+{
+    AtCommanderXBeeFrameParser parser;
+    at_commander_xbee_parser_init(&parser, true);
+
+    // Line noise, an ATNJ command frame, then one with a bad checksum
+    const uint8_t stream[] = { 0x42, 0x7E, 0x00, 0x04, 0x08, 0x52, 0x4E, 0x4A,
+            0x0D, 0x7E, 0x00, 0x02, 0x8A, 0x06, 0x00 };
+    int completed = 0;
+    for(int i = 0; i < (int)sizeof(stream); i++) {
+        int length = at_commander_xbee_parser_feed(&parser, stream[i]);
+        if(length > 0) {
+            ck_assert_int_eq(length, 4);
+            ck_assert(!memcmp(parser.frame, "\x08\x52\x4E\x4A", 4));
+            completed++;
+        }
+    }
+    ck_assert_int_eq(completed, 1);
+    ck_assert_int_eq(parser.checksum_errors, 1);
+
+    // An escaped 0x7E in the data, 0x7E ^ 0x20 = 0x5E
+    const uint8_t escaped[] = { 0x7E, 0x00, 0x02, 0x8A, 0x7D, 0x5E, 0xF7 };
+    int length = 0;
+    for(int i = 0; i < (int)sizeof(escaped); i++) {
+        length = at_commander_xbee_parser_feed(&parser, escaped[i]);
+    }
+    ck_assert_int_eq(length, 2);
+    ck_assert_int_eq(parser.frame[1], 0x7E);
+
+    // Too long to keep, skipped without losing the next frame
+    const uint8_t oversized[] = { 0x7E, 0x10, 0x00, 0x01, 0x7E, 0x00, 0x04,
+            0x08, 0x52, 0x4E, 0x4A, 0x0D };
+    for(int i = 0; i < (int)sizeof(oversized); i++) {
+        length = at_commander_xbee_parser_feed(&parser, oversized[i]);
+    }
+    ck_assert_int_eq(parser.oversized_frames, 1);
+    ck_assert_int_eq(length, 4);
+}
+END_TEST
+
+static int sent_count;
+static int delivered_count;
+
+void count_sent(AtCommanderXBeeApi* api, int destination,
+        const uint8_t* payload, int size, bool delivered) {
+    sent_count++;
+    if(delivered) {
+        delivered_count++;
+    }
+}
+
+// Wrap frame data in the API framing, for a mock response
+static int api_frame(uint8_t* response, const uint8_t* data, int length) {
+    uint8_t checksum = 0;
+    response[0] = 0x7E;
+    response[1] = length >> 8;
+    response[2] = length & 0xFF;
+    for(int i = 0; i < length; i++) {
+        response[3 + i] = data[i];
+        checksum += data[i];
+    }
+    response[3 + length] = 0xFF - checksum;
+    return length + 4;
+}
+
+static int transmit_status(uint8_t* response, uint8_t frame_id,
+        uint8_t delivery_status) {
+    const uint8_t frame[] = { 0x8B, frame_id, 0xFF, 0xFE, 0x00,
+            delivery_status, 0x00 };
+    return api_frame(response, frame, sizeof(frame));
+}
+
+static AtCommanderXBeeApi xbee_api;
+
+static void xbee_api_setup() {
+    setup();
+    config.platform = AT_PLATFORM_XBEE;
+    at_commander_xbee_api_init(&xbee_api, &config, false);
+    xbee_api.sent = count_sent;
+    sent_count = 0;
+    delivered_count = 0;
+}
+
+START_TEST (test_xbee_send_frame_format)
+{
+    int destination = at_commander_xbee_add_destination(&xbee_api,
+            0x0013A20040A1B2C3ULL);
+    ck_assert(at_commander_xbee_send(&xbee_api, destination,
+                (const uint8_t*)"hi", 2));
+
+    const uint8_t expected[] = { 0x7E, 0x00, 0x10, 0x10, 0x01, 0x00, 0x13,
+            0xA2, 0x00, 0x40, 0xA1, 0xB2, 0xC3, 0xFF, 0xFE, 0x00, 0x00, 'h',
+            'i', 0x15 };
+    ck_assert_int_eq(written_length, sizeof(expected));
+    ck_assert(!memcmp(written, expected, sizeof(expected)));
+}
+END_TEST
+
+START_TEST (test_xbee_send_window_full)
+{
+    int destination = at_commander_xbee_add_destination(&xbee_api,
+            AT_COMMANDER_XBEE_BROADCAST_ADDRESS);
+    xbee_api.window = 2;
+    ck_assert(at_commander_xbee_send(&xbee_api, destination,
+                (const uint8_t*)"a", 1));
+    ck_assert(at_commander_xbee_send(&xbee_api, destination,
+                (const uint8_t*)"b", 1));
+    int length = written_length;
+    ck_assert(!at_commander_xbee_send(&xbee_api, destination,
+                (const uint8_t*)"c", 1));
+    ck_assert_int_eq(written_length, length);
+    ck_assert(!at_commander_xbee_send(&xbee_api, 3, (const uint8_t*)"d", 1));
+
+    // Delivering one opens the window again
+    uint8_t response[16];
+    respond_with_bytes(response, transmit_status(response, 1, 0));
+    ck_assert_int_eq(at_commander_xbee_process(&xbee_api), 1);
+    ck_assert(at_commander_xbee_send(&xbee_api, destination,
+                (const uint8_t*)"c", 1));
+}
+END_TEST
+
+START_TEST (test_xbee_status_retries_only_failed_frame)
+{
+    int destination = at_commander_xbee_add_destination(&xbee_api,
+            0x0013A20040A1B2C3ULL);
+    ck_assert(at_commander_xbee_send(&xbee_api, destination,
+                (const uint8_t*)"first", 5));
+    ck_assert(at_commander_xbee_send(&xbee_api, destination,
+                (const uint8_t*)"second", 6));
+    written_length = 0;
+
+    // Out of order, and the first wasn't acknowledged by its destination
+    uint8_t response[32];
+    int length = transmit_status(response, 2, 0);
+    length += transmit_status(&response[length], 1, 0x01);
+    now_ms = 40;
+    respond_with_bytes(response, length);
+    ck_assert_int_eq(at_commander_xbee_process(&xbee_api), 1);
+
+    // Only the first is sent again, with a new frame ID
+    ck_assert_int_eq(written[4], 3);
+    ck_assert(!memcmp(&written[17], "first", 5));
+    ck_assert_int_eq(written_length, 18 + 5);
+
+    now_ms = 100;
+    respond_with_bytes(response, transmit_status(response, 3, 0));
+    ck_assert_int_eq(at_commander_xbee_process(&xbee_api), 0);
+    ck_assert_int_eq(delivered_count, 2);
+
+    AtCommanderXBeeDestination* stats = &xbee_api.destinations[destination];
+    ck_assert_int_eq(stats->frames_sent, 2);
+    ck_assert_int_eq(stats->frames_delivered, 2);
+    ck_assert_int_eq(stats->retries, 1);
+    ck_assert_int_eq(stats->bytes_delivered, 11);
+    ck_assert_int_eq(at_commander_xbee_mean_latency_ms(&xbee_api,
+                destination), 50);
+    ck_assert_int_eq(at_commander_xbee_throughput(&xbee_api, destination),
+            110);
+}
+END_TEST
+
+START_TEST (test_xbee_missing_status_gives_up)
+{
+    int destination = at_commander_xbee_add_destination(&xbee_api,
+            0x0013A20040A1B2C3ULL);
+    ck_assert(at_commander_xbee_send(&xbee_api, destination,
+                (const uint8_t*)"lost", 4));
+    for(int i = 1; i <= AT_COMMANDER_XBEE_DEFAULT_MAX_ATTEMPTS; i++) {
+        now_ms = i * AT_COMMANDER_XBEE_DEFAULT_STATUS_TIMEOUT_MS;
+        at_commander_xbee_process(&xbee_api);
+    }
+    ck_assert_int_eq(xbee_api.outstanding_count, 0);
+    ck_assert_int_eq(sent_count, 1);
+    ck_assert_int_eq(delivered_count, 0);
+    ck_assert_int_eq(xbee_api.destinations[destination].frames_failed, 1);
+    ck_assert_int_eq(xbee_api.destinations[destination].retries,
+            AT_COMMANDER_XBEE_DEFAULT_MAX_ATTEMPTS - 1);
+
+    // A status arriving after giving up is ignored
+    uint8_t response[16];
+    respond_with_bytes(response, transmit_status(response, 3, 0));
+    at_commander_xbee_process(&xbee_api);
+    ck_assert_int_eq(sent_count, 1);
+}
+END_TEST
+
+START_TEST (test_xbee_missing_status_without_millis)
+{
+    int destination = at_commander_xbee_add_destination(&xbee_api,
+            0x0013A20040A1B2C3ULL);
+    config.millis_function = NULL;
+    xbee_api.status_timeout_ms = 10;
+    ck_assert(at_commander_xbee_send(&xbee_api, destination,
+                (const uint8_t*)"lost", 4));
+    // Each process call counts as a tick, so the status still times out
+    for(int i = 0; i < 100 && xbee_api.outstanding_count > 0; i++) {
+        at_commander_xbee_process(&xbee_api);
+    }
+    ck_assert_int_eq(xbee_api.outstanding_count, 0);
+    ck_assert_int_eq(xbee_api.destinations[destination].retries,
+            AT_COMMANDER_XBEE_DEFAULT_MAX_ATTEMPTS - 1);
+}
+END_TEST
+
+// The transport frees up again, but only long after the write timeout
+void late_capacity_delay(unsigned long ms) {
+    now_ms += ms;
+    if(now_ms >= 2 * AT_COMMANDER_DEFAULT_RESPONSE_TIMEOUT_MS) {
+        transport_capacity = 1000;
+    }
+}
+
+START_TEST (test_xbee_stalled_frame_not_continued)
+{
+    uint8_t payload[100];
+    memset(payload, 'x', sizeof(payload));
+    config.write_bytes_function = mock_write_bytes;
+    config.delay_function = late_capacity_delay;
+    transport_capacity = 40;
+
+    const uint8_t header[] = { AT_XBEE_FRAME_TRANSMIT_REQUEST };
+    ck_assert(!at_commander_xbee_write_frame(&xbee_api, header,
+                sizeof(header), payload, sizeof(payload)));
+    // Nothing after the chunk that stalled
+    ck_assert_int_eq(written_length, 40);
+}
+END_TEST
+
+static int result_count;
+static AtCommanderXBeeCommandStatus last_result;
+
+void record_result(AtCommanderXBeeDeferred* deferred, uint64_t address,
+        const char* command, AtCommanderXBeeCommandStatus status,
+        const uint8_t* data, int length) {
+    result_count++;
+    last_result = status;
+}
+
+static AtCommanderXBeeDeferred deferred;
+static const uint64_t SLEEPY_NODE = 0x0013A20040A1B2C3ULL;
+
+// An XBee on SPI - it parses the frames clocked in, answers transmit requests
+// and AT commands with their status, and clocks out 0xFF when it has nothing
+// to send, asserting ATTN while it has
+static AtCommanderXBeeFrameParser spi_mosi;
+static uint8_t spi_miso[256];
+static int spi_miso_length;
+static int spi_miso_index;
+static int spi_clocked;
+
+static void spi_queue(const uint8_t* data, int length) {
+    if(spi_miso_index == spi_miso_length) {
+        spi_miso_index = spi_miso_length = 0;
+    }
+    spi_miso_length += api_frame(&spi_miso[spi_miso_length], data, length);
+}
+
+void mock_spi_transfer(void* device, const uint8_t* tx, uint8_t* rx,
+        int size) {
+    for(int i = 0; i < size; i++) {
+        rx[i] = spi_miso_index < spi_miso_length ?
+                spi_miso[spi_miso_index++] : 0xFF;
+        int length = at_commander_xbee_parser_feed(&spi_mosi, tx[i]);
+        if(length > 0 && spi_mosi.frame[0] == AT_XBEE_FRAME_TRANSMIT_REQUEST) {
+            const uint8_t status[] = { AT_XBEE_FRAME_TRANSMIT_STATUS,
+                    spi_mosi.frame[1], 0xFF, 0xFE, 0x00, 0x00, 0x00 };
+            spi_queue(status, sizeof(status));
+        } else if(length > 0 && spi_mosi.frame[0] == AT_XBEE_FRAME_AT_COMMAND) {
+            const uint8_t response[] = { AT_XBEE_FRAME_AT_RESPONSE,
+                    spi_mosi.frame[1], spi_mosi.frame[2], spi_mosi.frame[3],
+                    0x00 };
+            spi_queue(response, sizeof(response));
+        }
+    }
+    spi_clocked += size;
+}
+
+bool mock_spi_attention(void* device) {
+    return spi_miso_index < spi_miso_length;
+}
+
+static uint8_t spi_last_frame[AT_COMMANDER_XBEE_MAX_FRAME_LENGTH];
+static int spi_frames_received;
+
+void record_frame(AtCommanderXBeeApi* api, const uint8_t* frame,
+        int length) {
+    memcpy(spi_last_frame, frame, length);
+    spi_frames_received++;
+}
+
+static AtCommanderXBeeSpi xbee_spi;
+
+static void xbee_spi_setup() {
+    setup();
+    at_commander_xbee_spi_init(&xbee_spi, &config, mock_spi_transfer,
+            mock_spi_attention, NULL);
+    at_commander_xbee_api_init(&xbee_api, &config, false);
+    xbee_api.sent = count_sent;
+    xbee_api.frame_received = record_frame;
+    at_commander_xbee_parser_init(&spi_mosi, false);
+    spi_miso_length = spi_miso_index = 0;
+    spi_clocked = 0;
+    spi_frames_received = 0;
+    sent_count = 0;
+    delivered_count = 0;
+}
+
+START_TEST (test_xbee_spi_window_delivered)
+{
+    int destination = at_commander_xbee_add_destination(&xbee_api,
+            0x0013A20040A1B2C3ULL);
+    ck_assert(at_commander_xbee_send(&xbee_api, destination,
+                (const uint8_t*)"first", 5));
+    ck_assert(at_commander_xbee_send(&xbee_api, destination,
+                (const uint8_t*)"second", 6));
+    ck_assert(at_commander_xbee_send(&xbee_api, destination,
+                (const uint8_t*)"third", 5));
+    ck_assert(at_commander_xbee_flush(&xbee_api, 100));
+    ck_assert_int_eq(delivered_count, 3);
+    ck_assert_int_eq(spi_frames_received, 0);
+    // Nothing went to the UART
+    ck_assert_int_eq(written_length, 0);
+}
+END_TEST
+
+START_TEST (test_xbee_spi_full_duplex_keeps_received_frames)
+{
+    const uint8_t packet[] = { AT_XBEE_FRAME_RECEIVE_PACKET, 0x00, 0x13,
+            0xA2, 0x00, 0x40, 0xA1, 0xB2, 0xC3, 0xFF, 0xFE, 0x01, 'y', 'o' };
+    int destination = at_commander_xbee_add_destination(&xbee_api,
+            AT_COMMANDER_XBEE_BROADCAST_ADDRESS);
+    spi_queue(packet, sizeof(packet));
+
+    // The packet comes in while the request goes out
+    ck_assert(at_commander_xbee_send(&xbee_api, destination,
+                (const uint8_t*)"hello", 5));
+    ck_assert_int_eq(xbee_spi.received.count, sizeof(packet) + 4);
+
+    ck_assert_int_eq(at_commander_xbee_process(&xbee_api), 0);
+    ck_assert_int_eq(spi_frames_received, 1);
+    ck_assert(!memcmp(spi_last_frame, packet, sizeof(packet)));
+    ck_assert_int_eq(delivered_count, 1);
+    ck_assert_int_eq(xbee_spi.overflows, 0);
+}
+END_TEST
+
+START_TEST (test_xbee_spi_idle_bytes_dropped)
+{
+    uint8_t buffer[16];
+    // Nothing is clocked while ATTN is deasserted
+    ck_assert_int_eq(at_commander_data_read(&config, buffer, sizeof(buffer)),
+            0);
+    ck_assert_int_eq(spi_clocked, 0);
+
+    // Without ATTN, a chunk is polled and the idle bytes thrown away
+    xbee_spi.attention_function = NULL;
+    ck_assert_int_eq(at_commander_data_read(&config, buffer, sizeof(buffer)),
+            0);
+    ck_assert_int_eq(spi_clocked, sizeof(buffer));
+    ck_assert_int_eq(xbee_spi.received.count, 0);
+}
+END_TEST
+
+START_TEST (test_xbee_spi_no_baud_sweep)
+{
+    ck_assert(!at_commander_enter_command_mode(&config));
+    ck_assert_int_eq(tried_baud_count, 0);
+    ck_assert_int_eq(spi_clocked, 0);
+}
+END_TEST
+
+START_TEST (test_xbee_spi_local_command)
+{
+    uint8_t frame_id = at_commander_xbee_next_frame_id(&xbee_api);
+    ck_assert(at_commander_xbee_send_command(&xbee_api, frame_id, "NI",
+                (const uint8_t*)"gateway", 7));
+    ck_assert_int_eq(spi_mosi.frame[0], AT_XBEE_FRAME_AT_COMMAND);
+    ck_assert(!memcmp(&spi_mosi.frame[2], "NIgateway", 9));
+
+    at_commander_xbee_process(&xbee_api);
+    ck_assert_int_eq(spi_frames_received, 1);
+    ck_assert_int_eq(spi_last_frame[0], AT_XBEE_FRAME_AT_RESPONSE);
+    ck_assert_int_eq(spi_last_frame[1], frame_id);
+    ck_assert_int_eq(spi_last_frame[4], 0);
+}
+END_TEST
+
+static AtCommanderLinkHealth link_health;
+static AtCommanderLineErrors line_errors;
+static const int LINK_HEALTH_RATES[] = {115200, 9600, 57600};
+
+// The device answering a rate change - entering at the old rate, setting the
+// new one, rebooting into it and being found there
+static char* RATE_CHANGE_RESPONSES = "CMD\r\nAOK\r\nReboot!\r\nCMD\r\nEND\r\n";
+
+bool mock_line_errors(void* device, AtCommanderLineErrors* errors) {
+    *errors = line_errors;
+    return true;
+}
+
+/* Pass one health window, receiving bytes with some framing errors among
+ * them.
+ */
+static AtCommanderLinkHealthAction run_window(unsigned long framing,
+        unsigned long bytes) {
+    line_errors.framing += framing;
+    config.data_stats.bytes_received += bytes;
+    now_ms += AT_COMMANDER_DEFAULT_HEALTH_WINDOW_MS;
+    return at_commander_link_health_tick(&link_health);
+}
+
+static void link_health_setup() {
+    setup();
+    memset(&line_errors, 0, sizeof(line_errors));
+    config.line_errors_function = mock_line_errors;
+    config.supported_baud_rates = LINK_HEALTH_RATES;
+    config.supported_baud_rate_count = 3;
+    config.baud = 115200;
+    config.device_baud = 115200;
+    ck_assert(at_commander_link_health_init(&link_health, &config));
+    link_health.upgrade_ms = 5000;
+}
+
+START_TEST (test_link_health_rates_sorted)
+{
+    ck_assert_int_eq(link_health.rate_count, 3);
+    ck_assert_int_eq(link_health.rates[0], 9600);
+    ck_assert_int_eq(link_health.rates[1], 57600);
+    ck_assert_int_eq(link_health.rates[2], 115200);
+    ck_assert_int_eq(link_health.ceiling, 2);
+
+    config.baud = 4800;
+    ck_assert(!at_commander_link_health_init(&link_health, &config));
+}
+END_TEST
+
+START_TEST (test_link_health_clean_link_steady)
+{
+    int i;
+    for(i = 0; i < 10; i++) {
+        // A stray error now and then is under the threshold
+        ck_assert_int_eq(run_window(i % 2, 1000), AT_LINK_HEALTH_STEADY);
+    }
+    ck_assert_int_eq(link_health.errors.framing, 5);
+    ck_assert_int_eq(written_length, 0);
+    ck_assert_int_eq(config.baud, 115200);
+}
+END_TEST
+
+START_TEST (test_link_health_downgrade)
+{
+    read_message = RATE_CHANGE_RESPONSES;
+    read_message_length = strlen(RATE_CHANGE_RESPONSES);
+
+    ck_assert_int_eq(run_window(50, 1000), AT_LINK_HEALTH_STEADY);
+    ck_assert_int_eq(run_window(50, 1000), AT_LINK_HEALTH_STEADY);
+    ck_assert_int_eq(run_window(50, 1000), AT_LINK_HEALTH_DOWNGRADED);
+    ck_assert(strstr(written, "SU,57\r") != NULL);
+    ck_assert(strstr(written, "R,1\r") != NULL);
+    ck_assert_int_eq(config.baud, 57600);
+    ck_assert_int_eq(config.device_baud, 57600);
+    ck_assert(!config.connected);
+    ck_assert_int_eq(link_health.downgrades, 1);
+    ck_assert_int_eq(link_health.errors.framing, 150);
+}
+END_TEST
+
+START_TEST (test_link_health_upgrade_probation)
+{
+    int i;
+    read_message = RATE_CHANGE_RESPONSES;
+    read_message_length = strlen(RATE_CHANGE_RESPONSES);
+    for(i = 0; i < 3; i++) {
+        run_window(50, 1000);
+    }
+    ck_assert_int_eq(config.baud, 57600);
+
+    // Clean until the upgrade interval is up
+    read_message = RATE_CHANGE_RESPONSES;
+    read_message_length = strlen(RATE_CHANGE_RESPONSES);
+    read_index = 0;
+    for(i = 0; i < 4; i++) {
+        ck_assert_int_eq(run_window(0, 1000), AT_LINK_HEALTH_STEADY);
+    }
+    ck_assert_int_eq(run_window(0, 1000), AT_LINK_HEALTH_UPGRADED);
+    ck_assert_int_eq(config.baud, 115200);
+    ck_assert_int_eq(link_health.probation_remaining,
+            AT_COMMANDER_DEFAULT_PROBATION_WINDOWS);
+
+    // The faster rate is still bad, so it's dropped straight away and tried
+    // again later
+    read_message = RATE_CHANGE_RESPONSES;
+    read_message_length = strlen(RATE_CHANGE_RESPONSES);
+    read_index = 0;
+    ck_assert_int_eq(run_window(50, 1000), AT_LINK_HEALTH_DOWNGRADED);
+    ck_assert_int_eq(config.baud, 57600);
+    ck_assert_int_eq(link_health.upgrade_ms, 10000);
+    ck_assert_int_eq(link_health.downgrades, 2);
+    ck_assert_int_eq(link_health.upgrades, 1);
+}
+END_TEST
+
+START_TEST (test_link_health_change_failed)
+{
+    int i;
+    for(i = 0; i < 2; i++) {
+        run_window(50, 1000);
+    }
+    ck_assert_int_eq(run_window(50, 1000), AT_LINK_HEALTH_CHANGE_FAILED);
+    ck_assert_int_eq(link_health.failed_changes, 1);
+    ck_assert_int_eq(link_health.bad_windows, 0);
+    ck_assert(!config.connected);
+}
+END_TEST
+
+static void xbee_deferred_setup() {
+    xbee_api_setup();
+    at_commander_xbee_deferred_init(&deferred, &xbee_api);
+    deferred.result = record_result;
+    result_count = 0;
+}
+
+// A receive packet from the sleepy node, i.e. it just woke up
+static int wake_up(uint8_t* response) {
+    const uint8_t frame[] = { 0x90, 0x00, 0x13, 0xA2, 0x00, 0x40, 0xA1, 0xB2,
+            0xC3, 0xFF, 0xFE, 0x01, 'h', 'i' };
+    return api_frame(response, frame, sizeof(frame));
+}
+
+static int remote_response(uint8_t* response, uint8_t frame_id,
+        uint8_t status) {
+    const uint8_t frame[] = { 0x97, frame_id, 0x00, 0x13, 0xA2, 0x00, 0x40,
+            0xA1, 0xB2, 0xC3, 0xFF, 0xFE, 'S', 'P', status };
+    return api_frame(response, frame, sizeof(frame));
+}
+
+static void receive(uint8_t* response, int length) {
+    respond_with_bytes(response, length);
+    at_commander_xbee_process(&xbee_api);
+}
+
+void pass_to_deferred(AtCommanderXBeeApi* api, const uint8_t* frame,
+        int length) {
+    at_commander_xbee_deferred_handle_frame(&deferred, frame, length);
+}
+
+START_TEST (test_xbee_deferred_sent_in_one_burst_on_wake)
+{
+    xbee_api.frame_received = pass_to_deferred;
+    const uint8_t sleep_period[] = { 0x01, 0xF4 };
+    ck_assert(at_commander_xbee_defer_command(&deferred, SLEEPY_NODE, "SP",
+                sleep_period, sizeof(sleep_period), 0));
+    ck_assert(at_commander_xbee_defer_command(&deferred, SLEEPY_NODE, "NI",
+                (const uint8_t*)"porch", 5, 0));
+    at_commander_xbee_deferred_process(&deferred);
+    ck_assert_int_eq(written_length, 0);
+
+    uint8_t response[64];
+    receive(response, wake_up(response));
+
+    // Two remote AT command frames back to back, applied with the second
+    ck_assert_int_eq(written_length, 21 + 24);
+    ck_assert_int_eq((uint8_t)written[3], 0x17);
+    ck_assert_int_eq(written[15], 0);
+    ck_assert(!memcmp(&written[16], "SP", 2));
+    ck_assert_int_eq((uint8_t)written[21 + 3], 0x17);
+    ck_assert_int_eq(written[21 + 15], 0x02);
+    ck_assert(!memcmp(&written[21 + 16], "NIporch", 7));
+
+    int length = remote_response(response, 1, 0);
+    length += remote_response(&response[length], 2, 0);
+    receive(response, length);
+    ck_assert_int_eq(result_count, 2);
+    ck_assert_int_eq(last_result, AT_XBEE_COMMAND_OK);
+    ck_assert_int_eq(at_commander_xbee_deferred_pending(&deferred,
+                SLEEPY_NODE), 0);
+}
+END_TEST
+
+START_TEST (test_xbee_deferred_kept_when_node_sleeps_again)
+{
+    ck_assert(at_commander_xbee_defer_command(&deferred, SLEEPY_NODE, "SP",
+                NULL, 0, 0));
+    at_commander_xbee_deferred_node_awake(&deferred, SLEEPY_NODE);
+    ck_assert_int_eq(written_length, 19);
+
+    // Not acknowledged - it's asleep again, so nothing more is sent now
+    uint8_t response[32];
+    written_length = 0;
+    ck_assert(at_commander_xbee_deferred_handle_frame(&deferred, &response[3],
+                remote_response(response, 1, 0x04) - 4));
+    ck_assert_int_eq(written_length, 0);
+    ck_assert_int_eq(result_count, 0);
+
+    // Sent again on the next wake
+    ck_assert(!at_commander_xbee_deferred_handle_frame(&deferred,
+                &response[3], wake_up(response) - 4));
+    ck_assert_int_eq(written_length, 19);
+    ck_assert_int_eq(written[4], 2);
+    ck_assert_int_eq(deferred.nodes[0].bursts, 2);
+    ck_assert_int_eq(at_commander_xbee_deferred_pending(&deferred,
+                SLEEPY_NODE), 1);
+}
+END_TEST
+
+START_TEST (test_xbee_deferred_expires)
+{
+    ck_assert(at_commander_xbee_defer_command(&deferred, SLEEPY_NODE, "SP",
+                NULL, 0, 1000));
+    now_ms = 999;
+    ck_assert_int_eq(at_commander_xbee_deferred_process(&deferred), 1);
+    now_ms = 1000;
+    ck_assert_int_eq(at_commander_xbee_deferred_process(&deferred), 0);
+    ck_assert_int_eq(result_count, 1);
+    ck_assert_int_eq(last_result, AT_XBEE_COMMAND_EXPIRED);
+
+    at_commander_xbee_deferred_node_awake(&deferred, SLEEPY_NODE);
+    ck_assert_int_eq(written_length, 0);
+}
+END_TEST
+
+static AtCommanderXBeeBroadcast broadcast;
+static AtCommanderXBeeBroadcastReport completed_report;
+static int completed_count;
+
+void record_completion(AtCommanderXBeeBroadcast* broadcast,
+        const AtCommanderXBeeBroadcastReport* report) {
+    completed_report = *report;
+    completed_count++;
+}
+
+static void xbee_broadcast_setup() {
+    xbee_api_setup();
+    at_commander_xbee_broadcast_init(&broadcast, &xbee_api);
+    broadcast.complete = record_completion;
+    completed_count = 0;
+    for(uint64_t node = 1; node <= 3; node++) {
+        at_commander_xbee_broadcast_add_node(&broadcast,
+                0x0013A20040000000ULL + node);
+    }
+}
+
+static int node_response(uint8_t* response, uint8_t frame_id, uint8_t node,
+        uint8_t status) {
+    const uint8_t frame[] = { 0x97, frame_id, 0x00, 0x13, 0xA2, 0x00, 0x40,
+            0x00, 0x00, node, 0xFF, 0xFE, 'S', 'P', status };
+    return api_frame(response, frame, sizeof(frame));
+}
+
+START_TEST (test_xbee_broadcast_retries_stragglers)
+{
+    const uint8_t sleep_period[] = { 0x01, 0xF4 };
+    ck_assert(at_commander_xbee_broadcast_start(&broadcast, "SP",
+                sleep_period, sizeof(sleep_period), 10000));
+    // One broadcast remote AT command
+    ck_assert_int_eq(written_length, 21);
+    ck_assert(!memcmp(&written[5], "\x00\x00\x00\x00\x00\x00\xFF\xFF", 8));
+
+    uint8_t response[64];
+    int length = node_response(response, 1, 0x02, 0);
+    length += node_response(&response[length], 1, 0x01, 0);
+    // Not one of ours
+    length += node_response(&response[length], 1, 0x09, 0);
+    now_ms = 200;
+    for(int offset = 0; offset < length; offset += 19) {
+        ck_assert(at_commander_xbee_broadcast_handle_frame(&broadcast,
+                    &response[offset + 3], 15));
+    }
+    ck_assert(at_commander_xbee_broadcast_process(&broadcast));
+    ck_assert_int_eq(written_length, 21);
+
+    // Only the straggler is asked again
+    now_ms = AT_COMMANDER_XBEE_DEFAULT_STRAGGLER_DELAY_MS;
+    ck_assert(at_commander_xbee_broadcast_process(&broadcast));
+    ck_assert_int_eq(written_length, 42);
+    ck_assert_int_eq(written[21 + 12], 0x03);
+
+    now_ms += 50;
+    node_response(response, 2, 0x03, 0);
+    ck_assert(at_commander_xbee_broadcast_handle_frame(&broadcast,
+                &response[3], 15));
+    ck_assert(!at_commander_xbee_broadcast_process(&broadcast));
+    ck_assert_int_eq(completed_count, 1);
+    ck_assert_int_eq(completed_report.expected, 3);
+    ck_assert_int_eq(completed_report.acknowledged, 3);
+    ck_assert_int_eq(completed_report.missing, 0);
+    ck_assert_int_eq(completed_report.from_unicast, 1);
+    ck_assert_int_eq(completed_report.unexpected, 1);
+    ck_assert_int_eq(completed_report.elapsed_ms, 1050);
+}
+END_TEST
+
+START_TEST (test_xbee_broadcast_needs_millis)
+{
+    config.millis_function = NULL;
+    ck_assert(!at_commander_xbee_broadcast_start(&broadcast, "SP", NULL, 0,
+                10000));
+    ck_assert(!broadcast.running);
+    ck_assert_int_eq(written_length, 0);
+}
+END_TEST
+
+START_TEST (test_xbee_broadcast_budget_reports_missing)
+{
+    ck_assert(at_commander_xbee_broadcast_start(&broadcast, "SP", NULL, 0,
+                10000));
+    uint8_t response[32];
+    node_response(response, 1, 0x01, 0);
+    at_commander_xbee_broadcast_handle_frame(&broadcast, &response[3], 15);
+    // An error is a response all the same, and isn't retried
+    node_response(response, 1, 0x02, 0x03);
+    at_commander_xbee_broadcast_handle_frame(&broadcast, &response[3], 15);
+
+    for(now_ms = 0; now_ms < 20000 && at_commander_xbee_broadcast_process(
+                &broadcast); now_ms += 100);
+    ck_assert_int_eq(completed_count, 1);
+    ck_assert_int_eq(completed_report.acknowledged, 1);
+    ck_assert_int_eq(completed_report.failed, 1);
+    ck_assert_int_eq(completed_report.missing, 1);
+    ck_assert_int_eq(completed_report.unicast_requests,
+            AT_COMMANDER_XBEE_DEFAULT_UNICAST_ATTEMPTS);
+    // Gave up once the retries were spent, without waiting out the budget
+    ck_assert(completed_report.elapsed_ms < 10000);
+}
+END_TEST
+
+START_TEST (test_probe_xbee_capabilities)
+{
+    config.platform = AT_PLATFORM_XBEE;
+    config.connected = true;
+    respond_with("10EF\r");
+    next_response = "1947\r";
+    ck_assert(at_commander_probe_capabilities(&config));
+    ck_assert_str_eq(written, "ATVR\rATHV\r");
+    ck_assert_int_eq(config.firmware_version, 0x10EF);
+    ck_assert_int_eq(config.hardware_version, 0x1947);
+    ck_assert(at_commander_has_capability(&config,
+                AT_CAPABILITY_CHAINED_COMMANDS));
+    ck_assert(at_commander_has_capability(&config, AT_CAPABILITY_API_MODE));
+
+    // Cached from then on
+    written_length = 0;
+    ck_assert(at_commander_probe_capabilities(&config));
+    ck_assert_int_eq(written_length, 0);
+}
+END_TEST
+
+START_TEST (test_probe_rn42_version)
+{
+    config.connected = true;
+    respond_with("Ver 6.15 04/26/2013\r\n(c) Roving Networks\r\n");
+    ck_assert(at_commander_probe_capabilities(&config));
+    ck_assert_int_eq(config.firmware_version, 615);
+    ck_assert_int_eq(config.capabilities, 0);
+    // The rest of the banner isn't left for the next command
+    ck_assert_int_eq(read_index, read_message_length);
+}
+END_TEST
+
+START_TEST (test_probe_failure_keeps_basic_path)
+{
+    config.platform = AT_PLATFORM_XBEE;
+    config.connected = true;
+    ck_assert(!at_commander_probe_capabilities(&config));
+    ck_assert(!config.capabilities_probed);
+    ck_assert(!at_commander_has_capability(&config, AT_CAPABILITY_API_MODE));
+}
+END_TEST
+
+START_TEST (test_chained_settings_when_capable)
+{
+    config.platform = AT_PLATFORM_XBEE;
+    config.connected = true;
+    config.capabilities_probed = true;
+    config.capabilities = AT_CAPABILITY_CHAINED_COMMANDS;
+    respond_with("OK\rOK\rOK\r");
+    ck_assert(at_commander_set_link_profile(&config,
+                AT_LINK_PROFILE_LOW_LATENCY));
+    ck_assert_str_eq(written, "ATRO 0,D6 0,WR\r");
+
+    written_length = 0;
+    respond_with("OK\rOK\r");
+    ck_assert(at_commander_set_baud(&config, 115200));
+    ck_assert_str_eq(written, "ATBD 7,WR\r");
+}
+END_TEST
+
+START_TEST (test_older_firmware_not_chained)
+{
+    config.platform = AT_PLATFORM_XBEE;
+    config.connected = true;
+    respond_with("1084\r");
+    next_response = "0\r";
+    ck_assert(at_commander_probe_capabilities(&config));
+    ck_assert(!at_commander_has_capability(&config,
+                AT_CAPABILITY_CHAINED_COMMANDS));
+
+    written_length = 0;
+    respond_with("OKOKOK");
+    ck_assert(at_commander_set_link_profile(&config,
+                AT_LINK_PROFILE_LOW_LATENCY));
+    ck_assert_str_eq(written, "ATRO 0\rATD6 0\rATWR\r\n");
+}
+END_TEST
+
+START_TEST (test_failed_store_not_chained)
+{
+    config.platform = AT_PLATFORM_XBEE;
+    config.connected = true;
+    respond_with("OKOKERROR");
+    ck_assert(!at_commander_set_link_profile(&config,
+                AT_LINK_PROFILE_LOW_LATENCY));
+    ck_assert_str_eq(written, "ATRO 0\rATD6 0\rATWR\r\n");
+}
+END_TEST
+
+// An adversarial device for bounded mode - whatever it's sent, it streams the
+// same noise back forever, each byte taking a byte time at the host's baud
+// rate (or it never answers, without a pattern)
+static const char* noise_pattern;
+static int noise_index;
+static unsigned long noise_us;
+
+static void noise_byte_time() {
+    noise_us += 10 * 1000000UL / config.baud;
+    now_ms = noise_us / 1000;
+}
+
+void noise_write(void* device, uint8_t byte) {
+    noise_byte_time();
+}
+
+int noise_read(void* device) {
+    if(noise_pattern == NULL) {
+        return -1;
+    }
+    noise_byte_time();
+    return (uint8_t)noise_pattern[noise_index++ % strlen(noise_pattern)];
+}
+
+void noise_delay(unsigned long ms) {
+    noise_us += ms * 1000;
+    now_ms = noise_us / 1000;
+}
+
+static void bounded_setup() {
+    setup();
+    config.write_function = noise_write;
+    config.read_function = noise_read;
+    config.delay_function = noise_delay;
+    config.log_function = NULL;
+    config.retry_policy = &AT_RETRY_POLICY_DEFAULT;
+    config.bounded = true;
+}
+
+static void run_operation(AtCommanderOperation operation) {
+    char response[32];
+    AtCommand commands[2] = {
+        { "ATRO 0\r", "OK", NULL },
+        { "ATD6 0\r", "OK", NULL },
+    };
+    switch(operation) {
+        case AT_OPERATION_ENTER_COMMAND_MODE:
+            at_commander_enter_command_mode(&config);
+            break;
+        case AT_OPERATION_EXIT_COMMAND_MODE:
+            at_commander_exit_command_mode(&config);
+            break;
+        case AT_OPERATION_SET:
+            at_commander_apply_settings(&config, commands, 2);
+            break;
+        case AT_OPERATION_GET:
+            at_commander_get(&config,
+                    &config.platform.get_firmware_version_command, response,
+                    sizeof(response));
+            break;
+        case AT_OPERATION_REBOOT:
+            at_commander_reboot(&config);
+            break;
+        case AT_OPERATION_PROBE_CAPABILITIES:
+            at_commander_probe_capabilities(&config);
+            break;
+        case AT_OPERATION_COMMAND:
+            at_commander_command(&config, "AT+CREG?\r", response,
+                    sizeof(response), 0);
+            break;
+    }
+}
+
+/** Run every operation against every kind of noise, checking none takes
+ * longer than its bound.
+ */
+static void check_bounds(const AtCommanderPlatform* platform,
+        bool in_command_mode) {
+    static const char* patterns[] = {NULL, "\r\n", "#", "+CREG: 0\r\n"};
+    int pattern;
+    int operation;
+    for(pattern = 0; pattern < 4; pattern++) {
+        for(operation = AT_OPERATION_ENTER_COMMAND_MODE;
+                operation <= AT_OPERATION_COMMAND; operation++) {
+            unsigned long wcet;
+            config.platform = *platform;
+            config.connected = in_command_mode
+                    || operation == AT_OPERATION_EXIT_COMMAND_MODE;
+            config.baud = 9600;
+            noise_pattern = patterns[pattern];
+            noise_index = 0;
+            noise_us = 0;
+            now_ms = 0;
+
+            wcet = at_commander_wcet_ms(&config,
+                    (AtCommanderOperation)operation, 2);
+            if(wcet == 0) {
+                continue;
+            }
+            run_operation((AtCommanderOperation)operation);
+            ck_assert_msg(now_ms <= wcet, "Operation %d took %lu ms with "
+                    "noise %d, bound was %lu ms", operation, now_ms, pattern,
+                    wcet);
+        }
+    }
+}
+
+START_TEST (test_bounded_rn42_noise)
+{
+    check_bounds(&AT_PLATFORM_RN42, false);
+    check_bounds(&AT_PLATFORM_RN42, true);
+}
+END_TEST
+
+START_TEST (test_bounded_xbee_noise)
+{
+    check_bounds(&AT_PLATFORM_XBEE, false);
+    check_bounds(&AT_PLATFORM_XBEE, true);
+}
+END_TEST
+
+START_TEST (test_bounded_hayes_noise)
+{
+    check_bounds(&AT_PLATFORM_HAYES, false);
+    check_bounds(&AT_PLATFORM_HAYES, true);
+}
+END_TEST
+
+START_TEST (test_unbounded_hayes_noise_times_out)
+{
+    char response[32];
+    config.bounded = false;
+    config.retry_policy = NULL;
+    config.platform = AT_PLATFORM_HAYES;
+    config.connected = true;
+    noise_pattern = "RING\r\n";
+    noise_index = 0;
+    noise_us = 0;
+    now_ms = 0;
+
+    // Lines that aren't a final result don't hold the request up
+    ck_assert_int_le(at_commander_get(&config,
+                &config.platform.get_firmware_version_command, response,
+                sizeof(response)), 0);
+    ck_assert_int_le(now_ms, config.platform.response_timeout_ms + 10);
+
+    // Nor without a millis function, counting the bytes' time at the baud
+    config.millis_function = NULL;
+    noise_index = 0;
+    ck_assert_int_le(at_commander_get(&config,
+                &config.platform.get_firmware_version_command, response,
+                sizeof(response)), 0);
+    ck_assert_int_le(noise_index, config.baud
+            * config.platform.response_timeout_ms / 10000 + 10);
+
+    // And cancelling stops it straight away
+    config.millis_function = mock_millis;
+    config.cancel_flag = &cancelled;
+    cancelled = 1;
+    noise_index = 0;
+    ck_assert_int_le(at_commander_get(&config,
+                &config.platform.get_firmware_version_command, response,
+                sizeof(response)), 0);
+    ck_assert_int_le(noise_index, 1);
+}
+END_TEST
+
+START_TEST (test_bounded_line_endings_stop_read)
+{
+    // Line endings never fill the response, only the byte cap ends the read
+    noise_pattern = "\r\n";
+    noise_index = 0;
+    ck_assert(!at_commander_enter_command_mode(&config));
+    ck_assert_int_le(noise_index, config.platform.baud_rate_count
+            * AT_COMMANDER_BOUNDED_RESPONSE_BYTES);
+}
+END_TEST
+
+START_TEST (test_wcet_counts_retries)
+{
+    unsigned long retried;
+    config.connected = true;
+    config.baud = 115200;
+    retried = at_commander_wcet_ms(&config, AT_OPERATION_GET, 0);
+    config.retry_policy = NULL;
+    ck_assert_int_lt(at_commander_wcet_ms(&config, AT_OPERATION_GET, 0),
+            retried);
+    ck_assert_int_lt(at_commander_wcet_ms(&config, AT_OPERATION_SET, 1),
+            at_commander_wcet_ms(&config, AT_OPERATION_SET, 2));
+    config.connected = false;
+    ck_assert_int_gt(at_commander_wcet_ms(&config, AT_OPERATION_GET, 0),
+            at_commander_wcet_ms(&config, AT_OPERATION_ENTER_COMMAND_MODE,
+                0));
+    ck_assert_int_eq(at_commander_wcet_ms(&config, AT_OPERATION_COMMAND, 0),
+            0);
+}
+END_TEST
+
+// Set the name to r1, unless the device already has the name "FOO"
+static const uint8_t NAME_SCRIPT[] = {
+    AT_SCRIPT_VERSION,
+    AT_SCRIPT_GET, 0, 'G', 'N', '\r', 0, 'E', 'R', 'R', 0,
+    AT_SCRIPT_COMPARE, 0, 'F', 'O', 'O', 0,
+    AT_SCRIPT_JUMP_IF, 33, 0,
+    // 20
+    AT_SCRIPT_SET, 1, 'S', 'N', ',', '%', 's', '\r', 0, 'A', 'O', 'K', 0,
+    // 33
+    AT_SCRIPT_END,
+};
+
+static AtCommanderScriptState script_state;
+
+static void script_setup() {
+    setup();
+    config.connected = true;
+    at_commander_script_init(&script_state);
+    strcpy(script_state.registers[1], "FOO");
+}
+
+START_TEST (test_script_sets_from_register)
+{
+    respond_with("BAR\r\n");
+    next_response = "AOK\r\n";
+    ck_assert_int_eq(at_commander_run_script(&config, NAME_SCRIPT,
+                sizeof(NAME_SCRIPT), &script_state), AT_SCRIPT_SUCCEEDED);
+    ck_assert_str_eq(written, "GN\rSN,FOO\r");
+    ck_assert_str_eq(script_state.registers[0], "BAR");
+    ck_assert(!script_state.condition);
+}
+END_TEST
+
+START_TEST (test_script_branch_skips_set)
+{
+    respond_with("FOO\r\n");
+    ck_assert_int_eq(at_commander_run_script(&config, NAME_SCRIPT,
+                sizeof(NAME_SCRIPT), &script_state), AT_SCRIPT_SUCCEEDED);
+    ck_assert_str_eq(written, "GN\r");
+    ck_assert(script_state.condition);
+}
+END_TEST
+
+START_TEST (test_script_stops_at_failed_operation)
+{
+    respond_with("BAR\r\n");
+    next_response = "ERR\r\n";
+    ck_assert_int_eq(at_commander_run_script(&config, NAME_SCRIPT,
+                sizeof(NAME_SCRIPT), &script_state), AT_SCRIPT_FAILED);
+    ck_assert_int_eq(script_state.pc, 20);
+}
+END_TEST
+
+START_TEST (test_script_get_no_response)
+{
+    static const uint8_t script[] = {
+        AT_SCRIPT_VERSION,
+        AT_SCRIPT_GET | AT_SCRIPT_OPTIONAL, 1, 'G', 'N', '\r', 0, 0,
+        AT_SCRIPT_END,
+    };
+    ck_assert_int_eq(at_commander_run_script(&config, script, sizeof(script),
+                &script_state), AT_SCRIPT_SUCCEEDED);
+    ck_assert(!script_state.condition);
+    ck_assert_str_eq(script_state.registers[1], "FOO");
+
+    ck_assert_int_eq(at_commander_run_script(&config, NAME_SCRIPT,
+                sizeof(NAME_SCRIPT), &script_state), AT_SCRIPT_FAILED);
+    ck_assert_int_eq(script_state.pc, 1);
+}
+END_TEST
+
+START_TEST (test_script_optional_operation_sets_condition)
+{
+    static const uint8_t script[] = {
+        AT_SCRIPT_VERSION,
+        AT_SCRIPT_SET | AT_SCRIPT_OPTIONAL, AT_SCRIPT_NO_REGISTER,
+            'S', 'N', ',', 'X', '\r', 0, 'A', 'O', 'K', 0,
+        AT_SCRIPT_END,
+    };
+    respond_with("ERR\r\n");
+    ck_assert_int_eq(at_commander_run_script(&config, script, sizeof(script),
+                &script_state), AT_SCRIPT_SUCCEEDED);
+    ck_assert(!script_state.condition);
+}
+END_TEST
+
+START_TEST (test_script_malformed)
+{
+    static const uint8_t wrong_version[] = { 0, AT_SCRIPT_END };
+    static const uint8_t bad_register[] = {
+        AT_SCRIPT_VERSION, AT_SCRIPT_COMPARE, 9, 'X', 0, AT_SCRIPT_END
+    };
+    static const uint8_t unterminated[] = {
+        AT_SCRIPT_VERSION, AT_SCRIPT_COMPARE, 0, 'X'
+    };
+    static const uint8_t past_the_end[] = {
+        AT_SCRIPT_VERSION, AT_SCRIPT_JUMP, 200, 0
+    };
+    static const uint8_t unknown_opcode[] = { AT_SCRIPT_VERSION, 0x7f };
+
+    ck_assert_int_eq(at_commander_run_script(&config, wrong_version,
+                sizeof(wrong_version), &script_state), AT_SCRIPT_MALFORMED);
+    ck_assert_int_eq(at_commander_run_script(&config, bad_register,
+                sizeof(bad_register), &script_state), AT_SCRIPT_MALFORMED);
+    ck_assert_int_eq(at_commander_run_script(&config, unterminated,
+                sizeof(unterminated), &script_state), AT_SCRIPT_MALFORMED);
+    ck_assert_int_eq(at_commander_run_script(&config, past_the_end,
+                sizeof(past_the_end), &script_state), AT_SCRIPT_MALFORMED);
+    ck_assert_int_eq(script_state.pc, 200);
+    ck_assert_int_eq(at_commander_run_script(&config, unknown_opcode,
+                sizeof(unknown_opcode), &script_state), AT_SCRIPT_MALFORMED);
+    // Nothing was sent for any of them
+    ck_assert_int_eq(written_length, 0);
+}
+END_TEST
+
+START_TEST (test_script_loop_cancelled)
+{
+    static const uint8_t script[] = {
+        AT_SCRIPT_VERSION, AT_SCRIPT_WAIT, 10, 0, AT_SCRIPT_JUMP, 1, 0
+    };
+    config.delay_function = cancelling_delay;
+    config.cancel_flag = &cancelled;
+    ck_assert_int_eq(at_commander_run_script(&config, script, sizeof(script),
+                &script_state), AT_SCRIPT_INTERRUPTED);
+    ck_assert_int_eq(now_ms, 60);
+}
+END_TEST
+
+START_TEST (test_xbee_enter_command_mode_success)
+{
+    config.platform = AT_PLATFORM_XBEE;
+    char* response = "OK";
+    read_message = response;
+    read_message_length = 2;
+
+    ck_assert(!config.connected);
+    ck_assert(at_commander_enter_command_mode(&config));
+    ck_assert(config.connected);
+}
+END_TEST
+
+START_TEST (test_get_device_id_success)
+{
+    char* response = "CMD\r\n00066646C2AF\r\n";
+    read_message = response;
+    read_message_length = 19;
+
+    char device_id[20];
+    ck_assert(!config.connected);
+    ck_assert(at_commander_get_device_id(&config, device_id,
+                sizeof(device_id)) == 12);
+    ck_assert(config.connected);
+    ck_assert_str_eq(device_id, "00066646C2AF");
+}
+END_TEST
+
+START_TEST (test_get_device_id_bad_response)
+{
+    char* response = "CMD\r\nERR";
+    read_message = response;
+    read_message_length = 8;
+
+    char device_id[20];
+    ck_assert(!config.connected);
+    ck_assert(at_commander_get_device_id(&config, device_id, sizeof(device_id)) == -1);
+    ck_assert(config.connected);
+    ck_assert_str_ne(device_id, "00066646C2AF");
+}
+END_TEST
+
+START_TEST (test_get_device_id_no_response)
+{
+    char* response = "CMD\r\n";
+    read_message = response;
+    read_message_length = 5;
+
+    char device_id[20];
+    ck_assert(!config.connected);
+    ck_assert_int_eq(at_commander_get_device_id(&config, device_id,
+                sizeof(device_id)), 0);
+    ck_assert(config.connected);
+    ck_assert_str_ne(device_id, "00066646C2AF");
+}
+END_TEST
+
+START_TEST (test_get_name_success)
+{
+    char* response = "CMD\r\nFOO\r\n";
+    read_message = response;
+    read_message_length = 10;
+
+    char name[20];
+    ck_assert(!config.connected);
+    ck_assert(at_commander_get_name(&config, name, sizeof(name)) == 3);
+    ck_assert(config.connected);
+    ck_assert_str_eq(name, "FOO");
+}
+END_TEST
+
+START_TEST (test_get_name_bad_response)
+{
+    char* response = "CMD\r\nERR";
+    read_message = response;
+    read_message_length = 8;
+
+    char name[20];
+    ck_assert(!config.connected);
+    ck_assert(at_commander_get_name(&config, name, sizeof(name)) == -1);
+    ck_assert(config.connected);
+    ck_assert_str_ne(name, "FOO");
+}
+END_TEST
+
+START_TEST (test_get_name_no_response)
+{
+    char* response = "CMD\r\n";
+    read_message = response;
+    read_message_length = 5;
+
+    char name[20];
+    ck_assert(!config.connected);
+    ck_assert_int_eq(at_commander_get_name(&config, name, sizeof(name)), 0);
+    ck_assert(config.connected);
+    ck_assert_str_ne(name, "FOO");
+}
+END_TEST
+
+
+START_TEST (test_token_matcher_overlapping)
+{
+    AtCommanderTokenMatcher matcher;
+    at_commander_token_matcher_init(&matcher);
+    int connect = at_commander_token_matcher_add(&matcher, "%CONNECT");
+    int disconnect = at_commander_token_matcher_add(&matcher, "%DISCONNECT");
+
+    const char* stream = "data%%CONNECTmore%DISCONNECT";
+    int matches[2] = {-1, -1};
+    int match_count = 0;
+    for(int i = 0; stream[i] != '\0'; i++) {
+        int token = at_commander_token_matcher_feed(&matcher, stream[i]);
+        if(token != -1) {
+            matches[match_count++] = token;
+        }
+    }
+    ck_assert_int_eq(match_count, 2);
+    ck_assert_int_eq(matches[0], connect);
+    ck_assert_int_eq(matches[1], disconnect);
+}
+END_TEST
+
+START_TEST (test_token_matcher_scan)
+{
+    AtCommanderTokenMatcher matcher;
+    uint8_t stream[100];
+    int matched;
+    at_commander_token_matcher_init(&matcher);
+    int connect = at_commander_token_matcher_add(&matcher, "%CONNECT");
+    int disconnect = at_commander_token_matcher_add(&matcher, "%DISCONNECT");
+
+    // Tokens straddling the 16 and 64 byte vector boundaries
+    memset(stream, 'x', sizeof(stream));
+    memcpy(&stream[12], "%CONNECT", 8);
+    memcpy(&stream[60], "%DISCONNECT", 11);
+
+    ck_assert_int_eq(at_commander_token_matcher_scan(&matcher, stream, 50,
+                &matched), 20);
+    ck_assert_int_eq(matched, connect);
+    // Split the second token between two buffers
+    ck_assert_int_eq(at_commander_token_matcher_scan(&matcher, &stream[20],
+                45, &matched), 45);
+    ck_assert_int_eq(matched, -1);
+    ck_assert_int_eq(at_commander_token_matcher_scan(&matcher, &stream[65],
+                35, &matched), 6);
+    ck_assert_int_eq(matched, disconnect);
+    ck_assert_int_eq(at_commander_token_matcher_scan(&matcher, &stream[71],
+                29, &matched), 29);
+    ck_assert_int_eq(matched, -1);
+}
+END_TEST
+
+START_TEST (test_find_line_end)
+{
+    uint8_t line[80];
+    memset(line, 'a', sizeof(line));
+    ck_assert_int_eq(at_commander_find_line_end(line, sizeof(line)), 80);
+    line[47] = '\n';
+    ck_assert_int_eq(at_commander_find_line_end(line, sizeof(line)), 47);
+    line[33] = '\r';
+    ck_assert_int_eq(at_commander_find_line_end(line, sizeof(line)), 33);
+    ck_assert_int_eq(at_commander_find_line_end(line, 33), 33);
+    line[0] = '\n';
+    ck_assert_int_eq(at_commander_find_line_end(line, sizeof(line)), 0);
+}
+END_TEST
+
+START_TEST (test_connection_connect)
+{
+    AtCommanderConnectionManager manager;
+    at_commander_connection_init(&manager, &config);
+    respond_with("CMD\r\nTRYING\r\n");
+
+    ck_assert(at_commander_connection_connect(&manager, "00066646C2AF"));
+    ck_assert(strstr(written, "C,00066646C2AF\r") != NULL);
+    ck_assert_int_eq(manager.state, AT_LINK_CONNECTING);
+    ck_assert(!config.connected);
+
+    const char* event = "%CONNECT,00066646C2AF,0\r\n";
+    ck_assert_int_eq(at_commander_connection_process(&manager,
+                (const uint8_t*)event, strlen(event)), AT_LINK_CONNECTED);
+}
+END_TEST
+
+START_TEST (test_connection_reconnect_latency)
+{
+    AtCommanderConnectionManager manager;
+    at_commander_connection_init(&manager, &config);
+    respond_with("CMD\r\nTRYING\r\n");
+    ck_assert(at_commander_connection_connect(&manager, "00066646C2AF"));
+    const char* connect = "%CONNECT";
+    at_commander_connection_process(&manager, (const uint8_t*)connect, 8);
+
+    now_ms = 1000;
+    const char* disconnect = "%DISCONNECT";
+    ck_assert_int_eq(at_commander_connection_process(&manager,
+                (const uint8_t*)disconnect, 11), AT_LINK_DISCONNECTED);
+
+    // The dropped peer is retried right away, without waiting for a poll
+    respond_with("CMD\r\nTRYING\r\n");
+    written_length = 0;
+    ck_assert_int_eq(at_commander_connection_tick(&manager),
+            AT_LINK_CONNECTING);
+    ck_assert(strstr(written, "C,00066646C2AF\r") != NULL);
+
+    now_ms = 1400;
+    at_commander_connection_process(&manager, (const uint8_t*)connect, 8);
+    ck_assert_int_eq(manager.state, AT_LINK_CONNECTED);
+    ck_assert_int_eq(manager.last_reconnect_latency_ms, 400);
+    ck_assert_int_eq(manager.reconnect_count, 1);
+}
+END_TEST
+
+START_TEST (test_connection_backoff_rotates_peers)
+{
+    AtCommanderConnectionManager manager;
+    at_commander_connection_init(&manager, &config);
+    at_commander_connection_add_peer(&manager, "000000000002");
+    respond_with("CMD\r\nTRYING\r\n");
+    ck_assert(at_commander_connection_connect(&manager, "000000000001"));
+    ck_assert_str_eq(manager.peers[0], "000000000001");
+
+    now_ms = manager.connect_timeout_ms;
+    ck_assert_int_eq(at_commander_connection_tick(&manager),
+            AT_LINK_DISCONNECTED);
+    ck_assert_int_eq(manager.failed_attempts, 1);
+    ck_assert_int_eq(manager.next_attempt_at,
+            now_ms + manager.initial_backoff_ms);
+    ck_assert_int_eq(manager.backoff_ms, manager.initial_backoff_ms * 2);
+
+    // Nothing happens until the backoff has elapsed
+    written_length = 0;
+    written[0] = '\0';
+    at_commander_connection_tick(&manager);
+    ck_assert_int_eq(written_length, 0);
+
+    now_ms += manager.initial_backoff_ms;
+    respond_with("CMD\r\nTRYING\r\n");
+    config.connected = false;
+    ck_assert_int_eq(at_commander_connection_tick(&manager),
+            AT_LINK_CONNECTING);
+    ck_assert(strstr(written, "C,000000000002\r") != NULL);
+}
+END_TEST
+
+START_TEST (test_connection_disconnect_stops_retries)
+{
+    AtCommanderConnectionManager manager;
+    at_commander_connection_init(&manager, &config);
+    respond_with("CMD\r\nTRYING\r\n");
+    ck_assert(at_commander_connection_connect(&manager, "00066646C2AF"));
+
+    respond_with("CMD\r\nKILL\r\n");
+    ck_assert(at_commander_connection_disconnect(&manager));
+    ck_assert(strstr(written, "K,\r") != NULL);
+
+    now_ms = 100000;
+    written_length = 0;
+    ck_assert_int_eq(at_commander_connection_tick(&manager),
+            AT_LINK_DISCONNECTED);
+    ck_assert_int_eq(written_length, 0);
+}
+END_TEST
+
+static uint8_t rx_storage[16];
+static uint8_t tx_storage[16];
+
+START_TEST (test_data_write_partial_under_backpressure)
+{
+    at_commander_data_init(&config, rx_storage, sizeof(rx_storage),
+            tx_storage, sizeof(tx_storage));
+    config.write_bytes_function = mock_write_bytes;
+    transport_capacity = 10;
+
+    uint8_t payload[32];
+    memset(payload, 'x', sizeof(payload));
+    ck_assert_int_eq(at_commander_data_write(&config, payload,
+                sizeof(payload)), 10 + sizeof(tx_storage));
+    ck_assert_int_eq(config.data_stats.bytes_sent, 10);
+    ck_assert_int_eq(config.data_stats.backpressure_events, 1);
+
+    transport_capacity = 100;
+    ck_assert_int_eq(at_commander_data_flush(&config), 0);
+    ck_assert_int_eq(config.data_stats.bytes_sent, 10 + sizeof(tx_storage));
+}
+END_TEST
+
+// The transport frees up room after a while
+void backpressure_delay(unsigned long ms) {
+    now_ms += ms;
+    if(now_ms >= 50) {
+        transport_capacity = 100;
+    }
+}
+
+START_TEST (test_write_all_waits_out_backpressure)
+{
+    config.write_bytes_function = mock_write_bytes;
+    config.delay_function = backpressure_delay;
+    transport_capacity = 2;
+
+    ck_assert(at_commander_write_all(&config, (const uint8_t*)"abcdef", 6, 0));
+    ck_assert_str_eq(written, "abcdef");
+    ck_assert_int_ge(now_ms, 50);
+
+    // But not forever
+    config.delay_function = mock_delay;
+    transport_capacity = 0;
+    ck_assert(!at_commander_write_all(&config, (const uint8_t*)"ghi", 3, 0));
+    ck_assert_int_ge(now_ms, AT_COMMANDER_DEFAULT_RESPONSE_TIMEOUT_MS);
+}
+END_TEST
+
+START_TEST (test_data_write_honors_cts)
+{
+    at_commander_data_init(&config, NULL, 0, tx_storage, sizeof(tx_storage));
+    config.write_bytes_function = mock_write_bytes;
+    config.clear_to_send_function = mock_clear_to_send;
+    transport_capacity = 100;
+    clear_to_send = false;
+
+    ck_assert_int_eq(at_commander_data_write(&config, (const uint8_t*)"abc",
+                3), 3);
+    ck_assert_int_eq(written_length, 0);
+
+    clear_to_send = true;
+    ck_assert_int_eq(at_commander_data_write(&config, (const uint8_t*)"def",
+                3), 3);
+    ck_assert_str_eq(written, "abcdef");
+}
+END_TEST
+
+START_TEST (test_data_write_in_command_mode_is_queued)
+{
+    at_commander_data_init(&config, NULL, 0, tx_storage, sizeof(tx_storage));
+    config.connected = true;
+    ck_assert_int_eq(at_commander_data_write(&config, (const uint8_t*)"abc",
+                3), 3);
+    ck_assert_int_eq(written_length, 0);
+
+    respond_with("END\r\n");
+    ck_assert(at_commander_exit_command_mode(&config));
+    ck_assert_str_eq(written, "---\rabc");
+}
+END_TEST
+
+START_TEST (test_data_received_before_command_mode_is_kept)
+{
+    at_commander_data_init(&config, rx_storage, sizeof(rx_storage), NULL, 0);
+    respond_with("dataCMD\r\n");
+    read_pause_index = 4;
+
+    ck_assert(at_commander_enter_command_mode(&config));
+
+    uint8_t received[8];
+    ck_assert_int_eq(at_commander_data_read(&config, received,
+                sizeof(received)), 4);
+    ck_assert(!memcmp(received, "data", 4));
+    ck_assert_int_eq(config.data_stats.bytes_received, 4);
+}
+END_TEST
+
+START_TEST (test_data_throughput)
+{
+    config.write_bytes_function = mock_write_bytes;
+    transport_capacity = 100;
+    at_commander_data_reset_stats(&config);
+    at_commander_data_write(&config, (const uint8_t*)"0123456789", 10);
+
+    now_ms = 500;
+    unsigned long tx_rate, rx_rate;
+    at_commander_data_throughput(&config, &tx_rate, &rx_rate);
+    ck_assert_int_eq(tx_rate, 20);
+    ck_assert_int_eq(rx_rate, 0);
+}
+END_TEST
+
+START_TEST (test_pipelined_exit_sends_data_immediately)
+{
+    config.connected = true;
+    config.write_bytes_function = mock_write_bytes;
+    transport_capacity = 100;
+    ck_assert_int_eq(at_commander_exit_command_mode_pipelined(&config,
+                (const uint8_t*)"hello", 5), 5);
+    ck_assert_str_eq(written, "---\rhello");
+    ck_assert(!config.connected);
+    ck_assert(at_commander_exit_pending(&config));
+
+    respond_with("END\r\nworld");
+    uint8_t received[16];
+    ck_assert_int_eq(at_commander_data_read(&config, received,
+                sizeof(received)), 5);
+    ck_assert(!memcmp(received, "world", 5));
+    ck_assert(!at_commander_exit_pending(&config));
+}
+END_TEST
+
+START_TEST (test_pipelined_exit_response_split_across_reads)
+{
+    config.connected = true;
+    at_commander_exit_command_mode_pipelined(&config, NULL, 0);
+
+    uint8_t received[16];
+    respond_with("EN");
+    ck_assert_int_eq(at_commander_data_read(&config, received,
+                sizeof(received)), 0);
+    ck_assert(at_commander_exit_pending(&config));
+
+    respond_with("D\r\nabc");
+    ck_assert_int_eq(at_commander_data_read(&config, received,
+                sizeof(received)), 3);
+    ck_assert(!at_commander_exit_pending(&config));
+    ck_assert(!config.connected);
+}
+END_TEST
+
+START_TEST (test_pipelined_exit_failure_restores_command_mode)
+{
+    config.connected = true;
+    at_commander_exit_command_mode_pipelined(&config, NULL, 0);
+
+    respond_with("?\r\n");
+    uint8_t received[16];
+    ck_assert_int_eq(at_commander_data_read(&config, received,
+                sizeof(received)), 0);
+    ck_assert(config.connected);
+    ck_assert(!at_commander_exit_pending(&config));
+}
+END_TEST
+
+START_TEST (test_pipelined_exit_failure_keeps_response)
+{
+    at_commander_data_init(&config, rx_storage, sizeof(rx_storage), NULL, 0);
+    config.connected = true;
+    at_commander_exit_command_mode_pipelined(&config, NULL, 0);
+
+    uint8_t received[16];
+    respond_with("E");
+    ck_assert_int_eq(at_commander_data_read(&config, received,
+                sizeof(received)), 0);
+    respond_with("RR\r\n");
+    ck_assert_int_eq(at_commander_data_read(&config, received,
+                sizeof(received)), 0);
+    ck_assert(config.connected);
+
+    // The whole response is still there, including what looked like "END"
+    ck_assert_int_eq(at_commander_data_read(&config, received,
+                sizeof(received)), 5);
+    ck_assert(!memcmp(received, "ERR\r\n", 5));
+}
+END_TEST
+
+START_TEST (test_xbee_exit_command_mode)
+{
+    config.platform = AT_PLATFORM_XBEE;
+    config.connected = true;
+    respond_with("OK\r");
+    ck_assert(at_commander_exit_command_mode(&config));
+    ck_assert_str_eq(written, "ATCN\r");
+    ck_assert(!config.connected);
+}
+END_TEST
+
+START_TEST (test_rn42_low_latency_profile)
+{
+    respond_with("CMD\r\nAOK\r\nAOK\r\n");
+    ck_assert(at_commander_set_link_profile(&config,
+                AT_LINK_PROFILE_LOW_LATENCY));
+    ck_assert_str_eq(written, "$$$SQ,16\rSW,0000\r");
+}
+END_TEST
+
+START_TEST (test_xbee_bulk_profile_stores_once)
+{
+    config.platform = AT_PLATFORM_XBEE;
+    respond_with("OK\rOK\rOK\rOK\r");
+    ck_assert(at_commander_set_link_profile(&config,
+                AT_LINK_PROFILE_BULK_THROUGHPUT));
+    ck_assert_str_eq(written, "+++ATRO 20\rATD6 1\rATWR\r\n");
+}
+END_TEST
+
+START_TEST (test_profile_not_stored_on_failure)
+{
+    config.platform = AT_PLATFORM_XBEE;
+    respond_with("OK\rOK\rERROR\r");
+    ck_assert(!at_commander_set_link_profile(&config,
+                AT_LINK_PROFILE_BALANCED));
+    ck_assert(strstr(written, "ATWR") == NULL);
+}
+END_TEST
+
+START_TEST (test_hayes_command_skips_echo_and_collects_lines)
+{
+    config.platform = AT_PLATFORM_HAYES;
+    config.connected = true;
+    config.delay_function = mock_delay;
+    respond_with("AT+CREG?\r\r\n+CREG: 0,1\r\n\r\nOK\r\n");
+
+    char response[32];
+    ck_assert_int_eq(at_commander_command(&config, "AT+CREG?\r", response,
+                sizeof(response), 0), AT_COMMANDER_RESULT_OK);
+    ck_assert_str_eq(response, "+CREG: 0,1");
+    // Finished on the final result code, without any fixed delay
+    ck_assert_int_eq(now_ms, 0);
+}
+END_TEST
+
+START_TEST (test_hayes_command_cme_error)
+{
+    config.platform = AT_PLATFORM_HAYES;
+    config.connected = true;
+    respond_with("AT+CPIN?\r\r\n+CME ERROR: 10\r\n");
+
+    char response[32];
+    ck_assert_int_eq(at_commander_command(&config, "AT+CPIN?\r", response,
+                sizeof(response), 0), AT_COMMANDER_RESULT_ERROR);
+    ck_assert_str_eq(response, "+CME ERROR: 10");
+}
+END_TEST
+
+START_TEST (test_hayes_command_timeout)
+{
+    config.platform = AT_PLATFORM_HAYES;
+    config.connected = true;
+    config.delay_function = mock_delay;
+    respond_with("+COPS: 0\r\n");
+
+    char response[32];
+    ck_assert_int_eq(at_commander_command(&config, "AT+COPS?\r", response,
+                sizeof(response), 180000), AT_COMMANDER_RESULT_TIMEOUT);
+    ck_assert_int_ge(now_ms, 180000);
+}
+END_TEST
+
+START_TEST (test_hayes_get_device_id)
+{
+    config.platform = AT_PLATFORM_HAYES;
+    respond_with("AT\r\r\nOK\r\nAT+GSN\r\r\n490154203237518\r\n\r\nOK\r\n");
+
+    char device_id[20];
+    ck_assert_int_eq(at_commander_get_device_id(&config, device_id,
+                sizeof(device_id)), 15);
+    ck_assert_str_eq(device_id, "490154203237518");
+}
+END_TEST
+
+START_TEST (test_hayes_set_baud)
+{
+    config.platform = AT_PLATFORM_HAYES;
+    respond_with("OK\r\nOK\r\nOK\r\n");
+    ck_assert(at_commander_set_baud(&config, 115200));
+    ck_assert_str_eq(written, "AT\rAT+IPR=115200\rAT&W\r");
+}
+END_TEST
+
+START_TEST (test_espressif_send_at_prompt)
+{
+    config.platform = AT_PLATFORM_ESPRESSIF;
+    config.connected = true;
+    config.write_bytes_function = mock_write_bytes;
+    transport_capacity = 100;
+    respond_with("AT+CIPSEND=0,5\r\n\r\nOK\r\n> \r\nRecv 5 bytes\r\n"
+            "\r\nSEND OK\r\n");
+
+    ck_assert_int_eq(at_commander_espressif_send(&config, 0,
+                (const uint8_t*)"hello", 5), AT_COMMANDER_RESULT_OK);
+    ck_assert_str_eq(written, "AT+CIPSEND=0,5\r\nhello");
+}
+END_TEST
+
+START_TEST (test_espressif_send_fail)
+{
+    config.platform = AT_PLATFORM_ESPRESSIF;
+    config.connected = true;
+    respond_with("\r\nOK\r\n> \r\nSEND FAIL\r\n");
+
+    ck_assert_int_eq(at_commander_espressif_send(&config, -1,
+                (const uint8_t*)"hello", 5), AT_COMMANDER_RESULT_ERROR);
+    ck_assert_str_eq(written, "AT+CIPSEND=5\r\nhello");
+}
+END_TEST
+
+START_TEST (test_espressif_passthrough)
+{
+    config.platform = AT_PLATFORM_ESPRESSIF;
+    config.connected = true;
+    config.write_bytes_function = mock_write_bytes;
+    transport_capacity = 100;
+    respond_with("\r\nOK\r\n\r\nOK\r\n>");
+
+    ck_assert(at_commander_espressif_enter_passthrough(&config));
+    ck_assert(!config.connected);
+    ck_assert_int_eq(at_commander_data_write(&config,
+                (const uint8_t*)"stream", 6), 6);
+
+    respond_with("\r\nOK\r\n");
+    ck_assert(at_commander_espressif_exit_passthrough(&config));
+    ck_assert(config.connected);
+    ck_assert_str_eq(written, "AT+CIPMODE=1\r\nAT+CIPSEND\r\nstream+++"
+            "AT+CIPMODE=0\r\n");
+}
+END_TEST
+
+Suite* suite(void) {
+    Suite* s = suite_create("atcommander");
+    TCase *tc_enter_command_mode = tcase_create("enter_command_mode");
+    tcase_add_checked_fixture(tc_enter_command_mode, setup, NULL);
+    tcase_add_test(tc_enter_command_mode, test_enter_command_mode_success);
+    tcase_add_test(tc_enter_command_mode, test_enter_command_mode_already_active);
+    tcase_add_test(tc_enter_command_mode, test_enter_command_mode_fail_bad_response);
+    tcase_add_test(tc_enter_command_mode, test_enter_command_mode_fail_no_response);
+    tcase_add_test(tc_enter_command_mode, test_enter_command_mode_at_baud);
+    tcase_add_test(tc_enter_command_mode,
+            test_enter_command_mode_platform_bauds);
+    tcase_add_test(tc_enter_command_mode, test_enter_command_mode_host_bauds);
+    suite_add_tcase(s, tc_enter_command_mode);
+
+    TCase *tc_exit_command_mode = tcase_create("exit_command_mode");
+    tcase_add_checked_fixture(tc_exit_command_mode, setup, NULL);
+    tcase_add_test(tc_exit_command_mode, test_exit_command_mode_success);
+    tcase_add_test(tc_exit_command_mode, test_exit_command_mode_fail_bad_response);
+    tcase_add_test(tc_exit_command_mode, test_exit_command_mode_fail_no_response);
+    tcase_add_test(tc_exit_command_mode, test_exit_command_mode_already_done);
+    suite_add_tcase(s, tc_exit_command_mode);
+
+    TCase *tc_set_baud = tcase_create("set_baud");
+    tcase_add_checked_fixture(tc_set_baud, setup, NULL);
+    tcase_add_test(tc_set_baud, test_set_baud_success);
+    tcase_add_test(tc_set_baud, test_set_baud_bad_response);
+    tcase_add_test(tc_set_baud, test_set_baud_no_response);
+    tcase_add_test(tc_set_baud, test_set_baud_unsupported);
+    tcase_add_test(tc_set_baud, test_baud_rate_mappers);
+    suite_add_tcase(s, tc_set_baud);
+
+    TCase *tc_reboot = tcase_create("reboot");
+    tcase_add_checked_fixture(tc_reboot, setup, NULL);
+    tcase_add_test(tc_reboot, test_reboot_success);
+    tcase_add_test(tc_reboot, test_reboot_refused);
+    tcase_add_test(tc_reboot, test_reboot_unsupported);
+    tcase_add_test(tc_reboot, test_missing_platform_commands);
+    suite_add_tcase(s, tc_reboot);
+
+    TCase *tc_configuration_timer = tcase_create("configuration_timer");
+    tcase_add_checked_fixture(tc_configuration_timer, setup, NULL);
+    tcase_add_test(tc_configuration_timer, test_set_configuration_timer);
+    tcase_add_test(tc_configuration_timer,
+            test_set_configuration_timer_store_fails);
+    tcase_add_test(tc_configuration_timer,
+            test_set_configuration_timer_unsupported);
+    suite_add_tcase(s, tc_configuration_timer);
+
+    TCase *tc_trace = tcase_create("trace");
+    tcase_add_checked_fixture(tc_trace, setup, NULL);
+    tcase_add_test(tc_trace, test_trace_set_baud);
+    tcase_add_test(tc_trace, test_trace_nested_spans);
+    suite_add_tcase(s, tc_trace);
+
+    TCase *tc_interruption = tcase_create("interruption");
+    tcase_add_checked_fixture(tc_interruption, setup, NULL);
+    tcase_add_test(tc_interruption, test_cancel_before_enter);
+    tcase_add_test(tc_interruption, test_cancel_during_wait);
+    tcase_add_test(tc_interruption, test_budget_stops_sweep);
+    tcase_add_test(tc_interruption, test_budget_hayes_command);
+    suite_add_tcase(s, tc_interruption);
+
+    TCase *tc_retry_policy = tcase_create("retry_policy");
+    tcase_add_checked_fixture(tc_retry_policy, setup, NULL);
+    tcase_add_test(tc_retry_policy, test_retry_garbled_response);
+    tcase_add_test(tc_retry_policy, test_retry_error_fails_fast);
+    tcase_add_test(tc_retry_policy, test_retry_timeout_backoff);
+    tcase_add_test(tc_retry_policy, test_retry_jitter_bounded);
+    tcase_add_test(tc_retry_policy, test_retry_not_used_for_baud_sweep);
+    suite_add_tcase(s, tc_retry_policy);
+
+    TCase *tc_remote = tcase_create("remote");
+    tcase_add_checked_fixture(tc_remote, setup, NULL);
+    tcase_add_test(tc_remote, test_remote_configure_batch);
+    tcase_add_test(tc_remote, test_remote_configure_failure_returns_to_data);
+    tcase_add_test(tc_remote, test_remote_configure_single_attempt);
+    tcase_add_test(tc_remote, test_remote_configure_stalled_link);
+    suite_add_tcase(s, tc_remote);
+
+    TCase *tc_capabilities = tcase_create("capabilities");
+    tcase_add_checked_fixture(tc_capabilities, setup, NULL);
+    tcase_add_test(tc_capabilities, test_probe_xbee_capabilities);
+    tcase_add_test(tc_capabilities, test_probe_rn42_version);
+    tcase_add_test(tc_capabilities, test_probe_failure_keeps_basic_path);
+    tcase_add_test(tc_capabilities, test_chained_settings_when_capable);
+    tcase_add_test(tc_capabilities, test_older_firmware_not_chained);
+    tcase_add_test(tc_capabilities, test_failed_store_not_chained);
+    suite_add_tcase(s, tc_capabilities);
+
+    TCase *tc_bounded = tcase_create("bounded");
+    tcase_add_checked_fixture(tc_bounded, bounded_setup, NULL);
+    tcase_add_test(tc_bounded, test_bounded_rn42_noise);
+    tcase_add_test(tc_bounded, test_bounded_xbee_noise);
+    tcase_add_test(tc_bounded, test_bounded_hayes_noise);
+    tcase_add_test(tc_bounded, test_bounded_line_endings_stop_read);
+    tcase_add_test(tc_bounded, test_unbounded_hayes_noise_times_out);
+    tcase_add_test(tc_bounded, test_wcet_counts_retries);
+    suite_add_tcase(s, tc_bounded);
+
+    TCase *tc_script = tcase_create("script");
+    tcase_add_checked_fixture(tc_script, script_setup, NULL);
+    tcase_add_test(tc_script, test_script_sets_from_register);
+    tcase_add_test(tc_script, test_script_branch_skips_set);
+    tcase_add_test(tc_script, test_script_stops_at_failed_operation);
+    tcase_add_test(tc_script, test_script_get_no_response);
+    tcase_add_test(tc_script, test_script_optional_operation_sets_condition);
+    tcase_add_test(tc_script, test_script_malformed);
+    tcase_add_test(tc_script, test_script_loop_cancelled);
+    suite_add_tcase(s, tc_script);
+
+    TCase *tc_xbee_api = tcase_create("xbee_api");
+    tcase_add_checked_fixture(tc_xbee_api, xbee_api_setup, NULL);
+    tcase_add_test(tc_xbee_api, test_xbee_parser_frames);
+    tcase_add_test(tc_xbee_api, test_xbee_send_frame_format);
+    tcase_add_test(tc_xbee_api, test_xbee_send_window_full);
+    tcase_add_test(tc_xbee_api, test_xbee_status_retries_only_failed_frame);
+    tcase_add_test(tc_xbee_api, test_xbee_missing_status_gives_up);
+    tcase_add_test(tc_xbee_api, test_xbee_missing_status_without_millis);
+    tcase_add_test(tc_xbee_api, test_xbee_stalled_frame_not_continued);
+    suite_add_tcase(s, tc_xbee_api);
+
+    TCase *tc_xbee_spi = tcase_create("xbee_spi");
+    tcase_add_checked_fixture(tc_xbee_spi, xbee_spi_setup, NULL);
+    tcase_add_test(tc_xbee_spi, test_xbee_spi_window_delivered);
+    tcase_add_test(tc_xbee_spi, test_xbee_spi_full_duplex_keeps_received_frames);
+    tcase_add_test(tc_xbee_spi, test_xbee_spi_idle_bytes_dropped);
+    tcase_add_test(tc_xbee_spi, test_xbee_spi_no_baud_sweep);
+    tcase_add_test(tc_xbee_spi, test_xbee_spi_local_command);
+    suite_add_tcase(s, tc_xbee_spi);
+
+    TCase *tc_link_health = tcase_create("link_health");
+    tcase_add_checked_fixture(tc_link_health, link_health_setup, NULL);
+    tcase_add_test(tc_link_health, test_link_health_rates_sorted);
+    tcase_add_test(tc_link_health, test_link_health_clean_link_steady);
+    tcase_add_test(tc_link_health, test_link_health_downgrade);
+    tcase_add_test(tc_link_health, test_link_health_upgrade_probation);
+    tcase_add_test(tc_link_health, test_link_health_change_failed);
+    suite_add_tcase(s, tc_link_health);
+
+    TCase *tc_xbee_deferred = tcase_create("xbee_deferred");
+    tcase_add_checked_fixture(tc_xbee_deferred, xbee_deferred_setup, NULL);
+    tcase_add_test(tc_xbee_deferred,
+            test_xbee_deferred_sent_in_one_burst_on_wake);
+    tcase_add_test(tc_xbee_deferred,
+            test_xbee_deferred_kept_when_node_sleeps_again);
+    tcase_add_test(tc_xbee_deferred, test_xbee_deferred_expires);
+    suite_add_tcase(s, tc_xbee_deferred);
+
+    TCase *tc_xbee_broadcast = tcase_create("xbee_broadcast");
+    tcase_add_checked_fixture(tc_xbee_broadcast, xbee_broadcast_setup, NULL);
+    tcase_add_test(tc_xbee_broadcast, test_xbee_broadcast_retries_stragglers);
+    tcase_add_test(tc_xbee_broadcast,
+            test_xbee_broadcast_budget_reports_missing);
+    tcase_add_test(tc_xbee_broadcast, test_xbee_broadcast_needs_millis);
+    suite_add_tcase(s, tc_xbee_broadcast);
+
+    TCase *tc_get_device_id = tcase_create("get_device_id");
+    tcase_add_checked_fixture(tc_get_device_id, setup, NULL);
+    tcase_add_test(tc_get_device_id, test_get_device_id_success);
+    tcase_add_test(tc_get_device_id, test_get_device_id_bad_response);
+    tcase_add_test(tc_get_device_id, test_get_device_id_no_response);
+    suite_add_tcase(s, tc_get_device_id);
+
+    TCase *tc_get_name = tcase_create("get_name");
+    tcase_add_checked_fixture(tc_get_name, setup, NULL);
+    tcase_add_test(tc_get_name, test_get_name_success);
+    tcase_add_test(tc_get_name, test_get_name_bad_response);
+    tcase_add_test(tc_get_name, test_get_name_no_response);
+    suite_add_tcase(s, tc_get_name);
+
+    TCase *tc_link_profile = tcase_create("link_profile");
+    tcase_add_checked_fixture(tc_link_profile, setup, NULL);
+    tcase_add_test(tc_link_profile, test_rn42_low_latency_profile);
+    tcase_add_test(tc_link_profile, test_xbee_bulk_profile_stores_once);
+    tcase_add_test(tc_link_profile, test_profile_not_stored_on_failure);
+    suite_add_tcase(s, tc_link_profile);
+
+    TCase *tc_hayes = tcase_create("hayes");
+    tcase_add_checked_fixture(tc_hayes, setup, NULL);
+    tcase_add_test(tc_hayes, test_hayes_command_skips_echo_and_collects_lines);
+    tcase_add_test(tc_hayes, test_hayes_command_cme_error);
+    tcase_add_test(tc_hayes, test_hayes_command_timeout);
+    tcase_add_test(tc_hayes, test_hayes_get_device_id);
+    tcase_add_test(tc_hayes, test_hayes_set_baud);
+    suite_add_tcase(s, tc_hayes);
+
+    TCase *tc_espressif = tcase_create("espressif");
+    tcase_add_checked_fixture(tc_espressif, setup, NULL);
+    tcase_add_test(tc_espressif, test_espressif_send_at_prompt);
+    tcase_add_test(tc_espressif, test_espressif_send_fail);
+    tcase_add_test(tc_espressif, test_espressif_passthrough);
+    suite_add_tcase(s, tc_espressif);
+
+    TCase *tc_xbee = tcase_create("xbee");
+    tcase_add_checked_fixture(tc_xbee, setup, NULL);
+    tcase_add_test(tc_xbee, test_xbee_enter_command_mode_success);
+    tcase_add_test(tc_xbee, test_xbee_exit_command_mode);
+    suite_add_tcase(s, tc_xbee);
+
+    TCase *tc_connection = tcase_create("connection");
+    tcase_add_checked_fixture(tc_connection, setup, NULL);
+    tcase_add_test(tc_connection, test_token_matcher_overlapping);
+    tcase_add_test(tc_connection, test_token_matcher_scan);
+    tcase_add_test(tc_connection, test_find_line_end);
+    tcase_add_test(tc_connection, test_connection_connect);
+    tcase_add_test(tc_connection, test_connection_reconnect_latency);
+    tcase_add_test(tc_connection, test_connection_backoff_rotates_peers);
+    tcase_add_test(tc_connection, test_connection_disconnect_stops_retries);
+    suite_add_tcase(s, tc_connection);
+
+    TCase *tc_data_mode = tcase_create("data_mode");
+    tcase_add_checked_fixture(tc_data_mode, setup, NULL);
+    tcase_add_test(tc_data_mode, test_data_write_partial_under_backpressure);
+    tcase_add_test(tc_data_mode, test_data_write_honors_cts);
+    tcase_add_test(tc_data_mode, test_write_all_waits_out_backpressure);
+    tcase_add_test(tc_data_mode, test_data_write_in_command_mode_is_queued);
+    tcase_add_test(tc_data_mode, test_data_received_before_command_mode_is_kept);
+    tcase_add_test(tc_data_mode, test_data_throughput);
+    tcase_add_test(tc_data_mode, test_pipelined_exit_sends_data_immediately);
+    tcase_add_test(tc_data_mode, test_pipelined_exit_response_split_across_reads);
+    tcase_add_test(tc_data_mode, test_pipelined_exit_failure_restores_command_mode);
+    tcase_add_test(tc_data_mode, test_pipelined_exit_failure_keeps_response);
+    suite_add_tcase(s, tc_data_mode);
     return s;
 }
 